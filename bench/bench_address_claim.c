@@ -0,0 +1,219 @@
+/* ============================================================================
+ * File: bench_address_claim.c
+ *
+ * Description: Fills a node's address table with claims from 253 other nodes,
+ *              one at each address the node doesn't hold, and then times the
+ *              search for a new address after losing ours: with a single free
+ *              address just before ours, which is the last one the search
+ *              looks at, and with no free address at all. The same searches
+ *              over the plain int-per-address table the library used to keep
+ *              are timed as a reference.
+ * ============================================================================
+ */
+
+#include "bench_common.h"
+#include "j1939.h"
+#include "j1939_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS  (200000)
+#define CLAIM_ROUNDS  (2000)
+
+#define OUR_ADDR  (0x80)
+
+static struct J1939Context ctx;
+static struct J1939Private storage[1];
+static struct J1939 node;
+
+// Addresses taken, one int per address, as searched by reference_search()
+static int reference_table[J1939_AC_MAX_ADDRESSES];
+
+static volatile int sink;
+
+/* ============================================================================
+ * J1939 callbacks
+ * ============================================================================
+ */
+
+static bool
+bench_tx(
+    void* user_data,
+    struct J1939Msg* msg)
+{
+    (void)user_data;
+    (void)msg;
+    return true;
+}
+
+static void
+bench_msg_rx(
+    void* user_data,
+    struct J1939Msg* msg)
+{
+    (void)user_data;
+    (void)msg;
+}
+
+static void
+bench_startup_delay(
+    void* param)
+{
+    (void)param;
+}
+
+/* ============================================================================
+ * Benchmark driver
+ * ============================================================================
+ */
+
+// The linear search over an int per address, wrapping with a modulo
+static int
+reference_search(
+    uint8_t source_address)
+{
+    for (int i = 1; i <= (J1939_AC_MAX_ADDRESSES - 1); ++i)
+    {
+        int address = (source_address + i) % J1939_AC_MAX_ADDRESSES;
+
+        if (reference_table[address] == 0)
+            return address;
+    }
+
+    return -1;
+}
+
+// Claim every address but ours for another node, all with NAMEs of lower
+//  priority than ours
+static void
+claim_all(
+    struct J1939AC* ac)
+{
+    for (int address = 0; address < J1939_AC_MAX_ADDRESSES; ++address)
+    {
+        if (address == OUR_ADDR)
+            continue;
+
+        struct J1939Name name = {
+            .identity = 0x1000 + address,
+            .arbitrary_addr_capable = 1
+        };
+        struct J1939Msg msg = {
+            .pgn = J1939_ADDRESS_CLAIMED_PGN,
+            .data = (uint8_t*)&name,
+            .len = J1939_ADDRESS_CLAIMED_LEN,
+            .src = address,
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_ADDRESS_CLAIMED_PRI
+        };
+
+        j1939_ac_rx_address_claim(ac, &msg);
+    }
+}
+
+static void
+bench_claims(
+    struct J1939AC* ac)
+{
+    uint64_t start = bench_now_ns();
+
+    for (int i = 0; i < CLAIM_ROUNDS; ++i)
+        claim_all(ac);
+
+    bench_report("Address claims received", (uint64_t)CLAIM_ROUNDS * 253, "claim",
+        bench_now_ns() - start);
+
+    if (ac->addresses_available != 0)
+    {
+        fprintf(stderr, "%d addresses left after 253 claims\n", ac->addresses_available);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+bench_search(
+    struct J1939AC* ac,
+    const char* label,
+    bool free_slot)
+{
+    const uint8_t free_address = OUR_ADDR - 1;
+
+    if (free_slot)
+        j1939_ac_mark_address(ac, free_address, false);
+
+    uint64_t start = bench_now_ns();
+
+    for (int i = 0; i < ROUNDS; ++i)
+    {
+        node.source_address = OUR_ADDR;
+        ac->addresses_available = 1;
+        sink = j1939_ac_update_address(ac);
+    }
+
+    uint64_t elapsed = bench_now_ns() - start;
+
+    if (sink != free_slot || (free_slot && (node.source_address != free_address)))
+    {
+        fprintf(stderr, "%s: unexpected search result\n", label);
+        exit(EXIT_FAILURE);
+    }
+
+    bench_report(label, ROUNDS, "search", elapsed);
+
+    node.source_address = OUR_ADDR;
+    ac->addresses_available = 0;
+    if (free_slot)
+        j1939_ac_mark_address(ac, free_address, true);
+}
+
+static void
+bench_reference_search(
+    const char* label,
+    bool free_slot)
+{
+    const uint8_t free_address = OUR_ADDR - 1;
+
+    for (int address = 0; address < J1939_AC_MAX_ADDRESSES; ++address)
+        reference_table[address] = 1;
+    if (free_slot)
+        reference_table[free_address] = 0;
+
+    uint64_t start = bench_now_ns();
+
+    for (int i = 0; i < ROUNDS; ++i)
+        sink = reference_search(OUR_ADDR);
+
+    uint64_t elapsed = bench_now_ns() - start;
+
+    if (sink != (free_slot ? free_address : -1))
+    {
+        fprintf(stderr, "%s: unexpected search result\n", label);
+        exit(EXIT_FAILURE);
+    }
+
+    bench_report(label, ROUNDS, "search", elapsed);
+}
+
+int main(void)
+{
+    struct J1939Name name = { .identity = 1, .arbitrary_addr_capable = 1 };
+
+    j1939_context_init(&ctx, storage, 1, NULL);
+    if (!j1939_context_node_init(&ctx, &node, &name, OUR_ADDR, 10,
+            NULL, bench_tx, bench_msg_rx, bench_startup_delay, NULL))
+    {
+        fprintf(stderr, "j1939_context_node_init() failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct J1939AC* ac = &storage[0].ac;
+
+    bench_claims(ac);
+    bench_search(ac, "Bitset search, last free address", true);
+    bench_search(ac, "Bitset search, table full", false);
+    bench_reference_search("int[254] scan, last free address", true);
+    bench_reference_search("int[254] scan, table full", false);
+
+    return EXIT_SUCCESS;
+}
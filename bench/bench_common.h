@@ -0,0 +1,39 @@
+#pragma once
+
+/* ============================================================================
+ * File: bench_common.h
+ *
+ * Description: Small timing helpers shared by the benchmark programs. The
+ *              benchmarks are meant to be built in Release mode, e.g.:
+ *              cmake -DJ1939_BENCH=ON -DCMAKE_BUILD_TYPE=Release ...
+ * ============================================================================
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static inline uint64_t
+bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
+
+static inline void
+bench_report(
+    const char* label,
+    uint64_t count,
+    const char* unit,
+    uint64_t elapsed_ns)
+{
+    double seconds = (double)elapsed_ns / 1e9;
+
+    printf("%-36s %12.0f %s/s  %8.1f ns/%s\n",
+        label,
+        (double)count / seconds,
+        unit,
+        (double)elapsed_ns / (double)count,
+        unit);
+}
@@ -0,0 +1,198 @@
+/* ============================================================================
+ * File: bench_ring.c
+ *
+ * Description: Measures the frame ring between a reader thread calling
+ *              j1939_push_frame() and a protocol thread calling
+ *              j1939_update(). Throughput is measured with the producer
+ *              pushing as fast as it can. Latency, from push to delivery in
+ *              the j1939_rx callback, is measured with one frame in flight
+ *              at a time so that it doesn't include queueing delay.
+ * ============================================================================
+ */
+
+#include "bench_common.h"
+#include "j1939_private.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THROUGHPUT_FRAMES  (10000000u)
+#define LATENCY_FRAMES     (200000u)
+
+// PGN 0xFEF1 broadcast from address 0x10, priority 6
+#define BENCH_CAN_ID  (0x98FEF110u)
+
+static struct J1939Private storage[1];
+static struct J1939Context ctx;
+static struct J1939 node;
+
+static uint32_t frames_delivered;
+static uint64_t* latencies;
+
+/* ============================================================================
+ * J1939 callbacks
+ * ============================================================================
+ */
+
+static bool
+bench_tx(
+    void* user_data,
+    struct J1939Msg* msg)
+{
+    (void)user_data, (void)msg;
+    return true;
+}
+
+static void
+bench_msg_rx(
+    void* user_data,
+    struct J1939Msg* msg)
+{
+    (void)user_data;
+
+    if (latencies != NULL)
+    {
+        uint64_t sent_ns;
+        memcpy(&sent_ns, msg->data, sizeof(sent_ns));
+        latencies[frames_delivered] = bench_now_ns() - sent_ns;
+    }
+
+    __atomic_store_n(&frames_delivered, frames_delivered + 1, __ATOMIC_RELEASE);
+}
+
+static void
+bench_startup_delay(
+    void* param)
+{
+    (void)param;
+}
+
+/* ============================================================================
+ * Threads
+ * ============================================================================
+ */
+
+static void*
+consumer(
+    void* arg)
+{
+    uint32_t num_frames = *(uint32_t*)arg;
+
+    // Yield between updates so the benchmark still completes when both
+    //  threads share one CPU
+    while (__atomic_load_n(&frames_delivered, __ATOMIC_RELAXED) < num_frames)
+    {
+        j1939_update(&node);
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+static void
+produce_flat_out(void)
+{
+    struct J1939CanFrame frame = { .id = BENCH_CAN_ID, .len = 8 };
+
+    for (uint32_t i = 0; i < THROUGHPUT_FRAMES; i++)
+    {
+        memcpy(frame.data, &i, sizeof(i));
+
+        while (!j1939_push_frame(&node, &frame))
+            sched_yield();
+    }
+}
+
+static void
+produce_one_at_a_time(void)
+{
+    struct J1939CanFrame frame = { .id = BENCH_CAN_ID, .len = 8 };
+
+    for (uint32_t i = 0; i < LATENCY_FRAMES; i++)
+    {
+        uint64_t now = bench_now_ns();
+        memcpy(frame.data, &now, sizeof(now));
+
+        (void)j1939_push_frame(&node, &frame);
+
+        // Wait for delivery before sending the next frame
+        while (__atomic_load_n(&frames_delivered, __ATOMIC_ACQUIRE) <= i)
+            sched_yield();
+    }
+}
+
+/* ============================================================================
+ * Benchmark driver
+ * ============================================================================
+ */
+
+static uint64_t
+run(
+    uint32_t num_frames,
+    void (*produce)(void))
+{
+    pthread_t thread;
+
+    frames_delivered = 0;
+
+    uint64_t start = bench_now_ns();
+    pthread_create(&thread, NULL, consumer, &num_frames);
+    produce();
+    pthread_join(thread, NULL);
+    uint64_t elapsed_ns = bench_now_ns() - start;
+
+    if (frames_delivered != num_frames)
+    {
+        fprintf(stderr, "delivered %u frames, expected %u\n",
+            frames_delivered,
+            num_frames);
+        exit(EXIT_FAILURE);
+    }
+
+    return elapsed_ns;
+}
+
+static int
+compare_u64(
+    const void* a,
+    const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int main(void)
+{
+    struct J1939Name name = { .identity = 1 };
+
+    j1939_context_init(&ctx, storage, 1, NULL);
+    if (!j1939_context_node_init(&ctx, &node, &name, 0x80, 10,
+        NULL, bench_tx, bench_msg_rx, bench_startup_delay, NULL))
+    {
+        fprintf(stderr, "j1939_context_node_init() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t elapsed_ns = run(THROUGHPUT_FRAMES, produce_flat_out);
+    bench_report("ring throughput", THROUGHPUT_FRAMES, "frame", elapsed_ns);
+    printf("pushes retried because the ring was full: %u\n", j1939_dropped_frames(&node));
+
+    latencies = malloc(LATENCY_FRAMES * sizeof(*latencies));
+    if (latencies == NULL)
+        return EXIT_FAILURE;
+
+    run(LATENCY_FRAMES, produce_one_at_a_time);
+
+    qsort(latencies, LATENCY_FRAMES, sizeof(*latencies), compare_u64);
+    printf("push to delivery latency: p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+        (unsigned long long)latencies[LATENCY_FRAMES / 2],
+        (unsigned long long)latencies[(LATENCY_FRAMES * 99) / 100],
+        (unsigned long long)latencies[(LATENCY_FRAMES * 999) / 1000],
+        (unsigned long long)latencies[LATENCY_FRAMES - 1]);
+
+    free(latencies);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,270 @@
+/* ============================================================================
+ * File: bench_rx_batch.c
+ *
+ * Description: Compares the per-frame J1939_CAN_RX callback against the
+ *              batched J1939_CAN_RX_BATCH callback. Two frame sources are
+ *              measured: a datagram socket pair standing in for a SocketCAN
+ *              socket (one read() per frame vs. one recvmmsg() per batch),
+ *              and an in-memory array that isolates the library's own
+ *              per-frame overhead from the cost of the syscalls.
+ * ============================================================================
+ */
+
+// For recvmmsg()
+#define _GNU_SOURCE
+
+#include "bench_common.h"
+#include "j1939.h"
+
+#include <fcntl.h>
+#include <linux/can.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Stays below the default queue limit of a unix datagram socket pair
+#define FRAMES_PER_ROUND  (256)
+#define ROUNDS            (4000)
+
+// PGN 0xFEF1 broadcast from address 0x10, priority 6
+#define BENCH_CAN_ID  (0x98FEF110u)
+
+static int rx_fd;
+static int tx_fd;
+
+static struct can_frame mem_frames[FRAMES_PER_ROUND];
+static int mem_head;
+static int mem_tail;
+
+static uint64_t frames_delivered;
+
+/* ============================================================================
+ * Socket frame source
+ * ============================================================================
+ */
+
+static bool
+socket_rx(
+    void* user_data,
+    struct J1939CanFrame* jframe)
+{
+    (void)user_data;
+    struct can_frame frame;
+
+    if (read(rx_fd, &frame, sizeof(frame)) != sizeof(frame))
+        return false;
+
+    jframe->id = frame.can_id;
+    memcpy(jframe->data, frame.data, frame.len);
+    jframe->len = frame.len;
+    return true;
+}
+
+static int
+socket_rx_batch(
+    void* user_data,
+    struct J1939CanFrame* jframes,
+    int max_frames)
+{
+    (void)user_data;
+    struct can_frame frames[J1939_RX_BATCH_SIZE];
+    struct iovec iovs[J1939_RX_BATCH_SIZE];
+    struct mmsghdr msgs[J1939_RX_BATCH_SIZE];
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < max_frames; i++)
+    {
+        iovs[i].iov_base = &frames[i];
+        iovs[i].iov_len = sizeof(struct can_frame);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int nmsgs = recvmmsg(rx_fd, msgs, max_frames, MSG_DONTWAIT, NULL);
+    if (nmsgs <= 0)
+        return 0;
+
+    for (int i = 0; i < nmsgs; i++)
+    {
+        jframes[i].id = frames[i].can_id;
+        memcpy(jframes[i].data, frames[i].data, frames[i].len);
+        jframes[i].len = frames[i].len;
+    }
+
+    return nmsgs;
+}
+
+static void
+socket_fill(void)
+{
+    struct can_frame frame = {
+        .can_id = BENCH_CAN_ID,
+        .len = 8,
+        .data = { 0, 1, 2, 3, 4, 5, 6, 7 }
+    };
+
+    for (int i = 0; i < FRAMES_PER_ROUND; i++)
+    {
+        if (write(tx_fd, &frame, sizeof(frame)) != sizeof(frame))
+        {
+            perror("write()");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* ============================================================================
+ * In-memory frame source
+ * ============================================================================
+ */
+
+static bool
+mem_rx(
+    void* user_data,
+    struct J1939CanFrame* jframe)
+{
+    (void)user_data;
+    if (mem_tail == mem_head)
+        return false;
+
+    struct can_frame* frame = &mem_frames[mem_tail++];
+    jframe->id = frame->can_id;
+    memcpy(jframe->data, frame->data, frame->len);
+    jframe->len = frame->len;
+    return true;
+}
+
+static int
+mem_rx_batch(
+    void* user_data,
+    struct J1939CanFrame* jframes,
+    int max_frames)
+{
+    (void)user_data;
+    int n = 0;
+
+    while ((n < max_frames) && (mem_tail != mem_head))
+    {
+        struct can_frame* frame = &mem_frames[mem_tail++];
+        jframes[n].id = frame->can_id;
+        memcpy(jframes[n].data, frame->data, frame->len);
+        jframes[n].len = frame->len;
+        n++;
+    }
+
+    return n;
+}
+
+static void
+mem_fill(void)
+{
+    mem_head = FRAMES_PER_ROUND;
+    mem_tail = 0;
+}
+
+/* ============================================================================
+ * J1939 callbacks
+ * ============================================================================
+ */
+
+static bool
+bench_tx(
+    void* user_data,
+    struct J1939Msg* msg)
+{
+    (void)user_data, (void)msg;
+    return true;
+}
+
+static void
+bench_msg_rx(
+    void* user_data,
+    struct J1939Msg* msg)
+{
+    (void)user_data, (void)msg;
+    frames_delivered++;
+}
+
+static void
+bench_startup_delay(
+    void* param)
+{
+    (void)param;
+}
+
+/* ============================================================================
+ * Benchmark driver
+ * ============================================================================
+ */
+
+static void
+run(
+    struct J1939* node,
+    const char* label,
+    J1939_CAN_RX_BATCH can_rx_batch,
+    void (*fill)(void))
+{
+    uint64_t elapsed_ns = 0;
+
+    j1939_set_can_rx_batch(node, can_rx_batch);
+    frames_delivered = 0;
+
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        fill();
+
+        uint64_t start = bench_now_ns();
+        j1939_update(node);
+        elapsed_ns += bench_now_ns() - start;
+    }
+
+    if (frames_delivered != (uint64_t)FRAMES_PER_ROUND * ROUNDS)
+    {
+        fprintf(stderr, "%s: delivered %llu frames, expected %llu\n",
+            label,
+            (unsigned long long)frames_delivered,
+            (unsigned long long)FRAMES_PER_ROUND * ROUNDS);
+        exit(EXIT_FAILURE);
+    }
+
+    bench_report(label, frames_delivered, "frame", elapsed_ns);
+}
+
+int main(void)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0)
+    {
+        perror("socketpair()");
+        return EXIT_FAILURE;
+    }
+    rx_fd = fds[0];
+    tx_fd = fds[1];
+    fcntl(rx_fd, F_SETFL, (fcntl(rx_fd, F_GETFL, 0) | O_NONBLOCK));
+
+    for (int i = 0; i < FRAMES_PER_ROUND; i++)
+    {
+        mem_frames[i].can_id = BENCH_CAN_ID;
+        mem_frames[i].len = 8;
+    }
+
+    struct J1939 node;
+    struct J1939Name name = { .identity = 1, .arbitrary_addr_capable = 1 };
+
+    if (!j1939_init(&node, &name, 0x20, 10, socket_rx, bench_tx,
+            bench_msg_rx, bench_startup_delay, NULL))
+    {
+        fprintf(stderr, "j1939_init() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    run(&node, "socket: read() per frame", NULL, socket_fill);
+    run(&node, "socket: recvmmsg() per batch", socket_rx_batch, socket_fill);
+
+    node.can_rx = mem_rx;
+    run(&node, "memory: can_rx per frame", NULL, mem_fill);
+    run(&node, "memory: can_rx_batch", mem_rx_batch, mem_fill);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,307 @@
+/* ============================================================================
+ * File: bench_tp_loopback.c
+ *
+ * Description: Transfers maximum-size (1785 byte) multi-packet messages
+ *              between two nodes connected by an in-process loopback bus,
+ *              under several transport protocol timing profiles. The nodes
+ *              are driven by j1939_update_at() on a simulated clock that
+ *              jumps from one deadline to the next, and by the time each frame
+ *              would take on a 250 kbit/s bus. The simulated time per message
+ *              is thus what the pacing costs on an otherwise idle bus, while
+ *              the CPU time shows the library's own overhead. The last
+ *              profile hands each window to a batched transmit callback
+ *              (j1939_set_can_tx_batch()) instead of sending packets one by
+ *              one.
+ * ============================================================================
+ */
+
+#include "bench_common.h"
+#include "j1939.h"
+#include "j1939_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MESSAGES      (20)
+#define MSG_LEN       (J1939_TP_MAX_PAYLOAD)
+#define MSG_PGN       (0x00EF00)
+
+#define SENDER_ADDR    (0x20)
+#define RECEIVER_ADDR  (0x30)
+
+// Time (us) an extended frame with 8 data bytes, worst-case bit stuffing
+//  included, takes at 250 kbit/s
+#define FRAME_US  (540)
+
+// Enough for a full window of 255 packets and then some
+#define BUS_QUEUE_SIZE  (1024)
+
+struct BenchBus {
+    struct J1939CanFrame frames[BUS_QUEUE_SIZE];
+    int len;
+};
+
+struct BenchSide {
+    struct J1939Context ctx;
+    struct J1939Private storage[1];
+    struct J1939 node;
+
+    // Frames sent by this node, waiting to be received by the other one
+    struct BenchBus out;
+};
+
+struct Profile {
+    const char* label;
+    uint8_t dst;
+    struct J1939TPTiming timing;
+    uint8_t window;
+    bool tx_batch;
+};
+
+static struct BenchSide sender;
+static struct BenchSide receiver;
+
+static uint8_t payload[MSG_LEN];
+static uint64_t messages_delivered;
+
+/* ============================================================================
+ * J1939 callbacks
+ * ============================================================================
+ */
+
+static bool
+bench_tx(
+    void* user_data,
+    struct J1939Msg* msg)
+{
+    struct BenchSide* side = user_data;
+
+    if (side->out.len == BUS_QUEUE_SIZE)
+    {
+        fprintf(stderr, "loopback bus overflow\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct J1939CanFrame* frame = &side->out.frames[side->out.len++];
+    frame->id = j1939_msg_to_can_id(msg);
+    memcpy(frame->data, msg->data, msg->len);
+    frame->len = msg->len;
+    return true;
+}
+
+static int
+bench_tx_batch(
+    void* user_data,
+    const struct J1939CanFrame* frames,
+    int num_frames)
+{
+    struct BenchSide* side = user_data;
+
+    if (side->out.len + num_frames > BUS_QUEUE_SIZE)
+    {
+        fprintf(stderr, "loopback bus overflow\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(&side->out.frames[side->out.len], frames, num_frames * sizeof(frames[0]));
+    side->out.len += num_frames;
+    return num_frames;
+}
+
+static void
+bench_msg_rx(
+    void* user_data,
+    struct J1939Msg* msg)
+{
+    (void)user_data;
+
+    if ((msg->pgn == MSG_PGN) && (msg->len == MSG_LEN))
+        messages_delivered++;
+}
+
+static void
+bench_startup_delay(
+    void* param)
+{
+    (void)param;
+}
+
+/* ============================================================================
+ * Benchmark driver
+ * ============================================================================
+ */
+
+static void
+init_side(
+    struct BenchSide* side,
+    uint8_t address,
+    uint32_t identity)
+{
+    struct J1939Name name = { .identity = identity, .arbitrary_addr_capable = 1 };
+
+    j1939_context_init(&side->ctx, side->storage, 1, side);
+    if (!j1939_context_node_init(&side->ctx, &side->node, &name, address, 10,
+            NULL, bench_tx, bench_msg_rx, bench_startup_delay, NULL))
+    {
+        fprintf(stderr, "j1939_context_node_init() failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Hand the frames each node sent to the other one, until neither has anything
+//  more to say. Return the number of frames delivered.
+static int
+deliver_frames(void)
+{
+    static struct J1939CanFrame frames[BUS_QUEUE_SIZE];
+    int delivered = 0;
+
+    while ((sender.out.len != 0) || (receiver.out.len != 0))
+    {
+        struct BenchSide* sides[2] = { &sender, &receiver };
+
+        for (int i = 0; i < 2; ++i)
+        {
+            struct BenchSide* from = sides[i];
+            struct BenchSide* to = sides[1 - i];
+            int len = from->out.len;
+
+            memcpy(frames, from->out.frames, len * sizeof(frames[0]));
+            from->out.len = 0;
+            j1939_process_frames(&to->node, frames, len);
+            delivered += len;
+        }
+    }
+
+    return delivered;
+}
+
+static uint64_t
+min_deadline(void)
+{
+    uint64_t a = j1939_next_deadline(&sender.node);
+    uint64_t b = j1939_next_deadline(&receiver.node);
+
+    return (a < b) ? a : b;
+}
+
+static void
+run(
+    const struct Profile* profile,
+    uint64_t* now_us)
+{
+    j1939_set_tp_timing(&sender.node, &profile->timing);
+    j1939_set_tp_timing(&receiver.node, &profile->timing);
+    j1939_set_tp_window(&receiver.node, profile->window);
+    j1939_set_can_tx_batch(&sender.node, profile->tx_batch ? bench_tx_batch : NULL);
+
+    messages_delivered = 0;
+    uint64_t start_us = *now_us;
+    uint64_t start_ns = bench_now_ns();
+
+    for (int i = 0; i < MESSAGES; ++i)
+    {
+        struct J1939Msg msg = {
+            .pgn = MSG_PGN,
+            .data = payload,
+            .len = MSG_LEN,
+            .dst = profile->dst,
+            .pri = J1939_DEFAULT_PRIORITY
+        };
+
+        if (!j1939_tx(&sender.node, &msg))
+        {
+            fprintf(stderr, "%s: j1939_tx() failed\n", profile->label);
+            exit(EXIT_FAILURE);
+        }
+
+        // Run until both sides are idle again
+        for (;;)
+        {
+            j1939_update_at(&sender.node, *now_us);
+            j1939_update_at(&receiver.node, *now_us);
+            *now_us += (uint64_t)deliver_frames() * FRAME_US;
+
+            uint64_t deadline = min_deadline();
+            if (deadline == J1939_NO_DEADLINE)
+                break;
+
+            if (deadline > *now_us)
+                *now_us = deadline;
+        }
+    }
+
+    uint64_t elapsed_ns = bench_now_ns() - start_ns;
+    double sim_s = (double)(*now_us - start_us) / 1e6;
+
+    if (messages_delivered != MESSAGES)
+    {
+        fprintf(stderr, "%s: delivered %llu messages, expected %d\n",
+            profile->label,
+            (unsigned long long)messages_delivered,
+            MESSAGES);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-36s %8.0f ms/msg  %8.0f B/s (simulated)  %8.1f us/msg (CPU)\n",
+        profile->label,
+        sim_s * 1e3 / MESSAGES,
+        (double)MESSAGES * MSG_LEN / sim_s,
+        (double)elapsed_ns / 1e3 / MESSAGES);
+}
+
+int main(void)
+{
+    for (int i = 0; i < MSG_LEN; i++)
+        payload[i] = (uint8_t)i;
+
+    init_side(&sender, SENDER_ADDR, 1);
+    init_side(&receiver, RECEIVER_ADDR, 2);
+    (void)deliver_frames();
+
+    const struct Profile profiles[] = {
+        {
+            .label = "BAM, 50 ms gap",
+            .dst = J1939_ADDR_GLOBAL,
+            .timing = { .bam_gap_ms = 50, .p2p_gap_ms = 50, .cts_delay_ms = 50 },
+            .window = J1939_TP_CTS_WINDOW
+        },
+        {
+            .label = "P2P, 50 ms gap",
+            .dst = RECEIVER_ADDR,
+            .timing = { .bam_gap_ms = 50, .p2p_gap_ms = 50, .cts_delay_ms = 50 },
+            .window = J1939_TP_CTS_WINDOW
+        },
+        {
+            .label = "P2P, 5 ms gap",
+            .dst = RECEIVER_ADDR,
+            .timing = { .bam_gap_ms = 50, .p2p_gap_ms = 5, .cts_delay_ms = 5 },
+            .window = J1939_TP_CTS_WINDOW
+        },
+        {
+            .label = "P2P, burst, 16 packet window",
+            .dst = RECEIVER_ADDR,
+            .timing = { .bam_gap_ms = 50, .p2p_gap_ms = 0, .cts_delay_ms = 0 },
+            .window = 16
+        },
+        {
+            .label = "P2P, burst, 255 packet window",
+            .dst = RECEIVER_ADDR,
+            .timing = { .bam_gap_ms = 50, .p2p_gap_ms = 0, .cts_delay_ms = 0 },
+            .window = 255
+        },
+        {
+            .label = "P2P, burst, 255 window, batched TX",
+            .dst = RECEIVER_ADDR,
+            .timing = { .bam_gap_ms = 50, .p2p_gap_ms = 0, .cts_delay_ms = 0 },
+            .window = 255,
+            .tx_batch = true
+        },
+    };
+
+    uint64_t now_us = 1000000;
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); ++i)
+        run(&profiles[i], &now_us);
+
+    return EXIT_SUCCESS;
+}
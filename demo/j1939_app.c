@@ -1,8 +1,12 @@
+// For recvmmsg()
+#define _GNU_SOURCE
+
 #include "j1939_app.h"
 
 #include <unistd.h>
 #include <sys/socket.h>
 #include <linux/can.h>
+#include <linux/can/raw.h>
 #include <stdio.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -10,22 +14,30 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <time.h>
 
-static bool physical_rx(struct J1939CanFrame* frame);
-static bool physical_tx(struct J1939Msg* msg);
-static void j1939_msg_rx(struct J1939Msg* msg);
-static void startup_delay(void* param);
+static bool physical_rx(void* user_data, struct J1939CanFrame* frame);
+static int physical_rx_batch(void* user_data, struct J1939CanFrame* frames, int max_frames);
+static bool physical_tx(void* user_data, struct J1939Msg* msg);
+static void j1939_msg_rx(void* user_data, struct J1939Msg* msg);
+static bool load_snapshot(const char* path, struct J1939AddressSnapshot* snapshot);
+static void save_snapshot(void* user_data, struct J1939* node);
 static void print_j1939_msg(struct J1939Msg* msg);
 
 static int sockfd;
 
+// Kept across restarts, see j1939_app_init()
+static const char* snapshot_path;
+static struct J1939AddressSnapshot snapshot;
+
 void
 j1939_app_init(
     struct J1939* node,
     struct J1939Name* name,
     uint8_t preferred_address,
     int tick_rate_ms,
-    const char* device_name)
+    const char* device_name,
+    const char* address_file)
 {
     sockfd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
     if (sockfd < 0)
@@ -45,6 +57,14 @@ j1939_app_init(
     if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)))
         perror("bind()");
 
+    // Come back at the address of the last run, if it had one
+    snapshot_path = address_file;
+    bool restore = (snapshot_path != NULL) && load_snapshot(snapshot_path, &snapshot) &&
+        (memcmp(&snapshot.name, name, sizeof(*name)) == 0);
+
+    if (restore && (snapshot.address != J1939_ADDR_NULL))
+        preferred_address = snapshot.address;
+
     const bool init_result =
         j1939_init(
             node,
@@ -54,15 +74,39 @@ j1939_app_init(
             physical_rx,
             physical_tx,
             j1939_msg_rx,
-            startup_delay,
+            NULL,
             NULL);
 
     if (!init_result)
         exit(EXIT_FAILURE);
+
+    if (restore)
+        (void)j1939_restore_address_snapshot(node, &snapshot);
+
+    if (snapshot_path != NULL)
+        j1939_set_address_hook(node, save_snapshot, NULL);
+
+    // Drain the socket with a single recvmmsg() per batch of frames
+    j1939_set_can_rx_batch(node, physical_rx_batch);
+}
+
+int
+j1939_app_fd(void)
+{
+    return sockfd;
+}
+
+uint64_t
+j1939_app_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
 }
 
 static bool
 physical_rx(
+    void* user_data,
     struct J1939CanFrame* jcanframe)
 {
     struct can_frame frame;
@@ -87,8 +131,80 @@ physical_rx(
     return true;
 }
 
+void
+j1939_app_apply_filters(
+    struct J1939* node)
+{
+    // struct J1939CanIdFilter has the same layout as struct can_filter
+    struct can_filter filters[CAN_RAW_FILTER_MAX];
+    int count = j1939_export_filters(
+        node,
+        (struct J1939CanIdFilter*)filters,
+        CAN_RAW_FILTER_MAX);
+
+    if (count > CAN_RAW_FILTER_MAX)
+    {
+        fprintf(stderr, "Too many CAN filters (%d), not filtering in kernel\n", count);
+        return;
+    }
+
+    if (setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, filters,
+            count * sizeof(struct can_filter)))
+    {
+        perror("setsockopt()");
+    }
+}
+
+static int
+physical_rx_batch(
+    void* user_data,
+    struct J1939CanFrame* jcanframes,
+    int max_frames)
+{
+    struct can_frame frames[J1939_RX_BATCH_SIZE];
+    struct iovec iovs[J1939_RX_BATCH_SIZE];
+    struct mmsghdr msgs[J1939_RX_BATCH_SIZE];
+
+    if (max_frames > J1939_RX_BATCH_SIZE)
+        max_frames = J1939_RX_BATCH_SIZE;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < max_frames; i++)
+    {
+        iovs[i].iov_base = &frames[i];
+        iovs[i].iov_len = sizeof(struct can_frame);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int nmsgs = recvmmsg(sockfd, msgs, max_frames, MSG_DONTWAIT, NULL);
+
+    if (nmsgs < 0)
+    {
+        if (errno != EWOULDBLOCK)
+            perror("recvmmsg()");
+
+        return 0;
+    }
+
+    int nframes = 0;
+    for (int i = 0; i < nmsgs; i++)
+    {
+        if (msgs[i].msg_len < sizeof(struct can_frame))
+            continue;
+
+        jcanframes[nframes].id = frames[i].can_id;
+        memcpy(jcanframes[nframes].data, frames[i].data, frames[i].len);
+        jcanframes[nframes].len = frames[i].len;
+        nframes++;
+    }
+
+    return nframes;
+}
+
 static bool
 physical_tx(
+    void* user_data,
     struct J1939Msg* msg)
 {
     struct can_frame frame = {
@@ -113,11 +229,51 @@ physical_tx(
 
 static void
 j1939_msg_rx(
+    void* user_data,
     struct J1939Msg* msg)
 {
     print_j1939_msg(msg);
 }
 
+static bool
+load_snapshot(
+    const char* path,
+    struct J1939AddressSnapshot* snapshot)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+
+    size_t read = fread(snapshot, sizeof(*snapshot), 1, file);
+    fclose(file);
+
+    return (read == 1) && (snapshot->version == J1939_ADDRESS_SNAPSHOT_VERSION);
+}
+
+// Written to a temporary file first, so a crash never leaves half a snapshot
+static void
+save_snapshot(
+    void* user_data,
+    struct J1939* node)
+{
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", snapshot_path);
+
+    j1939_get_address_snapshot(node, &snapshot);
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL)
+    {
+        perror("fopen()");
+        return;
+    }
+
+    size_t written = fwrite(&snapshot, sizeof(snapshot), 1, file);
+
+    if ((fclose(file) != 0) || (written != 1) || (rename(tmp_path, snapshot_path) != 0))
+        perror("save_snapshot()");
+}
+
 static void
 print_j1939_msg(
     struct J1939Msg* msg)
@@ -132,10 +288,3 @@ print_j1939_msg(
     printf("\n");
 }
 
-static
-void startup_delay(
-    void* param)
-{
-    const int delay_ms = 250;
-    usleep(delay_ms * 1000);
-}
@@ -2,10 +2,28 @@
 
 #include "j1939.h"
 
+// Initialize the node on the SocketCAN device. If address_file isn't NULL,
+//  the node's address claim state is saved there whenever it changes, and
+//  restored from it on the next start.
 void
 j1939_app_init(
     struct J1939* node,
     struct J1939Name* name,
     uint8_t preferred_address,
     int tick_rate_ms,
-    const char* device_name);
+    const char* device_name,
+    const char* address_file);
+
+// Install the node's acceptance filter on the socket (CAN_RAW_FILTER), so the
+//  kernel drops unwanted traffic before it reaches the application
+void
+j1939_app_apply_filters(
+    struct J1939* node);
+
+// Return the CAN socket, for waiting on it with poll()/epoll()
+int
+j1939_app_fd(void);
+
+// Return the current CLOCK_MONOTONIC time in us, for j1939_update_at()
+uint64_t
+j1939_app_now_us(void);
@@ -3,8 +3,14 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+static int add_timer(int epfd);
+static void arm_deadline(int timerfd, uint64_t deadline_us);
+
 void node_init(
     struct J1939* node,
     struct J1939Name* name,
@@ -13,28 +19,104 @@ void node_init(
     const char* device = "vcan0";
     const int tick_rate_ms = 10;
 
-    j1939_app_init(node, name, src_addr, tick_rate_ms, device);
+    // One file per node, next to where the demo is run from
+    static char address_file[32];
+    snprintf(address_file, sizeof(address_file), "node_%u.j1939", (unsigned)name->identity);
+
+    j1939_app_init(node, name, src_addr, tick_rate_ms, device, address_file);
+
+    // Only the demo PGNs are of interest; drop everything else in the kernel
+    j1939_accept_pgn(node, DUMMY1_PGN);
+    j1939_accept_pgn(node, DUMMY2_PGN);
+    j1939_accept_pgn(node, DUMMY3_PGN);
+    j1939_app_apply_filters(node);
 }
 
 void node_superloop(
     struct J1939* node)
 {
-    const int tick_rate_ms = 10;
-
-    int counter_10ms = 0;
-
     printf("Press enter to start\n");
     getchar();
     printf("Starting...\n\n");
     printf("ID        P  SRC   DST   LEN DATA\n");
 
+    // Sleep until a frame arrives, a J1939 deadline is reached, or it's time
+    //  for the application's 1 Hz message; no fixed tick is needed.
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+    {
+        perror("epoll_create1()");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = j1939_app_fd() };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+    int deadline_fd = add_timer(epfd);
+    int tx_1hz_fd = add_timer(epfd);
+
+    struct itimerspec period = {
+        .it_interval = { .tv_sec = 1 },
+        .it_value = { .tv_sec = 1 }
+    };
+    timerfd_settime(tx_1hz_fd, 0, &period, NULL);
+
     while (true)
     {
-        usleep(tick_rate_ms * 1000);
+        arm_deadline(deadline_fd, j1939_next_deadline(node));
+
+        struct epoll_event events[3];
+        int num_events = epoll_wait(epfd, events, 3, -1);
+
+        for (int i = 0; i < num_events; i++)
+        {
+            uint64_t expirations;
+            int fd = events[i].data.fd;
+
+            if ((fd == deadline_fd) || (fd == tx_1hz_fd))
+                (void)read(fd, &expirations, sizeof(expirations));
+
+            if (fd == tx_1hz_fd)
+                node_tx_1hz(node);
+        }
+
+        j1939_update_at(node, j1939_app_now_us());
+    }
+}
+
+static int
+add_timer(
+    int epfd)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (fd < 0)
+    {
+        perror("timerfd_create()");
+        exit(EXIT_FAILURE);
+    }
 
-        if ((++counter_10ms % 100) == 0)
-            node_tx_1hz(node);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
 
-        j1939_update(node);
+    return fd;
+}
+
+static void
+arm_deadline(
+    int timerfd,
+    uint64_t deadline_us)
+{
+    struct itimerspec spec = { 0 };
+
+    if (deadline_us != J1939_NO_DEADLINE)
+    {
+        // A zero it_value would disarm the timer; an expired one fires at once
+        if (deadline_us == 0)
+            deadline_us = 1;
+
+        spec.it_value.tv_sec = deadline_us / 1000000;
+        spec.it_value.tv_nsec = (deadline_us % 1000000) * 1000;
     }
+
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
 }
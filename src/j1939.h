@@ -8,6 +8,13 @@
  *              J1939 object for each unique node. The number of unique nodes
  *              operated by the application (ECU) should be defined by the
  *              J1939_NODES macro.
+ *              Nodes belong to a context, which holds the nodes' protocol
+ *              state. Nodes initialized with j1939_init() share a built-in
+ *              default context sized by J1939_NODES. Applications driving
+ *              several independent buses can instead create one context per
+ *              bus, with caller-provided storage, and initialize nodes into
+ *              it with j1939_context_node_init(). Contexts share no state, so
+ *              each can be driven from its own thread.
  *              If this library is compiled with the J1939_LISTENER_ONLY_MODE
  *              option enabled all nodes simply passively listen to the bus,
  *              meaning that:
@@ -36,6 +43,15 @@ struct J1939CanFrame {
     uint8_t len;
 };
 
+// Acceptance filter entry: a frame matches if (frame_id & mask) == (id & mask).
+// Bit 31 is the extended frame flag and bit 30 the remote frame flag, so an
+//  array of these has the same layout and meaning as SocketCAN's
+//  struct can_filter and can be passed straight to CAN_RAW_FILTER.
+struct J1939CanIdFilter {
+    uint32_t id;
+    uint32_t mask;
+};
+
 struct J1939Msg {
     uint32_t pgn;
     uint8_t* data;
@@ -46,6 +62,209 @@ struct J1939Msg {
     uint8_t pri;
 };
 
+// Usage statistics of one size class of the transport protocol buffer pool
+struct J1939PoolStats {
+    uint16_t block_size;
+    uint16_t blocks;
+
+    // Blocks currently lent out, and the most ever lent out at once
+    uint16_t in_use;
+    uint16_t high_water;
+
+    // Requests this class couldn't serve because all of its blocks were in
+    //  use; they may still have been served by a larger class
+    uint32_t exhausted;
+};
+
+// Where a node looks for a new address when it loses its own to a node with
+//  a higher priority NAME, see j1939_set_address_policy()
+enum j1939_address_policy {
+    // The next free address above the current one, wrapping around from 253
+    //  to 0
+    J1939_ADDRESS_POLICY_NEXT_FREE = 0,
+
+    // Same, but within the self-configurable range (128 - 247) first, as the
+    //  standard recommends for arbitrary address capable nodes; the rest of
+    //  the addresses are only used if that range is full
+    J1939_ADDRESS_POLICY_SELF_CONFIGURABLE
+};
+
+// A node's address claim state, as persisted across restarts. It holds no
+//  pointers, so it can be written to a file or non-volatile memory as it is,
+//  and read back by the same build of the library on the same machine. See
+//  j1939_get_address_snapshot().
+#define J1939_ADDRESS_SNAPSHOT_VERSION  (1)
+struct J1939AddressSnapshot {
+    // J1939_ADDRESS_SNAPSHOT_VERSION when taken; other versions aren't
+    //  restored
+    uint32_t version;
+
+    // The NAME of the node the snapshot was taken from, which is the only one
+    //  it's restored into
+    struct J1939Name name;
+
+    // The address the node held, or J1939_ADDR_NULL if it held none
+    uint8_t address;
+
+    // The NAMEs of the other nodes at each valid address (0 - 253), for the
+    //  addresses whose bit in known is set
+    uint32_t known[256 / 32];
+    struct J1939Name names[J1939_ADDR_NULL];
+};
+
+// How a PGN of the PGN database is sent
+enum j1939_pgn_transport {
+    // Fits in a single frame
+    J1939_PGN_SINGLE_FRAME = 0,
+
+    // Always longer than 8 bytes, sent with the transport protocol
+    J1939_PGN_MULTI_PACKET,
+
+    // The length varies: the transport protocol is used if it's more than
+    //  8 bytes
+    J1939_PGN_EITHER
+};
+
+// An entry of the PGN database compiled into the library (j1939_pgn_db.txt),
+//  see j1939_pgn_info()
+struct J1939PgnInfo {
+    uint32_t pgn;
+
+    // Default priority
+    uint8_t pri;
+
+    // Data length in bytes, or zero if it varies
+    uint16_t len;
+
+    // Transmission repetition rate (ms), or zero if the PGN is sent on
+    //  request or on change
+    uint16_t rate_ms;
+
+    enum j1939_pgn_transport transport;
+
+    const char* name;
+};
+
+// Statistics of a node's queue of multi-packet messages waiting to be sent
+struct J1939TxQueueStats {
+    // Messages waiting now, and the most ever waiting at once
+    uint16_t depth;
+    uint16_t max_depth;
+
+    // Messages accepted into the queue, and refused because it was full (or no
+    //  buffer was available)
+    uint32_t queued;
+    uint32_t rejected;
+
+    // Messages taken off the queue to start their connection
+    uint32_t started;
+
+    // Time (us) messages spent waiting before their connection opened, in
+    //  total over all started messages and at most
+    uint64_t total_wait_us;
+    uint32_t max_wait_us;
+};
+
+// Timing of the transport protocol connections of a node, or of a single
+//  message sent with j1939_tx_timed()
+struct J1939TPTiming {
+    // Gap (ms) between the TP.DT packets of a broadcast. The standard requires
+    //  50 to 200 ms; values outside that range are clamped to it.
+    uint16_t bam_gap_ms;
+
+    // Gap (ms) between the TP.DT packets of a P2P connection. The standard
+    //  leaves this up to the sender, since the receiver controls the flow with
+    //  CTS messages. Zero sends all the packets a CTS asks for back-to-back,
+    //  in a single update. The receiver asks for the window again after
+    //  J1939_TP_TIMEOUT_TR (200 ms) without a packet, so longer gaps are
+    //  clamped to J1939_TP_P2P_GAP_MAX (150 ms).
+    uint16_t p2p_gap_ms;
+
+    // Delay (ms) before a receiver sends a CTS, after the RTS or after the
+    //  last packet of a window. The sender gives up after J1939_TP_TIMEOUT_TR
+    //  (200 ms) without a CTS, so longer delays are clamped to
+    //  J1939_TP_CTS_DELAY_MAX (150 ms).
+    uint16_t cts_delay_ms;
+};
+
+// How sending a multi-packet message ended
+enum j1939_tx_status {
+    // Every packet was sent and, for P2P messages, the receiver acknowledged
+    //  the message
+    J1939_TX_SENT = 0,
+
+    // The receiver aborted the connection, for abort_reason
+    J1939_TX_ABORTED,
+
+    // The receiver stopped responding
+    J1939_TX_TIMEOUT,
+
+    // can_tx failed to send one of the connection's frames, or a stream
+    //  source failed. The connection is abandoned rather than retried, so the
+    //  application can decide what to do.
+    J1939_TX_FAILED,
+
+    // The message was dropped before it was done, because the node's
+    //  address changed
+    J1939_TX_CANCELLED
+};
+
+struct J1939TxResult {
+    enum j1939_tx_status status;
+
+    // J1939_TX_ABORTED only; one of enum j1939_tp_abort_reason
+    uint8_t abort_reason;
+
+    // Length of the message in bytes, and how many of them were sent
+    uint32_t size;
+    uint32_t bytes_sent;
+
+    // Time (us) from the message being accepted for sending until it was
+    //  done, queueing included, as measured by the node's updates
+    uint32_t elapsed_us;
+};
+
+enum j1939_stream_event_type {
+    // A message is about to be received; size holds its length
+    J1939_STREAM_BEGIN = 0,
+
+    // The next len bytes of the message, at offset bytes into it
+    J1939_STREAM_DATA,
+
+    // Every byte of the message has been received
+    J1939_STREAM_COMPLETE,
+
+    // The connection was closed before the message was complete;
+    //  abort_reason holds one of enum j1939_tp_abort_reason
+    J1939_STREAM_ABORT
+};
+
+// An event of a message received through a stream sink
+//  (j1939_set_stream_sink() and j1939_set_pgn_stream_sink())
+struct J1939StreamEvent {
+    enum j1939_stream_event_type type;
+
+    uint32_t pgn;
+    uint8_t src;
+    uint8_t dst;
+    uint8_t pri;
+
+    // Length of the whole message in bytes
+    uint32_t size;
+
+    // J1939_STREAM_DATA only. The data is borrowed for the duration of the
+    //  callback. Every byte arrives exactly once. Chunks of messages sent with
+    //  the extended transport protocol, or broadcast, arrive in order; those
+    //  of a P2P transport protocol message may not, as a packet the receiver
+    //  asked for again arrives after the ones that followed it.
+    uint32_t offset;
+    const uint8_t* data;
+    uint16_t len;
+
+    // J1939_STREAM_ABORT only
+    uint8_t abort_reason;
+};
+
 /* ============================================================================
  * Subsection: Callback functions; implemented by application
  * ============================================================================
@@ -54,36 +273,131 @@ struct J1939Msg {
 // Receive a CAN frame from the bus into J1939CanFrame.
 // Return false if there are no CAN frames to receive. Return true otherwise.
 // This function is called at the rate specified by tick_rate_ms.
+// It's optional for nodes that receive every frame through j1939_push_frame().
 // The application must ensure that bit 31 of the CAN ID is set if the frame is
 //  extended.
-typedef bool (*J1939_CAN_RX)(struct J1939CanFrame*);
+// Every callback receives the node's user_data pointer as its first parameter
+//  (the user_data of the node's context, see j1939_context_init()).
+typedef bool (*J1939_CAN_RX)(void* user_data, struct J1939CanFrame*);
+
+// Optional batched alternative to J1939_CAN_RX. Receive up to max_frames CAN
+//  frames from the bus into the frames array and return the number of frames
+//  received (zero if there are none). If fewer than max_frames are returned,
+//  it's assumed that the bus has been drained for this tick. The same bit 31
+//  rule as J1939_CAN_RX applies to every frame.
+typedef int (*J1939_CAN_RX_BATCH)(
+    void* user_data,
+    struct J1939CanFrame* frames,
+    int max_frames);
 
 // Transmit a J1939Msg on the bus. Return true if successful, false otherwise.
-typedef bool (*J1939_CAN_TX)(struct J1939Msg*);
+typedef bool (*J1939_CAN_TX)(void* user_data, struct J1939Msg*);
+
+// Optional batched alternative to J1939_CAN_TX, used for TP.DT packets.
+//  Transmit num_frames CAN frames, in order, and return the number of frames
+//  sent (or queued for sending), stopping at the first one that can't be. The
+//  CAN IDs are complete, with bit 31 set. The frames array is only valid until
+//  this function returns.
+typedef int (*J1939_CAN_TX_BATCH)(
+    void* user_data,
+    const struct J1939CanFrame* frames,
+    int num_frames);
 
 // Receive a complete J1939Msg. This function is used for passing messages from
 //  the J1939 layer to the application.
-typedef void (*J1939_MSG_RX)(struct J1939Msg*);
+// The payload is borrowed, not copied. For single-frame messages, msg->data
+//  points directly into the J1939CanFrame it was received in: the library's
+//  receive buffer, or the caller's frame array when passed through
+//  j1939_process_frames(). For multi-packet messages it points into the
+//  transport protocol buffer. In either case the pointer is only valid until
+//  this callback returns and the data should be treated as read-only; copy
+//  out anything that's needed afterwards.
+typedef void (*J1939_MSG_RX)(void* user_data, struct J1939Msg*);
+
+// Receive a complete J1939Msg for a PGN registered with
+//  j1939_register_pgn_handler(). The user_data pointer given at registration
+//  is passed back unchanged. The same lifetime rules as J1939_MSG_RX apply to
+//  msg->data.
+typedef void (*J1939_PGN_HANDLER)(void* user_data, struct J1939Msg* msg);
+
+// Receive an event of a streamed message, see struct J1939StreamEvent. The
+//  user_data pointer given to j1939_set_stream_sink() or
+//  j1939_set_pgn_stream_sink() is passed back unchanged. Returning false from
+//  a J1939_STREAM_BEGIN event refuses the message; from a J1939_STREAM_DATA
+//  event it aborts the connection. The return value of the other events is
+//  ignored.
+typedef bool (*J1939_STREAM_SINK)(
+    void* user_data,
+    const struct J1939StreamEvent* event);
+
+// Called when the library is done with a multi-packet message it was asked to
+//  send: with j1939_tx_zero_copy(), after which the message's buffer may be
+//  reused or freed, and for every message through j1939_set_tx_done(). msg
+//  holds the message's PGN, addresses and priority. The user_data pointer
+//  given with the callback is passed back unchanged.
+typedef void (*J1939_TX_DONE)(
+    void* user_data,
+    struct J1939Msg* msg,
+    const struct J1939TxResult* result);
+
+// Copy len bytes of a streamed message, starting offset bytes into it, into
+//  data. Return false to abort the connection. Bytes may be asked for more
+//  than once, when the receiver asks for packets again.
+typedef bool (*J1939_STREAM_SOURCE)(
+    void* user_data,
+    uint32_t offset,
+    uint8_t* data,
+    uint16_t len);
+
+// Called when a node's address claim state worth persisting changes: the node
+//  comes to hold an address (or gives up on getting one), or it learns that a
+//  NAME has claimed an address it wasn't known at. Take a snapshot with
+//  j1939_get_address_snapshot().
+struct J1939;
+typedef void (*J1939_ADDRESS_HOOK)(void* user_data, struct J1939* node);
 
-// This function should implement a 250ms blocking delay. It accepts a single
-//  parameter of any type.
+// No longer called: the 250ms a node waits after claiming an address in the
+//  self-configurable range is now part of the address claim, which runs in the
+//  update functions. Kept so that existing callers build; may be NULL.
 typedef void (*J1939_AC_STARTUP_DELAY_250MS)(void*);
 
+// Per-node protocol state; storage for it is provided through a context. See
+//  j1939_private.h for the definition.
+struct J1939Private;
+
+struct J1939Context {
+    // Storage for the nodes of this context, provided by the caller
+    struct J1939Private* nodes;
+    int max_nodes;
+
+    // Number of nodes initialized so far
+    int num_nodes;
+
+    // Passed to the callbacks of every node in this context
+    void* user_data;
+};
+
 struct J1939 {
-    // An index given to this node; will be zero if there's just a single node
+    // The context this node belongs to
+    struct J1939Context* ctx;
+
+    // An index given to this node within its context; will be zero if there's
+    //  just a single node
     int node_idx;
 
+    // Passed as the first parameter of every callback
+    void* user_data;
+
     uint8_t source_address;
 
     // The rate in ms at which the update function is called
     int tick_rate_ms;
 
     J1939_CAN_RX can_rx;
+    J1939_CAN_RX_BATCH can_rx_batch;
     J1939_CAN_TX can_tx;
+    J1939_CAN_TX_BATCH can_tx_batch;
     J1939_MSG_RX j1939_rx;
-
-    J1939_AC_STARTUP_DELAY_250MS startup_delay;
-    void* startup_delay_param;
 };
 
 /* ============================================================================
@@ -99,9 +413,19 @@ struct J1939 {
 //  attempt using a device node if that node was not initialized successfully.
 // The J1939Name parameter should be unique and not used by any other node on
 //  the network.
-// Note that, depending on the preferred_address, this function may enter a
-//  250ms blocking delay (via startup_delay parameter). The startup_delay_param
-//  is an optional parameter that will be passed to the startup_delay callback.
+// The can_rx callback may be NULL if frames are received only through
+//  j1939_push_frame().
+// The j1939_rx callback is optional if the application only uses handlers
+//  registered with j1939_register_pgn_handler(); pass NULL to drop every
+//  message without a registered handler.
+// The node sends Address Claimed for preferred_address and returns right
+//  away. The rest of the address claim runs in the update functions: an
+//  address in the range 128-247 becomes the node's after 250ms without
+//  contention, and a node that loses its address, or can't claim one, waits a
+//  pseudo-random 0-153ms (seeded with its NAME) before claiming another or
+//  sending Cannot Claim Address. Until the node holds its address
+//  (j1939_is_address_claimed()), messages sent by the application are
+//  refused. startup_delay and startup_delay_param are ignored.
 bool
 j1939_init(
     struct J1939* node,
@@ -114,19 +438,406 @@ j1939_init(
     J1939_AC_STARTUP_DELAY_250MS startup_delay,
     void* startup_delay_param);
 
+// Initialize a context over caller-provided storage for up to max_nodes nodes.
+// The nodes array must be an array of struct J1939Private (j1939_private.h)
+//  and, like the context itself, must outlive every node initialized into it.
+// user_data is passed to the callbacks of every node in the context.
+// Return false if the arguments are invalid.
+bool
+j1939_context_init(
+    struct J1939Context* ctx,
+    struct J1939Private* nodes,
+    int max_nodes,
+    void* user_data);
+
+// Same as j1939_init(), but the node is added to the given context instead of
+//  the default one.
+bool
+j1939_context_node_init(
+    struct J1939Context* ctx,
+    struct J1939* node,
+    struct J1939Name* name,
+    uint8_t preferred_address,
+    int tick_rate_ms,
+    J1939_CAN_RX can_rx,
+    J1939_CAN_TX can_tx,
+    J1939_MSG_RX j1939_rx,
+    J1939_AC_STARTUP_DELAY_250MS startup_delay,
+    void* startup_delay_param);
+
 // Call this function periodically, at the rate specified by the tick_rate_ms
 //  init parameter.
 void
 j1939_update(
     struct J1939* node);
 
+// Alternative to calling j1939_update() for each node of the default context,
+//  for applications that run several nodes on the same bus. The bus is read
+//  once, through the callbacks of the first node initialized, and each frame
+//  is offered to every node whose address and acceptance filter match it. The
+//  other nodes' can_rx callbacks are never called. Call this at the
+//  tick_rate_ms shared by all nodes.
+void
+j1939_update_all(void);
+
+// Same as j1939_update_all(), for the nodes of the given context
+void
+j1939_context_update(
+    struct J1939Context* ctx);
+
+// Timestamp-driven alternative to j1939_update(), for applications that
+//  sleep until the bus or a deadline wakes them rather than polling at a fixed
+//  tick. now_us is the current time in us, from a monotonic clock such as
+//  CLOCK_MONOTONIC. Call this whenever frames arrive and whenever the time
+//  returned by j1939_next_deadline() is reached; calling it more often is
+//  harmless. A node should be driven by either j1939_update() or this
+//  function, not both.
+void
+j1939_update_at(
+    struct J1939* node,
+    uint64_t now_us);
+
+// Return the time (us, same clock as j1939_update_at()) by which
+//  j1939_update_at() must next be called: when the next transport protocol
+//  packet or CTS is due, when a transport protocol timeout (Tr, Th, T1-T4)
+//  expires, or when a wait of the address claim is over. A result at or
+//  before the current time means an update is due now. Return
+//  J1939_NO_DEADLINE if nothing is pending, in which case the node only needs
+//  updating when a frame arrives or a message is sent.
+uint64_t
+j1939_next_deadline(
+    struct J1939* node);
+
+// Same as j1939_context_update(), for timestamp-driven applications
+void
+j1939_context_update_at(
+    struct J1939Context* ctx,
+    uint64_t now_us);
+
+// Return the earliest j1939_next_deadline() among the nodes of the context
+uint64_t
+j1939_context_next_deadline(
+    struct J1939Context* ctx);
+
+// Process frames that are already in memory owned by the caller, e.g. the
+//  slots of a driver's receive ring. No payload is copied, so the frames must
+//  stay valid (and unmodified) until this function returns; after that the
+//  caller may reuse them. This doesn't advance the transport protocol timers,
+//  so j1939_update() still needs to be called at tick_rate_ms.
+void
+j1939_process_frames(
+    struct J1939* node,
+    struct J1939CanFrame* frames,
+    int num_frames);
+
+// Hand a received frame to the node from another thread or an interrupt
+//  handler, without blocking. The frame is copied into a lock-free ring of
+//  J1939_FRAME_RING_SIZE frames, which j1939_update() drains before calling
+//  can_rx. There must be at most one thread pushing frames to a node. When
+//  using j1939_update_all(), push every frame to the first node initialized;
+//  the frames are then offered to all nodes.
+// Return false, and drop the frame, if the ring is full.
+bool
+j1939_push_frame(
+    struct J1939* node,
+    const struct J1939CanFrame* frame);
+
+// Return the number of frames dropped by j1939_push_frame() because the ring
+//  was full. May be called from any thread.
+uint32_t
+j1939_dropped_frames(
+    struct J1939* node);
+
+// Optionally register a batched receive callback. If set, j1939_update()
+//  fetches frames J1939_RX_BATCH_SIZE at a time through this callback instead
+//  of calling can_rx once per frame. Pass NULL to revert to can_rx.
+void
+j1939_set_can_rx_batch(
+    struct J1939* node,
+    J1939_CAN_RX_BATCH can_rx_batch);
+
+// Optionally register a batched transmit callback. If set, a P2P transport
+//  protocol sender without a gap between packets (see j1939_set_tp_timing())
+//  packs each CTS window into frames and sends them J1939_TX_BATCH_SIZE at a
+//  time through this callback, instead of calling can_tx once per packet.
+//  Pass NULL to revert to can_tx.
+void
+j1939_set_can_tx_batch(
+    struct J1939* node,
+    J1939_CAN_TX_BATCH can_tx_batch);
+
+// Set the sink that receives messages sent with the extended transport
+//  protocol (ETP), which carries P2P messages of more than 1785 bytes. Such
+//  messages are never buffered as a whole: each packet is passed to the sink
+//  as it arrives. Without a sink, ETP connections are refused. Pass NULL to
+//  remove the sink.
+void
+j1939_set_stream_sink(
+    struct J1939* node,
+    J1939_STREAM_SINK sink,
+    void* user_data);
+
+// Stream multi-packet messages of the given PGN to sink instead of
+//  reassembling them: each TP.DT packet is passed to the sink as it arrives,
+//  and the message is never passed to j1939_rx or a PGN handler. This needs
+//  no buffer from the pool, and lets the application work on the start of a
+//  message while the rest is still arriving. The sink also takes precedence
+//  over the one set with j1939_set_stream_sink() for messages of this PGN
+//  sent with the extended transport protocol. Single-frame messages of the
+//  PGN are delivered as usual. Pass NULL to stop streaming the PGN.
+// Return false if J1939_TP_STREAM_SINKS PGNs are already streamed.
+bool
+j1939_set_pgn_stream_sink(
+    struct J1939* node,
+    uint32_t pgn,
+    J1939_STREAM_SINK sink,
+    void* user_data);
+
+// Set the timing of the node's transport protocol connections, for
+//  connections opened afterwards. Every field defaults to J1939_TP_TX_PERIOD
+//  (50 ms).
+void
+j1939_set_tp_timing(
+    struct J1939* node,
+    const struct J1939TPTiming* timing);
+
+// Set the number of TP.DT packets the node asks for with each CTS when it
+//  receives a P2P multi-packet message (J1939_TP_CTS_WINDOW by default). A
+//  smaller window means a lost packet costs less to resend, at the price of
+//  more CTS messages. Zero is treated as one. Applies to connections opened
+//  afterwards.
+void
+j1939_set_tp_window(
+    struct J1939* node,
+    uint8_t packets);
+
+// Register a handler to receive every message with the given PGN, instead of
+//  passing it to the j1939_rx callback. Registering a PGN again replaces its
+//  handler and user_data. At most J1939_PGN_HANDLERS_MAX PGNs may be
+//  registered per node. Messages consumed by the library itself (transport
+//  protocol and address claim) are never passed to handlers.
+// Return false if the handler could not be registered.
+bool
+j1939_register_pgn_handler(
+    struct J1939* node,
+    uint32_t pgn,
+    J1939_PGN_HANDLER handler,
+    void* user_data);
+
+// Return false if no handler was registered for the given PGN
+bool
+j1939_unregister_pgn_handler(
+    struct J1939* node,
+    uint32_t pgn);
+
+// Only accept frames with the given PGN. Until this is first called, every
+//  PGN is accepted. Frames are filtered by their raw CAN ID before any
+//  decoding, so rejected traffic costs only a few bit tests. The PGNs used
+//  internally for the transport protocol and address claim are always
+//  accepted. Return false if the PGN is invalid.
+bool
+j1939_accept_pgn(
+    struct J1939* node,
+    uint32_t pgn);
+
+// Only accept frames from the given source address. Until this is first
+//  called, every source address is accepted. Sources are restricted on their
+//  own: every PGN from them is still accepted unless j1939_accept_pgn() is
+//  called too. Transport protocol and address claim frames are accepted from
+//  any source.
+void
+j1939_accept_source(
+    struct J1939* node,
+    uint8_t source_address);
+
+// Export the node's acceptance filter as (id, mask) pairs for a hardware or
+//  kernel filter, writing at most max_filters of them. Return the number of
+//  pairs the full filter needs; if this is larger than max_filters, call
+//  again with a larger array. Peer-to-peer frames for other destinations
+//  aren't excluded by the exported filter, since our address may change.
+// Every restricted source address multiplies the number of pairs needed.
+int
+j1939_export_filters(
+    struct J1939* node,
+    struct J1939CanIdFilter* filters,
+    int max_filters);
+
+// Write the statistics of up to max_stats size classes of the transport
+//  protocol buffer pool, which is shared by all nodes, smallest class first.
+//  Return the number of size classes. Use these to size the pool
+//  (J1939_POOL_*_BLOCKS) for the application's traffic.
+int
+j1939_pool_stats(
+    struct J1939PoolStats* stats,
+    int max_stats);
+
+// Copy the statistics of the node's multi-packet transmit queue into stats
+void
+j1939_tx_queue_stats(
+    struct J1939* node,
+    struct J1939TxQueueStats* stats);
+
 // Transmit a message on the bus, using the can_tx init parameter callback
-//  function. Return true if successful, false otherwise.
+//  function. Return true if successful, false otherwise, which includes while
+//  the node doesn't hold an address (see j1939_is_address_claimed()).
+// Messages longer than 8 bytes are sent with the transport protocol. They're
+//  queued until a connection can be opened (J1939_TP_TX_QUEUE_SIZE at most),
+//  highest priority first, so true only means the message was accepted.
 bool
 j1939_tx(
     struct J1939* node,
     struct J1939Msg* msg);
 
+// Send a message of the given PGN with the priority the PGN database gives
+//  it, or J1939_DEFAULT_PRIORITY if it isn't in the database. As with
+//  j1939_tx(), messages longer than 8 bytes are sent with the transport
+//  protocol. Return false if the database gives the PGN a fixed length that
+//  len doesn't match, or if j1939_tx() fails.
+bool
+j1939_tx_pgn(
+    struct J1939* node,
+    uint32_t pgn,
+    uint8_t* data,
+    uint16_t len,
+    uint8_t dst);
+
+// Same as j1939_tx(), but sent to the node with the given NAME, at whatever
+//  address it has claimed (see j1939_name_to_address()). msg->dst is set to
+//  that address. Return false if the NAME's address isn't known.
+bool
+j1939_tx_to_name(
+    struct J1939* node,
+    struct J1939Msg* msg,
+    const struct J1939Name* name);
+
+// Broadcast a Commanded Address message, telling the node with the given NAME
+//  to move to new_address. The node answers with an Address Claimed message
+//  from its new address. A node receiving a command for its own NAME closes
+//  its transport protocol connections, takes the address and claims it. Return
+//  false if new_address isn't a valid node address or the message couldn't be
+//  sent.
+bool
+j1939_tx_commanded_address(
+    struct J1939* node,
+    const struct J1939Name* name,
+    uint8_t new_address);
+
+// Same as j1939_tx(), but a multi-packet message isn't copied: its packets
+//  are read straight from msg->data, which must stay valid and unchanged until
+//  done is called. This saves copying the payload into a pool buffer, and
+//  lets several messages be queued without the library holding copies of
+//  them. If the message is accepted, done is called exactly once; for a
+//  single-frame message, before returning. If it isn't, done isn't called.
+bool
+j1939_tx_zero_copy(
+    struct J1939* node,
+    struct J1939Msg* msg,
+    J1939_TX_DONE done,
+    void* user_data);
+
+// Set a callback told how every multi-packet message the node sends ends,
+//  whether it was sent with j1939_tx(), j1939_tx_zero_copy() or
+//  j1939_tx_stream(). For zero-copy messages, it's called after the
+//  message's own callback. Pass NULL to remove it.
+void
+j1939_set_tx_done(
+    struct J1939* node,
+    J1939_TX_DONE done,
+    void* user_data);
+
+// Send a P2P message of size bytes, more than 1785 and at most 117,440,505,
+//  with the extended transport protocol. Its data is read through the source
+//  callback as it's sent, so it doesn't need to be in memory all at once.
+//  Unlike j1939_tx(), the message isn't queued: return false if no transport
+//  protocol TX session is free or a connection to dst is already open, or if
+//  the arguments are invalid.
+bool
+j1939_tx_stream(
+    struct J1939* node,
+    uint32_t pgn,
+    uint8_t dst,
+    uint8_t pri,
+    uint32_t size,
+    J1939_STREAM_SOURCE source,
+    void* user_data);
+
+// Same as j1939_tx(), but a multi-packet message is sent with the given
+//  timing instead of the node's (see j1939_set_tp_timing()). Only the
+//  bam_gap_ms and p2p_gap_ms fields apply.
+bool
+j1939_tx_timed(
+    struct J1939* node,
+    struct J1939Msg* msg,
+    const struct J1939TPTiming* timing);
+
+// Return true if the node holds its address, i.e. its address claim has
+//  completed and the application's messages are sent
+bool
+j1939_is_address_claimed(
+    struct J1939* node);
+
+// Copy the node's address claim state into snapshot: the address it holds
+//  and the NAMEs it has seen at the other addresses
+void
+j1939_get_address_snapshot(
+    struct J1939* node,
+    struct J1939AddressSnapshot* snapshot);
+
+// Restore a snapshot taken by a previous run of the same node, for a warm
+//  restart. Initialize the node with snapshot->address as its preferred
+//  address (unless it's J1939_ADDR_NULL), so that it comes back at the address
+//  it had, then restore the snapshot before the node is first updated. The
+//  NAMEs it holds are taken as still being at their addresses, which a new
+//  address is then never searched for at, until the bus says otherwise.
+//  Return false if the snapshot is of another version or another NAME.
+bool
+j1939_restore_address_snapshot(
+    struct J1939* node,
+    const struct J1939AddressSnapshot* snapshot);
+
+// Set a hook to be called whenever the node's address claim state changes,
+//  e.g. to save a snapshot of it. Pass NULL to remove it. If the node already
+//  holds its address, e.g. one outside the self-configurable range claimed
+//  within j1939_init(), the hook is called right away. Restore a snapshot
+//  before setting the hook, so that the first one saved includes it.
+void
+j1939_set_address_hook(
+    struct J1939* node,
+    J1939_ADDRESS_HOOK hook,
+    void* user_data);
+
+// Choose where the node looks for a new address when it loses its own.
+//  J1939_ADDRESS_POLICY_NEXT_FREE by default.
+void
+j1939_set_address_policy(
+    struct J1939* node,
+    enum j1939_address_policy policy);
+
+// Return the address claimed by the node with the given NAME, as last seen in
+//  an Address Claimed message on the bus, or J1939_ADDR_NULL if it isn't
+//  known. A node that claims a new address is found there from then on, and
+//  one that can't claim an address is forgotten. Listener-only nodes don't
+//  learn addresses.
+uint8_t
+j1939_name_to_address(
+    struct J1939* node,
+    const struct J1939Name* name);
+
+// Copy the NAME of the node that claimed the address into name. Return false
+//  if it isn't known.
+bool
+j1939_address_to_name(
+    struct J1939* node,
+    uint8_t address,
+    struct J1939Name* name);
+
+// Look a PGN up in the PGN database compiled into the library. Return NULL if
+//  it isn't there. The lookup is a binary search of a constant table, so it
+//  needs no initialization and may be called from any thread.
+const struct J1939PgnInfo*
+j1939_pgn_info(
+    uint32_t pgn);
+
 // Optional helper function for physical layer to derive CAN ID from J1939Msg
 uint32_t
 j1939_msg_to_can_id(
@@ -3,6 +3,21 @@
 
 #include <string.h>
 
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+#define BIT_TEST(map, bit)  (((map)[(bit) >> 5] >> ((bit) & 31)) & 1)
+#define BIT_SET(map, bit)  ((map)[(bit) >> 5] |= (1u << ((bit) & 31)))
+#define BIT_CLEAR(map, bit)  ((map)[(bit) >> 5] &= ~(1u << ((bit) & 31)))
+
+// The self-configurable address range
+#define SELF_CONFIGURABLE_FIRST  (128)
+#define SELF_CONFIGURABLE_LAST  (247)
+
 /* ============================================================================
  *
  * Section: Static function prototypes
@@ -14,10 +29,41 @@ static void
 clear_address_table(
     struct J1939AC* ac);
 
+static void
+claim_address(
+    struct J1939AC* ac);
+
 static void
 cannot_claim_address(
     struct J1939AC* ac);
 
+static void
+start_wait(
+    struct J1939AC* ac,
+    enum j1939_ac_state state,
+    uint32_t wait_us);
+
+static uint32_t
+random_delay_us(
+    struct J1939AC* ac);
+
+static void
+notify(
+    struct J1939AC* ac);
+
+static int
+find_free(
+    const uint32_t* table,
+    int first,
+    int last);
+
+static int
+find_free_after(
+    const uint32_t* table,
+    int first,
+    int last,
+    int current);
+
 /* ============================================================================
  *
  * Section: Function definitions
@@ -28,33 +74,85 @@ cannot_claim_address(
 void
 j1939_ac_init(
     struct J1939AC* ac,
-    int node_idx,
-    struct J1939Name* name,
-    J1939_AC_STARTUP_DELAY_250MS startup_delay,
-    void* startup_delay_param)
+    struct J1939* node,
+    struct J1939Name* name)
 {
-    uint8_t source_address = j1939_get_source_address(ac->node_idx);
-
-    ac->node_idx = node_idx;
-    ac->cannot_claim_address = false;
+    ac->node = node;
+    ac->policy = J1939_ADDRESS_POLICY_NEXT_FREE;
+    ac->hook = NULL;
+    ac->hook_data = NULL;
     memcpy(&ac->name, name, sizeof(struct J1939Name));
 
+    // NAMEs often differ in a few low bits only, so they're scrambled with a
+    //  Fibonacci hash first. xorshift needs a non-zero seed.
+    uint64_t name_value;
+    memcpy(&name_value, name, sizeof(uint64_t));
+    ac->random_state = (uint32_t)((name_value * 0x9E3779B97F4A7C15ull) >> 32);
+    if (ac->random_state == 0)
+        ac->random_state = 1;
+
     clear_address_table(ac);
+    j1939_name_table_init(&ac->names);
 
-    // Send address claimed message
-    j1939_tx_helper(
-        ac->node_idx,
-        J1939_ADDRESS_CLAIMED_PGN,
-        (uint8_t*)&ac->name,
-        J1939_ADDRESS_CLAIMED_LEN,
-        J1939_ADDR_GLOBAL,
-        J1939_ADDRESS_CLAIMED_PRI);
-
-    // On startup, nodes claiming addresses in the range 0-127 or 248-253 may
-    //  begin their regular network activities immediately. Nodes claiming
-    //  other addresses should wait 250ms to begin.
-    if ((source_address > 127) && (source_address < 248))
-        startup_delay(startup_delay_param);
+    claim_address(ac);
+}
+
+void
+j1939_ac_update(
+    struct J1939AC* ac,
+    uint64_t now_us)
+{
+    if ((ac->state == J1939_AC_STATE_CLAIMED) ||
+        (ac->state == J1939_AC_STATE_CANNOT_CLAIM))
+    {
+        return;
+    }
+
+    if (ac->wait_stamp_us == J1939_AC_UNSTAMPED)
+        ac->wait_stamp_us = now_us;
+
+    if (now_us < ac->wait_stamp_us + ac->wait_us)
+        return;
+
+    switch (ac->state)
+    {
+    case J1939_AC_STATE_CLAIMING:
+        ac->state = J1939_AC_STATE_CLAIMED;
+        notify(ac);
+        break;
+    case J1939_AC_STATE_CLAIM_BACKOFF:
+        claim_address(ac);
+        break;
+    case J1939_AC_STATE_CANNOT_CLAIM_BACKOFF:
+        cannot_claim_address(ac);
+        break;
+    default:
+        break;
+    }
+}
+
+uint64_t
+j1939_ac_next_deadline(
+    struct J1939AC* ac)
+{
+    if ((ac->state == J1939_AC_STATE_CLAIMED) ||
+        (ac->state == J1939_AC_STATE_CANNOT_CLAIM))
+    {
+        return J1939_NO_DEADLINE;
+    }
+
+    // The wait starts at the next update
+    if (ac->wait_stamp_us == J1939_AC_UNSTAMPED)
+        return 0;
+
+    return ac->wait_stamp_us + ac->wait_us;
+}
+
+bool
+j1939_ac_has_address(
+    const struct J1939AC* ac)
+{
+    return ac->state == J1939_AC_STATE_CLAIMED;
 }
 
 bool
@@ -64,23 +162,68 @@ j1939_ac_update_address(
     if (ac->addresses_available == 0)
         return false;
 
-    uint8_t source_address = j1939_get_source_address(ac->node_idx);
-    uint8_t new_address;
+    uint8_t source_address = j1939_get_source_address(ac->node);
+    int new_address = -1;
 
-    for (int i = 1; i <= (J1939_AC_MAX_ADDRESSES - 1); ++i)
+    if (ac->policy == J1939_ADDRESS_POLICY_SELF_CONFIGURABLE)
     {
-        new_address = (source_address + i) % J1939_AC_MAX_ADDRESSES;
+        new_address = find_free_after(
+            ac->address_table,
+            SELF_CONFIGURABLE_FIRST,
+            SELF_CONFIGURABLE_LAST,
+            source_address);
+    }
 
-        if (ac->address_table[new_address] == 0)
-        {
-            j1939_set_source_address(ac->node_idx, new_address);
-            return true;
-        }
+    if (new_address < 0)
+    {
+        new_address = find_free_after(
+            ac->address_table,
+            0,
+            J1939_AC_MAX_ADDRESSES - 1,
+            source_address);
+    }
+
+    if (new_address < 0)
+    {
+        // This shouldn't happen but just in case
+        ac->addresses_available = 0;
+        return false;
     }
 
-    // This shouldn't happen but just in case
-    ac->addresses_available = 0;
-    return false;
+    j1939_set_source_address(ac->node, new_address);
+    return true;
+}
+
+bool
+j1939_ac_is_address_taken(
+    const struct J1939AC* ac,
+    uint8_t address)
+{
+    return BIT_TEST(ac->address_table, address);
+}
+
+void
+j1939_ac_mark_address(
+    struct J1939AC* ac,
+    uint8_t address,
+    bool taken)
+{
+    if ((address >= J1939_AC_MAX_ADDRESSES) ||
+        (j1939_ac_is_address_taken(ac, address) == taken))
+    {
+        return;
+    }
+
+    if (taken)
+    {
+        BIT_SET(ac->address_table, address);
+        ac->addresses_available--;
+    }
+    else
+    {
+        BIT_CLEAR(ac->address_table, address);
+        ac->addresses_available++;
+    }
 }
 
 void
@@ -88,58 +231,202 @@ j1939_ac_rx_address_claim(
     struct J1939AC* ac,
     struct J1939Msg* msg)
 {
-    uint8_t source_address = j1939_get_source_address(ac->node_idx);
-    struct J1939Name* received_name = (struct J1939Name*)msg->data;
+    uint8_t source_address = j1939_get_source_address(ac->node);
+
+    // Compare NAMEs as 64-bit integers; memcpy avoids type punning
+    uint64_t received_value;
+    uint64_t our_value;
+    memcpy(&received_value, msg->data, sizeof(uint64_t));
+    memcpy(&our_value, &ac->name, sizeof(uint64_t));
 
     // If there's an address contention, check the NAME of the other node.
     // If our NAME if higher priority (lower value), we keep our address.
     // Otherwise, attempt to claim another address.
-    if (msg->src == source_address)
+    if ((msg->src == source_address) && (source_address < J1939_AC_MAX_ADDRESSES))
     {
-        if (*((uint64_t*)received_name) < *((uint64_t*)&ac->name))
+        if (received_value < our_value)
         {
-            j1939_close_transport_protocol_connection(ac->node_idx);
+            j1939_close_transport_protocol_sessions(ac->node);
 
-            if (!j1939_ac_update_address(ac))
+            // Nodes that lose the same address at once would all pick the
+            //  same next one, so each claims it after a random delay
+            if (j1939_ac_update_address(ac))
+            {
+                start_wait(ac, J1939_AC_STATE_CLAIM_BACKOFF, random_delay_us(ac));
+            }
+            else
             {
-                cannot_claim_address(ac);
+                j1939_set_source_address(ac->node, J1939_ADDR_NULL);
+                start_wait(ac, J1939_AC_STATE_CANNOT_CLAIM_BACKOFF, random_delay_us(ac));
                 return;
             }
         }
+        else
+        {
+            if (ac->state == J1939_AC_STATE_CLAIM_BACKOFF)
+            {
+                // The address we were about to claim is ours to keep
+                claim_address(ac);
+            }
+            else
+            {
+                // Send address claimed message
+                j1939_tx_claim_helper(
+                    ac->node,
+                    J1939_ADDRESS_CLAIMED_PGN,
+                    (uint8_t*)&ac->name,
+                    J1939_ADDRESS_CLAIMED_LEN,
+                    J1939_ADDR_GLOBAL,
+                    J1939_ADDRESS_CLAIMED_PRI);
+            }
 
+            // The other node doesn't get the address, so it isn't recorded
+            //  there; its next claim or Cannot Claim says where it went
+            return;
+        }
+    }
+
+    bool moved = (j1939_name_table_address(&ac->names, received_value) != msg->src);
+
+    // A node that moves (or can't claim an address at all) leaves its old
+    //  address free
+    uint8_t previous = (msg->src < J1939_AC_MAX_ADDRESSES) ?
+        j1939_name_table_claim(&ac->names, msg->src, received_value) :
+        j1939_name_table_remove(&ac->names, received_value);
+
+    if ((previous != J1939_ADDR_NULL) && (previous != j1939_get_source_address(ac->node)))
+        j1939_ac_mark_address(ac, previous, false);
+
+    j1939_ac_mark_address(ac, msg->src, true);
+
+    if (moved)
+        notify(ac);
+}
+
+void
+j1939_ac_rx_address_claim_request(
+    struct J1939AC* ac)
+{
+    // Each node in the network should respond to the request for address claim.
+    // This allows us to update our address table. The NAMEs are forgotten
+    //  along with their addresses, so that a node that doesn't answer isn't
+    //  found at an address that may be handed out again.
+    clear_address_table(ac);
+    j1939_name_table_init(&ac->names);
+
+    switch (ac->state)
+    {
+    case J1939_AC_STATE_CLAIMED:
+    case J1939_AC_STATE_CLAIMING:
         // Send address claimed message
-        j1939_tx_helper(
-            ac->node_idx,
+        j1939_tx_claim_helper(
+            ac->node,
             J1939_ADDRESS_CLAIMED_PGN,
             (uint8_t*)&ac->name,
             J1939_ADDRESS_CLAIMED_LEN,
             J1939_ADDR_GLOBAL,
             J1939_ADDRESS_CLAIMED_PRI);
+        break;
+    case J1939_AC_STATE_CANNOT_CLAIM:
+        // Every node without an address answers from the null address, so
+        //  the answers are spread out by a random delay
+        start_wait(ac, J1939_AC_STATE_CANNOT_CLAIM_BACKOFF, random_delay_us(ac));
+        break;
+    default:
+        // The message about to be sent answers the request
+        break;
     }
+}
 
-    if (msg->src < 254)
+void
+j1939_ac_snapshot(
+    const struct J1939AC* ac,
+    struct J1939AddressSnapshot* snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    snapshot->version = J1939_ADDRESS_SNAPSHOT_VERSION;
+    snapshot->name = ac->name;
+    snapshot->address = j1939_ac_has_address(ac) ?
+        j1939_get_source_address(ac->node) :
+        J1939_ADDR_NULL;
+
+    for (int address = 0; address < J1939_AC_MAX_ADDRESSES; ++address)
     {
-        ac->address_table[msg->src] = 1;
-        ac->addresses_available--;
+        uint64_t name;
+
+        if (j1939_name_table_name(&ac->names, address, &name))
+        {
+            memcpy(&snapshot->names[address], &name, sizeof(name));
+            BIT_SET(snapshot->known, address);
+        }
+    }
+}
+
+bool
+j1939_ac_restore(
+    struct J1939AC* ac,
+    const struct J1939AddressSnapshot* snapshot)
+{
+    if ((snapshot->version != J1939_ADDRESS_SNAPSHOT_VERSION) ||
+        (memcmp(&snapshot->name, &ac->name, sizeof(struct J1939Name)) != 0))
+    {
+        return false;
+    }
+
+    uint8_t source_address = j1939_get_source_address(ac->node);
+    uint64_t unused;
+
+    for (int address = 0; address < J1939_AC_MAX_ADDRESSES; ++address)
+    {
+        uint64_t name;
+        memcpy(&name, &snapshot->names[address], sizeof(name));
+
+        // What's been heard on the bus since is more recent
+        if (!BIT_TEST(snapshot->known, address) ||
+            (address == source_address) ||
+            (memcmp(&snapshot->names[address], &ac->name, sizeof(struct J1939Name)) == 0) ||
+            j1939_name_table_name(&ac->names, address, &unused) ||
+            (j1939_name_table_address(&ac->names, name) != J1939_ADDR_NULL))
+        {
+            continue;
+        }
+
+        j1939_name_table_claim(&ac->names, address, name);
+        j1939_ac_mark_address(ac, address, true);
     }
+
+    return true;
 }
 
 void
-j1939_ac_rx_address_claim_request(
-    struct J1939AC* ac)
+j1939_ac_rx_commanded_address(
+    struct J1939AC* ac,
+    struct J1939Msg* msg)
 {
-    // Each node in the network should respond to the request for address claim.
-    // This allows us to update our address table.
-    clear_address_table(ac);
+    // Commands for other nodes are left to them; they'll announce their new
+    //  address with an Address Claimed message of their own
+    if ((msg->len < J1939_COMMANDED_ADDRESS_LEN) ||
+        (memcmp(msg->data, &ac->name, sizeof(struct J1939Name)) != 0))
+    {
+        return;
+    }
+
+    // Read before the sessions are closed, since the message may be in the
+    //  buffer of the session it arrived in
+    uint8_t new_address = ((struct J1939_COMMANDED_ADDRESS*)msg->data)->new_source_address;
+
+    if (new_address >= J1939_AC_MAX_ADDRESSES)
+        return;
 
-    // Send address claimed message
-    j1939_tx_helper(
-        ac->node_idx,
-        J1939_ADDRESS_CLAIMED_PGN,
-        (uint8_t*)&ac->name,
-        J1939_ADDRESS_CLAIMED_LEN,
-        J1939_ADDR_GLOBAL,
-        J1939_ADDRESS_CLAIMED_PRI);
+    // Connections made at our old address can't carry on at the new one
+    j1939_close_transport_protocol_sessions(ac->node);
+
+    j1939_ac_mark_address(ac, j1939_get_source_address(ac->node), false);
+    j1939_set_source_address(ac->node, new_address);
+    j1939_ac_mark_address(ac, new_address, true);
+
+    claim_address(ac);
 }
 
 /* ============================================================================
@@ -153,14 +440,90 @@ static void
 clear_address_table(
     struct J1939AC* ac)
 {
-    uint8_t source_address = j1939_get_source_address(ac->node_idx);
+    uint8_t source_address = j1939_get_source_address(ac->node);
 
     memset(ac->address_table, 0, sizeof(ac->address_table));
+    ac->addresses_available = J1939_AC_MAX_ADDRESSES;
+
+    j1939_ac_mark_address(ac, source_address, true);
+}
+
+// Return the lowest free address in [first, last], or -1 if there's none
+static int
+find_free(
+    const uint32_t* table,
+    int first,
+    int last)
+{
+    if (first > last)
+        return -1;
+
+    for (int word = first >> 5; word <= (last >> 5); ++word)
+    {
+        uint32_t free = ~table[word];
+
+        // Leave out the addresses outside the range
+        if (word == (first >> 5))
+            free &= ~0u << (first & 31);
+        if (word == (last >> 5))
+            free &= ~0u >> (31 - (last & 31));
+
+        if (free != 0)
+            return (word << 5) + __builtin_ctz(free);
+    }
+
+    return -1;
+}
+
+// Return the first free address in [first, last] after current, wrapping
+//  around from last to first, or -1 if there's none. current itself is only
+//  looked at last.
+static int
+find_free_after(
+    const uint32_t* table,
+    int first,
+    int last,
+    int current)
+{
+    if ((current < first) || (current > last))
+        return find_free(table, first, last);
+
+    int address = find_free(table, current + 1, last);
+
+    return (address >= 0) ? address : find_free(table, first, current);
+}
+
+// Send Address Claimed for the source address. Nodes claiming addresses in
+//  the range 0-127 or 248-253 may begin their regular network activities
+//  immediately; nodes claiming other addresses wait 250ms to begin.
+static void
+claim_address(
+    struct J1939AC* ac)
+{
+    uint8_t source_address = j1939_get_source_address(ac->node);
+
+    // A claim that can't be sent has most likely collided with another node's
+    //  frame; try again after a random delay
+    if (!j1939_tx_claim_helper(
+            ac->node,
+            J1939_ADDRESS_CLAIMED_PGN,
+            (uint8_t*)&ac->name,
+            J1939_ADDRESS_CLAIMED_LEN,
+            J1939_ADDR_GLOBAL,
+            J1939_ADDRESS_CLAIMED_PRI))
+    {
+        start_wait(ac, J1939_AC_STATE_CLAIM_BACKOFF, random_delay_us(ac));
+        return;
+    }
 
-    if (source_address < J1939_AC_MAX_ADDRESSES)
+    if ((source_address > 127) && (source_address < 248))
+    {
+        start_wait(ac, J1939_AC_STATE_CLAIMING, J1939_AC_CLAIM_WAIT_US);
+    }
+    else
     {
-        ac->address_table[source_address] = 1;
-        ac->addresses_available = J1939_AC_MAX_ADDRESSES - 1;
+        ac->state = J1939_AC_STATE_CLAIMED;
+        notify(ac);
     }
 }
 
@@ -168,15 +531,56 @@ static void
 cannot_claim_address(
     struct J1939AC* ac)
 {
-    j1939_set_source_address(ac->node_idx, J1939_ADDR_NULL);
+    j1939_set_source_address(ac->node, J1939_ADDR_NULL);
+
+    if (!j1939_tx_claim_helper(
+            ac->node,
+            J1939_CANNOT_CLAIM_ADDRESS_PGN,
+            (uint8_t*)&ac->name,
+            J1939_CANNOT_CLAIM_ADDRESS_LEN,
+            J1939_ADDR_GLOBAL,
+            J1939_CANNOT_CLAIM_ADDRESS_PRI))
+    {
+        start_wait(ac, J1939_AC_STATE_CANNOT_CLAIM_BACKOFF, random_delay_us(ac));
+        return;
+    }
 
-    j1939_tx_helper(
-        ac->node_idx,
-        J1939_CANNOT_CLAIM_ADDRESS_PGN,
-        (uint8_t*)&ac->name,
-        J1939_CANNOT_CLAIM_ADDRESS_LEN,
-        J1939_ADDR_GLOBAL,
-        J1939_CANNOT_CLAIM_ADDRESS_PRI);
+    ac->state = J1939_AC_STATE_CANNOT_CLAIM;
+    notify(ac);
+}
 
-    ac->cannot_claim_address = true;
+// Enter a waiting state; the wait starts at the next update
+static void
+start_wait(
+    struct J1939AC* ac,
+    enum j1939_ac_state state,
+    uint32_t wait_us)
+{
+    ac->state = state;
+    ac->wait_stamp_us = J1939_AC_UNSTAMPED;
+    ac->wait_us = wait_us;
+}
+
+// J1939-81's pseudo-random delay: 0.6 ms times a number from 0 to 255, i.e.
+//  0 - 153 ms
+static uint32_t
+random_delay_us(
+    struct J1939AC* ac)
+{
+    // xorshift32
+    uint32_t x = ac->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ac->random_state = x;
+
+    return (x >> 24) * 600;
+}
+
+static void
+notify(
+    struct J1939AC* ac)
+{
+    if (ac->hook != NULL)
+        ac->hook(ac->hook_data, ac->node);
 }
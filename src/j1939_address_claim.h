@@ -17,6 +17,7 @@
  */
 
 #include "j1939.h"
+#include "j1939_name_table.h"
 
 #include <stdbool.h>
 
@@ -30,6 +31,13 @@
 // Number of valid node addresses (0 - 253)
 #define J1939_AC_MAX_ADDRESSES  (254)
 
+// How long (us) a node claiming an address in the self-configurable range
+//  (128 - 247) waits for contention before using it
+#define J1939_AC_CLAIM_WAIT_US  (250000)
+
+// Set as the start of a wait until the next update stamps it
+#define J1939_AC_UNSTAMPED  (UINT64_MAX)
+
 /* ============================================================================
  *
  * Section: Type definitions
@@ -47,7 +55,8 @@ typedef J1939_ADDRESS_CLAIMED J1939_CANNOT_CLAIM_ADDRESS;
 #define J1939_CANNOT_CLAIM_ADDRESS_LEN  (J1939_ADDRESS_CLAIMED_LEN)
 #define J1939_CANNOT_CLAIM_ADDRESS_PRI  (J1939_ADDRESS_CLAIMED_PRI)
 
-// TODO: This is used to instruct a node with a given NAME to assume an address
+// Instructs the node with the given NAME to take a new address. At 9 bytes,
+//  it's sent with the transport protocol, usually as a broadcast (BAM).
 struct __attribute__((packed)) J1939_COMMANDED_ADDRESS {
     struct J1939Name name;
     uint8_t new_source_address;
@@ -56,23 +65,64 @@ struct __attribute__((packed)) J1939_COMMANDED_ADDRESS {
 #define J1939_COMMANDED_ADDRESS_LEN  (9)
 #define J1939_COMMANDED_ADDRESS_PRI  (6)
 
+// Where a node is in claiming its address. Only a node in the claimed state
+//  sends anything other than the address claim's own messages.
+enum j1939_ac_state {
+    // The address is ours
+    J1939_AC_STATE_CLAIMED = 0,
+
+    // Address Claimed was sent for an address in the self-configurable range,
+    //  which is ours once J1939_AC_CLAIM_WAIT_US pass without contention
+    J1939_AC_STATE_CLAIMING,
+
+    // Waiting a random delay before claiming the source address, after losing
+    //  the previous one or failing to send the claim
+    J1939_AC_STATE_CLAIM_BACKOFF,
+
+    // Waiting a random delay before sending Cannot Claim Address
+    J1939_AC_STATE_CANNOT_CLAIM_BACKOFF,
+
+    // No address could be claimed; the source address is J1939_ADDR_NULL
+    J1939_AC_STATE_CANNOT_CLAIM
+};
+
 struct J1939AC {
-    // Used for indexing into the global J1939Private array
-    int node_idx;
+    // The node this state belongs to, used for reaching the node's context
+    struct J1939* node;
 
     // The NAME uniquely identifies a node and is used in arbitrating address
     //  contentions.
     struct J1939Name name;
 
-    // Keeps a record of which addresses are available.
-    // Each index into the table represents a valid node address (0 - 253).
-    // If an address is available, the table value at the index will be zero.
-    int address_table[J1939_AC_MAX_ADDRESSES];
+    // Keeps a record of which addresses are taken, one bit per address; only
+    //  the bits of valid node addresses (0 - 253) are used. A free address is
+    //  found by counting the trailing zeros of a word's complement, so a
+    //  search looks at 8 words at most.
+    uint32_t address_table[256 / 32];
 
     // Keeps track of the number of available slots in the address table
     int addresses_available;
 
-    bool cannot_claim_address;
+    // NAMEs of the nodes that have claimed addresses
+    struct J1939NameTable names;
+
+    enum j1939_ac_state state;
+
+    // The current wait, in the time of j1939_ac_update(): when it started (or
+    //  J1939_AC_UNSTAMPED), and how long it lasts
+    uint64_t wait_stamp_us;
+    uint32_t wait_us;
+
+    // State of the pseudo-random generator for backoff delays, seeded with
+    //  the NAME so that nodes powering up together wait different times
+    uint32_t random_state;
+
+    // Order in which a new address is searched for after losing ours
+    enum j1939_address_policy policy;
+
+    // Called when the state changes in a way worth persisting
+    J1939_ADDRESS_HOOK hook;
+    void* hook_data;
 };
 
 /* ============================================================================
@@ -85,16 +135,44 @@ struct J1939AC {
 void
 j1939_ac_init(
     struct J1939AC* ac,
-    int node_idx,
-    struct J1939Name* name,
-    J1939_AC_STARTUP_DELAY_250MS startup_delay,
-    void* startup_delay_param);
+    struct J1939* node,
+    struct J1939Name* name);
+
+// Run the claim procedure at the time now_us (any monotonic clock): start a
+//  wait set since the last update, and act on the one that's over
+void
+j1939_ac_update(
+    struct J1939AC* ac,
+    uint64_t now_us);
+
+// Return the time by which j1939_ac_update() must next be called, or
+//  J1939_NO_DEADLINE if the procedure isn't waiting for anything
+uint64_t
+j1939_ac_next_deadline(
+    struct J1939AC* ac);
+
+// Return true if the node holds its address and may send
+bool
+j1939_ac_has_address(
+    const struct J1939AC* ac);
 
 // Return true if a new address is claimed; false otherwise.
 bool
 j1939_ac_update_address(
     struct J1939AC* ac);
 
+bool
+j1939_ac_is_address_taken(
+    const struct J1939AC* ac,
+    uint8_t address);
+
+// Mark a valid address as taken or free, keeping addresses_available in step
+void
+j1939_ac_mark_address(
+    struct J1939AC* ac,
+    uint8_t address,
+    bool taken);
+
 void
 j1939_ac_rx_address_claim(
     struct J1939AC* ac,
@@ -103,3 +181,21 @@ j1939_ac_rx_address_claim(
 void
 j1939_ac_rx_address_claim_request(
     struct J1939AC* ac);
+
+void
+j1939_ac_snapshot(
+    const struct J1939AC* ac,
+    struct J1939AddressSnapshot* snapshot);
+
+// Take in the NAMEs of a snapshot of our own, except where the bus has
+//  already told us otherwise. Return false if the snapshot isn't ours.
+bool
+j1939_ac_restore(
+    struct J1939AC* ac,
+    const struct J1939AddressSnapshot* snapshot);
+
+// Take the commanded address if the command is for our NAME, and claim it
+void
+j1939_ac_rx_commanded_address(
+    struct J1939AC* ac,
+    struct J1939Msg* msg);
@@ -23,6 +23,25 @@
 
 #define J1939_DEFAULT_PRIORITY  (6)
 
+// Returned by j1939_next_deadline() when nothing is scheduled
+#define J1939_NO_DEADLINE  (UINT64_MAX)
+
+// Used for aligning state that may be accessed from different threads
+#ifndef J1939_CACHE_LINE_SIZE
+#define J1939_CACHE_LINE_SIZE  (64)
+#endif
+
+// Maximum number of frames requested from the J1939_CAN_RX_BATCH callback
+//  per call
+#ifndef J1939_RX_BATCH_SIZE
+#define J1939_RX_BATCH_SIZE  (32)
+#endif
+
+// Maximum number of frames passed to the J1939_CAN_TX_BATCH callback per call
+#ifndef J1939_TX_BATCH_SIZE
+#define J1939_TX_BATCH_SIZE  (32)
+#endif
+
 /* ============================================================================
  *
  * Section: Type definitions
@@ -0,0 +1,468 @@
+#include "j1939_extended_transport_protocol.h"
+#include "j1939_transport_protocol_helper.h"
+#include "j1939_private.h"
+#include "j1939_pgn_db.h"
+
+#include <string.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+// Find the ceiling of the result of a / b, where a and b are positive integers
+#define CEIL_DIV(a, b)  ( ((a) / (b)) + (((a) % (b)) != 0) )
+
+_Static_assert(
+    (sizeof(struct J1939_ETP_CM_RTS) == J1939_ETP_CM_LEN) &&
+        (sizeof(struct J1939_ETP_CM_CTS) == J1939_ETP_CM_LEN) &&
+        (sizeof(struct J1939_ETP_CM_DPO) == J1939_ETP_CM_LEN) &&
+        (sizeof(struct J1939_ETP_CM_EOMA) == J1939_ETP_CM_LEN),
+    "ETP.CM messages must be packed into 8 bytes");
+
+/* ============================================================================
+ *
+ * Section: Static function prototypes
+ *
+ * ============================================================================
+ */
+
+static void
+update_sender(
+    struct J1939TPSession* session);
+
+static void
+update_receiver(
+    struct J1939TPSession* session);
+
+static uint32_t
+num_packets(
+    struct J1939TPSession* session);
+
+static bool
+is_complete(
+    struct J1939TPSession* session);
+
+static void
+abort_connection(
+    struct J1939TPSession* session,
+    enum j1939_tp_abort_reason reason);
+
+static bool
+send_cm(
+    struct J1939TPSession* session,
+    void* cm);
+
+/* ============================================================================
+ *
+ * Section: Function definitions
+ *
+ * ============================================================================
+ */
+
+/* ============================================================================
+ * Subsection: Sender/receiver functions
+ * ============================================================================
+ */
+
+void
+j1939_etp_update(
+    struct J1939TPSession* session)
+{
+    if (session->sender)
+        update_sender(session);
+    else
+        update_receiver(session);
+}
+
+int
+j1939_etp_next_event_ms(
+    struct J1939TPSession* session)
+{
+    // Mirrors the checks made by update_sender() and update_receiver()
+    if (session->sender)
+    {
+        if (session->clear_to_send)
+            return session->etp.dpo ? 0 : session->timing.p2p_gap_ms;
+
+        return (session->etp.window_last == 0) ? J1939_TP_TIMEOUT_TR : J1939_TP_TIMEOUT_T3;
+    }
+
+    if (!session->clear_to_send)
+        return session->timing.cts_delay_ms;
+
+    if (is_complete(session))
+        return 0;
+
+    if (session->retries < J1939_TP_MAX_RETRIES)
+        return J1939_TP_TIMEOUT_TR;
+
+    return session->etp.dpo ? J1939_TP_TIMEOUT_T1 : J1939_TP_TIMEOUT_T2;
+}
+
+void
+j1939_etp_rx_abort(
+    struct J1939TPSession* session,
+    struct J1939_TP_CM_ABORT* abort)
+{
+    if (abort->pgn != session->msg_info.pgn)
+        return;
+
+    if (session->sender)
+        session->status = J1939_TX_ABORTED;
+
+    session->abort_reason = abort->abort_reason;
+    j1939_tp_close_session(session);
+}
+
+/* ============================================================================
+ * Subsection: Sender functions
+ * ============================================================================
+ */
+
+bool
+j1939_etp_start(
+    struct J1939TPSession* session,
+    uint32_t size,
+    J1939_STREAM_SOURCE source,
+    void* source_data)
+{
+    session->etp.size = size;
+    session->etp.next_packet = 1;
+    session->etp.window_last = 0;
+    session->etp.dpo_offset = 0;
+    session->etp.dpo = false;
+    session->etp.source = source;
+    session->etp.source_data = source_data;
+    session->clear_to_send = false;
+    session->status = J1939_TX_CANCELLED;
+    session->abort_reason = J1939_TP_ABORT_REASON_OTHER;
+    j1939_tp_restart_timer(session);
+
+    struct J1939_ETP_CM_RTS rts = {
+        .control_byte = J1939_ETP_CM_CONTROL_BYTE_RTS,
+        .size = size,
+        .pgn = session->msg_info.pgn
+    };
+    return send_cm(session, &rts);
+}
+
+void
+j1939_etp_rx_cts(
+    struct J1939TPSession* session,
+    struct J1939_ETP_CM_CTS* cts)
+{
+    // As for TP, a CTS holding the connection open (zero packets) isn't
+    //  supported and is ignored, as is one asking for packets we don't have
+    uint32_t next_packet = cts->next_packet;
+
+    if ((cts->pgn != session->msg_info.pgn) ||
+        (cts->num_packages == 0) ||
+        (next_packet == 0) ||
+        (next_packet > num_packets(session)))
+    {
+        return;
+    }
+
+    uint32_t last = next_packet + cts->num_packages - 1;
+    if (last > num_packets(session))
+        last = num_packets(session);
+
+    session->etp.next_packet = next_packet;
+    session->etp.window_last = last;
+    session->etp.dpo = true;
+    session->clear_to_send = true;
+}
+
+void
+j1939_etp_rx_eoma(
+    struct J1939TPSession* session,
+    struct J1939_ETP_CM_EOMA* eoma)
+{
+    if ((eoma->pgn == session->msg_info.pgn) && is_complete(session))
+    {
+        session->status = J1939_TX_SENT;
+        j1939_tp_close_session(session);
+    }
+}
+
+/* ============================================================================
+ * Subsection: Receiver functions
+ * ============================================================================
+ */
+
+bool
+j1939_etp_rx_rts(
+    struct J1939TPSession* session,
+    struct J1939_ETP_CM_RTS* rts,
+    uint8_t msg_src)
+{
+    session->connection = J1939_TP_CONNECTION_ETP;
+    session->sender = false;
+
+    session->msg_info.pgn = rts->pgn;
+    session->msg_info.data = NULL;
+    session->msg_info.len = 0;
+    session->msg_info.src = msg_src;
+    session->msg_info.dst = j1939_get_source_address(session->tp->node);
+    session->msg_info.pri = j1939_pgn_db_priority(rts->pgn);
+
+    session->etp.size = rts->size;
+    session->etp.next_packet = 1;
+    session->etp.window_last = 0;
+    session->etp.dpo_offset = 0;
+    session->etp.dpo = false;
+    session->complete = false;
+    session->abort_reason = J1939_TP_ABORT_REASON_OTHER;
+
+    session->window_size = session->tp->window_size;
+    session->retries = 0;
+
+    // CTS message will be sent in update loop
+    session->clear_to_send = false;
+    j1939_tp_restart_timer(session);
+
+    return j1939_tp_stream_event(session, J1939_STREAM_BEGIN, 0, NULL, 0);
+}
+
+void
+j1939_etp_rx_dpo(
+    struct J1939TPSession* session,
+    struct J1939_ETP_CM_DPO* dpo)
+{
+    // The DPO must announce the window asked for by our last CTS
+    if ((dpo->pgn != session->msg_info.pgn) ||
+        !session->clear_to_send ||
+        ((uint32_t)dpo->offset + 1 != session->etp.next_packet))
+    {
+        return;
+    }
+
+    session->etp.dpo_offset = dpo->offset;
+    session->etp.dpo = true;
+    j1939_tp_restart_timer(session);
+}
+
+bool
+j1939_etp_rx_dt(
+    struct J1939TPSession* session,
+    struct J1939_TP_DT* dt)
+{
+    if (!session->etp.dpo)
+        return false;
+
+    // Packets are passed to the sink as they arrive, so they have to arrive in
+    //  order. A packet that doesn't is dropped, along with the rest of the
+    //  window, and asked for again.
+    uint32_t packet = session->etp.dpo_offset + dt->seq;
+
+    if ((packet != session->etp.next_packet) || (packet > session->etp.window_last))
+        return false;
+
+    uint32_t offset = (packet - 1) * 7;
+    uint16_t len = ((session->etp.size - offset) < 7) ? (session->etp.size - offset) : 7;
+
+    if (!j1939_tp_stream_event(session, J1939_STREAM_DATA, offset, &dt->data0, len))
+    {
+        abort_connection(session, J1939_TP_ABORT_REASON_RESOURCES);
+        return false;
+    }
+
+    session->etp.next_packet++;
+    session->retries = 0;
+
+    // Once the window is done, ask for the next one
+    if ((packet == session->etp.window_last) && !is_complete(session))
+        session->clear_to_send = false;
+
+    return true;
+}
+
+/* ============================================================================
+ *
+ * Section: Static function definitions
+ *
+ * ============================================================================
+ */
+
+static void
+update_sender(
+    struct J1939TPSession* session)
+{
+    if (!session->clear_to_send)
+    {
+        // Before the first CTS, the receiver must respond within Tr
+        int timeout_ms = (session->etp.window_last == 0) ?
+            J1939_TP_TIMEOUT_TR : J1939_TP_TIMEOUT_T3;
+
+        if (session->timer_ms >= timeout_ms)
+            abort_connection(session, J1939_TP_ABORT_REASON_TIMEOUT);
+
+        return;
+    }
+
+    if (session->etp.dpo)
+    {
+        struct J1939_ETP_CM_DPO dpo = {
+            .control_byte = J1939_ETP_CM_CONTROL_BYTE_DPO,
+            .num_packages = session->etp.window_last - session->etp.next_packet + 1,
+            .offset = session->etp.next_packet - 1,
+            .pgn = session->msg_info.pgn
+        };
+        if (!send_cm(session, &dpo))
+        {
+            abort_connection(session, J1939_TP_ABORT_REASON_OTHER);
+            return;
+        }
+
+        session->etp.dpo_offset = session->etp.next_packet - 1;
+        session->etp.dpo = false;
+        j1939_tp_restart_timer(session);
+    }
+
+    // Without a gap, the whole window goes out in this update
+    bool burst = (session->timing.p2p_gap_ms == 0);
+
+    while (session->clear_to_send &&
+           (burst || (session->timer_ms >= session->timing.p2p_gap_ms)))
+    {
+        uint32_t packet = session->etp.next_packet;
+        uint32_t offset = (packet - 1) * 7;
+        uint16_t len = ((session->etp.size - offset) < 7) ? (session->etp.size - offset) : 7;
+
+        struct J1939_TP_DT dt;
+        memset(&dt, 0xFF, sizeof(dt));
+        dt.seq = packet - session->etp.dpo_offset;
+
+        if (!session->etp.source(session->etp.source_data, offset, &dt.data0, len))
+        {
+            abort_connection(session, J1939_TP_ABORT_REASON_OTHER);
+            return;
+        }
+
+        if (!j1939_tx_helper(
+                session->tp->node,
+                J1939_ETP_DT_PGN,
+                (uint8_t*)&dt,
+                J1939_ETP_DT_LEN,
+                session->msg_info.dst,
+                J1939_ETP_DT_PRI))
+        {
+            abort_connection(session, J1939_TP_ABORT_REASON_OTHER);
+            return;
+        }
+        j1939_tp_restart_timer(session);
+
+        session->etp.next_packet++;
+
+        // The window is done, wait for the next CTS or the EOMA
+        if (packet == session->etp.window_last)
+            session->clear_to_send = false;
+    }
+}
+
+static void
+update_receiver(
+    struct J1939TPSession* session)
+{
+    if (!session->clear_to_send)
+    {
+        if (session->timer_ms >= session->timing.cts_delay_ms)
+        {
+            uint32_t remaining = num_packets(session) - session->etp.next_packet + 1;
+            uint8_t count = (remaining < session->window_size) ? remaining : session->window_size;
+
+            struct J1939_ETP_CM_CTS cts = {
+                .control_byte = J1939_ETP_CM_CONTROL_BYTE_CTS,
+                .num_packages = count,
+                .next_packet = session->etp.next_packet,
+                .pgn = session->msg_info.pgn
+            };
+            (void)send_cm(session, &cts);
+
+            session->etp.window_last = session->etp.next_packet + count - 1;
+            session->etp.dpo = false;
+            session->clear_to_send = true;
+            j1939_tp_restart_timer(session);
+        }
+
+        return;
+    }
+
+    if (is_complete(session))
+    {
+        struct J1939_ETP_CM_EOMA eoma = {
+            .control_byte = J1939_ETP_CM_CONTROL_BYTE_EOMA,
+            .size = session->etp.size,
+            .pgn = session->msg_info.pgn
+        };
+        (void)send_cm(session, &eoma);
+
+        (void)j1939_tp_stream_event(session, J1939_STREAM_COMPLETE, 0, NULL, 0);
+        session->complete = true;
+        j1939_tp_close_session(session);
+    }
+    else if (session->timer_ms >= (session->etp.dpo ? J1939_TP_TIMEOUT_T1 : J1939_TP_TIMEOUT_T2))
+    {
+        abort_connection(session, J1939_TP_ABORT_REASON_TIMEOUT);
+    }
+    else if ((session->timer_ms >= J1939_TP_TIMEOUT_TR) &&
+             (session->retries < J1939_TP_MAX_RETRIES))
+    {
+        // The rest of the window, or its DPO, was lost; ask for it again
+        session->retries++;
+        session->clear_to_send = false;
+    }
+}
+
+static uint32_t
+num_packets(
+    struct J1939TPSession* session)
+{
+    return CEIL_DIV(session->etp.size, 7);
+}
+
+static bool
+is_complete(
+    struct J1939TPSession* session)
+{
+    return (session->etp.next_packet > num_packets(session));
+}
+
+// Tell the other side, and the sink of a receiver, that the connection is over
+static void
+abort_connection(
+    struct J1939TPSession* session,
+    enum j1939_tp_abort_reason reason)
+{
+    struct J1939_TP_CM_ABORT abort;
+
+    j1939_tp_abort_pack(
+        &abort,
+        reason,
+        session->sender ? J1939_TP_ABORT_ROLE_SENDER : J1939_TP_ABORT_ROLE_RECEIVER,
+        session->msg_info.pgn);
+    (void)send_cm(session, &abort);
+
+    if (session->sender)
+        session->status = (reason == J1939_TP_ABORT_REASON_TIMEOUT) ? J1939_TX_TIMEOUT : J1939_TX_FAILED;
+
+    session->abort_reason = reason;
+    j1939_tp_close_session(session);
+}
+
+static bool
+send_cm(
+    struct J1939TPSession* session,
+    void* cm)
+{
+    return j1939_tx_helper(
+        session->tp->node,
+        J1939_ETP_CM_PGN,
+        (uint8_t*)cm,
+        J1939_ETP_CM_LEN,
+        session->sender ? session->msg_info.dst : session->msg_info.src,
+        J1939_ETP_CM_PRI);
+}
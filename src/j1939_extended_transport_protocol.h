@@ -0,0 +1,158 @@
+#pragma once
+
+/* ============================================================================
+ * File: j1939_extended_transport_protocol.h
+ *
+ * Description: The extended transport protocol (ETP) carries peer-to-peer
+ *              messages of more than 1785 bytes, up to 117,440,505 bytes. It
+ *              works like a P2P transport protocol connection, exchanging
+ *              ETP.CM and ETP.DT PGNs instead, except that packet numbers
+ *              have 24 bits: before each window of up to 255 packets granted
+ *              by a CTS, the sender sends a DPO (data packet offset) message,
+ *              and the 8-bit sequence number of each ETP.DT packet counts
+ *              from that offset.
+ *              ETP connections use the sessions, timers and timing of the
+ *              transport protocol (j1939_transport_protocol.h), which opens,
+ *              finds and closes them. The functions here implement the ETP
+ *              side of each session, in the same way as
+ *              j1939_transport_protocol_helper.h does for TP. No message
+ *              buffer is used: the sender reads its data from a stream
+ *              source as it goes, and the receiver passes each packet to the
+ *              stream sink as it arrives.
+ * ============================================================================
+ */
+
+#include "j1939_transport_protocol.h"
+
+#include <stdint.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+#define J1939_ETP_CM_CONTROL_BYTE_RTS  (20)
+#define J1939_ETP_CM_CONTROL_BYTE_CTS  (21)
+#define J1939_ETP_CM_CONTROL_BYTE_DPO  (22)
+#define J1939_ETP_CM_CONTROL_BYTE_EOMA  (23)
+#define J1939_ETP_CM_CONTROL_BYTE_ABORT  (255)
+
+// 2^24 - 1 packets of 7 bytes
+#define J1939_ETP_MAX_PACKETS  (0xFFFFFF)
+#define J1939_ETP_MAX_SIZE  (J1939_ETP_MAX_PACKETS * 7)
+
+/* ============================================================================
+ *
+ * Section: Type definitions
+ *
+ * ============================================================================
+ */
+
+struct __attribute__((packed)) J1939_ETP_CM_RTS {
+    uint8_t control_byte;
+    uint32_t size;
+    uint32_t pgn : 24;
+};
+struct __attribute__((packed)) J1939_ETP_CM_CTS {
+    uint8_t control_byte;
+    uint8_t num_packages;
+    uint32_t next_packet : 24;
+    uint32_t pgn : 24;
+};
+struct __attribute__((packed)) J1939_ETP_CM_DPO {
+    uint8_t control_byte;
+    uint8_t num_packages;
+    uint32_t offset : 24;
+    uint32_t pgn : 24;
+};
+struct __attribute__((packed)) J1939_ETP_CM_EOMA {
+    uint8_t control_byte;
+    uint32_t size;
+    uint32_t pgn : 24;
+};
+#define J1939_ETP_CM_PGN  (0x00C800)
+#define J1939_ETP_CM_LEN  (8)
+#define J1939_ETP_CM_PRI  (7)
+
+// ETP.DT packets have the same layout as TP.DT packets (struct J1939_TP_DT)
+#define J1939_ETP_DT_PGN  (0x00C700)
+#define J1939_ETP_DT_LEN  (8)
+#define J1939_ETP_DT_PRI  (7)
+
+/* ============================================================================
+ *
+ * Section: Function prototypes
+ *
+ * ============================================================================
+ */
+
+/* ============================================================================
+ * Subsection: Sender/receiver functions
+ * ============================================================================
+ */
+
+// Run the state machine of an open ETP session
+void
+j1939_etp_update(
+    struct J1939TPSession* session);
+
+// Same as j1939_tp_next_event_ms(), for an open ETP session
+int
+j1939_etp_next_event_ms(
+    struct J1939TPSession* session);
+
+void
+j1939_etp_rx_abort(
+    struct J1939TPSession* session,
+    struct J1939_TP_CM_ABORT* abort);
+
+/* ============================================================================
+ * Subsection: Sender functions
+ * ============================================================================
+ */
+
+// Set up a session opened for sending, whose msg_info (PGN, destination and
+//  priority) is already filled in, and send the RTS. Return false if it
+//  couldn't be sent.
+bool
+j1939_etp_start(
+    struct J1939TPSession* session,
+    uint32_t size,
+    J1939_STREAM_SOURCE source,
+    void* source_data);
+
+void
+j1939_etp_rx_cts(
+    struct J1939TPSession* session,
+    struct J1939_ETP_CM_CTS* cts);
+
+void
+j1939_etp_rx_eoma(
+    struct J1939TPSession* session,
+    struct J1939_ETP_CM_EOMA* eoma);
+
+/* ============================================================================
+ * Subsection: Receiver functions
+ * ============================================================================
+ */
+
+// Set up a session opened for receiving from an RTS, and offer the message to
+//  the session's sink. Return false if the sink refuses it.
+bool
+j1939_etp_rx_rts(
+    struct J1939TPSession* session,
+    struct J1939_ETP_CM_RTS* rts,
+    uint8_t msg_src);
+
+void
+j1939_etp_rx_dpo(
+    struct J1939TPSession* session,
+    struct J1939_ETP_CM_DPO* dpo);
+
+// Return false if the ETP.DT packet is not the one expected next
+bool
+j1939_etp_rx_dt(
+    struct J1939TPSession* session,
+    struct J1939_TP_DT* dt);
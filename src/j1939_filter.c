@@ -0,0 +1,316 @@
+#include "j1939_filter.h"
+#include "j1939_transport_protocol.h"
+#include "j1939_extended_transport_protocol.h"
+#include "j1939_address_claim.h"
+
+#include <string.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+#define BIT_TEST(map, bit)  (((map)[(bit) >> 5] >> ((bit) & 31)) & 1)
+#define BIT_SET(map, bit)  ((map)[(bit) >> 5] |= (1u << ((bit) & 31)))
+
+// Largest valid PGN (18 bits: EDP, DP, PF and PS)
+#define PGN_MAX  (0x3FFFF)
+
+/* ============================================================================
+ *
+ * Section: Static variables
+ *
+ * ============================================================================
+ */
+
+// PGNs the library needs regardless of what the application asks for
+static const uint32_t protocol_pgns[] = {
+    J1939_TP_CM_PGN,
+    J1939_TP_DT_PGN,
+    J1939_ETP_CM_PGN,
+    J1939_ETP_DT_PGN,
+    J1939_ADDRESS_CLAIMED_PGN,
+    J1939_REQUEST_PGN
+};
+
+/* ============================================================================
+ *
+ * Section: Static function prototypes
+ *
+ * ============================================================================
+ */
+
+static void
+restrict_pgns(
+    struct J1939Filter* filter);
+
+static void
+add_pgn(
+    struct J1939Filter* filter,
+    uint32_t pgn);
+
+static int
+emit(
+    struct J1939CanIdFilter* filters,
+    int max_filters,
+    int count,
+    uint32_t id,
+    uint32_t mask);
+
+static int
+emit_sources(
+    const struct J1939Filter* filter,
+    struct J1939CanIdFilter* filters,
+    int max_filters,
+    int count,
+    int dp_pf,
+    uint32_t id,
+    uint32_t mask);
+
+/* ============================================================================
+ *
+ * Section: Function definitions
+ *
+ * ============================================================================
+ */
+
+void
+j1939_filter_init(
+    struct J1939Filter* filter)
+{
+    memset(filter, 0, sizeof(struct J1939Filter));
+    memset(filter->sa, 0xFF, sizeof(filter->sa));
+
+    // PGNs the library needs from every node, whichever sources are accepted
+    for (unsigned i = 0; i < (sizeof(protocol_pgns) / sizeof(protocol_pgns[0])); ++i)
+        BIT_SET(filter->pf_any_source, (protocol_pgns[i] >> 8) & 0x1FF);
+}
+
+bool
+j1939_filter_add_pgn(
+    struct J1939Filter* filter,
+    uint32_t pgn)
+{
+    // Only EDP = 0 PGNs are J1939 messages
+    if (pgn > (PGN_MAX >> 1))
+        return false;
+
+    restrict_pgns(filter);
+    add_pgn(filter, pgn);
+    return true;
+}
+
+void
+j1939_filter_add_source(
+    struct J1939Filter* filter,
+    uint8_t sa)
+{
+    if (!filter->sources_restricted)
+    {
+        memset(filter->sa, 0, sizeof(filter->sa));
+        filter->sources_restricted = true;
+    }
+
+    BIT_SET(filter->sa, sa);
+}
+
+bool
+j1939_filter_accept(
+    const struct J1939Filter* filter,
+    uint32_t id)
+{
+    if (!filter->pgns_restricted && !filter->sources_restricted)
+        return true;
+
+    // DP (bit 24) and PF (bits 16-23) are adjacent in the CAN ID
+    uint32_t dp_pf = (id >> 16) & 0x1FF;
+
+    if (!filter->pgns_restricted)
+    {
+        return BIT_TEST(filter->sa, id & 0xFF) ||
+            BIT_TEST(filter->pf_any_source, dp_pf);
+    }
+
+    if (!BIT_TEST(filter->pf, dp_pf))
+        return false;
+
+    if ((dp_pf & 0xFF) >= 240)
+    {
+        uint32_t ps_bit =
+            ((((dp_pf >> 8) << 4) | ((dp_pf & 0xFF) - 240)) << 8) |
+            ((id >> 8) & 0xFF);
+
+        if (!BIT_TEST(filter->pdu2_ps, ps_bit))
+            return false;
+    }
+
+    return BIT_TEST(filter->sa, id & 0xFF) ||
+        BIT_TEST(filter->pf_any_source, dp_pf);
+}
+
+int
+j1939_filter_export(
+    const struct J1939Filter* filter,
+    struct J1939CanIdFilter* filters,
+    int max_filters)
+{
+    int count = 0;
+
+    // Let every extended data frame through; standard frames are useless to us
+    if (!filter->pgns_restricted && !filter->sources_restricted)
+    {
+        return emit(
+            filters,
+            max_filters,
+            count,
+            J1939_FILTER_EFF_FLAG,
+            J1939_FILTER_EFF_FLAG | J1939_FILTER_RTR_FLAG);
+    }
+
+    if (!filter->pgns_restricted)
+    {
+        // Any PGN from an accepted source
+        for (int sa = 0; sa < 256; ++sa)
+        {
+            if (BIT_TEST(filter->sa, sa))
+            {
+                count = emit(filters, max_filters, count,
+                    J1939_FILTER_EFF_FLAG | (uint32_t)sa,
+                    J1939_FILTER_EFF_FLAG | J1939_FILTER_RTR_FLAG | J1939_FILTER_SA_MASK);
+            }
+        }
+
+        // The protocol PGNs from any source
+        for (int dp_pf = 0; dp_pf < 512; ++dp_pf)
+        {
+            if (BIT_TEST(filter->pf_any_source, dp_pf))
+            {
+                count = emit(filters, max_filters, count,
+                    J1939_FILTER_EFF_FLAG | ((uint32_t)dp_pf << 16), J1939_FILTER_PDU1_MASK);
+            }
+        }
+
+        return count;
+    }
+
+    for (int dp_pf = 0; dp_pf < 512; ++dp_pf)
+    {
+        if (!BIT_TEST(filter->pf, dp_pf))
+            continue;
+
+        uint32_t id = J1939_FILTER_EFF_FLAG | ((uint32_t)dp_pf << 16);
+        int pf = dp_pf & 0xFF;
+
+        if (pf < 240)
+        {
+            // The PS field is a destination address; match any
+            count = emit_sources(filter, filters, max_filters, count, dp_pf,
+                id, J1939_FILTER_PDU1_MASK);
+            continue;
+        }
+
+        const uint32_t* ps_map =
+            &filter->pdu2_ps[((((dp_pf >> 8) << 4) | (pf - 240)) << 8) >> 5];
+
+        bool all_ps = true;
+        for (int i = 0; i < (256 / 32); ++i)
+            all_ps = all_ps && (ps_map[i] == 0xFFFFFFFF);
+
+        if (all_ps)
+        {
+            count = emit_sources(filter, filters, max_filters, count, dp_pf,
+                id, J1939_FILTER_PDU1_MASK);
+            continue;
+        }
+
+        for (int ps = 0; ps < 256; ++ps)
+        {
+            if (BIT_TEST(ps_map, ps))
+            {
+                count = emit_sources(filter, filters, max_filters, count, dp_pf,
+                    id | ((uint32_t)ps << 8), J1939_FILTER_PDU2_MASK);
+            }
+        }
+    }
+
+    return count;
+}
+
+/* ============================================================================
+ *
+ * Section: Static function definitions
+ *
+ * ============================================================================
+ */
+
+static void
+restrict_pgns(
+    struct J1939Filter* filter)
+{
+    if (filter->pgns_restricted)
+        return;
+
+    filter->pgns_restricted = true;
+
+    for (unsigned i = 0; i < (sizeof(protocol_pgns) / sizeof(protocol_pgns[0])); ++i)
+        add_pgn(filter, protocol_pgns[i]);
+}
+
+static void
+add_pgn(
+    struct J1939Filter* filter,
+    uint32_t pgn)
+{
+    uint32_t dp_pf = (pgn >> 8) & 0x1FF;
+    uint32_t pf = dp_pf & 0xFF;
+
+    BIT_SET(filter->pf, dp_pf);
+
+    if (pf >= 240)
+        BIT_SET(filter->pdu2_ps, ((((dp_pf >> 8) << 4) | (pf - 240)) << 8) | (pgn & 0xFF));
+}
+
+static int
+emit(
+    struct J1939CanIdFilter* filters,
+    int max_filters,
+    int count,
+    uint32_t id,
+    uint32_t mask)
+{
+    if (count < max_filters)
+    {
+        filters[count].id = id;
+        filters[count].mask = mask;
+    }
+
+    return count + 1;
+}
+
+static int
+emit_sources(
+    const struct J1939Filter* filter,
+    struct J1939CanIdFilter* filters,
+    int max_filters,
+    int count,
+    int dp_pf,
+    uint32_t id,
+    uint32_t mask)
+{
+    if (!filter->sources_restricted || BIT_TEST(filter->pf_any_source, dp_pf))
+        return emit(filters, max_filters, count, id, mask);
+
+    // Each accepted source needs its own entry
+    for (int sa = 0; sa < 256; ++sa)
+    {
+        if (BIT_TEST(filter->sa, sa))
+        {
+            count = emit(filters, max_filters, count,
+                id | (uint32_t)sa, mask | J1939_FILTER_SA_MASK);
+        }
+    }
+
+    return count;
+}
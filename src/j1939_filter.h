@@ -0,0 +1,113 @@
+#pragma once
+
+/* ============================================================================
+ * File: j1939_filter.h
+ *
+ * Description: Acceptance filter applied to the raw 29-bit CAN ID, before a
+ *              frame is unpacked into a J1939Msg. The filter is a set of
+ *              bitmaps: one bit per (DP, PF) pair, one bit per group extension
+ *              (PS) of each PDU2 PF, and one bit per source address. A frame
+ *              is accepted with at most three bit tests and no decoding.
+ *              A new filter accepts every frame. Adding the first PGN
+ *              restricts PGNs; from then on only the added PGNs (plus the
+ *              PGNs the library itself relies on) are accepted. Source
+ *              addresses work the same way, independently of the PGNs: all
+ *              are accepted until the first one is added. The PGNs used by
+ *              the transport protocol and address claim always pass the
+ *              source check, since dropping them would break those
+ *              procedures.
+ *              The filter can be exported as a list of (id, mask) pairs for a
+ *              hardware or kernel filter, e.g. SocketCAN's CAN_RAW_FILTER,
+ *              so unwanted traffic is discarded before it reaches the
+ *              application at all.
+ * ============================================================================
+ */
+
+#include "j1939.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+// Bit 31 marks an extended frame (same as SocketCAN's CAN_EFF_FLAG) and bit 30
+//  a remote frame (CAN_RTR_FLAG).
+#define J1939_FILTER_EFF_FLAG  (0x80000000u)
+#define J1939_FILTER_RTR_FLAG  (0x40000000u)
+
+// Masks for the EDP/DP/PF bits, plus the PS bits of a PDU2 PGN
+#define J1939_FILTER_PDU1_MASK  (J1939_FILTER_EFF_FLAG | J1939_FILTER_RTR_FLAG | 0x03FF0000u)
+#define J1939_FILTER_PDU2_MASK  (J1939_FILTER_PDU1_MASK | 0x0000FF00u)
+#define J1939_FILTER_SA_MASK  (0x000000FFu)
+
+/* ============================================================================
+ *
+ * Section: Type definitions
+ *
+ * ============================================================================
+ */
+
+struct J1939Filter {
+    // If false, every PGN is accepted
+    bool pgns_restricted;
+
+    // If false, every source address is accepted
+    bool sources_restricted;
+
+    // Accepted (DP, PF) pairs, indexed by ((dp << 8) | pf)
+    uint32_t pf[512 / 32];
+
+    // (DP, PF) pairs that skip the source address check
+    uint32_t pf_any_source[512 / 32];
+
+    // Accepted group extensions of PDU2 PGNs, indexed by
+    //  ((((dp << 4) | (pf - 240)) << 8) | ps)
+    uint32_t pdu2_ps[(2 * 16 * 256) / 32];
+
+    // Accepted source addresses
+    uint32_t sa[256 / 32];
+};
+
+/* ============================================================================
+ *
+ * Section: Function prototypes
+ *
+ * ============================================================================
+ */
+
+// The filter starts out accepting every frame
+void
+j1939_filter_init(
+    struct J1939Filter* filter);
+
+// Accept frames of the given PGN. Return false if the PGN is invalid.
+bool
+j1939_filter_add_pgn(
+    struct J1939Filter* filter,
+    uint32_t pgn);
+
+// Accept frames from the given source address
+void
+j1939_filter_add_source(
+    struct J1939Filter* filter,
+    uint8_t sa);
+
+// Return true if a frame with this raw CAN ID passes the filter
+bool
+j1939_filter_accept(
+    const struct J1939Filter* filter,
+    uint32_t id);
+
+// Write the filter as (id, mask) pairs, at most max_filters of them.
+// Return the number of pairs the full filter needs, which may be larger than
+//  max_filters.
+int
+j1939_filter_export(
+    const struct J1939Filter* filter,
+    struct J1939CanIdFilter* filters,
+    int max_filters);
@@ -0,0 +1,96 @@
+#include "j1939_frame_ring.h"
+
+#include <string.h>
+
+_Static_assert(
+    (J1939_FRAME_RING_SIZE & J1939_FRAME_RING_MASK) == 0,
+    "J1939_FRAME_RING_SIZE must be a power of two");
+
+/* ============================================================================
+ *
+ * Section: Function definitions
+ *
+ * ============================================================================
+ */
+
+void
+j1939_frame_ring_init(
+    struct J1939FrameRing* ring)
+{
+    ring->head = 0;
+    ring->cached_tail = 0;
+    ring->dropped = 0;
+    ring->tail = 0;
+    ring->cached_head = 0;
+}
+
+bool
+j1939_frame_ring_push(
+    struct J1939FrameRing* ring,
+    const struct J1939CanFrame* frame)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    if ((head - ring->cached_tail) == J1939_FRAME_RING_SIZE)
+    {
+        // Looks full; refresh our view of the consumer's progress
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        if ((head - ring->cached_tail) == J1939_FRAME_RING_SIZE)
+        {
+            __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+
+    memcpy(&ring->frames[head & J1939_FRAME_RING_MASK], frame, sizeof(*frame));
+
+    // Publish the frame to the consumer
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+int
+j1939_frame_ring_peek(
+    struct J1939FrameRing* ring,
+    struct J1939CanFrame** frames)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    if (ring->cached_head == tail)
+    {
+        // Looks empty; refresh our view of the producer's progress
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        if (ring->cached_head == tail)
+            return 0;
+    }
+
+    uint32_t available = ring->cached_head - tail;
+    uint32_t offset = tail & J1939_FRAME_RING_MASK;
+
+    // Stop at the end of the array; the rest is returned by the next call
+    if (available > (J1939_FRAME_RING_SIZE - offset))
+        available = J1939_FRAME_RING_SIZE - offset;
+
+    *frames = &ring->frames[offset];
+    return (int)available;
+}
+
+void
+j1939_frame_ring_consume(
+    struct J1939FrameRing* ring,
+    int num_frames)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    // Hand the slots back to the producer
+    __atomic_store_n(&ring->tail, tail + (uint32_t)num_frames, __ATOMIC_RELEASE);
+}
+
+uint32_t
+j1939_frame_ring_dropped(
+    const struct J1939FrameRing* ring)
+{
+    return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
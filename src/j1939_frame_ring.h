@@ -0,0 +1,99 @@
+#pragma once
+
+/* ============================================================================
+ * File: j1939_frame_ring.h
+ *
+ * Description: Lock-free single-producer/single-consumer ring of CAN frames.
+ *              It lets a reader thread (or a CAN receive interrupt) hand
+ *              frames to the thread running j1939_update() without either
+ *              side ever blocking. The producer only writes the head index
+ *              and the consumer only writes the tail index; each index sits
+ *              on its own cache line, together with the owner's cached copy
+ *              of the other index, so the two sides only touch each other's
+ *              cache lines when the ring looks full or empty. Frames are
+ *              consumed in place, so they are never copied a second time.
+ * ============================================================================
+ */
+
+#include "j1939.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+// Number of frame slots; must be a power of two
+#ifndef J1939_FRAME_RING_SIZE
+#define J1939_FRAME_RING_SIZE  (64)
+#endif
+
+#define J1939_FRAME_RING_MASK  (J1939_FRAME_RING_SIZE - 1)
+
+/* ============================================================================
+ *
+ * Section: Type definitions
+ *
+ * ============================================================================
+ */
+
+// Head and tail are free-running counters; their difference is the number of
+//  frames in the ring.
+struct J1939FrameRing {
+    // Producer side
+    __attribute__((aligned(J1939_CACHE_LINE_SIZE)))
+    uint32_t head;
+    uint32_t cached_tail;
+    // Frames dropped because the ring was full
+    uint32_t dropped;
+
+    // Consumer side
+    __attribute__((aligned(J1939_CACHE_LINE_SIZE)))
+    uint32_t tail;
+    uint32_t cached_head;
+
+    __attribute__((aligned(J1939_CACHE_LINE_SIZE)))
+    struct J1939CanFrame frames[J1939_FRAME_RING_SIZE];
+};
+
+/* ============================================================================
+ *
+ * Section: Function prototypes
+ *
+ * ============================================================================
+ */
+
+// Not thread-safe; call before the producer and consumer start
+void
+j1939_frame_ring_init(
+    struct J1939FrameRing* ring);
+
+// Producer side. Copy a frame into the ring. Return false, and count the frame
+//  as dropped, if the ring is full.
+bool
+j1939_frame_ring_push(
+    struct J1939FrameRing* ring,
+    const struct J1939CanFrame* frame);
+
+// Consumer side. Point *frames at the oldest frames in the ring and return how
+//  many of them are contiguous in memory (zero if the ring is empty). The
+//  frames stay valid until they're released with j1939_frame_ring_consume().
+int
+j1939_frame_ring_peek(
+    struct J1939FrameRing* ring,
+    struct J1939CanFrame** frames);
+
+// Consumer side. Release the oldest num_frames frames back to the producer.
+void
+j1939_frame_ring_consume(
+    struct J1939FrameRing* ring,
+    int num_frames);
+
+// Return the number of frames dropped so far. May be called from any thread.
+uint32_t
+j1939_frame_ring_dropped(
+    const struct J1939FrameRing* ring);
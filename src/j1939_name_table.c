@@ -0,0 +1,189 @@
+#include "j1939_name_table.h"
+
+#include <string.h>
+
+_Static_assert(
+    (J1939_NAME_TABLE_SLOTS & (J1939_NAME_TABLE_SLOTS - 1)) == 0,
+    "J1939_NAME_TABLE_SLOTS must be a power of two");
+_Static_assert(
+    J1939_NAME_TABLE_SLOTS > J1939_ADDR_NULL,
+    "J1939_NAME_TABLE_SLOTS must exceed the number of valid addresses");
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+#define BIT_TEST(map, bit)  (((map)[(bit) >> 5] >> ((bit) & 31)) & 1)
+#define BIT_SET(map, bit)  ((map)[(bit) >> 5] |= (1u << ((bit) & 31)))
+#define BIT_CLEAR(map, bit)  ((map)[(bit) >> 5] &= ~(1u << ((bit) & 31)))
+
+#define SLOT_MASK  (J1939_NAME_TABLE_SLOTS - 1)
+#define EMPTY  (J1939_ADDR_GLOBAL)
+
+/* ============================================================================
+ *
+ * Section: Static function prototypes
+ *
+ * ============================================================================
+ */
+
+static int
+home_slot(
+    uint64_t name);
+
+static int
+find_slot(
+    const struct J1939NameTable* table,
+    uint64_t name);
+
+static void
+remove_slot(
+    struct J1939NameTable* table,
+    int slot);
+
+/* ============================================================================
+ *
+ * Section: Function definitions
+ *
+ * ============================================================================
+ */
+
+void
+j1939_name_table_init(
+    struct J1939NameTable* table)
+{
+    memset(table->claimed, 0, sizeof(table->claimed));
+    memset(table->index, EMPTY, sizeof(table->index));
+}
+
+uint8_t
+j1939_name_table_claim(
+    struct J1939NameTable* table,
+    uint8_t address,
+    uint64_t name)
+{
+    if (address >= J1939_ADDR_NULL)
+        return J1939_ADDR_NULL;
+
+    // Already known at this address
+    if (BIT_TEST(table->claimed, address) && (table->names[address] == name))
+        return J1939_ADDR_NULL;
+
+    uint8_t previous = j1939_name_table_remove(table, name);
+
+    // Whoever was at this address has lost it
+    if (BIT_TEST(table->claimed, address))
+        (void)j1939_name_table_remove(table, table->names[address]);
+
+    table->names[address] = name;
+    BIT_SET(table->claimed, address);
+
+    int slot = home_slot(name);
+    while (table->index[slot] != EMPTY)
+        slot = (slot + 1) & SLOT_MASK;
+    table->index[slot] = address;
+
+    return previous;
+}
+
+uint8_t
+j1939_name_table_remove(
+    struct J1939NameTable* table,
+    uint64_t name)
+{
+    int slot = find_slot(table, name);
+
+    if (slot < 0)
+        return J1939_ADDR_NULL;
+
+    uint8_t address = table->index[slot];
+    remove_slot(table, slot);
+    BIT_CLEAR(table->claimed, address);
+
+    return address;
+}
+
+uint8_t
+j1939_name_table_address(
+    const struct J1939NameTable* table,
+    uint64_t name)
+{
+    int slot = find_slot(table, name);
+
+    return (slot < 0) ? J1939_ADDR_NULL : table->index[slot];
+}
+
+bool
+j1939_name_table_name(
+    const struct J1939NameTable* table,
+    uint8_t address,
+    uint64_t* name)
+{
+    if ((address >= J1939_ADDR_NULL) || !BIT_TEST(table->claimed, address))
+        return false;
+
+    *name = table->names[address];
+    return true;
+}
+
+/* ============================================================================
+ *
+ * Section: Static function definitions
+ *
+ * ============================================================================
+ */
+
+// Fibonacci hashing: the upper half of the product is well mixed, even though
+//  NAMEs of the same manufacturer differ little in their low bits
+static int
+home_slot(
+    uint64_t name)
+{
+    return (int)((name * 0x9E3779B97F4A7C15ull) >> 32) & SLOT_MASK;
+}
+
+// Return the index slot holding the NAME's address, or -1 if there's none
+static int
+find_slot(
+    const struct J1939NameTable* table,
+    uint64_t name)
+{
+    for (int slot = home_slot(name);
+         table->index[slot] != EMPTY;
+         slot = (slot + 1) & SLOT_MASK)
+    {
+        if (table->names[table->index[slot]] == name)
+            return slot;
+    }
+
+    return -1;
+}
+
+// Empty a slot, moving later entries of the same probe run back into the hole
+//  so every entry stays reachable from its home slot without tombstones
+static void
+remove_slot(
+    struct J1939NameTable* table,
+    int slot)
+{
+    int hole = slot;
+
+    for (int i = (slot + 1) & SLOT_MASK;
+         table->index[i] != EMPTY;
+         i = (i + 1) & SLOT_MASK)
+    {
+        int home = home_slot(table->names[table->index[i]]);
+
+        // The entry can move back if the hole lies between its home and i
+        if (((i - home) & SLOT_MASK) >= ((i - hole) & SLOT_MASK))
+        {
+            table->index[hole] = table->index[i];
+            hole = i;
+        }
+    }
+
+    table->index[hole] = EMPTY;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+/* ============================================================================
+ * File: j1939_name_table.h
+ *
+ * Description: Table of the NAMEs of the nodes on the bus and the addresses
+ *              they've claimed, learned from Address Claimed messages. It's
+ *              indexed both ways: by address, through an array of NAMEs, and
+ *              by NAME, through an open-addressing hash index of addresses
+ *              with linear probing. Both lookups take constant time, and a
+ *              NAME is only ever at one address, so a node that claims a new
+ *              address is found there right away.
+ *              NAMEs are handled as 64-bit integers, with the same value as
+ *              the 8 data bytes of an Address Claimed message.
+ * ============================================================================
+ */
+
+#include "j1939.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+// Slots of the hash index; a power of two, at least twice the number of
+//  valid addresses so probe sequences stay short
+#ifndef J1939_NAME_TABLE_SLOTS
+#define J1939_NAME_TABLE_SLOTS  (512)
+#endif
+
+/* ============================================================================
+ *
+ * Section: Type definitions
+ *
+ * ============================================================================
+ */
+
+struct J1939NameTable {
+    // NAME of the node at each valid address (0 - 253), if its bit in
+    //  claimed is set
+    uint64_t names[J1939_ADDR_NULL];
+    uint32_t claimed[256 / 32];
+
+    // Hash index from NAME to address; J1939_ADDR_GLOBAL marks an empty slot
+    uint8_t index[J1939_NAME_TABLE_SLOTS];
+};
+
+/* ============================================================================
+ *
+ * Section: Function prototypes
+ *
+ * ============================================================================
+ */
+
+void
+j1939_name_table_init(
+    struct J1939NameTable* table);
+
+// Record that the node with the given NAME has claimed the address. The
+//  NAME's previous address, and any other NAME at this address, are
+//  forgotten. Return the NAME's previous address if it had a different one,
+//  J1939_ADDR_NULL otherwise.
+uint8_t
+j1939_name_table_claim(
+    struct J1939NameTable* table,
+    uint8_t address,
+    uint64_t name);
+
+// Forget the node with the given NAME, e.g. when it can't claim an address.
+//  Return the address it had, or J1939_ADDR_NULL if it wasn't known.
+uint8_t
+j1939_name_table_remove(
+    struct J1939NameTable* table,
+    uint64_t name);
+
+// Return the address of the node with the given NAME, or J1939_ADDR_NULL if
+//  it isn't known
+uint8_t
+j1939_name_table_address(
+    const struct J1939NameTable* table,
+    uint64_t name);
+
+// Copy the NAME of the node at the address into name. Return false if no
+//  node is known to be there.
+bool
+j1939_name_table_name(
+    const struct J1939NameTable* table,
+    uint8_t address,
+    uint64_t* name);
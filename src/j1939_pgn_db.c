@@ -0,0 +1,54 @@
+#include "j1939_pgn_db.h"
+
+#include <stddef.h>
+
+/* ============================================================================
+ *
+ * Section: Global variables
+ *
+ * ============================================================================
+ */
+
+const struct J1939PgnInfo j1939_pgn_db[] = {
+    #include "j1939_pgn_db_table.h"
+};
+
+const int j1939_pgn_db_len = sizeof(j1939_pgn_db) / sizeof(j1939_pgn_db[0]);
+
+/* ============================================================================
+ *
+ * Section: Function definitions
+ *
+ * ============================================================================
+ */
+
+const struct J1939PgnInfo*
+j1939_pgn_db_lookup(
+    uint32_t pgn)
+{
+    const struct J1939PgnInfo* base = j1939_pgn_db;
+    int len = sizeof(j1939_pgn_db) / sizeof(j1939_pgn_db[0]);
+
+    // Narrow the range down to the last entry not above the PGN. Each step
+    //  halves it without a data-dependent branch (the compiler turns the
+    //  select into a conditional move), so every lookup takes the same
+    //  log2(len) steps.
+    while (len > 1)
+    {
+        int half = len / 2;
+
+        base = (base[half].pgn <= pgn) ? &base[half] : base;
+        len -= half;
+    }
+
+    return (base->pgn == pgn) ? base : NULL;
+}
+
+uint8_t
+j1939_pgn_db_priority(
+    uint32_t pgn)
+{
+    const struct J1939PgnInfo* info = j1939_pgn_db_lookup(pgn);
+
+    return (info != NULL) ? info->pri : J1939_DEFAULT_PRIORITY;
+}
@@ -0,0 +1,87 @@
+# Generate the rows of the PGN database table (j1939_pgn_db.c) from its text
+#  definition (j1939_pgn_db.txt), sorted by PGN so it can be binary searched.
+#
+# Usage: cmake -DINPUT=j1939_pgn_db.txt -DOUTPUT=j1939_pgn_db_table.h -P j1939_pgn_db.cmake
+
+if (NOT INPUT OR NOT OUTPUT)
+    message(FATAL_ERROR "Usage: cmake -DINPUT=<definition> -DOUTPUT=<table> -P j1939_pgn_db.cmake")
+endif()
+
+file(STRINGS "${INPUT}" lines)
+
+set(rows "")
+foreach(line IN LISTS lines)
+    string(REGEX REPLACE "#.*$" "" line "${line}")
+    string(STRIP "${line}" line)
+    if (line STREQUAL "")
+        continue()
+    endif()
+
+    if (NOT line MATCHES "^(0[xX][0-9A-Fa-f]+)[ \t]+([0-7])[ \t]+([0-9]+|var)[ \t]+([0-9]+)[ \t]+(.+)$")
+        message(FATAL_ERROR "${INPUT}: can't parse \"${line}\"")
+    endif()
+    set(pgn "${CMAKE_MATCH_1}")
+    set(pri "${CMAKE_MATCH_2}")
+    set(len "${CMAKE_MATCH_3}")
+    set(rate_ms "${CMAKE_MATCH_4}")
+    set(name "${CMAKE_MATCH_5}")
+
+    math(EXPR pgn_value "${pgn}")
+    math(EXPR pf "(${pgn_value} >> 8) & 0xFF")
+    math(EXPR ps "${pgn_value} & 0xFF")
+    if (pgn_value GREATER 0x3FFFF)
+        message(FATAL_ERROR "${INPUT}: PGN ${pgn} is out of range")
+    endif()
+    if (pf LESS 240 AND NOT ps EQUAL 0)
+        message(FATAL_ERROR "${INPUT}: PDU1 PGN ${pgn} must have a PS of zero")
+    endif()
+
+    if (len STREQUAL "var")
+        set(len 0)
+        set(transport J1939_PGN_EITHER)
+    elseif (len LESS 1 OR len GREATER 1785)
+        message(FATAL_ERROR "${INPUT}: PGN ${pgn} has an invalid length ${len}")
+    elseif (len GREATER 8)
+        set(transport J1939_PGN_MULTI_PACKET)
+    else()
+        set(transport J1939_PGN_SINGLE_FRAME)
+    endif()
+
+    if (rate_ms GREATER 65535)
+        message(FATAL_ERROR "${INPUT}: PGN ${pgn} has an invalid rate ${rate_ms}")
+    endif()
+
+    string(REPLACE "\\" "\\\\" name "${name}")
+    string(REPLACE "\"" "\\\"" name "${name}")
+
+    # Zero-padded, so the rows sort by PGN as strings
+    math(EXPR key "${pgn_value}" OUTPUT_FORMAT HEXADECIMAL)
+    string(SUBSTRING "${key}" 2 -1 key)
+    string(TOUPPER "${key}" key)
+    string(LENGTH "${key}" key_len)
+    math(EXPR pad "6 - ${key_len}")
+    string(REPEAT "0" ${pad} zeros)
+    set(key "0x${zeros}${key}")
+
+    list(APPEND rows "${key}|    { ${key}, ${pri}, ${len}, ${rate_ms}, ${transport}, \"${name}\" },")
+endforeach()
+
+list(SORT rows)
+
+set(table "// Generated from j1939_pgn_db.txt by j1939_pgn_db.cmake; don't edit.\n")
+set(prev_key "")
+foreach(row IN LISTS rows)
+    string(REGEX MATCH "^[^|]*" key "${row}")
+    if (key STREQUAL prev_key)
+        message(FATAL_ERROR "${INPUT}: PGN ${key} is defined more than once")
+    endif()
+    set(prev_key "${key}")
+
+    string(REGEX REPLACE "^[^|]*\\|" "" row "${row}")
+    string(APPEND table "${row}\n")
+endforeach()
+
+# Leave the table alone if it hasn't changed, so nothing is rebuilt
+file(WRITE "${OUTPUT}.tmp" "${table}")
+file(COPY_FILE "${OUTPUT}.tmp" "${OUTPUT}" ONLY_IF_DIFFERENT)
+file(REMOVE "${OUTPUT}.tmp")
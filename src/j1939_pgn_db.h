@@ -0,0 +1,44 @@
+#pragma once
+
+/* ============================================================================
+ * File: j1939_pgn_db.h
+ *
+ * Description: PGN database: the default priority, length, repetition rate
+ *              and transport of well-known PGNs. The table is generated at
+ *              build time from j1939_pgn_db.txt by j1939_pgn_db.cmake, sorted
+ *              by PGN, and compiled in as constant data, so it takes no
+ *              runtime initialization. Add PGNs to j1939_pgn_db.txt rather
+ *              than to the generated table.
+ * ============================================================================
+ */
+
+#include "j1939.h"
+
+/* ============================================================================
+ *
+ * Section: Global variables
+ *
+ * ============================================================================
+ */
+
+// Sorted by PGN, without duplicates
+extern const struct J1939PgnInfo j1939_pgn_db[];
+extern const int j1939_pgn_db_len;
+
+/* ============================================================================
+ *
+ * Section: Function prototypes
+ *
+ * ============================================================================
+ */
+
+// Return the database entry of the PGN, or NULL if there's none
+const struct J1939PgnInfo*
+j1939_pgn_db_lookup(
+    uint32_t pgn);
+
+// Return the default priority of the PGN: the database's, or
+//  J1939_DEFAULT_PRIORITY if the PGN isn't in it
+uint8_t
+j1939_pgn_db_priority(
+    uint32_t pgn);
@@ -0,0 +1,162 @@
+#include "j1939_pgn_handler.h"
+
+#include <stddef.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+#define TABLE_MASK  (J1939_PGN_HANDLER_TABLE_SIZE - 1)
+
+// Largest valid PGN (18 bits: EDP, DP, PF and PS)
+#define PGN_MAX  (0x3FFFF)
+
+/* ============================================================================
+ *
+ * Section: Static function prototypes
+ *
+ * ============================================================================
+ */
+
+static uint32_t
+home_slot(
+    uint32_t pgn);
+
+/* ============================================================================
+ *
+ * Section: Function definitions
+ *
+ * ============================================================================
+ */
+
+void
+j1939_pgn_handlers_init(
+    struct J1939PgnHandlers* handlers)
+{
+    for (int i = 0; i < J1939_PGN_HANDLER_TABLE_SIZE; ++i)
+    {
+        handlers->table[i].pgn = J1939_PGN_HANDLER_EMPTY;
+        handlers->table[i].handler = NULL;
+        handlers->table[i].user_data = NULL;
+    }
+
+    handlers->count = 0;
+}
+
+bool
+j1939_pgn_handlers_register(
+    struct J1939PgnHandlers* handlers,
+    uint32_t pgn,
+    J1939_PGN_HANDLER handler,
+    void* user_data)
+{
+    if ((handler == NULL) || (pgn > PGN_MAX))
+        return false;
+
+    uint32_t slot = home_slot(pgn);
+
+    while (handlers->table[slot].pgn != J1939_PGN_HANDLER_EMPTY)
+    {
+        if (handlers->table[slot].pgn == pgn)
+        {
+            handlers->table[slot].handler = handler;
+            handlers->table[slot].user_data = user_data;
+            return true;
+        }
+
+        slot = (slot + 1) & TABLE_MASK;
+    }
+
+    if (handlers->count >= J1939_PGN_HANDLERS_MAX)
+        return false;
+
+    handlers->table[slot].pgn = pgn;
+    handlers->table[slot].handler = handler;
+    handlers->table[slot].user_data = user_data;
+    handlers->count++;
+
+    return true;
+}
+
+bool
+j1939_pgn_handlers_unregister(
+    struct J1939PgnHandlers* handlers,
+    uint32_t pgn)
+{
+    if (pgn > PGN_MAX)
+        return false;
+
+    uint32_t slot = home_slot(pgn);
+
+    while (handlers->table[slot].pgn != pgn)
+    {
+        if (handlers->table[slot].pgn == J1939_PGN_HANDLER_EMPTY)
+            return false;
+
+        slot = (slot + 1) & TABLE_MASK;
+    }
+
+    // Shift back any following entries that would otherwise become
+    //  unreachable once this slot is emptied.
+    uint32_t hole = slot;
+    uint32_t next = (hole + 1) & TABLE_MASK;
+
+    while (handlers->table[next].pgn != J1939_PGN_HANDLER_EMPTY)
+    {
+        uint32_t home = home_slot(handlers->table[next].pgn);
+
+        // The entry can move into the hole if its home slot doesn't lie
+        //  (cyclically) between the hole and its current position.
+        if (((next - home) & TABLE_MASK) >= ((next - hole) & TABLE_MASK))
+        {
+            handlers->table[hole] = handlers->table[next];
+            hole = next;
+        }
+
+        next = (next + 1) & TABLE_MASK;
+    }
+
+    handlers->table[hole].pgn = J1939_PGN_HANDLER_EMPTY;
+    handlers->table[hole].handler = NULL;
+    handlers->table[hole].user_data = NULL;
+    handlers->count--;
+
+    return true;
+}
+
+const struct J1939PgnHandlerEntry*
+j1939_pgn_handlers_lookup(
+    const struct J1939PgnHandlers* handlers,
+    uint32_t pgn)
+{
+    uint32_t slot = home_slot(pgn);
+
+    while (handlers->table[slot].pgn != J1939_PGN_HANDLER_EMPTY)
+    {
+        if (handlers->table[slot].pgn == pgn)
+            return &handlers->table[slot];
+
+        slot = (slot + 1) & TABLE_MASK;
+    }
+
+    return NULL;
+}
+
+/* ============================================================================
+ *
+ * Section: Static function definitions
+ *
+ * ============================================================================
+ */
+
+static uint32_t
+home_slot(
+    uint32_t pgn)
+{
+    // Fibonacci hashing: the multiply spreads the PF/PS bits across the word
+    //  and the top bits select the slot.
+    return (pgn * 2654435761u) >> (32 - J1939_PGN_HANDLER_TABLE_BITS);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+/* ============================================================================
+ * File: j1939_pgn_handler.h
+ *
+ * Description: Per-node registry of application handlers, keyed by PGN.
+ *              Rather than funneling every message through a single j1939_rx
+ *              callback (which then has to switch on the PGN itself), the
+ *              application registers one handler per PGN of interest, each
+ *              with its own user data. The registry is a small open-addressing
+ *              hash table with linear probing, so a lookup costs the same
+ *              regardless of how many PGNs are registered. Deletion uses
+ *              backward shifting, so no tombstones accumulate over time.
+ * ============================================================================
+ */
+
+#include "j1939.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+// The hash table has (1 << J1939_PGN_HANDLER_TABLE_BITS) slots. At most half
+//  of them may be used so that probe sequences stay short.
+#ifndef J1939_PGN_HANDLER_TABLE_BITS
+#define J1939_PGN_HANDLER_TABLE_BITS  (6)
+#endif
+
+#define J1939_PGN_HANDLER_TABLE_SIZE  (1 << J1939_PGN_HANDLER_TABLE_BITS)
+#define J1939_PGN_HANDLERS_MAX  (J1939_PGN_HANDLER_TABLE_SIZE / 2)
+
+// Marks an unused table slot; PGNs are only 18 bits wide
+#define J1939_PGN_HANDLER_EMPTY  (0xFFFFFFFF)
+
+/* ============================================================================
+ *
+ * Section: Type definitions
+ *
+ * ============================================================================
+ */
+
+struct J1939PgnHandlerEntry {
+    uint32_t pgn;
+    J1939_PGN_HANDLER handler;
+    void* user_data;
+};
+
+struct J1939PgnHandlers {
+    struct J1939PgnHandlerEntry table[J1939_PGN_HANDLER_TABLE_SIZE];
+
+    // Number of occupied slots in the table
+    int count;
+};
+
+/* ============================================================================
+ *
+ * Section: Function prototypes
+ *
+ * ============================================================================
+ */
+
+void
+j1939_pgn_handlers_init(
+    struct J1939PgnHandlers* handlers);
+
+// Add a handler for the given PGN, replacing any existing handler for it.
+// Return false if the table is full or the arguments are invalid.
+bool
+j1939_pgn_handlers_register(
+    struct J1939PgnHandlers* handlers,
+    uint32_t pgn,
+    J1939_PGN_HANDLER handler,
+    void* user_data);
+
+// Return false if no handler was registered for the given PGN
+bool
+j1939_pgn_handlers_unregister(
+    struct J1939PgnHandlers* handlers,
+    uint32_t pgn);
+
+// Return the entry registered for the given PGN, or NULL if there is none
+const struct J1939PgnHandlerEntry*
+j1939_pgn_handlers_lookup(
+    const struct J1939PgnHandlers* handlers,
+    uint32_t pgn);
@@ -0,0 +1,226 @@
+#include "j1939_pool.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+#define MAP_WORDS(blocks)  (((blocks) + 31) / 32)
+
+/* ============================================================================
+ *
+ * Section: Type definitions
+ *
+ * ============================================================================
+ */
+
+struct PoolClass {
+    uint8_t* blocks;
+    uint16_t block_size;
+    uint16_t num_blocks;
+
+    // One bit per block, set while the block is in use
+    uint32_t* used;
+
+    // Statistics, updated atomically
+    uint16_t in_use;
+    uint16_t high_water;
+    uint32_t exhausted;
+};
+
+/* ============================================================================
+ *
+ * Section: Static variables
+ *
+ * ============================================================================
+ */
+
+static uint8_t small_blocks[J1939_POOL_SMALL_BLOCKS][J1939_POOL_SMALL_SIZE];
+static uint8_t medium_blocks[J1939_POOL_MEDIUM_BLOCKS][J1939_POOL_MEDIUM_SIZE];
+static uint8_t large_blocks[J1939_POOL_LARGE_BLOCKS][J1939_POOL_LARGE_SIZE];
+
+static uint32_t small_used[MAP_WORDS(J1939_POOL_SMALL_BLOCKS)];
+static uint32_t medium_used[MAP_WORDS(J1939_POOL_MEDIUM_BLOCKS)];
+static uint32_t large_used[MAP_WORDS(J1939_POOL_LARGE_BLOCKS)];
+
+static struct PoolClass pool[J1939_POOL_CLASSES] = {
+    {
+        .blocks = &small_blocks[0][0],
+        .block_size = J1939_POOL_SMALL_SIZE,
+        .num_blocks = J1939_POOL_SMALL_BLOCKS,
+        .used = small_used
+    },
+    {
+        .blocks = &medium_blocks[0][0],
+        .block_size = J1939_POOL_MEDIUM_SIZE,
+        .num_blocks = J1939_POOL_MEDIUM_BLOCKS,
+        .used = medium_used
+    },
+    {
+        .blocks = &large_blocks[0][0],
+        .block_size = J1939_POOL_LARGE_SIZE,
+        .num_blocks = J1939_POOL_LARGE_BLOCKS,
+        .used = large_used
+    }
+};
+
+/* ============================================================================
+ *
+ * Section: Static function prototypes
+ *
+ * ============================================================================
+ */
+
+static uint8_t*
+class_alloc(
+    struct PoolClass* pc);
+
+/* ============================================================================
+ *
+ * Section: Function definitions
+ *
+ * ============================================================================
+ */
+
+uint8_t*
+j1939_pool_alloc(
+    uint16_t len)
+{
+    for (int i = 0; i < J1939_POOL_CLASSES; ++i)
+    {
+        struct PoolClass* pc = &pool[i];
+
+        if (len > pc->block_size)
+            continue;
+
+        uint8_t* block = class_alloc(pc);
+        if (block != NULL)
+            return block;
+
+        // This class is exhausted; a larger one will have to do
+        __atomic_fetch_add(&pc->exhausted, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+void
+j1939_pool_free(
+    uint8_t* block)
+{
+    if (block == NULL)
+        return;
+
+    for (int i = 0; i < J1939_POOL_CLASSES; ++i)
+    {
+        struct PoolClass* pc = &pool[i];
+        uint8_t* end = pc->blocks + ((size_t)pc->num_blocks * pc->block_size);
+
+        if ((block < pc->blocks) || (block >= end))
+            continue;
+
+        int idx = (block - pc->blocks) / pc->block_size;
+
+        __atomic_fetch_and(&pc->used[idx / 32], ~(1u << (idx % 32)), __ATOMIC_RELEASE);
+        __atomic_fetch_sub(&pc->in_use, 1, __ATOMIC_RELAXED);
+        return;
+    }
+}
+
+int
+j1939_pool_get_stats(
+    struct J1939PoolStats* stats,
+    int max_stats)
+{
+    for (int i = 0; (i < J1939_POOL_CLASSES) && (i < max_stats); ++i)
+    {
+        struct PoolClass* pc = &pool[i];
+
+        stats[i].block_size = pc->block_size;
+        stats[i].blocks = pc->num_blocks;
+        stats[i].in_use = __atomic_load_n(&pc->in_use, __ATOMIC_RELAXED);
+        stats[i].high_water = __atomic_load_n(&pc->high_water, __ATOMIC_RELAXED);
+        stats[i].exhausted = __atomic_load_n(&pc->exhausted, __ATOMIC_RELAXED);
+    }
+
+    return J1939_POOL_CLASSES;
+}
+
+void
+j1939_pool_reset_stats(void)
+{
+    for (int i = 0; i < J1939_POOL_CLASSES; ++i)
+    {
+        struct PoolClass* pc = &pool[i];
+
+        __atomic_store_n(
+            &pc->high_water,
+            __atomic_load_n(&pc->in_use, __ATOMIC_RELAXED),
+            __ATOMIC_RELAXED);
+        __atomic_store_n(&pc->exhausted, 0, __ATOMIC_RELAXED);
+    }
+}
+
+/* ============================================================================
+ *
+ * Section: Static function definitions
+ *
+ * ============================================================================
+ */
+
+static uint8_t*
+class_alloc(
+    struct PoolClass* pc)
+{
+    for (int w = 0; w < MAP_WORDS(pc->num_blocks); ++w)
+    {
+        uint32_t used = __atomic_load_n(&pc->used[w], __ATOMIC_RELAXED);
+
+        // Claim the lowest free bit of this word, retrying if another thread
+        //  changes the word under us
+        while (true)
+        {
+            int bits_in_word = pc->num_blocks - (w * 32);
+            uint32_t valid = (bits_in_word >= 32) ? 0xFFFFFFFFu : ((1u << bits_in_word) - 1);
+            uint32_t free_bits = ~used & valid;
+
+            if (free_bits == 0)
+                break;
+
+            int bit = __builtin_ctz(free_bits);
+
+            if (__atomic_compare_exchange_n(
+                    &pc->used[w],
+                    &used,
+                    used | (1u << bit),
+                    false,
+                    __ATOMIC_ACQUIRE,
+                    __ATOMIC_RELAXED))
+            {
+                uint16_t in_use = __atomic_add_fetch(&pc->in_use, 1, __ATOMIC_RELAXED);
+                uint16_t high_water = __atomic_load_n(&pc->high_water, __ATOMIC_RELAXED);
+
+                while ((in_use > high_water) &&
+                    !__atomic_compare_exchange_n(
+                        &pc->high_water,
+                        &high_water,
+                        in_use,
+                        true,
+                        __ATOMIC_RELAXED,
+                        __ATOMIC_RELAXED))
+                {
+                }
+
+                int idx = (w * 32) + bit;
+                return pc->blocks + ((size_t)idx * pc->block_size);
+            }
+        }
+    }
+
+    return NULL;
+}
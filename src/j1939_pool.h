@@ -0,0 +1,79 @@
+#pragma once
+
+/* ============================================================================
+ * File: j1939_pool.h
+ *
+ * Description: Fixed-block memory pool for transport protocol buffers.
+ *              Rather than every session embedding a J1939_TP_MAX_PAYLOAD
+ *              buffer, sessions borrow a block from a statically allocated
+ *              pool when a connection opens, sized from the length announced
+ *              in the RTS/BAM, and return it when the connection closes. The
+ *              pool has a few size classes; a request is served from the
+ *              smallest class that fits, falling back to larger classes when
+ *              that one is exhausted. A single pool is shared by every node
+ *              of every context. Each class tracks its used blocks in a
+ *              bitmap updated with atomic operations, so nodes driven from
+ *              different threads can share the pool without a lock.
+ * ============================================================================
+ */
+
+#include "j1939.h"
+
+#include <stdint.h>
+
+/* ============================================================================
+ *
+ * Section: Macros
+ *
+ * ============================================================================
+ */
+
+// Block sizes of the size classes, smallest first
+#define J1939_POOL_SMALL_SIZE   (64)
+#define J1939_POOL_MEDIUM_SIZE  (256)
+#define J1939_POOL_LARGE_SIZE   (J1939_TP_MAX_PAYLOAD)
+
+// Number of blocks in each size class
+#ifndef J1939_POOL_SMALL_BLOCKS
+#define J1939_POOL_SMALL_BLOCKS  (16)
+#endif
+
+#ifndef J1939_POOL_MEDIUM_BLOCKS
+#define J1939_POOL_MEDIUM_BLOCKS  (8)
+#endif
+
+#ifndef J1939_POOL_LARGE_BLOCKS
+#define J1939_POOL_LARGE_BLOCKS  (4)
+#endif
+
+#define J1939_POOL_CLASSES  (3)
+
+/* ============================================================================
+ *
+ * Section: Function prototypes
+ *
+ * ============================================================================
+ */
+
+// Borrow a block of at least len bytes. Return NULL if no class that fits has
+//  a free block left.
+uint8_t*
+j1939_pool_alloc(
+    uint16_t len);
+
+// Return a block obtained from j1939_pool_alloc(). NULL is ignored.
+void
+j1939_pool_free(
+    uint8_t* block);
+
+// Write the statistics of up to max_stats size classes, smallest first.
+//  Return the number of size classes.
+int
+j1939_pool_get_stats(
+    struct J1939PoolStats* stats,
+    int max_stats);
+
+// Reset each class's high-water mark to its current use, and its exhausted
+//  count to zero
+void
+j1939_pool_reset_stats(void);
@@ -1,4 +1,7 @@
 #include "j1939_private.h"
+#include "j1939_pool.h"
+#include "j1939_extended_transport_protocol.h"
+#include "j1939_pgn_db.h"
 
 #include <string.h>
 
@@ -17,6 +20,14 @@ struct J1939Private g_j1939[J1939_NODES];
 static struct J1939Private g_j1939[J1939_NODES];
 #endif
 
+// Context of the nodes initialized with j1939_init()
+static struct J1939Context default_context = {
+    .nodes = g_j1939,
+    .max_nodes = J1939_NODES,
+    .num_nodes = 0,
+    .user_data = NULL
+};
+
 /* ============================================================================
  *
  * Section: Static function prototypes
@@ -24,11 +35,55 @@ static struct J1939Private g_j1939[J1939_NODES];
  * ============================================================================
  */
 
+static struct J1939Private*
+node_private(
+    struct J1939* node);
+
+static void
+read_bus(
+    struct J1939* bus,
+    struct J1939* node);
+
+static void
+drain_ring(
+    struct J1939* bus,
+    struct J1939* node);
+
+static void
+receive_frame(
+    struct J1939* bus,
+    struct J1939* node,
+    struct J1939CanFrame* frame);
+
+static void
+process_frame(
+    struct J1939* node,
+    struct J1939CanFrame* frame);
+
+static void
+fan_out_frame(
+    struct J1939Context* ctx,
+    struct J1939CanFrame* frame);
+
+static bool
+accept_frame(
+    struct J1939* node,
+    struct J1939CanFrame* frame);
+
 static void
 dispatch(
     struct J1939* node,
     struct J1939Msg* msg);
 
+static void
+deliver(
+    struct J1939Private* jp,
+    struct J1939Msg* msg);
+
+static uint64_t
+node_deadline(
+    struct J1939Private* jp);
+
 /* ============================================================================
  *
  * Section: Function definitions
@@ -53,9 +108,54 @@ j1939_init(
     J1939_AC_STARTUP_DELAY_250MS startup_delay,
     void* startup_delay_param)
 {
-    static int next_idx = 0;
+    return j1939_context_node_init(
+        &default_context,
+        node,
+        name,
+        preferred_address,
+        tick_rate_ms,
+        can_rx,
+        can_tx,
+        j1939_rx,
+        startup_delay,
+        startup_delay_param);
+}
 
-    if (next_idx >= J1939_NODES)
+bool
+j1939_context_init(
+    struct J1939Context* ctx,
+    struct J1939Private* nodes,
+    int max_nodes,
+    void* user_data)
+{
+    if ((ctx == NULL) || (nodes == NULL) || (max_nodes <= 0))
+        return false;
+
+    ctx->nodes = nodes;
+    ctx->max_nodes = max_nodes;
+    ctx->num_nodes = 0;
+    ctx->user_data = user_data;
+
+    return true;
+}
+
+bool
+j1939_context_node_init(
+    struct J1939Context* ctx,
+    struct J1939* node,
+    struct J1939Name* name,
+    uint8_t preferred_address,
+    int tick_rate_ms,
+    J1939_CAN_RX can_rx,
+    J1939_CAN_TX can_tx,
+    J1939_MSG_RX j1939_rx,
+    J1939_AC_STARTUP_DELAY_250MS startup_delay,
+    void* startup_delay_param)
+{
+    if (ctx == NULL)
+        return false;
+
+    if (ctx->num_nodes >= ctx->max_nodes)
         return false;
 
     if ((node == NULL) || (name == NULL))
@@ -67,40 +167,47 @@ j1939_init(
     if (tick_rate_ms <= 0)
         return false;
 
-    if ((startup_delay == NULL)  ||
-        (j1939_rx == NULL)       ||
-        (can_rx == NULL)         ||
-        (can_tx == NULL))
-    {
+    // can_rx may be NULL if frames are only passed in with j1939_push_frame()
+    if (can_tx == NULL)
         return false;
-    }
 
-    node->node_idx = next_idx;
-    g_j1939[next_idx].j1939_public = node;
+    // No longer called, see J1939_AC_STARTUP_DELAY_250MS
+    (void)startup_delay, (void)startup_delay_param;
+
+    struct J1939Private* jp = &ctx->nodes[ctx->num_nodes];
+
+    node->ctx = ctx;
+    node->node_idx = ctx->num_nodes;
+    node->user_data = ctx->user_data;
+    jp->j1939_public = node;
 
     node->source_address = preferred_address;
     node->tick_rate_ms = tick_rate_ms;
     node->can_rx = can_rx;
+    node->can_rx_batch = NULL;
     node->can_tx = can_tx;
+    node->can_tx_batch = NULL;
     node->j1939_rx = j1939_rx;
 
+    j1939_pgn_handlers_init(&jp->pgn_handlers);
+    j1939_filter_init(&jp->filter);
+    j1939_frame_ring_init(&jp->rx_ring);
+
     j1939_tp_init(
-        &g_j1939[next_idx].tp,
-        next_idx,
+        &jp->tp,
+        node,
         tick_rate_ms);
 
 #ifndef J1939_LISTENER_ONLY_MODE
     j1939_ac_init(
-        &g_j1939[next_idx].ac,
-        next_idx,
-        name,
-        startup_delay,
-        startup_delay_param);
+        &jp->ac,
+        node,
+        name);
 #else
-    (void)startup_delay_param;
+    j1939_name_table_init(&jp->ac.names);
 #endif
 
-    next_idx++;
+    ctx->num_nodes++;
     return true;
 }
 
@@ -108,62 +215,531 @@ void
 j1939_update(
     struct J1939* node)
 {
-    struct J1939CanFrame frame;
-    struct J1939Msg msg;
-    uint8_t msg_buf[8];
-    msg.data = msg_buf;
+    struct J1939Private* jp = node_private(node);
 
-    while (node->can_rx(&frame))
+    read_bus(node, node);
+
+#ifndef J1939_LISTENER_ONLY_MODE
+    // The address claim keeps time with the transport protocol's clock
+    j1939_ac_update(&jp->ac, jp->tp.now_us);
+#endif
+
+    j1939_tp_update(&jp->tp);
+}
+
+void
+j1939_update_all(void)
+{
+    j1939_context_update(&default_context);
+}
+
+void
+j1939_context_update(
+    struct J1939Context* ctx)
+{
+    if (ctx->num_nodes == 0)
+        return;
+
+    // Every node is on the same bus, so it's read through the first node's
+    //  callbacks and each frame is offered to all nodes.
+    read_bus(ctx->nodes[0].j1939_public, NULL);
+
+    for (int i = 0; i < ctx->num_nodes; ++i)
     {
-        // Sanity check
-        if (frame.len > 8)
-            continue;
+    #ifndef J1939_LISTENER_ONLY_MODE
+        j1939_ac_update(&ctx->nodes[i].ac, ctx->nodes[i].tp.now_us);
+    #endif
+        j1939_tp_update(&ctx->nodes[i].tp);
+    }
+}
 
-        if (!j1939_can_frame_unpack(node, &frame, &msg))
-            continue;
+void
+j1939_update_at(
+    struct J1939* node,
+    uint64_t now_us)
+{
+    read_bus(node, node);
 
-        // Ignore peer-to-peer messages not addressed to us
-        if ((msg.dst != J1939_ADDR_GLOBAL) && (msg.dst != node->source_address))
-        {
-        #ifdef J1939_LISTENER_ONLY_MODE
-            node->j1939_rx(&msg);
-        #else
-            continue;
-        #endif
-        }
+#ifndef J1939_LISTENER_ONLY_MODE
+    j1939_ac_update(&node_private(node)->ac, now_us);
+#endif
 
-        dispatch(node, &msg);
+    j1939_tp_update_at(&node_private(node)->tp, now_us);
+}
+
+uint64_t
+j1939_next_deadline(
+    struct J1939* node)
+{
+    return node_deadline(node_private(node));
+}
+
+void
+j1939_context_update_at(
+    struct J1939Context* ctx,
+    uint64_t now_us)
+{
+    if (ctx->num_nodes == 0)
+        return;
+
+    read_bus(ctx->nodes[0].j1939_public, NULL);
+
+    for (int i = 0; i < ctx->num_nodes; ++i)
+    {
+    #ifndef J1939_LISTENER_ONLY_MODE
+        j1939_ac_update(&ctx->nodes[i].ac, now_us);
+    #endif
+        j1939_tp_update_at(&ctx->nodes[i].tp, now_us);
     }
+}
+
+uint64_t
+j1939_context_next_deadline(
+    struct J1939Context* ctx)
+{
+    uint64_t deadline = J1939_NO_DEADLINE;
 
-    j1939_tp_update(&g_j1939[node->node_idx].tp);
+    for (int i = 0; i < ctx->num_nodes; ++i)
+    {
+        uint64_t next = node_deadline(&ctx->nodes[i]);
+
+        if (next < deadline)
+            deadline = next;
+    }
+
+    return deadline;
+}
+
+void
+j1939_process_frames(
+    struct J1939* node,
+    struct J1939CanFrame* frames,
+    int num_frames)
+{
+    for (int i = 0; i < num_frames; ++i)
+        process_frame(node, &frames[i]);
+}
+
+bool
+j1939_push_frame(
+    struct J1939* node,
+    const struct J1939CanFrame* frame)
+{
+    return j1939_frame_ring_push(&node_private(node)->rx_ring, frame);
+}
+
+uint32_t
+j1939_dropped_frames(
+    struct J1939* node)
+{
+    return j1939_frame_ring_dropped(&node_private(node)->rx_ring);
+}
+
+void
+j1939_set_can_rx_batch(
+    struct J1939* node,
+    J1939_CAN_RX_BATCH can_rx_batch)
+{
+    node->can_rx_batch = can_rx_batch;
+}
+
+void
+j1939_set_can_tx_batch(
+    struct J1939* node,
+    J1939_CAN_TX_BATCH can_tx_batch)
+{
+    node->can_tx_batch = can_tx_batch;
+}
+
+void
+j1939_set_stream_sink(
+    struct J1939* node,
+    J1939_STREAM_SINK sink,
+    void* user_data)
+{
+    struct J1939TP* tp = &node_private(node)->tp;
+
+    tp->sink = sink;
+    tp->sink_data = user_data;
+}
+
+void
+j1939_set_tx_done(
+    struct J1939* node,
+    J1939_TX_DONE done,
+    void* user_data)
+{
+    struct J1939TP* tp = &node_private(node)->tp;
+
+    tp->tx_done = done;
+    tp->tx_done_data = user_data;
+}
+
+bool
+j1939_set_pgn_stream_sink(
+    struct J1939* node,
+    uint32_t pgn,
+    J1939_STREAM_SINK sink,
+    void* user_data)
+{
+    return j1939_tp_set_pgn_stream_sink(&node_private(node)->tp, pgn, sink, user_data);
+}
+
+void
+j1939_set_tp_timing(
+    struct J1939* node,
+    const struct J1939TPTiming* timing)
+{
+    j1939_tp_set_timing(&node_private(node)->tp, timing);
+}
+
+void
+j1939_set_tp_window(
+    struct J1939* node,
+    uint8_t packets)
+{
+    node_private(node)->tp.window_size = (packets == 0) ? 1 : packets;
+}
+
+bool
+j1939_register_pgn_handler(
+    struct J1939* node,
+    uint32_t pgn,
+    J1939_PGN_HANDLER handler,
+    void* user_data)
+{
+    return j1939_pgn_handlers_register(
+        &node_private(node)->pgn_handlers,
+        pgn,
+        handler,
+        user_data);
+}
+
+bool
+j1939_unregister_pgn_handler(
+    struct J1939* node,
+    uint32_t pgn)
+{
+    return j1939_pgn_handlers_unregister(
+        &node_private(node)->pgn_handlers,
+        pgn);
+}
+
+bool
+j1939_accept_pgn(
+    struct J1939* node,
+    uint32_t pgn)
+{
+    return j1939_filter_add_pgn(&node_private(node)->filter, pgn);
+}
+
+void
+j1939_accept_source(
+    struct J1939* node,
+    uint8_t source_address)
+{
+    j1939_filter_add_source(&node_private(node)->filter, source_address);
+}
+
+int
+j1939_export_filters(
+    struct J1939* node,
+    struct J1939CanIdFilter* filters,
+    int max_filters)
+{
+    return j1939_filter_export(
+        &node_private(node)->filter,
+        filters,
+        max_filters);
+}
+
+int
+j1939_pool_stats(
+    struct J1939PoolStats* stats,
+    int max_stats)
+{
+    return j1939_pool_get_stats(stats, max_stats);
+}
+
+void
+j1939_tx_queue_stats(
+    struct J1939* node,
+    struct J1939TxQueueStats* stats)
+{
+    *stats = node_private(node)->tp.tx_queue_stats;
 }
 
 bool
 j1939_tx(
     struct J1939* node,
     struct J1939Msg* msg)
+{
+    return j1939_tx_timed(node, msg, &node_private(node)->tp.timing);
+}
+
+bool
+j1939_tx_pgn(
+    struct J1939* node,
+    uint32_t pgn,
+    uint8_t* data,
+    uint16_t len,
+    uint8_t dst)
+{
+    const struct J1939PgnInfo* info = j1939_pgn_db_lookup(pgn);
+
+    if ((info != NULL) && (info->len != 0) && (info->len != len))
+        return false;
+
+    struct J1939Msg msg = {
+        .pgn = pgn,
+        .data = data,
+        .len = len,
+        .dst = dst,
+        .pri = (info != NULL) ? info->pri : J1939_DEFAULT_PRIORITY
+    };
+
+    return j1939_tx(node, &msg);
+}
+
+bool
+j1939_tx_to_name(
+    struct J1939* node,
+    struct J1939Msg* msg,
+    const struct J1939Name* name)
+{
+    uint8_t dst = j1939_name_to_address(node, name);
+
+    if (dst == J1939_ADDR_NULL)
+        return false;
+
+    msg->dst = dst;
+    return j1939_tx(node, msg);
+}
+
+bool
+j1939_tx_commanded_address(
+    struct J1939* node,
+    const struct J1939Name* name,
+    uint8_t new_address)
+{
+    if (new_address >= J1939_AC_MAX_ADDRESSES)
+        return false;
+
+    struct J1939_COMMANDED_ADDRESS command = {
+        .name = *name,
+        .new_source_address = new_address
+    };
+
+    return j1939_tx_pgn(
+        node,
+        J1939_COMMANDED_ADDRESS_PGN,
+        (uint8_t*)&command,
+        J1939_COMMANDED_ADDRESS_LEN,
+        J1939_ADDR_GLOBAL);
+}
+
+bool
+j1939_tx_zero_copy(
+    struct J1939* node,
+    struct J1939Msg* msg,
+    J1939_TX_DONE done,
+    void* user_data)
 {
 #ifndef J1939_LISTENER_ONLY_MODE
-    if (g_j1939[node->node_idx].ac.cannot_claim_address)
+    if (!j1939_ac_has_address(&node_private(node)->ac))
         return false;
 
     msg->src = node->source_address;
 
     if (msg->len > 8)
     {
-        struct J1939Private* jp = &g_j1939[node->node_idx];
-        return j1939_tp_queue(&jp->tp, msg);
+        struct J1939TP* tp = &node_private(node)->tp;
+        return j1939_tp_queue_zero_copy(tp, msg, &tp->timing, done, user_data);
+    }
+
+    if (!node->can_tx(node->user_data, msg))
+        return false;
+
+    if (done != NULL)
+    {
+        struct J1939TxResult result = {
+            .status = J1939_TX_SENT,
+            .size = msg->len,
+            .bytes_sent = msg->len
+        };
+        done(user_data, msg, &result);
+    }
+
+    return true;
+#else
+    (void)node, (void)msg, (void)done, (void)user_data;
+    return false;
+#endif
+}
+
+bool
+j1939_tx_stream(
+    struct J1939* node,
+    uint32_t pgn,
+    uint8_t dst,
+    uint8_t pri,
+    uint32_t size,
+    J1939_STREAM_SOURCE source,
+    void* user_data)
+{
+#ifndef J1939_LISTENER_ONLY_MODE
+    if (!j1939_ac_has_address(&node_private(node)->ac))
+        return false;
+
+    if ((dst == J1939_ADDR_GLOBAL) ||
+        (size <= J1939_TP_MAX_PAYLOAD) ||
+        (size > J1939_ETP_MAX_SIZE) ||
+        (source == NULL))
+    {
+        return false;
+    }
+
+    struct J1939Msg msg = {
+        .pgn = pgn,
+        .src = node->source_address,
+        .dst = dst,
+        .pri = pri
+    };
+
+    return j1939_tp_open_stream(&node_private(node)->tp, &msg, size, source, user_data);
+#else
+    (void)node, (void)pgn, (void)dst, (void)pri, (void)size, (void)source, (void)user_data;
+    return false;
+#endif
+}
+
+bool
+j1939_tx_timed(
+    struct J1939* node,
+    struct J1939Msg* msg,
+    const struct J1939TPTiming* timing)
+{
+#ifndef J1939_LISTENER_ONLY_MODE
+    if (!j1939_ac_has_address(&node_private(node)->ac))
+        return false;
+
+    msg->src = node->source_address;
+
+    if (msg->len > 8)
+    {
+        struct J1939Private* jp = node_private(node);
+        return j1939_tp_queue_timed(&jp->tp, msg, timing);
     }
     else
     {
-        return node->can_tx(msg);
+        return node->can_tx(node->user_data, msg);
     }
 #else
-    (void)node, (void)msg;
+    (void)node, (void)msg, (void)timing;
+    return false;
+#endif
+}
+
+bool
+j1939_is_address_claimed(
+    struct J1939* node)
+{
+#ifndef J1939_LISTENER_ONLY_MODE
+    return j1939_ac_has_address(&node_private(node)->ac);
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+void
+j1939_get_address_snapshot(
+    struct J1939* node,
+    struct J1939AddressSnapshot* snapshot)
+{
+#ifndef J1939_LISTENER_ONLY_MODE
+    j1939_ac_snapshot(&node_private(node)->ac, snapshot);
+#else
+    (void)node;
+    memset(snapshot, 0, sizeof(*snapshot));
+#endif
+}
+
+bool
+j1939_restore_address_snapshot(
+    struct J1939* node,
+    const struct J1939AddressSnapshot* snapshot)
+{
+#ifndef J1939_LISTENER_ONLY_MODE
+    return j1939_ac_restore(&node_private(node)->ac, snapshot);
+#else
+    (void)node, (void)snapshot;
     return false;
 #endif
 }
 
+void
+j1939_set_address_hook(
+    struct J1939* node,
+    J1939_ADDRESS_HOOK hook,
+    void* user_data)
+{
+#ifndef J1939_LISTENER_ONLY_MODE
+    struct J1939AC* ac = &node_private(node)->ac;
+
+    ac->hook = hook;
+    ac->hook_data = user_data;
+
+    // A claim outside the self-configurable range completes within
+    //  j1939_init() itself, before there was a hook to tell
+    if ((hook != NULL) && j1939_ac_has_address(ac))
+        hook(user_data, node);
+#else
+    (void)node, (void)hook, (void)user_data;
+#endif
+}
+
+void
+j1939_set_address_policy(
+    struct J1939* node,
+    enum j1939_address_policy policy)
+{
+    node_private(node)->ac.policy = policy;
+}
+
+uint8_t
+j1939_name_to_address(
+    struct J1939* node,
+    const struct J1939Name* name)
+{
+    uint64_t value;
+    memcpy(&value, name, sizeof(value));
+
+    return j1939_name_table_address(&node_private(node)->ac.names, value);
+}
+
+bool
+j1939_address_to_name(
+    struct J1939* node,
+    uint8_t address,
+    struct J1939Name* name)
+{
+    uint64_t value;
+
+    if (!j1939_name_table_name(&node_private(node)->ac.names, address, &value))
+        return false;
+
+    memcpy(name, &value, sizeof(value));
+    return true;
+}
+
+const struct J1939PgnInfo*
+j1939_pgn_info(
+    uint32_t pgn)
+{
+    return j1939_pgn_db_lookup(pgn);
+}
+
 uint32_t
 j1939_msg_to_can_id(
     struct J1939Msg* msg)
@@ -223,7 +799,7 @@ j1939_can_frame_unpack(
     if (!((frame->id >> 31) & 1))
         return false;
 
-    struct J1939Private* jp = &g_j1939[node->node_idx];
+    struct J1939Private* jp = node_private(node);
 
     if (j1939_can_id_converter(&jp->can_id_converter, frame->id))
         msg->dst = J1939_ADDR_GLOBAL;
@@ -235,7 +811,8 @@ j1939_can_frame_unpack(
     msg->pri = jp->can_id_converter.pri;
     msg->len = frame->len;
 
-    memcpy(msg->data, frame->data, frame->len);
+    // Borrow the payload from the frame rather than copying it
+    msg->data = frame->data;
 
     return true;
 }
@@ -245,55 +822,100 @@ j1939_can_frame_unpack(
  * ============================================================================
  */
 
-void
+bool
 j1939_tx_helper(
-    int node_idx,
+    struct J1939* node,
+    uint32_t pgn,
+    uint8_t* data,
+    uint16_t len,
+    uint8_t dst,
+    uint8_t pri)
+{
+    struct J1939Msg msg = {
+        .pgn = pgn,
+        .data = data,
+        .len = len,
+        .dst = dst,
+        .pri = pri
+    };
+
+    return j1939_tx(node, &msg);
+}
+
+bool
+j1939_tx_claim_helper(
+    struct J1939* node,
     uint32_t pgn,
     uint8_t* data,
     uint16_t len,
     uint8_t dst,
     uint8_t pri)
 {
-    struct J1939Private* jp = &g_j1939[node_idx];
     struct J1939Msg msg = {
         .pgn = pgn,
         .data = data,
         .len = len,
+        .src = node->source_address,
         .dst = dst,
         .pri = pri
     };
 
-    (void)j1939_tx(jp->j1939_public, &msg);
+    return node->can_tx(node->user_data, &msg);
 }
 
 void
 j1939_rx_helper(
-    int node_idx,
+    struct J1939* node,
     struct J1939Msg* msg)
 {
-    g_j1939[node_idx].j1939_public->j1939_rx(msg);
+#ifndef J1939_LISTENER_ONLY_MODE
+    // The only protocol message too long for a single frame
+    if (msg->pgn == J1939_COMMANDED_ADDRESS_PGN)
+    {
+        j1939_ac_rx_commanded_address(&node_private(node)->ac, msg);
+        return;
+    }
+#endif
+
+    deliver(node_private(node), msg);
+}
+
+bool
+j1939_is_pgn_wanted(
+    struct J1939* node,
+    uint32_t pgn)
+{
+    struct J1939Private* jp = node_private(node);
+
+#ifndef J1939_LISTENER_ONLY_MODE
+    if (pgn == J1939_COMMANDED_ADDRESS_PGN)
+        return true;
+#endif
+
+    return (jp->j1939_public->j1939_rx != NULL) ||
+        (j1939_pgn_handlers_lookup(&jp->pgn_handlers, pgn) != NULL);
 }
 
 void
 j1939_set_source_address(
-    int node_idx,
+    struct J1939* node,
     uint8_t new_address)
 {
-    g_j1939[node_idx].j1939_public->source_address = new_address;
+    node->source_address = new_address;
 }
 
 uint8_t
 j1939_get_source_address(
-    int node_idx)
+    struct J1939* node)
 {
-    return g_j1939[node_idx].j1939_public->source_address;
+    return node->source_address;
 }
 
 void
-j1939_close_transport_protocol_connection(
-    int node_idx)
+j1939_close_transport_protocol_sessions(
+    struct J1939* node)
 {
-    j1939_tp_close_connection(&g_j1939[node_idx].tp);
+    j1939_tp_close_all(&node_private(node)->tp);
 }
 
 /* ============================================================================
@@ -303,17 +925,188 @@ j1939_close_transport_protocol_connection(
  * ============================================================================
  */
 
+static struct J1939Private*
+node_private(
+    struct J1939* node)
+{
+    return &node->ctx->nodes[node->node_idx];
+}
+
+// Receive every pending frame: first those pushed into the bus node's ring,
+//  then those returned by its callbacks. Frames are passed to the given node,
+//  or to every node if node is NULL.
+static void
+read_bus(
+    struct J1939* bus,
+    struct J1939* node)
+{
+    drain_ring(bus, node);
+
+    if (bus->can_rx_batch != NULL)
+    {
+        struct J1939CanFrame frames[J1939_RX_BATCH_SIZE];
+        int num_frames;
+
+        // Keep pulling batches until the callback returns a partial batch
+        do
+        {
+            num_frames = bus->can_rx_batch(
+                bus->user_data,
+                frames,
+                J1939_RX_BATCH_SIZE);
+
+            for (int i = 0; i < num_frames; ++i)
+                receive_frame(bus, node, &frames[i]);
+        } while (num_frames == J1939_RX_BATCH_SIZE);
+    }
+    else if (bus->can_rx != NULL)
+    {
+        struct J1939CanFrame frame;
+
+        while (bus->can_rx(bus->user_data, &frame))
+            receive_frame(bus, node, &frame);
+    }
+}
+
+// Frames are processed in place, inside the ring, and only then released to
+//  the producer.
+static void
+drain_ring(
+    struct J1939* bus,
+    struct J1939* node)
+{
+    struct J1939FrameRing* ring = &node_private(bus)->rx_ring;
+    struct J1939CanFrame* frames;
+    int num_frames;
+
+    // Take at most one ring's worth of frames per update, so that a producer
+    //  that never pauses can't hold up the transport protocol timers
+    int budget = J1939_FRAME_RING_SIZE;
+
+    while ((budget > 0) && ((num_frames = j1939_frame_ring_peek(ring, &frames)) > 0))
+    {
+        if (num_frames > budget)
+            num_frames = budget;
+
+        for (int i = 0; i < num_frames; ++i)
+            receive_frame(bus, node, &frames[i]);
+
+        j1939_frame_ring_consume(ring, num_frames);
+        budget -= num_frames;
+    }
+}
+
+static void
+receive_frame(
+    struct J1939* bus,
+    struct J1939* node,
+    struct J1939CanFrame* frame)
+{
+    if (node != NULL)
+        process_frame(node, frame);
+    else
+        fan_out_frame(bus->ctx, frame);
+}
+
+static void
+process_frame(
+    struct J1939* node,
+    struct J1939CanFrame* frame)
+{
+    struct J1939Msg msg;
+
+    if (!accept_frame(node, frame))
+        return;
+
+    if (!j1939_can_frame_unpack(node, frame, &msg))
+        return;
+
+#ifdef J1939_LISTENER_ONLY_MODE
+    // Peer-to-peer messages not addressed to us are passed on as well
+    if ((msg.dst != J1939_ADDR_GLOBAL) && (msg.dst != node->source_address))
+        deliver(node_private(node), &msg);
+#endif
+
+    dispatch(node, &msg);
+}
+
+static void
+fan_out_frame(
+    struct J1939Context* ctx,
+    struct J1939CanFrame* frame)
+{
+    struct J1939Msg decoded;
+    bool is_decoded = false;
+
+    for (int i = 0; i < ctx->num_nodes; ++i)
+    {
+        struct J1939* node = ctx->nodes[i].j1939_public;
+
+        if (!accept_frame(node, frame))
+            continue;
+
+        // The frame is decoded once, by the first node that accepts it
+        if (!is_decoded)
+        {
+            if (!j1939_can_frame_unpack(node, frame, &decoded))
+                return;
+
+            is_decoded = true;
+        }
+
+        // Each node gets its own copy of the header, in case a callback
+        //  modifies it
+        struct J1939Msg msg = decoded;
+
+    #ifdef J1939_LISTENER_ONLY_MODE
+        if ((msg.dst != J1939_ADDR_GLOBAL) && (msg.dst != node->source_address))
+            deliver(&ctx->nodes[i], &msg);
+    #endif
+
+        dispatch(node, &msg);
+    }
+}
+
+// Return true if the node wants this frame, judging only by its raw ID
+static bool
+accept_frame(
+    struct J1939* node,
+    struct J1939CanFrame* frame)
+{
+    // Sanity check
+    if (frame->len > 8)
+        return false;
+
+    // Reject unwanted frames by their raw ID, before doing any decoding
+    if (!j1939_filter_accept(&node_private(node)->filter, frame->id))
+        return false;
+
+#ifndef J1939_LISTENER_ONLY_MODE
+    // Ignore peer-to-peer messages not addressed to us. For PDU1 frames
+    //  (PF < 240) the PS field holds the destination address.
+    uint8_t pf = (frame->id >> 16) & 0xFF;
+    uint8_t ps = (frame->id >> 8) & 0xFF;
+
+    if ((pf < 240) && (ps != J1939_ADDR_GLOBAL) && (ps != node->source_address))
+        return false;
+#endif
+
+    return true;
+}
+
 static void
 dispatch(
     struct J1939* node,
     struct J1939Msg* msg)
 {
-    struct J1939Private* jp = &g_j1939[node->node_idx];
+    struct J1939Private* jp = node_private(node);
 
     switch (msg->pgn)
     {
     case J1939_TP_CM_PGN:
     case J1939_TP_DT_PGN:
+    case J1939_ETP_CM_PGN:
+    case J1939_ETP_DT_PGN:
         j1939_tp_dispatch(&jp->tp, msg);
         break;
 
@@ -332,7 +1125,38 @@ dispatch(
 #endif
 
     default:
-        node->j1939_rx(msg);
+        deliver(jp, msg);
         break;
     }
 }
+
+static void
+deliver(
+    struct J1939Private* jp,
+    struct J1939Msg* msg)
+{
+    const struct J1939PgnHandlerEntry* entry =
+        j1939_pgn_handlers_lookup(&jp->pgn_handlers, msg->pgn);
+
+    if (entry != NULL)
+        entry->handler(entry->user_data, msg);
+    else if (jp->j1939_public->j1939_rx != NULL)
+        jp->j1939_public->j1939_rx(jp->j1939_public->user_data, msg);
+}
+
+// The earlier of the address claim's and the transport protocol's deadlines
+static uint64_t
+node_deadline(
+    struct J1939Private* jp)
+{
+    uint64_t deadline = j1939_tp_next_deadline(&jp->tp);
+
+#ifndef J1939_LISTENER_ONLY_MODE
+    uint64_t ac_deadline = j1939_ac_next_deadline(&jp->ac);
+
+    if (ac_deadline < deadline)
+        deadline = ac_deadline;
+#endif
+
+    return deadline;
+}
@@ -6,18 +6,25 @@
  * Description: "Private" J1939 implementation. The J1939Private struct holds
  *              a pointer to a J1939 struct, created by the application layer
  *              and passed as a parameter to the top-level init function.
- *              The corresponding source file defines a static global array of
- *              J1939Private objects. Other translation units (transport
- *              protocol and address claim) are linked to a global J1939Private
- *              object via a node_idx variable, which indexes into the global
- *              array. This header file provides helper function to those
- *              translation units for interfacing with this "private" data.
+ *              J1939Private objects live in the node array of a context
+ *              (J1939Context), indexed by the node's node_idx. The
+ *              corresponding source file defines a static global array of
+ *              J1939Private objects for the default context. Other translation
+ *              units (transport protocol and address claim) keep a pointer to
+ *              their J1939 node, through which they reach its context. This
+ *              header file provides helper function to those translation units
+ *              for interfacing with this "private" data.
+ *              Applications creating their own contexts include this header
+ *              to allocate the node storage.
  * ============================================================================
  */
 
 #include "j1939.h"
 #include "j1939_transport_protocol.h"
 #include "j1939_address_claim.h"
+#include "j1939_pgn_handler.h"
+#include "j1939_filter.h"
+#include "j1939_frame_ring.h"
 
 /* ============================================================================
  *
@@ -26,13 +33,22 @@
  * ============================================================================
  */
 
-struct J1939Private {
+// Aligned to a cache line so that nodes of different contexts, driven from
+//  different threads, never share one.
+struct __attribute__((aligned(J1939_CACHE_LINE_SIZE))) J1939Private {
     struct J1939* j1939_public;
 
     struct J1939TP tp;
 
     struct J1939AC ac;
 
+    struct J1939PgnHandlers pgn_handlers;
+
+    struct J1939Filter filter;
+
+    // Frames pushed with j1939_push_frame(), drained by the update functions
+    struct J1939FrameRing rx_ring;
+
     // CAN ID fields of the most recently processed CAN frame
     struct CanIdConverter {
         uint8_t pri;
@@ -60,7 +76,8 @@ j1939_can_id_converter(
     struct CanIdConverter* converter,
     uint32_t id);
 
-// Return false if the CAN frame is a standard frame (CAN 2.0A); true otherwise
+// Return false if the CAN frame is a standard frame (CAN 2.0A); true otherwise.
+// The payload is not copied: msg->data is set to point at frame->data.
 bool
 j1939_can_frame_unpack(
     struct J1939* node,
@@ -72,29 +89,52 @@ j1939_can_frame_unpack(
  * ============================================================================
  */
 
-void
+// Return the result of can_tx
+bool
 j1939_tx_helper(
-    int node_idx,
+    struct J1939* node,
     uint32_t pgn,
     uint8_t* data,
     uint16_t len,
     uint8_t dst,
     uint8_t pri);
 
+// Same as j1939_tx_helper(), but sent even while the node doesn't hold an
+//  address, for the address claim's own single-frame messages
+bool
+j1939_tx_claim_helper(
+    struct J1939* node,
+    uint32_t pgn,
+    uint8_t* data,
+    uint16_t len,
+    uint8_t dst,
+    uint8_t pri);
+
+// Pass a complete message to its registered PGN handler, or to the j1939_rx
+//  callback if there isn't one. Commanded Address messages go to the address
+//  claim instead.
 void
 j1939_rx_helper(
-    int node_idx,
+    struct J1939* node,
     struct J1939Msg* msg);
 
+// Return true if a message with the given PGN would be passed to the
+//  application, i.e. it has a registered handler or there's a j1939_rx
+//  callback. Used to avoid reassembling messages nobody will consume.
+bool
+j1939_is_pgn_wanted(
+    struct J1939* node,
+    uint32_t pgn);
+
 void
 j1939_set_source_address(
-    int node_idx,
+    struct J1939* node,
     uint8_t new_address);
 
 uint8_t
 j1939_get_source_address(
-    int node_idx);
+    struct J1939* node);
 
 void
-j1939_close_transport_protocol_connection(
-    int node_idx);
+j1939_close_transport_protocol_sessions(
+    struct J1939* node);
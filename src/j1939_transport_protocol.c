@@ -1,6 +1,9 @@
 #include "j1939_transport_protocol_helper.h"
+#include "j1939_extended_transport_protocol.h"
 #include "j1939_private.h"
+#include "j1939_pool.h"
 
+#include <limits.h>
 #include <string.h>
 
 /* ============================================================================
@@ -13,6 +16,13 @@
 // Find the ceiling of the result of a / b, where a and b are positive integers
 #define CEIL_DIV(a, b)  ( ((a) / (b)) + (((a) % (b)) != 0) )
 
+#define J1939_TP_SESSIONS  (J1939_TP_RX_SESSIONS + J1939_TP_TX_SESSIONS)
+
+_Static_assert(
+    (J1939_TP_RX_SESSIONS < J1939_TP_NO_SESSION) &&
+        (J1939_TP_TX_SESSIONS < J1939_TP_NO_SESSION),
+    "Session indices must fit in the index tables");
+
 /* ============================================================================
  *
  * Section: Static function prototypes
@@ -22,8 +32,100 @@
 
 static bool
 is_connection_active(
+    struct J1939TPSession* session);
+
+static struct J1939TPSession*
+session_at(
+    struct J1939TP* tp,
+    int i);
+
+static struct J1939TPSession*
+alloc_session(
+    struct J1939TPSession* sessions,
+    int num_sessions);
+
+static uint8_t*
+session_index_entry(
+    struct J1939TPSession* session);
+
+static void
+enqueue(
+    struct J1939TP* tp,
+    struct J1939TPQueueEntry* entry);
+
+static void
+start_queued(
     struct J1939TP* tp);
 
+static void
+clamp_timing(
+    struct J1939TPTiming* timing);
+
+static void
+open_tx_session(
+    struct J1939TP* tp,
+    struct J1939TPSession* session,
+    struct J1939Msg* msg);
+
+static void
+open_rx_session(
+    struct J1939TP* tp,
+    struct J1939Msg* msg);
+
+static void
+open_etp_rx_session(
+    struct J1939TP* tp,
+    struct J1939Msg* msg);
+
+static void
+dispatch_etp(
+    struct J1939TP* tp,
+    struct J1939Msg* msg);
+
+static struct J1939TPStreamSink*
+find_stream_sink(
+    struct J1939TP* tp,
+    uint32_t pgn);
+
+static void
+send_abort(
+    struct J1939TP* tp,
+    uint32_t cm_pgn,
+    enum j1939_tp_abort_reason reason,
+    uint32_t pgn,
+    uint8_t dst);
+
+static bool
+aborts_role(
+    struct J1939Msg* msg,
+    enum j1939_tp_abort_role role);
+
+static uint32_t
+elapsed_us(
+    struct J1939TP* tp,
+    uint64_t since_us);
+
+static void
+report_tx_done(
+    struct J1939TP* tp,
+    J1939_TX_DONE done,
+    void* done_data,
+    struct J1939Msg* msg,
+    const struct J1939TxResult* result);
+
+static struct J1939TPSession*
+find_tp_session(
+    struct J1939TPSession* session);
+
+static void
+run_connection(
+    struct J1939TPSession* session);
+
+static void
+advance_timer(
+    struct J1939TPSession* session,
+    uint64_t now_us);
+
 /* ============================================================================
  *
  * Section: Function definitions
@@ -34,14 +136,46 @@ is_connection_active(
 void
 j1939_tp_init(
     struct J1939TP* tp,
-    int node_idx,
+    struct J1939* node,
     int tick_rate_ms)
 {
-    tp->node_idx = node_idx;
-
-    tp->connection = J1939_TP_CONNECTION_NONE;
-    tp->msg_info.data = tp->buf;
+    tp->node = node;
     tp->tick_rate_ms = tick_rate_ms;
+    tp->window_size = J1939_TP_CTS_WINDOW;
+    tp->timing = (struct J1939TPTiming) {
+        .bam_gap_ms = J1939_TP_TX_PERIOD,
+        .p2p_gap_ms = J1939_TP_TX_PERIOD,
+        .cts_delay_ms = J1939_TP_TX_PERIOD
+    };
+
+    tp->sink = NULL;
+    tp->sink_data = NULL;
+    tp->tx_done = NULL;
+    tp->tx_done_data = NULL;
+    tp->num_stream_sinks = 0;
+
+    for (int i = 0; i < J1939_TP_SESSIONS; ++i)
+    {
+        struct J1939TPSession* session = session_at(tp, i);
+
+        session->tp = tp;
+        session->connection = J1939_TP_CONNECTION_NONE;
+        session->buf = NULL;
+        session->sink = NULL;
+        session->buf_borrowed = false;
+        session->done = NULL;
+        session->msg_info.data = NULL;
+        j1939_tp_restart_timer(session);
+    }
+
+    memset(tp->rx_broadcast_by_src, J1939_TP_NO_SESSION, sizeof(tp->rx_broadcast_by_src));
+    memset(tp->rx_p2p_by_src, J1939_TP_NO_SESSION, sizeof(tp->rx_p2p_by_src));
+    memset(tp->tx_p2p_by_dst, J1939_TP_NO_SESSION, sizeof(tp->tx_p2p_by_dst));
+    tp->tx_broadcast = J1939_TP_NO_SESSION;
+
+    tp->tx_queue_len = 0;
+    memset(&tp->tx_queue_stats, 0, sizeof(tp->tx_queue_stats));
+    tp->now_us = 0;
 }
 
 bool
@@ -49,85 +183,285 @@ j1939_tp_queue(
     struct J1939TP* tp,
     struct J1939Msg* msg)
 {
-    if (is_connection_active(tp))
+    return j1939_tp_queue_timed(tp, msg, &tp->timing);
+}
+
+bool
+j1939_tp_queue_timed(
+    struct J1939TP* tp,
+    struct J1939Msg* msg,
+    const struct J1939TPTiming* timing)
+{
+    struct J1939TxQueueStats* stats = &tp->tx_queue_stats;
+
+    if (tp->tx_queue_len == J1939_TP_TX_QUEUE_SIZE)
+    {
+        stats->rejected++;
         return false;
+    }
 
-    memcpy(tp->buf, msg->data, msg->len);
-    tp->sender = true;
-    tp->next_seq = 1;
-    tp->bytes_rem = msg->len;
-    tp->num_packages = CEIL_DIV(msg->len, 7);
-    tp->timer_ms = 0;
-    tp->clear_to_send = false;
+    uint8_t* buf = j1939_pool_alloc(msg->len);
+    if (buf == NULL)
+    {
+        stats->rejected++;
+        return false;
+    }
 
-    tp->msg_info.pgn = msg->pgn;
-    tp->msg_info.len = msg->len;
-    tp->msg_info.src = msg->src;
-    tp->msg_info.dst = msg->dst;
-    tp->msg_info.pri = msg->pri;
+    memcpy(buf, msg->data, msg->len);
 
-    if (msg->dst == J1939_ADDR_GLOBAL)
+    struct J1939TPQueueEntry entry = {
+        .msg = *msg,
+        .timing = *timing,
+        .buf_borrowed = false,
+        .done = NULL,
+        .done_data = NULL
+    };
+    entry.msg.data = buf;
+
+    enqueue(tp, &entry);
+    return true;
+}
+
+bool
+j1939_tp_queue_zero_copy(
+    struct J1939TP* tp,
+    struct J1939Msg* msg,
+    const struct J1939TPTiming* timing,
+    J1939_TX_DONE done,
+    void* done_data)
+{
+    if ((tp->tx_queue_len == J1939_TP_TX_QUEUE_SIZE) || (msg->len > J1939_TP_MAX_PAYLOAD))
     {
-        tp->connection = J1939_TP_CONNECTION_BROADCAST;
+        tp->tx_queue_stats.rejected++;
+        return false;
+    }
 
-        struct J1939_TP_CM_BAM bam;
-        j1939_tp_bam_pack(tp, &bam);
-        j1939_tx_helper(
-            tp->node_idx,
-            J1939_TP_CM_PGN,
-            (uint8_t*)&bam,
-            J1939_TP_CM_LEN,
-            tp->msg_info.dst,
-            J1939_TP_CM_PRI);
+    struct J1939TPQueueEntry entry = {
+        .msg = *msg,
+        .timing = *timing,
+        .buf_borrowed = true,
+        .done = done,
+        .done_data = done_data
+    };
+
+    enqueue(tp, &entry);
+    return true;
+}
+
+bool
+j1939_tp_open_stream(
+    struct J1939TP* tp,
+    struct J1939Msg* msg,
+    uint32_t size,
+    J1939_STREAM_SOURCE source,
+    void* source_data)
+{
+    if (j1939_tp_find_tx_session(tp, msg->dst) != NULL)
+        return false;
+
+    struct J1939TPSession* session =
+        alloc_session(tp->tx_sessions, J1939_TP_TX_SESSIONS);
+
+    if (session == NULL)
+        return false;
+
+    session->buf = NULL;
+    session->msg_info = *msg;
+    session->msg_info.data = NULL;
+    session->msg_info.len = 0;
+    session->timing = tp->timing;
+    session->sender = true;
+    session->queued_us = tp->now_us;
+    session->connection = J1939_TP_CONNECTION_ETP;
+    *session_index_entry(session) = session - tp->tx_sessions;
+
+    // If the RTS can't be sent, the message was never accepted
+    if (!j1939_etp_start(session, size, source, source_data))
+    {
+        *session_index_entry(session) = J1939_TP_NO_SESSION;
+        session->connection = J1939_TP_CONNECTION_NONE;
+        return false;
     }
-    else
+
+    return true;
+}
+
+bool
+j1939_tp_set_pgn_stream_sink(
+    struct J1939TP* tp,
+    uint32_t pgn,
+    J1939_STREAM_SINK sink,
+    void* sink_data)
+{
+    struct J1939TPStreamSink* entry = find_stream_sink(tp, pgn);
+
+    if (sink == NULL)
     {
-        tp->connection = J1939_TP_CONNECTION_P2P;
+        // Removing a sink that isn't set is fine
+        if (entry != NULL)
+        {
+            *entry = tp->stream_sinks[tp->num_stream_sinks - 1];
+            tp->num_stream_sinks--;
+        }
+        return true;
+    }
 
-        struct J1939_TP_CM_RTS rts;
-        j1939_tp_rts_pack(tp, &rts);
-        j1939_tx_helper(
-            tp->node_idx,
-            J1939_TP_CM_PGN,
-            (uint8_t*)&rts,
-            J1939_TP_CM_LEN,
-            tp->msg_info.dst,
-            J1939_TP_CM_PRI);
+    if (entry == NULL)
+    {
+        if (tp->num_stream_sinks == J1939_TP_STREAM_SINKS)
+            return false;
+
+        entry = &tp->stream_sinks[tp->num_stream_sinks++];
+        entry->pgn = pgn;
     }
 
+    entry->sink = sink;
+    entry->sink_data = sink_data;
     return true;
 }
 
+void
+j1939_tp_set_timing(
+    struct J1939TP* tp,
+    const struct J1939TPTiming* timing)
+{
+    tp->timing = *timing;
+    clamp_timing(&tp->timing);
+}
+
 void
 j1939_tp_update(
     struct J1939TP* tp)
 {
-    if (!is_connection_active(tp))
-        return;
+    for (int i = 0; i < J1939_TP_SESSIONS; ++i)
+    {
+        struct J1939TPSession* session = session_at(tp, i);
+
+        if (!is_connection_active(session))
+            continue;
+
+        run_connection(session);
+
+        session->timer_ms += tp->tick_rate_ms;
+    }
+
+    // Sessions closed by this update make room for queued messages
+    start_queued(tp);
+
+    tp->now_us += (uint64_t)tp->tick_rate_ms * 1000;
+}
+
+void
+j1939_tp_update_at(
+    struct J1939TP* tp,
+    uint64_t now_us)
+{
+    tp->now_us = now_us;
 
-    if (tp->connection == J1939_TP_CONNECTION_BROADCAST)
+    for (int i = 0; i < J1939_TP_SESSIONS; ++i)
     {
-        if (tp->sender)
-            j1939_tp_broadcast_update_sender(tp);
-        else
-            j1939_tp_broadcast_update_receiver(tp);
+        struct J1939TPSession* session = session_at(tp, i);
+
+        if (!is_connection_active(session))
+            continue;
+
+        advance_timer(session, now_us);
+
+        run_connection(session);
     }
-    else
+
+    start_queued(tp);
+
+    // Timers restarted by this update, including those of the sessions just
+    //  started, were restarted now
+    for (int i = 0; i < J1939_TP_SESSIONS; ++i)
+    {
+        struct J1939TPSession* session = session_at(tp, i);
+
+        if (is_connection_active(session) &&
+            (session->timer_stamp_us == J1939_TP_TIMER_UNSTAMPED))
+        {
+            session->timer_stamp_us = now_us;
+        }
+    }
+}
+
+uint64_t
+j1939_tp_next_deadline(
+    struct J1939TP* tp)
+{
+    uint64_t deadline = J1939_NO_DEADLINE;
+
+    for (int i = 0; i < J1939_TP_SESSIONS; ++i)
     {
-        if (tp->sender)
-            j1939_tp_p2p_update_sender(tp);
+        struct J1939TPSession* session = session_at(tp, i);
+        uint64_t session_deadline;
+
+        if (!is_connection_active(session))
+            continue;
+
+        int due_ms = j1939_tp_next_event_ms(session);
+
+        // The timer starts counting at the next update
+        if (session->timer_stamp_us == J1939_TP_TIMER_UNSTAMPED)
+            session_deadline = 0;
+        else if (due_ms <= session->timer_ms)
+            session_deadline = session->timer_stamp_us;
         else
-            j1939_tp_p2p_update_receiver(tp);
+            session_deadline = session->timer_stamp_us +
+                ((uint64_t)(due_ms - session->timer_ms) * 1000);
+
+        if (session_deadline < deadline)
+            deadline = session_deadline;
     }
 
-    tp->timer_ms += tp->tick_rate_ms;
+    return deadline;
 }
 
 void
-j1939_tp_close_connection(
+j1939_tp_close_all(
     struct J1939TP* tp)
 {
-    tp->connection = J1939_TP_CONNECTION_NONE;
+    // Empty the queue before calling anyone back, so that none of it starts
+    //  in a session closed here. Messages sent from the callbacks are kept.
+    struct J1939TPQueueEntry dropped[J1939_TP_TX_QUEUE_SIZE];
+    int num_dropped = tp->tx_queue_len;
+
+    memcpy(dropped, tp->tx_queue, num_dropped * sizeof(dropped[0]));
+    tp->tx_queue_len = 0;
+    tp->tx_queue_stats.depth = 0;
+
+    // Likewise, a message sent from a callback may start in a free session
+    //  further on; only the sessions open now are closed
+    struct J1939TPSession* open[J1939_TP_SESSIONS];
+    int num_open = 0;
+
+    for (int i = 0; i < J1939_TP_SESSIONS; ++i)
+    {
+        struct J1939TPSession* session = session_at(tp, i);
+
+        if (is_connection_active(session))
+            open[num_open++] = session;
+    }
+
+    for (int i = 0; i < num_open; ++i)
+        j1939_tp_close_session(open[i]);
+
+    for (int i = 0; i < num_dropped; ++i)
+    {
+        struct J1939TxResult result = {
+            .status = J1939_TX_CANCELLED,
+            .abort_reason = J1939_TP_ABORT_REASON_OTHER,
+            .size = dropped[i].msg.len,
+            .bytes_sent = 0,
+            .elapsed_us = elapsed_us(tp, dropped[i].queued_us)
+        };
+
+        if (!dropped[i].buf_borrowed)
+            j1939_pool_free(dropped[i].msg.data);
+
+        report_tx_done(tp, dropped[i].done, dropped[i].done_data, &dropped[i].msg, &result);
+    }
 }
 
 void
@@ -135,63 +469,150 @@ j1939_tp_dispatch(
     struct J1939TP* tp,
     struct J1939Msg* msg)
 {
+    if ((msg->pgn == J1939_ETP_CM_PGN) || (msg->pgn == J1939_ETP_DT_PGN))
+    {
+        dispatch_etp(tp, msg);
+        return;
+    }
+
     if (msg->pgn == J1939_TP_DT_PGN)
     {
-        if (!is_connection_active(tp))
+        struct J1939TPSession* session =
+            find_tp_session(j1939_tp_find_rx_session(tp, msg->src, msg->dst));
+
+        if (session == NULL)
             return;
 
-        if (j1939_tp_rx_dt(tp, (struct J1939_TP_DT*)msg->data))
-            tp->timer_ms = 0;
+        if (j1939_tp_rx_dt(session, (struct J1939_TP_DT*)msg->data))
+            j1939_tp_restart_timer(session);
+
+        return;
     }
-    else
+
+    uint8_t control_byte = msg->data[0];
+    struct J1939TPSession* session;
+
+    switch (control_byte)
     {
-        uint8_t control_byte = msg->data[0];
+    case J1939_TP_CM_CONTROL_BYTE_RTS:
+    case J1939_TP_CM_CONTROL_BYTE_BAM:
+        open_rx_session(tp, msg);
+        break;
+    case J1939_TP_CM_CONTROL_BYTE_CTS:
+        session = find_tp_session(j1939_tp_find_tx_session(tp, msg->src));
+        if (session != NULL)
+            j1939_tp_rx_cts(session, (struct J1939_TP_CM_CTS*)msg->data);
+        break;
+    case J1939_TP_CM_CONTROL_BYTE_ACK:
+        session = find_tp_session(j1939_tp_find_tx_session(tp, msg->src));
+        if (session != NULL)
+            j1939_tp_rx_ack(session, (struct J1939_TP_CM_ACK*)msg->data);
+        break;
+    case J1939_TP_CM_CONTROL_BYTE_ABORT:
+        // Either side of a P2P connection may abort it
+        session = find_tp_session(j1939_tp_find_tx_session(tp, msg->src));
+        if ((session != NULL) && aborts_role(msg, J1939_TP_ABORT_ROLE_RECEIVER))
+            j1939_tp_rx_abort(session, (struct J1939_TP_CM_ABORT*)msg->data);
 
-        // If there's an active connection and another node tries to open a
-        //  connection, tell them to stop.
-        if (is_connection_active(tp) &&
-            ((control_byte == J1939_TP_CM_CONTROL_BYTE_RTS) ||
-                (control_byte == J1939_TP_CM_CONTROL_BYTE_BAM)))
+        session = find_tp_session(j1939_tp_find_rx_session(tp, msg->src, msg->dst));
+        if ((session != NULL) && (msg->dst != J1939_ADDR_GLOBAL) &&
+            aborts_role(msg, J1939_TP_ABORT_ROLE_SENDER))
         {
-            struct J1939_TP_CM_ABORT abort;
-
-            // This cast assumes the PGN is in the 3 MSBs of the message
-            j1939_tp_abort_pack(
-                tp,
-                &abort,
-                J1939_TP_ABORT_REASON_BUSY,
-                (uint32_t)msg->data[5]);
-            j1939_tx_helper(
-                tp->node_idx,
-                J1939_TP_CM_PGN,
-                (uint8_t*)&abort,
-                J1939_TP_CM_LEN,
-                msg->src,
-                J1939_TP_CM_PRI);
-            return;
+            j1939_tp_rx_abort(session, (struct J1939_TP_CM_ABORT*)msg->data);
         }
+        break;
+    }
 
-        switch (control_byte)
-        {
-        case J1939_TP_CM_CONTROL_BYTE_RTS:
-            j1939_tp_rx_rts(tp, (struct J1939_TP_CM_RTS*)msg->data, msg->src);
-            break;
-        case J1939_TP_CM_CONTROL_BYTE_CTS:
-            j1939_tp_rx_cts(tp, (struct J1939_TP_CM_CTS*)msg->data);
-            break;
-        case J1939_TP_CM_CONTROL_BYTE_ACK:
-            j1939_tp_rx_ack(tp, (struct J1939_TP_CM_ACK*)msg->data);
-            break;
-        case J1939_TP_CM_CONTROL_BYTE_BAM:
-            j1939_tp_rx_bam(tp, (struct J1939_TP_CM_BAM*)msg->data, msg->src);
-            break;
-        case J1939_TP_CM_CONTROL_BYTE_ABORT:
-            j1939_tp_rx_abort(tp, (struct J1939_TP_CM_ABORT*)msg->data);
-            break;
-        }
+    // An ACK or abort may have freed a TX session
+    start_queued(tp);
+}
+
+struct J1939TPSession*
+j1939_tp_find_rx_session(
+    struct J1939TP* tp,
+    uint8_t src,
+    uint8_t dst)
+{
+    uint8_t idx = (dst == J1939_ADDR_GLOBAL) ?
+        tp->rx_broadcast_by_src[src] :
+        tp->rx_p2p_by_src[src];
+
+    return (idx == J1939_TP_NO_SESSION) ? NULL : &tp->rx_sessions[idx];
+}
+
+struct J1939TPSession*
+j1939_tp_find_tx_session(
+    struct J1939TP* tp,
+    uint8_t dst)
+{
+    uint8_t idx = (dst == J1939_ADDR_GLOBAL) ?
+        tp->tx_broadcast :
+        tp->tx_p2p_by_dst[dst];
+
+    return (idx == J1939_TP_NO_SESSION) ? NULL : &tp->tx_sessions[idx];
+}
+
+void
+j1939_tp_close_session(
+    struct J1939TPSession* session)
+{
+    if (!is_connection_active(session))
+        return;
+
+    // Tell the sink of a streamed message that didn't complete
+    if (session->sink != NULL)
+    {
+        if (!session->complete)
+            (void)j1939_tp_stream_event(session, J1939_STREAM_ABORT, 0, NULL, 0);
+
+        session->sink = NULL;
+    }
+
+    struct J1939TxResult result = {
+        .status = session->status,
+        .abort_reason = session->abort_reason,
+        .size = session->msg_info.len,
+        .bytes_sent = session->msg_info.len - session->bytes_rem,
+        .elapsed_us = elapsed_us(session->tp, session->queued_us)
+    };
+
+    if (session->connection == J1939_TP_CONNECTION_ETP)
+    {
+        uint32_t in_order = (session->etp.next_packet - 1) * 7;
+
+        result.size = session->etp.size;
+        result.bytes_sent = (in_order < session->etp.size) ? in_order : session->etp.size;
+    }
+
+    *session_index_entry(session) = J1939_TP_NO_SESSION;
+    session->connection = J1939_TP_CONNECTION_NONE;
+
+    if (!session->buf_borrowed)
+        j1939_pool_free(session->buf);
+    session->buf = NULL;
+    session->buf_borrowed = false;
+
+    struct J1939Msg msg = session->msg_info;
+    session->msg_info.data = NULL;
+
+    // Reported last, since the session may be reused from the callbacks
+    if (session->sender)
+    {
+        J1939_TX_DONE done = session->done;
+
+        session->done = NULL;
+        report_tx_done(session->tp, done, session->done_data, &msg, &result);
     }
 }
 
+void
+j1939_tp_restart_timer(
+    struct J1939TPSession* session)
+{
+    session->timer_ms = 0;
+    session->timer_stamp_us = J1939_TP_TIMER_UNSTAMPED;
+}
+
 /* ============================================================================
  *
  * Section: Static function definitions
@@ -201,7 +622,568 @@ j1939_tp_dispatch(
 
 static bool
 is_connection_active(
+    struct J1939TPSession* session)
+{
+    return (session->connection != J1939_TP_CONNECTION_NONE);
+}
+
+// Index over the RX sessions followed by the TX sessions
+static struct J1939TPSession*
+session_at(
+    struct J1939TP* tp,
+    int i)
+{
+    if (i < J1939_TP_RX_SESSIONS)
+        return &tp->rx_sessions[i];
+    else
+        return &tp->tx_sessions[i - J1939_TP_RX_SESSIONS];
+}
+
+static struct J1939TPSession*
+alloc_session(
+    struct J1939TPSession* sessions,
+    int num_sessions)
+{
+    for (int i = 0; i < num_sessions; ++i)
+    {
+        if (!is_connection_active(&sessions[i]))
+            return &sessions[i];
+    }
+
+    return NULL;
+}
+
+// Return the index table entry that refers to an open session
+static uint8_t*
+session_index_entry(
+    struct J1939TPSession* session)
+{
+    struct J1939TP* tp = session->tp;
+
+    if (session->sender)
+    {
+        if (session->connection == J1939_TP_CONNECTION_BROADCAST)
+            return &tp->tx_broadcast;
+        else
+            return &tp->tx_p2p_by_dst[session->msg_info.dst];
+    }
+    else
+    {
+        if (session->connection == J1939_TP_CONNECTION_BROADCAST)
+            return &tp->rx_broadcast_by_src[session->msg_info.src];
+        else
+            return &tp->rx_p2p_by_src[session->msg_info.src];
+    }
+}
+
+// Keep every field within the range the standard and the peer's timeouts
+//  allow
+static void
+clamp_timing(
+    struct J1939TPTiming* timing)
+{
+    if (timing->bam_gap_ms < J1939_TP_BAM_GAP_MIN)
+        timing->bam_gap_ms = J1939_TP_BAM_GAP_MIN;
+
+    if (timing->bam_gap_ms > J1939_TP_BAM_GAP_MAX)
+        timing->bam_gap_ms = J1939_TP_BAM_GAP_MAX;
+
+    if (timing->p2p_gap_ms > J1939_TP_P2P_GAP_MAX)
+        timing->p2p_gap_ms = J1939_TP_P2P_GAP_MAX;
+
+    if (timing->cts_delay_ms > J1939_TP_CTS_DELAY_MAX)
+        timing->cts_delay_ms = J1939_TP_CTS_DELAY_MAX;
+}
+
+// Insert the entry behind every queued message of the same or higher
+//  priority, and send it right away if possible
+static void
+enqueue(
+    struct J1939TP* tp,
+    struct J1939TPQueueEntry* entry)
+{
+    struct J1939TxQueueStats* stats = &tp->tx_queue_stats;
+
+    int pos = tp->tx_queue_len;
+    while ((pos > 0) && (tp->tx_queue[pos - 1].msg.pri > entry->msg.pri))
+    {
+        tp->tx_queue[pos] = tp->tx_queue[pos - 1];
+        pos--;
+    }
+
+    tp->tx_queue[pos] = *entry;
+    clamp_timing(&tp->tx_queue[pos].timing);
+    tp->tx_queue[pos].queued_us = tp->now_us;
+    tp->tx_queue_len++;
+
+    stats->queued++;
+    stats->depth = tp->tx_queue_len;
+    if (stats->depth > stats->max_depth)
+        stats->max_depth = stats->depth;
+
+    start_queued(tp);
+}
+
+// Open a connection for every queued message that can be sent now, in queue
+//  order. A message waits if its destination already has a connection open,
+//  which keeps messages to the same destination in order.
+static void
+start_queued(
     struct J1939TP* tp)
 {
-    return (tp->connection != J1939_TP_CONNECTION_NONE);
+    int i = 0;
+
+    while (i < tp->tx_queue_len)
+    {
+        struct J1939TPQueueEntry* entry = &tp->tx_queue[i];
+
+        if (j1939_tp_find_tx_session(tp, entry->msg.dst) != NULL)
+        {
+            i++;
+            continue;
+        }
+
+        struct J1939TPSession* session =
+            alloc_session(tp->tx_sessions, J1939_TP_TX_SESSIONS);
+
+        // Nothing else can start until a session closes
+        if (session == NULL)
+            break;
+
+        struct J1939TxQueueStats* stats = &tp->tx_queue_stats;
+        uint64_t wait_us = tp->now_us - entry->queued_us;
+
+        stats->started++;
+        stats->total_wait_us += wait_us;
+        if (wait_us > stats->max_wait_us)
+            stats->max_wait_us = (wait_us > UINT32_MAX) ? UINT32_MAX : (uint32_t)wait_us;
+
+        // Off the queue before the session opens, since a failure to send the
+        //  BAM or RTS is reported to callbacks that may queue more messages
+        struct J1939TPQueueEntry started = *entry;
+
+        memmove(
+            entry,
+            entry + 1,
+            (tp->tx_queue_len - i - 1) * sizeof(*entry));
+        tp->tx_queue_len--;
+        stats->depth = tp->tx_queue_len;
+
+        session->timing = started.timing;
+        session->buf_borrowed = started.buf_borrowed;
+        session->done = started.done;
+        session->done_data = started.done_data;
+        session->queued_us = started.queued_us;
+        open_tx_session(tp, session, &started.msg);
+    }
+}
+
+// Take over the queued message's buffer and send the BAM or RTS
+static void
+open_tx_session(
+    struct J1939TP* tp,
+    struct J1939TPSession* session,
+    struct J1939Msg* msg)
+{
+    session->buf = msg->data;
+    session->sender = true;
+    session->next_seq = 1;
+    session->window_last = 0;
+    session->bytes_rem = msg->len;
+    session->num_packages = CEIL_DIV(msg->len, 7);
+    session->clear_to_send = false;
+    session->status = J1939_TX_CANCELLED;
+    session->abort_reason = J1939_TP_ABORT_REASON_OTHER;
+    j1939_tp_restart_timer(session);
+
+    session->msg_info = *msg;
+
+    bool sent;
+
+    if (msg->dst == J1939_ADDR_GLOBAL)
+    {
+        session->connection = J1939_TP_CONNECTION_BROADCAST;
+        *session_index_entry(session) = session - tp->tx_sessions;
+
+        struct J1939_TP_CM_BAM bam;
+        j1939_tp_bam_pack(session, &bam);
+        sent = j1939_tx_helper(
+            tp->node,
+            J1939_TP_CM_PGN,
+            (uint8_t*)&bam,
+            J1939_TP_CM_LEN,
+            session->msg_info.dst,
+            J1939_TP_CM_PRI);
+    }
+    else
+    {
+        session->connection = J1939_TP_CONNECTION_P2P;
+        *session_index_entry(session) = session - tp->tx_sessions;
+
+        struct J1939_TP_CM_RTS rts;
+        j1939_tp_rts_pack(session, &rts);
+        sent = j1939_tx_helper(
+            tp->node,
+            J1939_TP_CM_PGN,
+            (uint8_t*)&rts,
+            J1939_TP_CM_LEN,
+            session->msg_info.dst,
+            J1939_TP_CM_PRI);
+    }
+
+    if (!sent)
+    {
+        session->status = J1939_TX_FAILED;
+        j1939_tp_close_session(session);
+    }
+}
+
+// Handle an RTS or BAM
+static void
+open_rx_session(
+    struct J1939TP* tp,
+    struct J1939Msg* msg)
+{
+    bool broadcast = (msg->data[0] == J1939_TP_CM_CONTROL_BYTE_BAM);
+
+    // RTS and BAM share the position of the length and PGN fields
+    uint16_t len = ((struct J1939_TP_CM_RTS*)msg->data)->len;
+    uint32_t pgn = ((struct J1939_TP_CM_RTS*)msg->data)->pgn;
+
+    // A BAM must go to everyone, and an RTS to us alone
+    if (broadcast != (msg->dst == J1939_ADDR_GLOBAL))
+        return;
+
+    if (len > J1939_TP_MAX_PAYLOAD)
+    {
+        if (!broadcast)
+            send_abort(tp, J1939_TP_CM_PGN, J1939_TP_ABORT_REASON_RESOURCES, pgn, msg->src);
+        return;
+    }
+
+    // A packet count that doesn't match the length would leave the session
+    //  waiting for packets that never come
+    uint8_t num_packages = ((struct J1939_TP_CM_RTS*)msg->data)->num_packages;
+
+    if ((len < J1939_TP_MIN_PAYLOAD) || (num_packages != ((len + 6) / 7)))
+    {
+        if (!broadcast)
+            send_abort(tp, J1939_TP_CM_PGN, J1939_TP_ABORT_REASON_OTHER, pgn, msg->src);
+        return;
+    }
+
+    struct J1939TPStreamSink* stream = find_stream_sink(tp, pgn);
+
+    // Refuse to reassemble a message nobody is going to consume. Broadcasts
+    //  can't be refused, so unwanted ones are just ignored.
+    if ((stream == NULL) && !j1939_is_pgn_wanted(tp->node, pgn))
+    {
+        if (!broadcast)
+            send_abort(tp, J1939_TP_CM_PGN, J1939_TP_ABORT_REASON_RESOURCES, pgn, msg->src);
+        return;
+    }
+
+    struct J1939TPSession* session =
+        j1939_tp_find_rx_session(tp, msg->src, msg->dst);
+
+    if (session != NULL)
+    {
+        if (!broadcast)
+        {
+            // The sender already has a connection open with us
+            send_abort(tp, J1939_TP_CM_PGN, J1939_TP_ABORT_REASON_BUSY, pgn, msg->src);
+            return;
+        }
+
+        // A new BAM from the same source replaces the broadcast in progress,
+        //  which the sender has evidently given up on
+        j1939_tp_close_session(session);
+    }
+
+    session = alloc_session(tp->rx_sessions, J1939_TP_RX_SESSIONS);
+
+    if (session == NULL)
+    {
+        if (!broadcast)
+            send_abort(tp, J1939_TP_CM_PGN, J1939_TP_ABORT_REASON_BUSY, pgn, msg->src);
+        return;
+    }
+
+    // Borrow a buffer just big enough for the announced length, unless the
+    //  message is streamed
+    session->buf = (stream == NULL) ? j1939_pool_alloc(len) : NULL;
+
+    if ((stream == NULL) && (session->buf == NULL))
+    {
+        if (!broadcast)
+            send_abort(tp, J1939_TP_CM_PGN, J1939_TP_ABORT_REASON_RESOURCES, pgn, msg->src);
+        return;
+    }
+    session->msg_info.data = session->buf;
+    session->timing = tp->timing;
+
+    if (broadcast)
+        j1939_tp_rx_bam(session, (struct J1939_TP_CM_BAM*)msg->data, msg->src);
+    else
+        j1939_tp_rx_rts(session, (struct J1939_TP_CM_RTS*)msg->data, msg->src);
+
+    if (stream != NULL)
+    {
+        session->sink = stream->sink;
+        session->sink_data = stream->sink_data;
+
+        if (!j1939_tp_stream_event(session, J1939_STREAM_BEGIN, 0, NULL, 0))
+        {
+            session->sink = NULL;
+            session->connection = J1939_TP_CONNECTION_NONE;
+            if (!broadcast)
+                send_abort(tp, J1939_TP_CM_PGN, J1939_TP_ABORT_REASON_RESOURCES, pgn, msg->src);
+            return;
+        }
+    }
+
+    *session_index_entry(session) = session - tp->rx_sessions;
+}
+
+// Handle an ETP RTS
+static void
+open_etp_rx_session(
+    struct J1939TP* tp,
+    struct J1939Msg* msg)
+{
+    struct J1939_ETP_CM_RTS* rts = (struct J1939_ETP_CM_RTS*)msg->data;
+    struct J1939TPStreamSink* stream = find_stream_sink(tp, rts->pgn);
+
+    // ETP connections are always P2P
+    if (msg->dst == J1939_ADDR_GLOBAL)
+        return;
+
+    // The PGN's own sink takes precedence over the node's
+    J1939_STREAM_SINK sink = (stream != NULL) ? stream->sink : tp->sink;
+    void* sink_data = (stream != NULL) ? stream->sink_data : tp->sink_data;
+
+    if ((sink == NULL) || (rts->size == 0) || (rts->size > J1939_ETP_MAX_SIZE))
+    {
+        send_abort(tp, J1939_ETP_CM_PGN, J1939_TP_ABORT_REASON_RESOURCES, rts->pgn, msg->src);
+        return;
+    }
+
+    struct J1939TPSession* session =
+        alloc_session(tp->rx_sessions, J1939_TP_RX_SESSIONS);
+
+    if ((session == NULL) || (j1939_tp_find_rx_session(tp, msg->src, msg->dst) != NULL))
+    {
+        send_abort(tp, J1939_ETP_CM_PGN, J1939_TP_ABORT_REASON_BUSY, rts->pgn, msg->src);
+        return;
+    }
+
+    session->buf = NULL;
+    session->timing = tp->timing;
+    session->sink = sink;
+    session->sink_data = sink_data;
+
+    if (!j1939_etp_rx_rts(session, rts, msg->src))
+    {
+        session->sink = NULL;
+        session->connection = J1939_TP_CONNECTION_NONE;
+        send_abort(tp, J1939_ETP_CM_PGN, J1939_TP_ABORT_REASON_RESOURCES, rts->pgn, msg->src);
+        return;
+    }
+
+    *session_index_entry(session) = session - tp->rx_sessions;
+}
+
+static void
+dispatch_etp(
+    struct J1939TP* tp,
+    struct J1939Msg* msg)
+{
+    struct J1939TPSession* session;
+
+    if (msg->pgn == J1939_ETP_DT_PGN)
+    {
+        session = j1939_tp_find_rx_session(tp, msg->src, msg->dst);
+
+        if ((session == NULL) || (session->connection != J1939_TP_CONNECTION_ETP))
+            return;
+
+        if (j1939_etp_rx_dt(session, (struct J1939_TP_DT*)msg->data))
+            j1939_tp_restart_timer(session);
+
+        return;
+    }
+
+    struct J1939TPSession* tx_session = j1939_tp_find_tx_session(tp, msg->src);
+    struct J1939TPSession* rx_session = j1939_tp_find_rx_session(tp, msg->src, msg->dst);
+
+    if ((tx_session != NULL) && (tx_session->connection != J1939_TP_CONNECTION_ETP))
+        tx_session = NULL;
+
+    if ((rx_session != NULL) && (rx_session->connection != J1939_TP_CONNECTION_ETP))
+        rx_session = NULL;
+
+    switch (msg->data[0])
+    {
+    case J1939_ETP_CM_CONTROL_BYTE_RTS:
+        open_etp_rx_session(tp, msg);
+        break;
+    case J1939_ETP_CM_CONTROL_BYTE_CTS:
+        if (tx_session != NULL)
+            j1939_etp_rx_cts(tx_session, (struct J1939_ETP_CM_CTS*)msg->data);
+        break;
+    case J1939_ETP_CM_CONTROL_BYTE_EOMA:
+        if (tx_session != NULL)
+            j1939_etp_rx_eoma(tx_session, (struct J1939_ETP_CM_EOMA*)msg->data);
+        break;
+    case J1939_ETP_CM_CONTROL_BYTE_DPO:
+        if (rx_session != NULL)
+            j1939_etp_rx_dpo(rx_session, (struct J1939_ETP_CM_DPO*)msg->data);
+        break;
+    case J1939_ETP_CM_CONTROL_BYTE_ABORT:
+        if ((tx_session != NULL) && aborts_role(msg, J1939_TP_ABORT_ROLE_RECEIVER))
+            j1939_etp_rx_abort(tx_session, (struct J1939_TP_CM_ABORT*)msg->data);
+        if ((rx_session != NULL) && aborts_role(msg, J1939_TP_ABORT_ROLE_SENDER))
+            j1939_etp_rx_abort(rx_session, (struct J1939_TP_CM_ABORT*)msg->data);
+        break;
+    }
+
+    // An EOMA or abort may have freed a TX session
+    start_queued(tp);
+}
+
+static struct J1939TPStreamSink*
+find_stream_sink(
+    struct J1939TP* tp,
+    uint32_t pgn)
+{
+    for (int i = 0; i < tp->num_stream_sinks; ++i)
+    {
+        if (tp->stream_sinks[i].pgn == pgn)
+            return &tp->stream_sinks[i];
+    }
+
+    return NULL;
+}
+
+static void
+send_abort(
+    struct J1939TP* tp,
+    uint32_t cm_pgn,
+    enum j1939_tp_abort_reason reason,
+    uint32_t pgn,
+    uint8_t dst)
+{
+    struct J1939_TP_CM_ABORT abort;
+
+    // Only a receiver refuses connections
+    j1939_tp_abort_pack(&abort, reason, J1939_TP_ABORT_ROLE_RECEIVER, pgn);
+    j1939_tx_helper(
+        tp->node,
+        cm_pgn,
+        (uint8_t*)&abort,
+        J1939_TP_CM_LEN,
+        dst,
+        J1939_TP_CM_PRI);
+}
+
+// Return true if an abort received from a peer may have been sent by the
+//  given side of a connection
+static bool
+aborts_role(
+    struct J1939Msg* msg,
+    enum j1939_tp_abort_role role)
+{
+    uint32_t sent_by = ((struct J1939_TP_CM_ABORT*)msg->data)->role;
+
+    return (sent_by == (uint32_t)role) || (sent_by > J1939_TP_ABORT_ROLE_RECEIVER);
+}
+
+static uint32_t
+elapsed_us(
+    struct J1939TP* tp,
+    uint64_t since_us)
+{
+    uint64_t elapsed = (tp->now_us > since_us) ? (tp->now_us - since_us) : 0;
+
+    return (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed;
+}
+
+// Tell the message's own callback, then the node's, how sending it ended
+static void
+report_tx_done(
+    struct J1939TP* tp,
+    J1939_TX_DONE done,
+    void* done_data,
+    struct J1939Msg* msg,
+    const struct J1939TxResult* result)
+{
+    if (done != NULL)
+        done(done_data, msg, result);
+
+    if (tp->tx_done != NULL)
+        tp->tx_done(tp->tx_done_data, msg, result);
+}
+
+// Pass an open session through if it's a TP connection, since ETP messages
+//  are handled separately
+static struct J1939TPSession*
+find_tp_session(
+    struct J1939TPSession* session)
+{
+    if ((session == NULL) || (session->connection == J1939_TP_CONNECTION_ETP))
+        return NULL;
+
+    return session;
+}
+
+static void
+run_connection(
+    struct J1939TPSession* session)
+{
+    if (session->connection == J1939_TP_CONNECTION_ETP)
+    {
+        j1939_etp_update(session);
+    }
+    else if (session->connection == J1939_TP_CONNECTION_BROADCAST)
+    {
+        if (session->sender)
+            j1939_tp_broadcast_update_sender(session);
+        else
+            j1939_tp_broadcast_update_receiver(session);
+    }
+    else
+    {
+        if (session->sender)
+            j1939_tp_p2p_update_sender(session);
+        else
+            j1939_tp_p2p_update_receiver(session);
+    }
+}
+
+// Bring timer_ms up to date with now_us. Sub-millisecond remainders are kept
+//  in the stamp, so no time is lost between updates.
+static void
+advance_timer(
+    struct J1939TPSession* session,
+    uint64_t now_us)
+{
+    // A restarted timer starts counting from the first update that sees it
+    if (session->timer_stamp_us == J1939_TP_TIMER_UNSTAMPED)
+    {
+        session->timer_stamp_us = now_us;
+        return;
+    }
+
+    if (now_us <= session->timer_stamp_us)
+        return;
+
+    uint64_t elapsed_ms = (now_us - session->timer_stamp_us) / 1000;
+
+    session->timer_stamp_us += elapsed_ms * 1000;
+
+    // Saturate rather than wrap if we haven't been updated in a long time
+    if (elapsed_ms >= (uint64_t)(INT_MAX - session->timer_ms))
+        session->timer_ms = INT_MAX;
+    else
+        session->timer_ms += (int)elapsed_ms;
 }
@@ -16,6 +16,12 @@
  *              differs slightly depending on the type of connection. TP data
  *              transfer and connection management are handled via the exchange
  *              of TP.DT and TP.CM PGNs, respectively.
+ *              Each node can have several connections open at once, each held
+ *              in a session with its own buffer and timers. A TP.DT frame
+ *              carries no PGN, so the standard allows a single connection per
+ *              (source, destination) pair at a time; sessions are found from
+ *              a frame's addresses through per-address index tables, so the
+ *              lookup costs the same however many sessions are open.
  * ============================================================================
  */
 
@@ -43,12 +49,69 @@
 #define J1939_TP_TIMEOUT_T3  (1250)
 #define J1939_TP_TIMEOUT_T4  (1050)
 
-// While a connection is open, transmit TP packets at this period (ms)
+// While a connection is open, transmit TP packets at this period (ms), unless
+//  set otherwise with j1939_set_tp_timing()
 #define J1939_TP_TX_PERIOD  (50)
 
+// The range of gaps (ms) between the TP.DT packets of a broadcast allowed by
+//  the standard
+#define J1939_TP_BAM_GAP_MIN  (50)
+#define J1939_TP_BAM_GAP_MAX  (200)
+
+// The shortest message sent with the transport protocol; anything shorter
+//  fits in a single frame
+#define J1939_TP_MIN_PAYLOAD  (9)
+
+// The longest gap (ms) between the TP.DT packets of a P2P connection, and the
+//  longest delay (ms) before a CTS. The peer gives up after
+//  J1939_TP_TIMEOUT_TR without either; one period is left for late updates.
+#define J1939_TP_P2P_GAP_MAX  (J1939_TP_TIMEOUT_TR - J1939_TP_TX_PERIOD)
+#define J1939_TP_CTS_DELAY_MAX  (J1939_TP_TIMEOUT_TR - J1939_TP_TX_PERIOD)
+
+// Marks a connection timer that was restarted outside of a timestamp-driven
+//  update, and hasn't yet been stamped with the time it was restarted at
+#define J1939_TP_TIMER_UNSTAMPED  (UINT64_MAX)
+
+// Number of connections that can be received, and sent, at the same time.
+//  Open sessions also need a buffer from the pool (j1939_pool.h).
+#ifndef J1939_TP_RX_SESSIONS
+#define J1939_TP_RX_SESSIONS  (4)
+#endif
+
+#ifndef J1939_TP_TX_SESSIONS
+#define J1939_TP_TX_SESSIONS  (2)
+#endif
+
+// Number of multi-packet messages that can wait for a TX session
+#ifndef J1939_TP_TX_QUEUE_SIZE
+#define J1939_TP_TX_QUEUE_SIZE  (8)
+#endif
+
+// Number of PGNs per node that can be streamed to a sink of their own
+//  (j1939_set_pgn_stream_sink()) instead of being reassembled in a buffer
+#ifndef J1939_TP_STREAM_SINKS
+#define J1939_TP_STREAM_SINKS  (4)
+#endif
+
+// Marks an unused entry in the session index tables
+#define J1939_TP_NO_SESSION  (0xFF)
+
 // No limit on the number of packages sent during a P2P connection
 #define J1939_TP_CM_RTS_MAX_PACKAGES  (0xFF)
 
+// Number of packets a receiver asks for with each CTS, unless the sender's
+//  RTS limits it further. Can be changed per node with j1939_set_tp_window().
+#ifndef J1939_TP_CTS_WINDOW
+#define J1939_TP_CTS_WINDOW  (16)
+#endif
+
+// A receiver missing packets asks for them again when no TP.DT packet has
+//  arrived for J1939_TP_TIMEOUT_TR, at most this many times in a row, before
+//  it gives up at J1939_TP_TIMEOUT_T1
+#ifndef J1939_TP_MAX_RETRIES
+#define J1939_TP_MAX_RETRIES  (2)
+#endif
+
 /* ============================================================================
  *
  * Section: Type definitions
@@ -62,7 +125,10 @@
 enum j1939_tp_connection {
     J1939_TP_CONNECTION_NONE = 0,
     J1939_TP_CONNECTION_BROADCAST,
-    J1939_TP_CONNECTION_P2P
+    J1939_TP_CONNECTION_P2P,
+    // Extended transport protocol, always P2P
+    //  (j1939_extended_transport_protocol.h)
+    J1939_TP_CONNECTION_ETP
 };
 
 enum j1939_tp_abort_reason {
@@ -72,12 +138,28 @@ enum j1939_tp_abort_reason {
     J1939_TP_ABORT_REASON_OTHER
 };
 
-struct J1939TP {
-    // Used for indexing into the global J1939Private array
-    int node_idx;
+// Which side of the connection sent an abort. A node may have a connection
+//  open in each direction with the same peer, for the same PGN even, so the
+//  role tells which of the two is aborted. Older implementations leave it
+//  unspecified, in which case both are.
+enum j1939_tp_abort_role {
+    J1939_TP_ABORT_ROLE_SENDER = 0,
+    J1939_TP_ABORT_ROLE_RECEIVER = 1,
+    J1939_TP_ABORT_ROLE_UNSPECIFIED = 3
+};
+
+struct J1939TP;
+
+// A single connection, identified by its (src, dst, PGN) in msg_info
+struct J1939TPSession {
+    // The transport protocol state this session belongs to
+    struct J1939TP* tp;
 
-    // Buffer for holding the TP.DT payload
-    uint8_t buf[J1939_TP_MAX_PAYLOAD];
+    // Buffer for holding the TP.DT payload, borrowed from the buffer pool
+    //  (j1939_pool.h) for as long as the connection is open. It holds at
+    //  least msg_info.len bytes. NULL for streamed messages, which aren't
+    //  buffered.
+    uint8_t* buf;
 
     // This is the multi-packet message that our connection is currently trying
     //  to send or receive. If we're the sender, this struct is basically
@@ -86,9 +168,8 @@ struct J1939TP {
     //  This msg is passed to j1939_rx() once fully received.
     struct J1939Msg msg_info;
 
-    // If this is set to NONE, a connection is not presently active.
-    // Indicates what kind of connection is currently active. If set to NONE, a
-    //  connection is not presently active.
+    // Indicates what kind of connection is currently active. If set to NONE,
+    //  the session is free.
     enum j1939_tp_connection connection;
 
     // True: this node is the sender (and the one that opened the connection).
@@ -97,11 +178,78 @@ struct J1939TP {
 
     // This holds the sequence number of the next TP.DT packet.
     // Sender: the next transmitted TP.DT packet will have this sequence number.
-    // Receiver: the next received TP.DT packet should have this sequence number.
+    // Receiver: the first sequence number of the window requested by the
+    //  last CTS (1 for broadcasts).
     uint8_t next_seq;
 
+    // The last sequence number of the current window, i.e. the packets
+    //  granted (sender) or requested (receiver) by the last CTS. For
+    //  broadcasts, every packet is in the window. Zero until the first CTS.
+    uint8_t window_last;
+
+    // Receiver: the number of packets to ask for with each CTS
+    uint8_t window_size;
+
+    // Receiver: the number of times in a row missing packets were asked for
+    //  again without any arriving
+    uint8_t retries;
+
+    // Receiver: bit n is set while packet n hasn't been received yet
+    uint32_t missing[8];
+
+    // Extended transport protocol connections only. Packets are numbered
+    //  from 1 across the whole message.
+    struct {
+        // Length of the message in bytes
+        uint32_t size;
+
+        // Sender: the packet to send next.
+        // Receiver: the packet expected next.
+        uint32_t next_packet;
+
+        // The last packet of the window granted (sender) or requested
+        //  (receiver) by the last CTS. Zero until the first CTS.
+        uint32_t window_last;
+
+        // The packet number of the current window's packets, less their
+        //  sequence number
+        uint32_t dpo_offset;
+
+        // Sender: the DPO of the current window is yet to be sent.
+        // Receiver: the DPO of the current window has been received.
+        bool dpo;
+
+        // Sender: where the data comes from
+        J1939_STREAM_SOURCE source;
+        void* source_data;
+    } etp;
+
+    // Receiver: the sink the message is streamed to, packet by packet,
+    //  instead of being reassembled in buf. NULL for a reassembled message.
+    J1939_STREAM_SINK sink;
+    void* sink_data;
+
+    // Sender: buf is the caller's buffer (j1939_tx_zero_copy()) rather than
+    //  one borrowed from the pool, and done is called when the session
+    //  closes. done is NULL for other messages.
+    bool buf_borrowed;
+    J1939_TX_DONE done;
+    void* done_data;
+
+    // Sender: how sending the message ended, reported when the session
+    //  closes; J1939_TX_CANCELLED until it's known. Also the time (us) the
+    //  message was accepted for sending.
+    enum j1939_tx_status status;
+    uint64_t queued_us;
+
+    // Receiver: whether the message was received in full.
+    // Both: the reason the connection was aborted for, by either side.
+    bool complete;
+    uint8_t abort_reason;
+
     // The number of data bytes that remain for the presently open connection.
-    // Sender: this number of bytes still needs to be transmitted.
+    // Sender: this number of bytes hasn't been transmitted yet; packets sent
+    //  again don't count.
     // Receiver: this number of bytes still needs to be received.
     uint16_t bytes_rem;
 
@@ -109,16 +257,91 @@ struct J1939TP {
     //  full multi-packet message.
     uint8_t num_packages;
 
-    // Used for periodic message transmission and timeout tracking
+    // The gaps between packets and before a CTS; the node's timing, or the
+    //  one the message was sent with
+    struct J1939TPTiming timing;
+
+    // Used for periodic message transmission and timeout tracking; the time
+    //  in ms since the timer was last restarted
     int timer_ms;
-    int tick_rate_ms;
+
+    // Only used by timestamp-driven updates: the time (us) up to which
+    //  timer_ms has been advanced, or J1939_TP_TIMER_UNSTAMPED if the timer
+    //  was restarted since the last update.
+    uint64_t timer_stamp_us;
 
     // Used for P2P connections to signal when we're ready for data transfer.
-    // Sender: we've received a CTS msg and can begin transmitting data.
-    // Receiver: we've responded to an RTS with a CTS and are ready for data.
+    // Sender: we've received a CTS msg and are transmitting its window.
+    // Receiver: we've sent a CTS for the current window and are ready for its
+    //  data.
     bool clear_to_send;
 };
 
+struct J1939TP {
+    // The node this state belongs to, used for reaching the node's context
+    struct J1939* node;
+
+    int tick_rate_ms;
+
+    // Number of packets asked for with each CTS (j1939_set_tp_window())
+    uint8_t window_size;
+
+    // Timing of the connections opened from now on (j1939_set_tp_timing())
+    struct J1939TPTiming timing;
+
+    // Receives messages sent with the extended transport protocol
+    //  (j1939_set_stream_sink())
+    J1939_STREAM_SINK sink;
+    void* sink_data;
+
+    // Told how every message sent ends (j1939_set_tx_done())
+    J1939_TX_DONE tx_done;
+    void* tx_done_data;
+
+    // PGNs streamed to a sink of their own, whether they arrive with the
+    //  transport protocol or the extended one (j1939_set_pgn_stream_sink())
+    struct J1939TPStreamSink {
+        uint32_t pgn;
+        J1939_STREAM_SINK sink;
+        void* sink_data;
+    } stream_sinks[J1939_TP_STREAM_SINKS];
+    int num_stream_sinks;
+
+    struct J1939TPSession rx_sessions[J1939_TP_RX_SESSIONS];
+    struct J1939TPSession tx_sessions[J1939_TP_TX_SESSIONS];
+
+    // Indices of the open sessions, or J1939_TP_NO_SESSION. Received
+    //  connections are indexed by the address of their sender, sent P2P
+    //  connections by the address of their receiver. A node only ever sends
+    //  one broadcast at a time, since its TP.DT frames couldn't be told apart.
+    uint8_t rx_broadcast_by_src[256];
+    uint8_t rx_p2p_by_src[256];
+    uint8_t tx_p2p_by_dst[256];
+    uint8_t tx_broadcast;
+
+    // Multi-packet messages waiting for a TX session, highest priority (lowest
+    //  value) first and, within a priority, in the order they were queued.
+    //  Each one already holds its payload in a pool buffer (or the caller's
+    //  buffer), which is handed over to the session that sends it.
+    struct J1939TPQueueEntry {
+        struct J1939Msg msg;
+        struct J1939TPTiming timing;
+        uint64_t queued_us;
+
+        // The payload is the caller's, see struct J1939TPSession
+        bool buf_borrowed;
+        J1939_TX_DONE done;
+        void* done_data;
+    } tx_queue[J1939_TP_TX_QUEUE_SIZE];
+    int tx_queue_len;
+
+    struct J1939TxQueueStats tx_queue_stats;
+
+    // The time (us) as of the last update, for timing the queue; advanced by
+    //  tick_rate_ms per j1939_tp_update() call
+    uint64_t now_us;
+};
+
 struct __attribute__((packed)) J1939_TP_DT {
     uint8_t seq;
     uint8_t data0;
@@ -165,7 +388,8 @@ struct __attribute__((packed)) J1939_TP_CM_BAM {
 struct __attribute__((packed)) J1939_TP_CM_ABORT {
     uint8_t control_byte;
     uint8_t abort_reason;
-    uint32_t res : 24;
+    uint32_t role : 2;
+    uint32_t res : 22;
     uint32_t pgn : 24;
 };
 #define J1939_TP_CM_PGN  (0x00EC00)
@@ -182,25 +406,120 @@ struct __attribute__((packed)) J1939_TP_CM_ABORT {
 void
 j1939_tp_init(
     struct J1939TP* tp,
-    int node_idx,
+    struct J1939* node,
     int tick_rate_ms);
 
-// Attempt to queue up a multi-packet message for transmission. Return true if
-//  successful, return false otherwise.
+// Queue up a multi-packet message for transmission. It's sent right away if a
+//  TX session is free and no connection to the same destination is open;
+//  otherwise it waits in the TX queue until one is. Return false if the queue
+//  is full or no pool buffer is available.
 bool
 j1939_tp_queue(
     struct J1939TP* tp,
     struct J1939Msg* msg);
 
+// Same as j1939_tp_queue(), but the message is sent with the given timing
+//  instead of the node's
+bool
+j1939_tp_queue_timed(
+    struct J1939TP* tp,
+    struct J1939Msg* msg,
+    const struct J1939TPTiming* timing);
+
+// Same as j1939_tp_queue_timed(), but the payload isn't copied: the message
+//  is sent straight from msg->data, and done is called once it's no longer
+//  needed. done isn't called if the message is rejected.
+bool
+j1939_tp_queue_zero_copy(
+    struct J1939TP* tp,
+    struct J1939Msg* msg,
+    const struct J1939TPTiming* timing,
+    J1939_TX_DONE done,
+    void* done_data);
+
+// Open a connection sending a message of size bytes with the extended
+//  transport protocol, reading its data through source. Return false if no TX
+//  session is free or a connection to msg->dst is already open. Only the
+//  PGN, destination and priority of msg are used.
+bool
+j1939_tp_open_stream(
+    struct J1939TP* tp,
+    struct J1939Msg* msg,
+    uint32_t size,
+    J1939_STREAM_SOURCE source,
+    void* source_data);
+
+// Stream messages of the given PGN to sink, replacing any sink already set
+//  for it, or remove its sink if sink is NULL. Sessions already open are left
+//  as they are. Return false if J1939_TP_STREAM_SINKS PGNs already have one.
+bool
+j1939_tp_set_pgn_stream_sink(
+    struct J1939TP* tp,
+    uint32_t pgn,
+    J1939_STREAM_SINK sink,
+    void* sink_data);
+
+// Set the timing of connections opened from now on, clamping the broadcast
+//  gap to the range allowed by the standard
+void
+j1939_tp_set_timing(
+    struct J1939TP* tp,
+    const struct J1939TPTiming* timing);
+
+// Advance the timers of every open session by tick_rate_ms per call
 void
 j1939_tp_update(
     struct J1939TP* tp);
 
+// Advance the timers of every open session to the monotonic time now_us.
+//  Don't mix this with j1939_tp_update() on the same node.
 void
-j1939_tp_close_connection(
+j1939_tp_update_at(
+    struct J1939TP* tp,
+    uint64_t now_us);
+
+// Return the earliest time (us) at which j1939_tp_update_at() has something
+//  to do for any session: transmit a packet, send a CTS, or check for a
+//  timeout. A session whose timer hasn't been stamped yet is due immediately
+//  (zero). Return J1939_NO_DEADLINE if no session is open.
+uint64_t
+j1939_tp_next_deadline(
+    struct J1939TP* tp);
+
+// Close every open session and drop every queued message, e.g. when our
+//  address changes. The done callbacks of zero-copy messages are called.
+void
+j1939_tp_close_all(
     struct J1939TP* tp);
 
 void
 j1939_tp_dispatch(
     struct J1939TP* tp,
     struct J1939Msg* msg);
+
+// Return the open session receiving from src, as a broadcast if dst is the
+//  global address or peer-to-peer otherwise; NULL if there's none.
+struct J1939TPSession*
+j1939_tp_find_rx_session(
+    struct J1939TP* tp,
+    uint8_t src,
+    uint8_t dst);
+
+// Return the open session sending to dst (the global address for our
+//  broadcast); NULL if there's none.
+struct J1939TPSession*
+j1939_tp_find_tx_session(
+    struct J1939TP* tp,
+    uint8_t dst);
+
+// Free the session, return its buffer to the pool, and remove it from the
+//  index tables. Tell the sink or the done callback of the session's message,
+//  if any, how it ended.
+void
+j1939_tp_close_session(
+    struct J1939TPSession* session);
+
+// Restart the session's timer
+void
+j1939_tp_restart_timer(
+    struct J1939TPSession* session);
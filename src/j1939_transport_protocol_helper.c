@@ -1,5 +1,9 @@
 #include "j1939_transport_protocol_helper.h"
+#include "j1939_extended_transport_protocol.h"
 #include "j1939_private.h"
+#include "j1939_pgn_db.h"
+
+#include <string.h>
 
 /* ============================================================================
  *
@@ -9,8 +13,41 @@
  */
 
 static void
-timeout(
-    struct J1939TP* tp);
+abort_connection(
+    struct J1939TPSession* session,
+    enum j1939_tp_abort_reason reason);
+
+static void
+deliver(
+    struct J1939TPSession* session);
+
+static int
+packet_len(
+    struct J1939TPSession* session,
+    uint8_t seq);
+
+static void
+pack_packet(
+    struct J1939TPSession* session,
+    uint8_t seq,
+    uint8_t* data);
+
+static void
+count_sent(
+    struct J1939TPSession* session,
+    uint8_t seq);
+
+static void
+send_window_batch(
+    struct J1939TPSession* session);
+
+static void
+init_missing(
+    struct J1939TPSession* session);
+
+static void
+request_missing(
+    struct J1939TPSession* session);
 
 /* ============================================================================
  *
@@ -26,28 +63,92 @@ timeout(
 
 void
 j1939_tp_rx_abort(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_ABORT* abort)
 {
-    if (abort->pgn == tp->msg_info.pgn)
-        j1939_tp_close_connection(tp);
+    if (abort->pgn != session->msg_info.pgn)
+        return;
+
+    session->status = J1939_TX_ABORTED;
+    session->abort_reason = abort->abort_reason;
+    j1939_tp_close_session(session);
 }
 
 void
 j1939_tp_abort_pack(
-    struct J1939TP* tp,
     struct J1939_TP_CM_ABORT* abort,
     enum j1939_tp_abort_reason reason,
+    enum j1939_tp_abort_role role,
     uint32_t pgn)
 {
-    (void)tp;
-
     abort->control_byte = J1939_TP_CM_CONTROL_BYTE_ABORT;
     abort->abort_reason = reason;
-    abort->res = 0xFF;
+    abort->role = role;
+    abort->res = 0x3FFFFF;
     abort->pgn = pgn;
 }
 
+bool
+j1939_tp_stream_event(
+    struct J1939TPSession* session,
+    enum j1939_stream_event_type type,
+    uint32_t offset,
+    const uint8_t* data,
+    uint16_t len)
+{
+    struct J1939StreamEvent event = {
+        .type = type,
+        .pgn = session->msg_info.pgn,
+        .src = session->msg_info.src,
+        .dst = session->msg_info.dst,
+        .pri = session->msg_info.pri,
+        .size = (session->connection == J1939_TP_CONNECTION_ETP) ?
+            session->etp.size : session->msg_info.len,
+        .offset = offset,
+        .data = data,
+        .len = len,
+        .abort_reason = session->abort_reason
+    };
+
+    return session->sink(session->sink_data, &event);
+}
+
+int
+j1939_tp_next_event_ms(
+    struct J1939TPSession* session)
+{
+    if (session->connection == J1939_TP_CONNECTION_ETP)
+        return j1939_etp_next_event_ms(session);
+
+    // Mirrors the checks made by the update functions of each connection type
+    if (session->connection == J1939_TP_CONNECTION_BROADCAST)
+    {
+        if (session->sender)
+            return session->bytes_rem ? session->timing.bam_gap_ms : 0;
+        else
+            return (session->bytes_rem == 0) ? 0 : J1939_TP_TIMEOUT_T1;
+    }
+
+    if (session->sender)
+    {
+        if (session->clear_to_send)
+            return session->timing.p2p_gap_ms;
+
+        return (session->window_last == 0) ? J1939_TP_TIMEOUT_TR : J1939_TP_TIMEOUT_T3;
+    }
+    else
+    {
+        if (!session->clear_to_send)
+            return session->timing.cts_delay_ms;
+
+        if (session->bytes_rem == 0)
+            return 0;
+
+        return (session->retries < J1939_TP_MAX_RETRIES) ?
+            J1939_TP_TIMEOUT_TR : J1939_TP_TIMEOUT_T1;
+    }
+}
+
 /* ============================================================================
  * Subsection: Sender helper functions
  * ============================================================================
@@ -55,134 +156,204 @@ j1939_tp_abort_pack(
 
 void
 j1939_tp_broadcast_update_sender(
-    struct J1939TP* tp)
+    struct J1939TPSession* session)
 {
-    if (tp->bytes_rem)
+    if (session->bytes_rem)
     {
-        if (tp->timer_ms >= J1939_TP_TX_PERIOD)
+        if (session->timer_ms >= session->timing.bam_gap_ms)
         {
+            // Bytes not sent aren't counted as sent
+            uint16_t bytes_rem = session->bytes_rem;
+
             struct J1939_TP_DT dt;
-            j1939_tp_dt_pack(tp, &dt);
-            j1939_tx_helper(
-                tp->node_idx,
-                J1939_TP_DT_PGN,
-                (uint8_t*)&dt,
-                J1939_TP_DT_LEN,
-                tp->msg_info.dst,
-                J1939_TP_DT_PRI);
-            tp->timer_ms = 0;
+            j1939_tp_dt_pack(session, &dt);
+            if (!j1939_tx_helper(
+                    session->tp->node,
+                    J1939_TP_DT_PGN,
+                    (uint8_t*)&dt,
+                    J1939_TP_DT_LEN,
+                    session->msg_info.dst,
+                    J1939_TP_DT_PRI))
+            {
+                session->bytes_rem = bytes_rem;
+                abort_connection(session, J1939_TP_ABORT_REASON_OTHER);
+                return;
+            }
+            j1939_tp_restart_timer(session);
         }
     }
     else
     {
-        j1939_tp_close_connection(tp);
+        session->status = J1939_TX_SENT;
+        j1939_tp_close_session(session);
     }
 }
 
 void
 j1939_tp_p2p_update_sender(
-    struct J1939TP* tp)
+    struct J1939TPSession* session)
 {
-    if (tp->clear_to_send)
+    if (session->clear_to_send)
     {
-        if (tp->bytes_rem)
+        // Without a gap, the whole window goes out in this update
+        bool burst = (session->timing.p2p_gap_ms == 0);
+
+        if (burst && (session->tp->node->can_tx_batch != NULL))
         {
-            if (tp->timer_ms >= J1939_TP_TX_PERIOD)
-            {
-                struct J1939_TP_DT dt;
-                j1939_tp_dt_pack(tp, &dt);
-                j1939_tx_helper(
-                    tp->node_idx,
+            send_window_batch(session);
+            return;
+        }
+
+        while (session->clear_to_send &&
+               (burst || (session->timer_ms >= session->timing.p2p_gap_ms)))
+        {
+            // Bytes not sent aren't counted as sent
+            uint16_t bytes_rem = session->bytes_rem;
+
+            struct J1939_TP_DT dt;
+            j1939_tp_dt_pack(session, &dt);
+            if (!j1939_tx_helper(
+                    session->tp->node,
                     J1939_TP_DT_PGN,
                     (uint8_t*)&dt,
                     J1939_TP_DT_LEN,
-                    tp->msg_info.dst,
-                    J1939_TP_DT_PRI);
-                tp->timer_ms = 0;
+                    session->msg_info.dst,
+                    J1939_TP_DT_PRI))
+            {
+                session->bytes_rem = bytes_rem;
+                abort_connection(session, J1939_TP_ABORT_REASON_OTHER);
+                return;
             }
-        }
-        else
-        {
-            if (tp->timer_ms >= J1939_TP_TIMEOUT_T3)
-                timeout(tp);
+            j1939_tp_restart_timer(session);
+
+            // The window is done, wait for the next CTS or the ACK
+            if (dt.seq == session->window_last)
+                session->clear_to_send = false;
         }
     }
     else
     {
-        if (tp->timer_ms >= J1939_TP_TIMEOUT_TR)
-            timeout(tp);
+        // Before the first CTS, the receiver must respond within Tr
+        int timeout_ms = (session->window_last == 0) ?
+            J1939_TP_TIMEOUT_TR : J1939_TP_TIMEOUT_T3;
+
+        if (session->timer_ms >= timeout_ms)
+            abort_connection(session, J1939_TP_ABORT_REASON_TIMEOUT);
     }
 }
 
 void
 j1939_tp_dt_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_DT* dt)
 {
-    uint8_t* buf = tp->buf + ((tp->next_seq - 1) * 7);
-    uint8_t* data = (uint8_t*)&dt->data0;
-    int bytes_to_copy = (tp->bytes_rem < 7) ? tp->bytes_rem : 7;
+    pack_packet(session, session->next_seq, (uint8_t*)&dt->data0);
+    count_sent(session, session->next_seq);
 
-    int i;
-    for (i = 0; i < bytes_to_copy; ++i)
+    dt->seq = session->next_seq;
+    session->next_seq++;
+}
+
+int
+j1939_tp_dt_pack_frames(
+    struct J1939TPSession* session,
+    struct J1939CanFrame* frames,
+    int max_frames)
+{
+    // Every packet has the same CAN ID
+    struct J1939Msg dt_msg = {
+        .pgn = J1939_TP_DT_PGN,
+        .dst = session->msg_info.dst,
+        .src = session->tp->node->source_address,
+        .pri = J1939_TP_DT_PRI
+    };
+    uint32_t id = j1939_msg_to_can_id(&dt_msg);
+
+    int num_frames = session->window_last - session->next_seq + 1;
+    if (num_frames > max_frames)
+        num_frames = max_frames;
+
+    for (int i = 0; i < num_frames; ++i)
     {
-        data[i] = buf[i];
-        tp->bytes_rem--;
+        uint8_t seq = session->next_seq + i;
+
+        frames[i].id = id;
+        frames[i].len = J1939_TP_DT_LEN;
+        frames[i].data[0] = seq;
+        pack_packet(session, seq, &frames[i].data[1]);
     }
 
-    // We've no more bytes remaining, fill unused data bytes with 0xFF
-    for (; i < 7; ++i)
-        data[i] = 0xFF;
+    if (num_frames > 0)
+    {
+        count_sent(session, session->next_seq + num_frames - 1);
+        session->next_seq += num_frames;
+    }
 
-    dt->seq = tp->next_seq;
-    tp->next_seq++;
+    return num_frames;
 }
 
 void j1939_tp_rts_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_RTS* rts)
 {
     rts->control_byte = J1939_TP_CM_CONTROL_BYTE_RTS;
-    rts->len = tp->msg_info.len;
-    rts->num_packages = tp->num_packages;
+    rts->len = session->msg_info.len;
+    rts->num_packages = session->num_packages;
     rts->max_packages = J1939_TP_CM_RTS_MAX_PACKAGES;
-    rts->pgn = tp->msg_info.pgn;
+    rts->pgn = session->msg_info.pgn;
 }
 
 void j1939_tp_rx_cts(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_CTS* cts)
 {
     // NOTE: the standard defines a method by which the receiver can delay the
     //  data transmission while keeping the connection open. This is done by
     //  sending a CTS message, with num_packages set to zero, every 0.5 seconds
-    //  until it's ready to receive the data. I'm choosing not to implement this.
-    //  Thus, when the sender receives a CTS message, it's assumed that the
-    //  receiver is ready to receive all bytes of payload.
-    (void)cts;
+    //  until it's ready to receive the data. I'm choosing not to implement this,
+    //  so such a CTS is ignored, as is one asking for packets we don't have.
+    if (cts->pgn != session->msg_info.pgn)
+        return;
+
+    if ((cts->num_packages == 0) ||
+        (cts->next_seq == 0) ||
+        (cts->next_seq > session->num_packages))
+    {
+        return;
+    }
+
+    // The receiver may ask for any packets again, e.g. ones it missed
+    int last = cts->next_seq + cts->num_packages - 1;
+    if (last > session->num_packages)
+        last = session->num_packages;
 
-    tp->clear_to_send = true;
+    session->next_seq = cts->next_seq;
+    session->window_last = last;
+    session->clear_to_send = true;
 }
 
 void
 j1939_tp_rx_ack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_ACK* ack)
 {
-    if ((ack->pgn == tp->msg_info.pgn) && (tp->bytes_rem == 0))
-        j1939_tp_close_connection(tp);
+    if ((ack->pgn == session->msg_info.pgn) && (session->bytes_rem == 0))
+    {
+        session->status = J1939_TX_SENT;
+        j1939_tp_close_session(session);
+    }
 }
 
 void
 j1939_tp_bam_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_BAM* bam)
 {
     bam->control_byte = J1939_TP_CM_CONTROL_BYTE_BAM;
-    bam->len = tp->msg_info.len;
-    bam->num_packages = tp->num_packages;
+    bam->len = session->msg_info.len;
+    bam->num_packages = session->num_packages;
     bam->res = 0xFF;
-    bam->pgn = tp->msg_info.pgn;
+    bam->pgn = session->msg_info.pgn;
 }
 
 /* ============================================================================
@@ -192,154 +363,211 @@ j1939_tp_bam_pack(
 
 void
 j1939_tp_broadcast_update_receiver(
-    struct J1939TP* tp)
+    struct J1939TPSession* session)
 {
-    if (tp->timer_ms >= J1939_TP_TIMEOUT_T1)
+    if (session->timer_ms >= J1939_TP_TIMEOUT_T1)
     {
-        timeout(tp);
+        abort_connection(session, J1939_TP_ABORT_REASON_TIMEOUT);
     }
-    else if (tp->bytes_rem == 0)
+    else if (session->bytes_rem == 0)
     {
-        j1939_rx_helper(tp->node_idx, &tp->msg_info);
-        j1939_tp_close_connection(tp);
+        deliver(session);
     }
 }
 
 void
 j1939_tp_p2p_update_receiver(
-    struct J1939TP* tp)
+    struct J1939TPSession* session)
 {
-    if (!tp->clear_to_send)
+    if (!session->clear_to_send)
     {
-        if (tp->timer_ms >= J1939_TP_TX_PERIOD)
+        if (session->timer_ms >= session->timing.cts_delay_ms)
         {
             struct J1939_TP_CM_CTS cts;
-            j1939_tp_cts_pack(tp, &cts);
+            j1939_tp_cts_pack(session, &cts);
             j1939_tx_helper(
-                tp->node_idx,
+                session->tp->node,
                 J1939_TP_CM_PGN,
                 (uint8_t*)&cts,
                 J1939_TP_CM_LEN,
-                tp->msg_info.src,
+                session->msg_info.src,
                 J1939_TP_CM_PRI);
-            tp->timer_ms = 0;
-            tp->clear_to_send = true;
+            j1939_tp_restart_timer(session);
+            session->clear_to_send = true;
         }
     }
     else
     {
-        if (tp->timer_ms >= J1939_TP_TIMEOUT_T1)
+        if (session->timer_ms >= J1939_TP_TIMEOUT_T1)
         {
-            timeout(tp);
+            abort_connection(session, J1939_TP_ABORT_REASON_TIMEOUT);
         }
-        else if (tp->bytes_rem == 0)
+        else if ((session->bytes_rem != 0) &&
+                 (session->timer_ms >= J1939_TP_TIMEOUT_TR) &&
+                 (session->retries < J1939_TP_MAX_RETRIES))
+        {
+            // The rest of the window, or its last packet, was lost
+            session->retries++;
+            request_missing(session);
+        }
+        else if (session->bytes_rem == 0)
         {
             struct J1939_TP_CM_ACK ack;
-            j1939_tp_ack_pack(tp, &ack);
+            j1939_tp_ack_pack(session, &ack);
             j1939_tx_helper(
-                tp->node_idx,
+                session->tp->node,
                 J1939_TP_CM_PGN,
                 (uint8_t*)&ack,
                 J1939_TP_CM_LEN,
-                tp->msg_info.src,
+                session->msg_info.src,
                 J1939_TP_CM_PRI);
 
-            j1939_rx_helper(tp->node_idx, &tp->msg_info);
-            j1939_tp_close_connection(tp);
+            deliver(session);
         }
     }
 }
 
 bool
 j1939_tp_rx_dt(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_DT* dt)
 {
-    if (dt->seq != tp->next_seq)
+    uint8_t seq = dt->seq;
+
+    // Only packets of the current window, and each of them once
+    if ((seq < session->next_seq) || (seq > session->window_last))
+        return false;
+
+    uint32_t bit = UINT32_C(1) << (seq % 32);
+    if (!(session->missing[seq / 32] & bit))
         return false;
 
-    uint8_t* buf = tp->buf + ((tp->next_seq - 1) * 7);
     uint8_t* data = (uint8_t*)&dt->data0;
-    int bytes_to_copy = (tp->bytes_rem < 7) ? tp->bytes_rem : 7;
+    int bytes_to_copy = packet_len(session, seq);
+
+    if (session->sink != NULL)
+    {
+        if (!j1939_tp_stream_event(session, J1939_STREAM_DATA, (seq - 1) * 7, data, bytes_to_copy))
+        {
+            abort_connection(session, J1939_TP_ABORT_REASON_RESOURCES);
+            return false;
+        }
+    }
+    else
+    {
+        uint8_t* buf = session->buf + ((seq - 1) * 7);
 
-    for (int i = 0; i < bytes_to_copy; ++i)
+        for (int i = 0; i < bytes_to_copy; ++i)
+            buf[i] = data[i];
+    }
+
+    session->missing[seq / 32] &= ~bit;
+
+    session->bytes_rem -= bytes_to_copy;
+    session->retries = 0;
+
+    // Once the window's last packet is in, ask for whatever is still missing
+    if ((session->connection == J1939_TP_CONNECTION_P2P) &&
+        (seq == session->window_last) &&
+        (session->bytes_rem != 0))
     {
-        buf[i] = data[i];
-        tp->bytes_rem--;
+        request_missing(session);
     }
 
-    tp->next_seq++;
     return true;
 }
 
 void
 j1939_tp_rx_rts(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_RTS* rts,
     uint8_t msg_src)
 {
-    tp->connection = J1939_TP_CONNECTION_P2P;
-    tp->sender = false;
+    session->connection = J1939_TP_CONNECTION_P2P;
+    session->sender = false;
+
+    session->bytes_rem = rts->len;
+    session->num_packages = rts->num_packages;
 
-    tp->next_seq = 1;
-    tp->bytes_rem = rts->len;
-    tp->num_packages = rts->num_packages;
+    session->msg_info.pgn = rts->pgn;
+    session->msg_info.len = rts->len;
+    session->msg_info.src = msg_src;
+    session->msg_info.dst = j1939_get_source_address(session->tp->node);
 
-    tp->msg_info.pgn = rts->pgn;
-    tp->msg_info.len = rts->len;
-    tp->msg_info.src = msg_src;
-    tp->msg_info.dst = j1939_get_source_address(tp->node_idx);
+    // The sender may limit the number of packets per CTS
+    session->window_size = session->tp->window_size;
+    if ((rts->max_packages != 0) && (rts->max_packages < session->window_size))
+        session->window_size = rts->max_packages;
 
-    // TODO: pgn lookup to determine priority
-    tp->msg_info.pri = J1939_DEFAULT_PRIORITY;
+    init_missing(session);
+    session->retries = 0;
+    request_missing(session);
+
+    // Reassembled in buf, unless the caller sets a sink
+    session->sink = NULL;
+    session->complete = false;
+    session->abort_reason = J1939_TP_ABORT_REASON_OTHER;
+
+    // The TP.CM frames have their own priority, so the message gets its PGN's
+    session->msg_info.pri = j1939_pgn_db_priority(session->msg_info.pgn);
 
     // CTS message will be sent in update loop
-    tp->clear_to_send = false;
+    j1939_tp_restart_timer(session);
 }
 
 void j1939_tp_cts_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_CTS* cts)
 {
     cts->control_byte = J1939_TP_CM_CONTROL_BYTE_CTS;
-    cts->num_packages = tp->num_packages;
-    cts->next_seq = 1;
+    cts->num_packages = session->window_last - session->next_seq + 1;
+    cts->next_seq = session->next_seq;
     cts->res = 0xFFFF;
-    cts->pgn = tp->msg_info.pgn;
+    cts->pgn = session->msg_info.pgn;
 }
 
 void
 j1939_tp_ack_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_ACK* ack)
 {
     ack->control_byte = J1939_TP_CM_CONTROL_BYTE_ACK;
-    ack->len = tp->msg_info.len;
-    ack->num_packages = tp->num_packages;
+    ack->len = session->msg_info.len;
+    ack->num_packages = session->num_packages;
     ack->res = 0xFF;
-    ack->pgn = tp->msg_info.pgn;
+    ack->pgn = session->msg_info.pgn;
 }
 
 void
 j1939_tp_rx_bam(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_BAM* bam,
     uint8_t msg_src)
 {
-    tp->connection = J1939_TP_CONNECTION_BROADCAST;
-    tp->sender = false;
+    session->connection = J1939_TP_CONNECTION_BROADCAST;
+    session->sender = false;
+
+    session->next_seq = 1;
+    session->window_last = bam->num_packages;
+    session->bytes_rem = bam->len;
+    session->num_packages = bam->num_packages;
+
+    init_missing(session);
+
+    // Reassembled in buf, unless the caller sets a sink
+    session->sink = NULL;
+    session->complete = false;
+    session->abort_reason = J1939_TP_ABORT_REASON_OTHER;
 
-    tp->next_seq = 1;
-    tp->bytes_rem = bam->len;
-    tp->num_packages = bam->num_packages;
+    session->msg_info.pgn = bam->pgn;
+    session->msg_info.len = bam->len;
+    session->msg_info.src = msg_src;
+    session->msg_info.dst = J1939_ADDR_GLOBAL;
 
-    tp->msg_info.pgn = bam->pgn;
-    tp->msg_info.len = bam->len;
-    tp->msg_info.src = msg_src;
-    tp->msg_info.dst = J1939_ADDR_GLOBAL;
+    // The TP.CM frames have their own priority, so the message gets its PGN's
+    session->msg_info.pri = j1939_pgn_db_priority(session->msg_info.pgn);
 
-    // TODO: pgn lookup to determine priority
-    tp->msg_info.pri = J1939_DEFAULT_PRIORITY;
+    j1939_tp_restart_timer(session);
 }
 
 /* ============================================================================
@@ -350,18 +578,176 @@ j1939_tp_rx_bam(
  */
 
 static void
-timeout(
-    struct J1939TP* tp)
+abort_connection(
+    struct J1939TPSession* session,
+    enum j1939_tp_abort_reason reason)
 {
     struct J1939_TP_CM_ABORT abort;
 
-    j1939_tp_abort_pack(tp, &abort, J1939_TP_ABORT_REASON_TIMEOUT, tp->msg_info.pgn);
-    j1939_tx_helper(
-        tp->node_idx,
-        J1939_TP_CM_PGN,
-        (uint8_t*)&abort,
-        J1939_TP_CM_LEN,
-        tp->msg_info.dst,
-        J1939_TP_CM_PRI);
-    j1939_tp_close_connection(tp);
+    // Broadcasts can't be aborted; the receivers just give up on them. A P2P
+    //  connection is aborted towards the other side of it.
+    if ((session->connection == J1939_TP_CONNECTION_P2P) ||
+        (session->sender))
+    {
+        j1939_tp_abort_pack(
+            &abort,
+            reason,
+            session->sender ? J1939_TP_ABORT_ROLE_SENDER : J1939_TP_ABORT_ROLE_RECEIVER,
+            session->msg_info.pgn);
+        j1939_tx_helper(
+            session->tp->node,
+            J1939_TP_CM_PGN,
+            (uint8_t*)&abort,
+            J1939_TP_CM_LEN,
+            session->sender ? session->msg_info.dst : session->msg_info.src,
+            J1939_TP_CM_PRI);
+    }
+
+    // A sender gives up either because the receiver went quiet, or because
+    //  it couldn't send
+    if (session->sender)
+        session->status = (reason == J1939_TP_ABORT_REASON_TIMEOUT) ? J1939_TX_TIMEOUT : J1939_TX_FAILED;
+
+    session->abort_reason = reason;
+    j1939_tp_close_session(session);
+}
+
+// Hand the complete message to the application, or tell its sink it's
+//  complete, and close the session
+static void
+deliver(
+    struct J1939TPSession* session)
+{
+    if (session->sink != NULL)
+    {
+        (void)j1939_tp_stream_event(session, J1939_STREAM_COMPLETE, 0, NULL, 0);
+        session->complete = true;
+    }
+    else
+    {
+        j1939_rx_helper(session->tp->node, &session->msg_info);
+    }
+
+    j1939_tp_close_session(session);
+}
+
+// Return the number of payload bytes carried by the packet with sequence
+//  number seq
+static int
+packet_len(
+    struct J1939TPSession* session,
+    uint8_t seq)
+{
+    int len = session->msg_info.len - ((seq - 1) * 7);
+
+    if (len < 0)
+        return 0;
+
+    return (len < 7) ? len : 7;
+}
+
+// Copy the 7 data bytes of a packet, the last one padded with 0xFF
+static void
+pack_packet(
+    struct J1939TPSession* session,
+    uint8_t seq,
+    uint8_t* data)
+{
+    int len = packet_len(session, seq);
+
+    memcpy(data, session->buf + ((seq - 1) * 7), len);
+    if (len < 7)
+        memset(data + len, 0xFF, 7 - len);
+}
+
+// Count the bytes up to the end of packet seq as sent. Packets asked for again
+//  by the receiver were already counted.
+static void
+count_sent(
+    struct J1939TPSession* session,
+    uint8_t seq)
+{
+    int sent = ((seq - 1) * 7) + packet_len(session, seq);
+
+    if (session->msg_info.len - session->bytes_rem < sent)
+        session->bytes_rem = session->msg_info.len - sent;
+}
+
+// Send the rest of the CTS window through can_tx_batch
+static void
+send_window_batch(
+    struct J1939TPSession* session)
+{
+    struct J1939* node = session->tp->node;
+    struct J1939CanFrame frames[J1939_TX_BATCH_SIZE];
+
+    while (session->clear_to_send)
+    {
+        uint16_t bytes_rem = session->bytes_rem;
+        uint8_t first_seq = session->next_seq;
+
+        int num_frames = j1939_tp_dt_pack_frames(session, frames, J1939_TX_BATCH_SIZE);
+        int sent = node->can_tx_batch(node->user_data, frames, num_frames);
+
+        if (sent < num_frames)
+        {
+            // Only the frames accepted count as sent
+            session->bytes_rem = bytes_rem;
+            if (sent > 0)
+                count_sent(session, first_seq + sent - 1);
+
+            abort_connection(session, J1939_TP_ABORT_REASON_OTHER);
+            return;
+        }
+        j1939_tp_restart_timer(session);
+
+        // The window is done, wait for the next CTS or the ACK. next_seq
+        //  wraps to zero after packet 255.
+        if (first_seq + num_frames > session->window_last)
+            session->clear_to_send = false;
+    }
+}
+
+// Mark packets 1 to num_packages as missing
+static void
+init_missing(
+    struct J1939TPSession* session)
+{
+    memset(session->missing, 0, sizeof(session->missing));
+
+    for (int seq = 1; seq <= session->num_packages; ++seq)
+        session->missing[seq / 32] |= UINT32_C(1) << (seq % 32);
+}
+
+// Make the next CTS ask for the first run of missing packets, at most
+//  window_size of them
+static void
+request_missing(
+    struct J1939TPSession* session)
+{
+    int first = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        if (session->missing[i])
+        {
+            first = (i * 32) + __builtin_ctz(session->missing[i]);
+            break;
+        }
+    }
+
+    // Nothing missing; the ACK is sent once bytes_rem reaches zero
+    if (first == 0)
+        return;
+
+    int last = first;
+    while ((last < session->num_packages) &&
+           (last - first + 1 < session->window_size) &&
+           (session->missing[(last + 1) / 32] & (UINT32_C(1) << ((last + 1) % 32))))
+    {
+        last++;
+    }
+
+    session->next_seq = first;
+    session->window_last = last;
+    session->clear_to_send = false;
 }
@@ -29,28 +29,35 @@
  * ============================================================================
  */
 
-// Create a J1939 msg and transmit it, used for sending TP.DT and TP.CM msgs
-void
-j1939_tp_tx(
-    struct J1939TP* tp,
-    uint32_t pgn,
-    uint8_t* data,
-    uint16_t len,
-    uint8_t dst,
-    uint8_t pri);
-
 void
 j1939_tp_rx_abort(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_ABORT* abort);
 
 void
 j1939_tp_abort_pack(
-    struct J1939TP* tp,
     struct J1939_TP_CM_ABORT* abort,
     enum j1939_tp_abort_reason reason,
+    enum j1939_tp_abort_role role,
     uint32_t pgn);
 
+// Pass an event of the message received by the session to its sink. Return
+//  the sink's answer.
+bool
+j1939_tp_stream_event(
+    struct J1939TPSession* session,
+    enum j1939_stream_event_type type,
+    uint32_t offset,
+    const uint8_t* data,
+    uint16_t len);
+
+// Return the value of timer_ms at which the update function of the open
+//  connection next acts: transmits a packet, sends a CTS, delivers the message
+//  or times out.
+int
+j1939_tp_next_event_ms(
+    struct J1939TPSession* session);
+
 /* ============================================================================
  * Subsection: Sender helper functions
  * ============================================================================
@@ -58,34 +65,43 @@ j1939_tp_abort_pack(
 
 void
 j1939_tp_broadcast_update_sender(
-    struct J1939TP* tp);
+    struct J1939TPSession* session);
 
 void
 j1939_tp_p2p_update_sender(
-    struct J1939TP* tp);
+    struct J1939TPSession* session);
 
 void
 j1939_tp_dt_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_DT* dt);
 
+// Pack the TP.DT packets of a P2P sender's CTS window, from next_seq on, into
+//  up to max_frames CAN frames ready to be sent, like j1939_tp_dt_pack() does
+//  for a single packet. Return the number of frames packed.
+int
+j1939_tp_dt_pack_frames(
+    struct J1939TPSession* session,
+    struct J1939CanFrame* frames,
+    int max_frames);
+
 void j1939_tp_rts_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_RTS* rts);
 
 void
 j1939_tp_rx_cts(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_CTS* cts);
 
 void
 j1939_tp_rx_ack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_ACK* ack);
 
 void
 j1939_tp_bam_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_BAM* bam);
 
 /* ============================================================================
@@ -95,36 +111,36 @@ j1939_tp_bam_pack(
 
 void
 j1939_tp_broadcast_update_receiver(
-    struct J1939TP* tp);
+    struct J1939TPSession* session);
 
 void
 j1939_tp_p2p_update_receiver(
-    struct J1939TP* tp);
+    struct J1939TPSession* session);
 
 // Return false if TP.DT message is not received successfully
 bool
 j1939_tp_rx_dt(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_DT* dt);
 
 void
 j1939_tp_rx_rts(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_RTS* rts,
     uint8_t msg_src);
 
 void
 j1939_tp_cts_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_CTS* cts);
 
 void
 j1939_tp_ack_pack(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_ACK* ack);
 
 void
 j1939_tp_rx_bam(
-    struct J1939TP* tp,
+    struct J1939TPSession* session,
     struct J1939_TP_CM_BAM* bam,
     uint8_t msg_src);
@@ -1,5 +1,7 @@
 #include "test_j1939.hpp"
 
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
 #include <iostream>
 
 J1939 TestJ1939::node;
@@ -23,14 +25,15 @@ void startup_delay_250ms(void* param)
     return;
 }
 
-bool TestJ1939::can_rx(J1939CanFrame* jframe)
+bool TestJ1939::can_rx(void* user_data, J1939CanFrame* jframe)
 {
-    (void)jframe;
+    (void)user_data, (void)jframe;
     return false;
 }
 
-bool TestJ1939::can_tx(J1939Msg* msg)
+bool TestJ1939::can_tx(void* user_data, J1939Msg* msg)
 {
+    (void)user_data;
     TestJ1939::msg.pgn = msg->pgn;
     TestJ1939::msg.len = msg->len;
     TestJ1939::msg.dst = msg->dst;
@@ -41,8 +44,9 @@ bool TestJ1939::can_tx(J1939Msg* msg)
     return true;
 }
 
-void TestJ1939::j1939_rx(J1939Msg *msg)
+void TestJ1939::j1939_rx(void* user_data, J1939Msg *msg)
 {
+    (void)user_data;
     TestJ1939::msg.pgn = msg->pgn;
     TestJ1939::msg.len = msg->len;
     TestJ1939::msg.dst = msg->dst;
@@ -74,3 +78,74 @@ void TestJ1939::testRunStarting(Catch::TestRunInfo const& test_run_info)
 }
 
 CATCH_REGISTER_LISTENER(TestJ1939)
+
+std::function<bool(const J1939CanFrame&)> TestSide::bus_filter;
+
+static void
+side_rx(void* user_data, J1939Msg* msg)
+{
+    (void)user_data, (void)msg;
+}
+
+bool TestSide::can_tx(void* user_data, J1939Msg* msg)
+{
+    TestSide* side = static_cast<TestSide*>(user_data);
+
+    J1939CanFrame frame {};
+    frame.id = j1939_msg_to_can_id(msg);
+    std::memcpy(frame.data, msg->data, msg->len);
+    frame.len = msg->len;
+
+    if (!bus_filter || bus_filter(frame))
+        side->out.push_back(frame);
+
+    return true;
+}
+
+void TestSide::init(TestSide* side, uint32_t identity, uint8_t address)
+{
+    J1939Name name {};
+    name.identity = identity;
+    name.arbitrary_addr_capable = 1;
+
+    side->out.clear();
+
+    REQUIRE(j1939_context_init(&side->ctx, side->storage, 1, side) == true);
+    REQUIRE(j1939_context_node_init(&side->ctx, &side->node, &name, address, 10,
+        nullptr, TestSide::can_tx, side_rx, startup_delay_250ms, nullptr) == true);
+}
+
+void TestSide::deliver_frames(TestSide* a, TestSide* b)
+{
+    while (!a->out.empty() || !b->out.empty())
+    {
+        std::vector<J1939CanFrame> frames;
+
+        frames.swap(a->out);
+        j1939_process_frames(&b->node, frames.data(), frames.size());
+
+        frames.clear();
+        frames.swap(b->out);
+        j1939_process_frames(&a->node, frames.data(), frames.size());
+    }
+}
+
+void TestSide::run(TestSide* a, TestSide* b, uint64_t* now_us)
+{
+    for (;;)
+    {
+        j1939_update_at(&a->node, *now_us);
+        j1939_update_at(&b->node, *now_us);
+        deliver_frames(a, b);
+
+        uint64_t deadline_a = j1939_next_deadline(&a->node);
+        uint64_t deadline_b = j1939_next_deadline(&b->node);
+        uint64_t deadline = (deadline_a < deadline_b) ? deadline_a : deadline_b;
+
+        if (deadline == J1939_NO_DEADLINE)
+            break;
+
+        if (deadline > *now_us)
+            *now_us = deadline;
+    }
+}
@@ -3,7 +3,9 @@
 #include <catch2/reporters/catch_reporter_event_listener.hpp>
 #include <catch2/reporters/catch_reporter_registrars.hpp>
 
+#include <functional>
 #include <stdint.h>
+#include <vector>
 
 extern "C" {
     struct CanIdConverter {
@@ -29,11 +31,35 @@ public:
     static uint8_t msg_buf[J1939_TP_MAX_PAYLOAD];
     static J1939Name name;
 
-    static bool can_rx(J1939CanFrame* jframe);
-    static bool can_tx(J1939Msg* msg);
-    static void j1939_rx(J1939Msg* msg);
+    static bool can_rx(void* user_data, J1939CanFrame* jframe);
+    static bool can_tx(void* user_data, J1939Msg* msg);
+    static void j1939_rx(void* user_data, J1939Msg* msg);
 
     using Catch::EventListenerBase::EventListenerBase;
 
     void testRunStarting(Catch::TestRunInfo const& test_run_info) override;
 };
+
+// One of two nodes connected back-to-back, each in its own context
+struct TestSide {
+    J1939Context ctx;
+    J1939Private storage[1];
+    J1939 node;
+
+    // Frames sent by this node, not yet seen by the other one
+    std::vector<J1939CanFrame> out;
+
+    // Return false to lose a frame on its way to the other node
+    static std::function<bool(const J1939CanFrame&)> bus_filter;
+
+    static bool can_tx(void* user_data, J1939Msg* msg);
+
+    // Start the node over with an arbitrary address capable NAME
+    static void init(TestSide* side, uint32_t identity, uint8_t address);
+
+    // Pass frames between the two nodes until neither has any left to send
+    static void deliver_frames(TestSide* a, TestSide* b);
+
+    // Run both nodes on a simulated clock until neither has anything to do
+    static void run(TestSide* a, TestSide* b, uint64_t* now_us);
+};
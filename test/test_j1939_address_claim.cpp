@@ -1,6 +1,15 @@
 #include "test_j1939.hpp"
 
 #include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+TestSide commander;
+TestSide commanded;
+
+}
 
 TEST_CASE("New address search", "[j1939_ac_update_address]")
 {
@@ -17,7 +26,7 @@ TEST_CASE("New address search", "[j1939_ac_update_address]")
         // It shouldn't be possible for addresses_available to be a positive
         //  number and address_table be full.
         ac->addresses_available = 1;
-        std::memset(ac->address_table, 1, sizeof(ac->address_table));
+        std::memset(ac->address_table, 0xFF, sizeof(ac->address_table));
 
         REQUIRE(j1939_ac_update_address(ac) == false);
         REQUIRE(ac->addresses_available == 0);
@@ -25,10 +34,10 @@ TEST_CASE("New address search", "[j1939_ac_update_address]")
     SECTION("Function loops over entire address_table until it finds and available address")
     {
         ac->addresses_available = 1;
-        std::memset(ac->address_table, 1, sizeof(ac->address_table));
+        std::memset(ac->address_table, 0xFF, sizeof(ac->address_table));
 
         TestJ1939::node.source_address = 80;
-        ac->address_table[79] = 0;
+        j1939_ac_mark_address(ac, 79, false);
 
         REQUIRE(j1939_ac_update_address(ac) == true);
         REQUIRE(TestJ1939::node.source_address == 79);
@@ -36,16 +45,76 @@ TEST_CASE("New address search", "[j1939_ac_update_address]")
     SECTION("Loop wraps around to beginning of address_table during search")
     {
         ac->addresses_available = 1;
-        std::memset(ac->address_table, 1, sizeof(ac->address_table));
+        std::memset(ac->address_table, 0xFF, sizeof(ac->address_table));
 
         TestJ1939::node.source_address = 80;
 
         const int foo = 85;
-        ac->address_table[foo] = 0;
+        j1939_ac_mark_address(ac, foo, false);
 
         REQUIRE(j1939_ac_update_address(ac) == true);
         REQUIRE(TestJ1939::node.source_address == foo);
     }
+    SECTION("The search never lands on the null or global address")
+    {
+        ac->addresses_available = 1;
+        std::memset(ac->address_table, 0xFF, sizeof(ac->address_table));
+        ac->address_table[7] = 0x3FFFFFFF;
+
+        TestJ1939::node.source_address = 200;
+
+        REQUIRE(j1939_ac_update_address(ac) == false);
+        REQUIRE(ac->addresses_available == 0);
+
+        j1939_ac_mark_address(ac, 253, false);
+
+        REQUIRE(j1939_ac_update_address(ac) == true);
+        REQUIRE(TestJ1939::node.source_address == 253);
+    }
+    SECTION("Marking an address changes the number of addresses available once")
+    {
+        std::memset(ac->address_table, 0, sizeof(ac->address_table));
+        ac->addresses_available = J1939_AC_MAX_ADDRESSES;
+
+        j1939_ac_mark_address(ac, 0x33, true);
+        j1939_ac_mark_address(ac, 0x33, true);
+        j1939_ac_mark_address(ac, J1939_ADDR_NULL, true);
+        REQUIRE(j1939_ac_is_address_taken(ac, 0x33) == true);
+        REQUIRE(ac->addresses_available == J1939_AC_MAX_ADDRESSES - 1);
+
+        j1939_ac_mark_address(ac, 0x33, false);
+        j1939_ac_mark_address(ac, 0x33, false);
+        REQUIRE(j1939_ac_is_address_taken(ac, 0x33) == false);
+        REQUIRE(ac->addresses_available == J1939_AC_MAX_ADDRESSES);
+    }
+    SECTION("The self-configurable policy looks in 128-247 first")
+    {
+        j1939_set_address_policy(&TestJ1939::node, J1939_ADDRESS_POLICY_SELF_CONFIGURABLE);
+        std::memset(ac->address_table, 0, sizeof(ac->address_table));
+        ac->addresses_available = J1939_AC_MAX_ADDRESSES;
+
+        // From outside the range, the first free address in the range
+        TestJ1939::node.source_address = 80;
+        REQUIRE(j1939_ac_update_address(ac) == true);
+        REQUIRE(TestJ1939::node.source_address == 128);
+
+        // From inside the range, the next free one, wrapping within the range
+        for (int i = 128; i <= 247; ++i)
+            j1939_ac_mark_address(ac, i, true);
+        j1939_ac_mark_address(ac, 140, false);
+
+        TestJ1939::node.source_address = 200;
+        REQUIRE(j1939_ac_update_address(ac) == true);
+        REQUIRE(TestJ1939::node.source_address == 140);
+
+        // Once the range is full, any free address
+        j1939_ac_mark_address(ac, 140, true);
+        TestJ1939::node.source_address = 200;
+        REQUIRE(j1939_ac_update_address(ac) == true);
+        REQUIRE(TestJ1939::node.source_address == 248);
+
+        j1939_set_address_policy(&TestJ1939::node, J1939_ADDRESS_POLICY_NEXT_FREE);
+    }
 
     g_j1939[TestJ1939::node.node_idx].j1939_public->source_address = original_address;
 }
@@ -76,7 +145,7 @@ TEST_CASE("Receiving address claim", "[j1939_ac_rx_address_claim]")
         received_msg.src = our_address + 1;
         j1939_ac_rx_address_claim(ac, &received_msg);
 
-        REQUIRE(ac->address_table[received_msg.src] == 1);
+        REQUIRE(j1939_ac_is_address_taken(ac, received_msg.src) == true);
         REQUIRE(ac->addresses_available == (J1939_AC_MAX_ADDRESSES - 1));
     }
     SECTION("Receive lower priority NAME")
@@ -85,6 +154,7 @@ TEST_CASE("Receiving address claim", "[j1939_ac_rx_address_claim]")
         std::memset(&received_ac, 0xFF, sizeof(J1939Name));
         received_msg.src = our_address;
 
+        j1939_name_table_init(&ac->names);
         j1939_ac_rx_address_claim(ac, &received_msg);
 
         REQUIRE(TestJ1939::msg.pgn == J1939_ADDRESS_CLAIMED_PGN);
@@ -93,6 +163,11 @@ TEST_CASE("Receiving address claim", "[j1939_ac_rx_address_claim]")
         REQUIRE(TestJ1939::msg.dst == J1939_ADDR_GLOBAL);
         REQUIRE(TestJ1939::msg.pri == J1939_ADDRESS_CLAIMED_PRI);
         REQUIRE(std::memcmp(TestJ1939::msg.data, &TestJ1939::name, sizeof(J1939Name)) == 0);
+
+        // The losing node isn't recorded at our address
+        J1939Name name;
+        REQUIRE(j1939_address_to_name(&TestJ1939::node, our_address, &name) == false);
+        REQUIRE(j1939_name_to_address(&TestJ1939::node, &received_ac) == J1939_ADDR_NULL);
     }
     SECTION("Receive higher priority NAME and can claim a new address")
     {
@@ -101,12 +176,26 @@ TEST_CASE("Receiving address claim", "[j1939_ac_rx_address_claim]")
         received_msg.src = our_address;
 
         std::memset(ac->address_table, 0, sizeof(ac->address_table));
-        ac->address_table[our_address] = 1;
-        ac->addresses_available = J1939_AC_MAX_ADDRESSES - 1;
+        ac->addresses_available = J1939_AC_MAX_ADDRESSES;
+        j1939_ac_mark_address(ac, our_address, true);
 
+        TestJ1939::msg.pgn = 0;
         j1939_ac_rx_address_claim(ac, &received_msg);
 
+        // The new address is claimed after a random delay of at most 153 ms
+        REQUIRE(ac->state == J1939_AC_STATE_CLAIM_BACKOFF);
+        REQUIRE(j1939_is_address_claimed(&TestJ1939::node) == false);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+
+        j1939_ac_update(ac, 1000000);
+        REQUIRE(j1939_ac_next_deadline(ac) <= 1153000);
+        j1939_ac_update(ac, 1153000);
+
+        // The winning node is recorded at our old address
+        REQUIRE(j1939_name_to_address(&TestJ1939::node, &received_ac) == our_address);
+
         // We should sent out an address claim msg with our newly claimed addr
+        REQUIRE(j1939_is_address_claimed(&TestJ1939::node) == true);
         REQUIRE(TestJ1939::msg.src == (our_address + 1));
         REQUIRE(TestJ1939::msg.pgn == J1939_ADDRESS_CLAIMED_PGN);
         REQUIRE(TestJ1939::msg.len == J1939_ADDRESS_CLAIMED_LEN);
@@ -120,15 +209,33 @@ TEST_CASE("Receiving address claim", "[j1939_ac_rx_address_claim]")
         std::memset(&received_ac, 0x00, sizeof(J1939Name));
         received_msg.src = our_address;
 
-        J1939TP* tp = &g_j1939[ac->node_idx].tp;
+        J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+
+        uint8_t tp_data[9] = { 0 };
+        J1939Msg tp_msg {
+            .pgn = 0xFEE3,
+            .data = tp_data,
+            .len = sizeof(tp_data),
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_DEFAULT_PRIORITY
+        };
+        j1939_tp_close_all(tp);
+        REQUIRE(j1939_tp_queue(tp, &tp_msg) == true);
 
         ac->addresses_available = 0;
-        tp->connection = J1939_TP_CONNECTION_BROADCAST;
+        TestJ1939::msg.pgn = 0;
         j1939_ac_rx_address_claim(ac, &received_msg);
 
         // Any open TP connections should be closed
-        REQUIRE(tp->connection == J1939_TP_CONNECTION_NONE);
-        REQUIRE(ac->cannot_claim_address == true);
+        REQUIRE(j1939_tp_find_tx_session(tp, J1939_ADDR_GLOBAL) == nullptr);
+        REQUIRE(ac->state == J1939_AC_STATE_CANNOT_CLAIM_BACKOFF);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+
+        j1939_ac_update(ac, 1000000);
+        j1939_ac_update(ac, 1153000);
+        REQUIRE(ac->state == J1939_AC_STATE_CANNOT_CLAIM);
+        REQUIRE(j1939_ac_next_deadline(ac) == J1939_NO_DEADLINE);
+        REQUIRE(j1939_tx(&TestJ1939::node, &tp_msg) == false);
 
         // We should send out an CANNOT CLAIM ADDRESS message and set our source
         //  address to 254.
@@ -139,8 +246,414 @@ TEST_CASE("Receiving address claim", "[j1939_ac_rx_address_claim]")
         REQUIRE(TestJ1939::msg.pri == J1939_CANNOT_CLAIM_ADDRESS_PRI);
         REQUIRE(std::memcmp(TestJ1939::msg.data, &TestJ1939::name, sizeof(J1939Name)) == 0);
 
-        ac->cannot_claim_address = false;
+        // A request for address claim is answered with Cannot Claim Address,
+        //  after a random delay
+        TestJ1939::msg.pgn = 0;
+        j1939_ac_rx_address_claim_request(ac);
+        REQUIRE(ac->state == J1939_AC_STATE_CANNOT_CLAIM_BACKOFF);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+
+        j1939_ac_update(ac, 2000000);
+        j1939_ac_update(ac, 2153000);
+        REQUIRE(ac->state == J1939_AC_STATE_CANNOT_CLAIM);
+        REQUIRE(TestJ1939::msg.pgn == J1939_CANNOT_CLAIM_ADDRESS_PGN);
+        REQUIRE(TestJ1939::msg.src == J1939_ADDR_NULL);
+    }
+
+    ac->state = J1939_AC_STATE_CLAIMED;
+    g_j1939[TestJ1939::node.node_idx].j1939_public->source_address = original_address;
+}
+
+TEST_CASE("Receiving commanded address", "[j1939_ac_rx_commanded_address]")
+{
+    J1939AC* ac = &g_j1939[TestJ1939::node.node_idx].ac;
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    uint8_t original_address = g_j1939[TestJ1939::node.node_idx].j1939_public->source_address;
+
+    const uint8_t our_address = 0x55;
+    const uint8_t new_address = 0x99;
+    g_j1939[TestJ1939::node.node_idx].j1939_public->source_address = our_address;
+
+    std::memset(ac->address_table, 0, sizeof(ac->address_table));
+    ac->addresses_available = J1939_AC_MAX_ADDRESSES;
+    j1939_ac_mark_address(ac, our_address, true);
+
+    J1939_COMMANDED_ADDRESS command {
+        .name = TestJ1939::name,
+        .new_source_address = new_address
+    };
+    J1939Msg command_msg {
+        .pgn = J1939_COMMANDED_ADDRESS_PGN,
+        .data = (uint8_t*)&command,
+        .len = J1939_COMMANDED_ADDRESS_LEN,
+        .src = 0x20,
+        .dst = J1939_ADDR_GLOBAL,
+        .pri = J1939_COMMANDED_ADDRESS_PRI
+    };
+
+    TestJ1939::msg.pgn = 0;
+
+    SECTION("A command for our NAME moves us to the new address")
+    {
+        uint8_t tp_data[9] = { 0 };
+        J1939Msg tp_msg {
+            .pgn = 0xFEE3,
+            .data = tp_data,
+            .len = sizeof(tp_data),
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_DEFAULT_PRIORITY
+        };
+        j1939_tp_close_all(tp);
+        REQUIRE(j1939_tp_queue(tp, &tp_msg) == true);
+
+        j1939_ac_rx_commanded_address(ac, &command_msg);
+
+        REQUIRE(TestJ1939::node.source_address == new_address);
+        REQUIRE(j1939_tp_find_tx_session(tp, J1939_ADDR_GLOBAL) == nullptr);
+
+        REQUIRE(j1939_ac_is_address_taken(ac, our_address) == false);
+        REQUIRE(j1939_ac_is_address_taken(ac, new_address) == true);
+        REQUIRE(ac->addresses_available == J1939_AC_MAX_ADDRESSES - 1);
+
+        // The new address is claimed, and used once 250 ms pass without
+        //  contention since it's in the self-configurable range
+        REQUIRE(TestJ1939::msg.pgn == J1939_ADDRESS_CLAIMED_PGN);
+        REQUIRE(TestJ1939::msg.src == new_address);
+        REQUIRE(TestJ1939::msg.dst == J1939_ADDR_GLOBAL);
+        REQUIRE(std::memcmp(TestJ1939::msg.data, &TestJ1939::name, sizeof(J1939Name)) == 0);
+
+        REQUIRE(ac->state == J1939_AC_STATE_CLAIMING);
+        j1939_ac_update(ac, 1000000);
+        j1939_ac_update(ac, 1249000);
+        REQUIRE(j1939_is_address_claimed(&TestJ1939::node) == false);
+        j1939_ac_update(ac, 1250000);
+        REQUIRE(j1939_is_address_claimed(&TestJ1939::node) == true);
     }
+    SECTION("A command for another NAME is ignored")
+    {
+        command.name.identity++;
+        j1939_ac_rx_commanded_address(ac, &command_msg);
+
+        REQUIRE(TestJ1939::node.source_address == our_address);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+    }
+    SECTION("Invalid commands are ignored")
+    {
+        command.new_source_address = J1939_ADDR_NULL;
+        j1939_ac_rx_commanded_address(ac, &command_msg);
+        REQUIRE(TestJ1939::node.source_address == our_address);
 
+        command.new_source_address = new_address;
+        command_msg.len = 8;
+        j1939_ac_rx_commanded_address(ac, &command_msg);
+        REQUIRE(TestJ1939::node.source_address == our_address);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+    }
+
+    ac->state = J1939_AC_STATE_CLAIMED;
     g_j1939[TestJ1939::node.node_idx].j1939_public->source_address = original_address;
 }
+
+TEST_CASE("Reassembled messages are passed on", "[j1939_rx_helper]")
+{
+    J1939AC* ac = &g_j1939[TestJ1939::node.node_idx].ac;
+
+    std::memset(ac->address_table, 0, sizeof(ac->address_table));
+    ac->addresses_available = J1939_AC_MAX_ADDRESSES;
+    j1939_ac_mark_address(ac, TestJ1939::node.source_address, true);
+    j1939_ac_mark_address(ac, 0x60, true);
+
+    // Protocol PGNs carried by the transport protocol aren't acted on
+    uint8_t data[9] = { 0 };
+    J1939Msg msg {
+        .pgn = J1939_REQUEST_PGN,
+        .data = data,
+        .len = sizeof(data),
+        .src = 0x60,
+        .dst = J1939_ADDR_GLOBAL,
+        .pri = J1939_DEFAULT_PRIORITY
+    };
+    ((J1939_REQUEST*)data)->pgn = J1939_ADDRESS_CLAIMED_PGN;
+
+    const uint32_t pgns[] = {
+        J1939_REQUEST_PGN,
+        J1939_ADDRESS_CLAIMED_PGN,
+        J1939_TP_CM_PGN,
+        J1939_TP_DT_PGN
+    };
+
+    for (uint32_t pgn : pgns)
+    {
+        msg.pgn = pgn;
+        TestJ1939::msg.pgn = 0;
+        j1939_rx_helper(&TestJ1939::node, &msg);
+
+        REQUIRE(TestJ1939::msg.pgn == pgn);
+        REQUIRE(j1939_ac_is_address_taken(ac, 0x60) == true);
+        REQUIRE(ac->addresses_available == J1939_AC_MAX_ADDRESSES - 2);
+    }
+}
+
+TEST_CASE("Commanded address over the transport protocol", "[j1939_tx_commanded_address]")
+{
+    constexpr uint8_t commander_address = 0x20;
+    constexpr uint8_t commanded_address = 0x30;
+    constexpr uint8_t new_address = 0x90;
+
+    TestSide::init(&commander, 1, commander_address);
+    TestSide::init(&commanded, 2, commanded_address);
+
+    uint64_t now_us = 1000000;
+    TestSide::run(&commander, &commanded, &now_us);
+
+    J1939Name commanded_name;
+    REQUIRE(j1939_address_to_name(&commander.node, commanded_address, &commanded_name) == true);
+
+    SECTION("The commanded node moves and is found at its new address")
+    {
+        REQUIRE(j1939_tx_commanded_address(&commander.node, &commanded_name, new_address) == true);
+        TestSide::run(&commander, &commanded, &now_us);
+
+        REQUIRE(commanded.node.source_address == new_address);
+        REQUIRE(j1939_name_to_address(&commander.node, &commanded_name) == new_address);
+        REQUIRE(j1939_ac_is_address_taken(&commander.storage[0].ac, commanded_address) == false);
+        REQUIRE(j1939_ac_is_address_taken(&commander.storage[0].ac, new_address) == true);
+    }
+    SECTION("Invalid addresses can't be commanded")
+    {
+        REQUIRE(j1939_tx_commanded_address(&commander.node, &commanded_name, J1939_ADDR_NULL) == false);
+        REQUIRE(j1939_tx_commanded_address(&commander.node, &commanded_name, J1939_ADDR_GLOBAL) == false);
+    }
+}
+
+TEST_CASE("Address claim runs in the update functions", "[j1939_ac_update][j1939_is_address_claimed]")
+{
+    uint8_t data[8] = { 0 };
+    J1939Msg msg {
+        .pgn = 0xFEF1,
+        .data = data,
+        .len = sizeof(data),
+        .dst = J1939_ADDR_GLOBAL,
+        .pri = J1939_DEFAULT_PRIORITY
+    };
+
+    SECTION("A self-configurable address is used after 250 ms")
+    {
+        const uint64_t start_us = 1000000;
+
+        TestSide::init(&commander, 1, 0x90);
+
+        REQUIRE(commander.out.size() == 1);
+        REQUIRE(j1939_is_address_claimed(&commander.node) == false);
+        REQUIRE(j1939_tx(&commander.node, &msg) == false);
+
+        // The wait starts at the first update
+        REQUIRE(j1939_next_deadline(&commander.node) == 0);
+        j1939_update_at(&commander.node, start_us);
+        REQUIRE(j1939_next_deadline(&commander.node) == start_us + J1939_AC_CLAIM_WAIT_US);
+
+        j1939_update_at(&commander.node, start_us + J1939_AC_CLAIM_WAIT_US - 1);
+        REQUIRE(j1939_is_address_claimed(&commander.node) == false);
+
+        j1939_update_at(&commander.node, start_us + J1939_AC_CLAIM_WAIT_US);
+        REQUIRE(j1939_is_address_claimed(&commander.node) == true);
+        REQUIRE(j1939_next_deadline(&commander.node) == J1939_NO_DEADLINE);
+        REQUIRE(j1939_tx(&commander.node, &msg) == true);
+    }
+    SECTION("The wait keeps time with j1939_update()")
+    {
+        TestSide::init(&commander, 1, 0x90);
+
+        // The first update starts the wait, and each one advances it by the
+        //  tick rate (10 ms)
+        for (int i = 0; i < 25; ++i)
+            j1939_update(&commander.node);
+        REQUIRE(j1939_is_address_claimed(&commander.node) == false);
+
+        j1939_update(&commander.node);
+        REQUIRE(j1939_is_address_claimed(&commander.node) == true);
+    }
+    SECTION("Other addresses are used right away")
+    {
+        TestSide::init(&commander, 1, 0x20);
+
+        REQUIRE(j1939_is_address_claimed(&commander.node) == true);
+        REQUIRE(j1939_next_deadline(&commander.node) == J1939_NO_DEADLINE);
+        REQUIRE(j1939_tx(&commander.node, &msg) == true);
+    }
+    SECTION("Nodes starting on the same address end up on different ones")
+    {
+        TestSide::init(&commander, 1, 0x30);
+        TestSide::init(&commanded, 2, 0x30);
+
+        uint64_t now_us = 1000000;
+        j1939_update_at(&commander.node, now_us);
+        j1939_update_at(&commanded.node, now_us);
+
+        // The node with the lower priority NAME backs off
+        std::vector<J1939CanFrame> frames;
+        frames.swap(commander.out);
+        commanded.out.clear();
+        j1939_process_frames(&commanded.node, frames.data(), frames.size());
+
+        J1939AC* loser = &commanded.storage[0].ac;
+        REQUIRE(loser->state == J1939_AC_STATE_CLAIM_BACKOFF);
+        REQUIRE(loser->wait_us <= 153000);
+        REQUIRE(commanded.out.empty());
+
+        TestSide::run(&commander, &commanded, &now_us);
+
+        REQUIRE(j1939_is_address_claimed(&commander.node) == true);
+        REQUIRE(j1939_is_address_claimed(&commanded.node) == true);
+        REQUIRE(commander.node.source_address == 0x30);
+        REQUIRE(commanded.node.source_address == 0x31);
+
+        J1939Name name;
+        REQUIRE(j1939_address_to_name(&commander.node, 0x31, &name) == true);
+        REQUIRE(name.identity == 2);
+    }
+    SECTION("Backoff delays are seeded with the NAME")
+    {
+        TestSide::init(&commander, 1, 0x20);
+        TestSide::init(&commanded, 2, 0x20);
+
+        // Both nodes lose their address to a third one
+        J1939Name winner {};
+        J1939Msg claim {
+            .pgn = J1939_ADDRESS_CLAIMED_PGN,
+            .data = (uint8_t*)&winner,
+            .len = J1939_ADDRESS_CLAIMED_LEN,
+            .src = 0x20,
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_ADDRESS_CLAIMED_PRI
+        };
+        j1939_ac_rx_address_claim(&commander.storage[0].ac, &claim);
+        j1939_ac_rx_address_claim(&commanded.storage[0].ac, &claim);
+
+        REQUIRE(commander.storage[0].ac.state == J1939_AC_STATE_CLAIM_BACKOFF);
+        REQUIRE(commanded.storage[0].ac.state == J1939_AC_STATE_CLAIM_BACKOFF);
+        REQUIRE(commander.storage[0].ac.wait_us != commanded.storage[0].ac.wait_us);
+    }
+}
+
+TEST_CASE("Address claim snapshots", "[j1939_get_address_snapshot][j1939_restore_address_snapshot]")
+{
+    constexpr uint8_t commander_address = 0x20;
+    constexpr uint8_t commanded_address = 0x30;
+
+    TestSide::init(&commander, 1, commander_address);
+    TestSide::init(&commanded, 2, commanded_address);
+
+    int hook_calls = 0;
+    j1939_set_address_hook(&commander.node, [](void* user_data, J1939* node) {
+        REQUIRE(node == &commander.node);
+        (*static_cast<int*>(user_data))++;
+    }, &hook_calls);
+
+    // The commander's address is outside the self-configurable range, so it
+    //  already holds it
+    REQUIRE(hook_calls == 1);
+
+    uint64_t now_us = 1000000;
+    TestSide::run(&commander, &commanded, &now_us);
+
+    // The commanded node's claim was new to the commander
+    REQUIRE(hook_calls == 2);
+
+    J1939Name commanded_name;
+    REQUIRE(j1939_address_to_name(&commander.node, commanded_address, &commanded_name) == true);
+
+    static J1939AddressSnapshot snapshot;
+    j1939_get_address_snapshot(&commander.node, &snapshot);
+
+    REQUIRE(snapshot.version == J1939_ADDRESS_SNAPSHOT_VERSION);
+    REQUIRE(snapshot.address == commander_address);
+    REQUIRE(snapshot.name.identity == 1);
+
+    SECTION("A restarted node comes back knowing the other nodes")
+    {
+        TestSide::init(&commander, 1, snapshot.address);
+        REQUIRE(j1939_name_to_address(&commander.node, &commanded_name) == J1939_ADDR_NULL);
+
+        REQUIRE(j1939_restore_address_snapshot(&commander.node, &snapshot) == true);
+        REQUIRE(commander.node.source_address == commander_address);
+        REQUIRE(j1939_is_address_claimed(&commander.node) == true);
+        REQUIRE(j1939_name_to_address(&commander.node, &commanded_name) == commanded_address);
+
+        // A new address is never searched for at a known node's
+        J1939AC* ac = &commander.storage[0].ac;
+        REQUIRE(j1939_ac_is_address_taken(ac, commanded_address) == true);
+        REQUIRE(ac->addresses_available == J1939_AC_MAX_ADDRESSES - 2);
+    }
+    SECTION("The bus is trusted over a snapshot")
+    {
+        TestSide::init(&commander, 1, commander_address);
+
+        // The commanded node has moved since the snapshot was taken
+        J1939Msg claim {
+            .pgn = J1939_ADDRESS_CLAIMED_PGN,
+            .data = (uint8_t*)&commanded_name,
+            .len = J1939_ADDRESS_CLAIMED_LEN,
+            .src = 0x40,
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_ADDRESS_CLAIMED_PRI
+        };
+        j1939_ac_rx_address_claim(&commander.storage[0].ac, &claim);
+
+        REQUIRE(j1939_restore_address_snapshot(&commander.node, &snapshot) == true);
+        REQUIRE(j1939_name_to_address(&commander.node, &commanded_name) == 0x40);
+        REQUIRE(j1939_ac_is_address_taken(&commander.storage[0].ac, commanded_address) == false);
+    }
+    SECTION("Snapshots of other nodes or versions aren't restored")
+    {
+        REQUIRE(j1939_restore_address_snapshot(&commanded.node, &snapshot) == false);
+
+        snapshot.version++;
+        REQUIRE(j1939_restore_address_snapshot(&commander.node, &snapshot) == false);
+    }
+    SECTION("The hook is called when something changes")
+    {
+        J1939Msg claim {
+            .pgn = J1939_ADDRESS_CLAIMED_PGN,
+            .data = (uint8_t*)&commanded_name,
+            .len = J1939_ADDRESS_CLAIMED_LEN,
+            .src = commanded_address,
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_ADDRESS_CLAIMED_PRI
+        };
+
+        // The same claim again changes nothing
+        j1939_ac_rx_address_claim(&commander.storage[0].ac, &claim);
+        REQUIRE(hook_calls == 2);
+
+        claim.src = 0x40;
+        j1939_ac_rx_address_claim(&commander.storage[0].ac, &claim);
+        REQUIRE(hook_calls == 3);
+
+        // As does the node claiming an address after a restart
+        TestSide::init(&commander, 1, 0x90);
+        j1939_set_address_hook(&commander.node, [](void* user_data, J1939*) {
+            (*static_cast<int*>(user_data))++;
+        }, &hook_calls);
+        TestSide::run(&commander, &commanded, &now_us);
+
+        REQUIRE(j1939_is_address_claimed(&commander.node) == true);
+        REQUIRE(hook_calls == 4);
+    }
+    SECTION("A node alone on the bus saves a snapshot of its claim")
+    {
+        static J1939AddressSnapshot saved;
+        saved.address = J1939_ADDR_NULL;
+
+        TestSide::init(&commander, 1, 0x55);
+        REQUIRE(j1939_restore_address_snapshot(&commander.node, &snapshot) == true);
+        j1939_set_address_hook(&commander.node, [](void*, J1939* node) {
+            j1939_get_address_snapshot(node, &saved);
+        }, nullptr);
+
+        REQUIRE(saved.address == 0x55);
+        REQUIRE(saved.name.identity == 1);
+        // The restored NAMEs are part of it
+        REQUIRE(((saved.known[commanded_address / 32] >> (commanded_address % 32)) & 1) == 1);
+    }
+}
@@ -0,0 +1,252 @@
+#include "test_j1939.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+    #include "j1939_extended_transport_protocol.h"
+}
+
+namespace {
+
+// A back-to-back node that also records what its stream sink is given
+struct Side : TestSide {
+    std::vector<uint8_t> data;
+    std::vector<J1939StreamEvent> events;
+    bool refuse = false;
+};
+
+Side sender;
+Side receiver;
+
+std::vector<uint8_t> source_data;
+
+// How the sender's last message ended
+J1939TxResult tx_result;
+int tx_results;
+
+bool
+sink(void* user_data, const J1939StreamEvent* event)
+{
+    Side* side = static_cast<Side*>(user_data);
+
+    side->events.push_back(*event);
+
+    if (event->type == J1939_STREAM_DATA)
+    {
+        // Chunks arrive in order
+        REQUIRE(event->offset == side->data.size());
+        side->data.insert(side->data.end(), event->data, event->data + event->len);
+    }
+
+    return !side->refuse;
+}
+
+bool
+source(void*, uint32_t offset, uint8_t* data, uint16_t len)
+{
+    std::memcpy(data, &source_data[offset], len);
+    return true;
+}
+
+void
+tx_done(void*, J1939Msg*, const J1939TxResult* result)
+{
+    tx_result = *result;
+    tx_results++;
+}
+
+void
+init_side(Side* side, uint32_t identity, uint8_t address)
+{
+    side->data.clear();
+    side->events.clear();
+    side->refuse = false;
+
+    TestSide::init(side, identity, address);
+}
+
+}
+
+TEST_CASE("ETP.CM messages are packed into 8 bytes", "[j1939_etp]")
+{
+    REQUIRE(sizeof(J1939_ETP_CM_RTS) == J1939_ETP_CM_LEN);
+    REQUIRE(sizeof(J1939_ETP_CM_CTS) == J1939_ETP_CM_LEN);
+    REQUIRE(sizeof(J1939_ETP_CM_DPO) == J1939_ETP_CM_LEN);
+    REQUIRE(sizeof(J1939_ETP_CM_EOMA) == J1939_ETP_CM_LEN);
+
+    J1939_ETP_CM_CTS cts {
+        .control_byte = J1939_ETP_CM_CONTROL_BYTE_CTS,
+        .num_packages = 16,
+        .next_packet = 0x123456,
+        .pgn = 0xABCDEF
+    };
+    uint8_t expected[8] = { 21, 16, 0x56, 0x34, 0x12, 0xEF, 0xCD, 0xAB };
+    REQUIRE(std::memcmp(&cts, expected, sizeof(expected)) == 0);
+}
+
+TEST_CASE("Extended transport protocol", "[j1939_tx_stream][j1939_set_stream_sink]")
+{
+    constexpr uint8_t sender_address = 0x20;
+    constexpr uint8_t receiver_address = 0x30;
+    constexpr uint32_t msg_pgn = 0xEF00;
+
+    TestSide::bus_filter = nullptr;
+    init_side(&sender, 1, sender_address);
+    init_side(&receiver, 2, receiver_address);
+    j1939_set_stream_sink(&receiver.node, sink, &receiver);
+    j1939_set_tx_done(&sender.node, tx_done, nullptr);
+    tx_results = 0;
+
+    // 715 packets, the last one holding a single byte; several windows of
+    //  J1939_TP_CTS_WINDOW packets
+    source_data.resize(4999);
+    for (size_t i = 0; i < source_data.size(); ++i)
+        source_data[i] = static_cast<uint8_t>(i * 7 + (i >> 8));
+
+    uint64_t now_us = 1000000;
+
+    SECTION("A message is streamed to the receiver's sink")
+    {
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            source_data.size(), source, nullptr) == true);
+        TestSide::run(&sender, &receiver, &now_us);
+
+        REQUIRE(receiver.data == source_data);
+        REQUIRE(receiver.events.front().type == J1939_STREAM_BEGIN);
+        REQUIRE(receiver.events.front().size == source_data.size());
+        REQUIRE(receiver.events.front().pgn == msg_pgn);
+        REQUIRE(receiver.events.front().src == sender_address);
+        REQUIRE(receiver.events.back().type == J1939_STREAM_COMPLETE);
+
+        REQUIRE(tx_results == 1);
+        REQUIRE(tx_result.status == J1939_TX_SENT);
+        REQUIRE(tx_result.size == source_data.size());
+        REQUIRE(tx_result.bytes_sent == source_data.size());
+
+        // Both sessions are closed
+        REQUIRE(j1939_tp_find_tx_session(&sender.storage[0].tp, receiver_address) == nullptr);
+        REQUIRE(j1939_tp_find_rx_session(&receiver.storage[0].tp, sender_address, receiver_address) == nullptr);
+    }
+    SECTION("Windows can span a DPO offset beyond 8 bits")
+    {
+        J1939TPTiming timing { .bam_gap_ms = 50, .p2p_gap_ms = 0, .cts_delay_ms = 0 };
+        j1939_set_tp_timing(&sender.node, &timing);
+        j1939_set_tp_timing(&receiver.node, &timing);
+        j1939_set_tp_window(&receiver.node, 255);
+
+        source_data.resize(300 * 255 * 7 + 3);
+        for (size_t i = 0; i < source_data.size(); ++i)
+            source_data[i] = static_cast<uint8_t>(i ^ (i >> 9));
+
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            source_data.size(), source, nullptr) == true);
+        TestSide::run(&sender, &receiver, &now_us);
+
+        REQUIRE(receiver.data == source_data);
+        REQUIRE(receiver.events.back().type == J1939_STREAM_COMPLETE);
+    }
+    SECTION("Lost packets are asked for again")
+    {
+        int dropped = 0;
+        TestSide::bus_filter = [&](const J1939CanFrame& frame) {
+            // Lose packet 5 of the second window, and the last packet of the
+            //  fourth window, once each
+            bool dt = ((frame.id >> 8) & 0xFF00) == (J1939_ETP_DT_PGN & 0xFF00);
+            if (dt && (dropped == 0) && (frame.data[0] == 5) && (receiver.data.size() >= 16 * 7))
+            {
+                dropped++;
+                return false;
+            }
+            if (dt && (dropped == 1) && (frame.data[0] == 16) && (receiver.data.size() >= 63 * 7))
+            {
+                dropped++;
+                return false;
+            }
+            return true;
+        };
+
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            source_data.size(), source, nullptr) == true);
+        TestSide::run(&sender, &receiver, &now_us);
+
+        REQUIRE(dropped == 2);
+        REQUIRE(receiver.data == source_data);
+        REQUIRE(receiver.events.back().type == J1939_STREAM_COMPLETE);
+    }
+    SECTION("The sink can refuse a message")
+    {
+        receiver.refuse = true;
+
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            source_data.size(), source, nullptr) == true);
+        TestSide::run(&sender, &receiver, &now_us);
+
+        REQUIRE(receiver.events.size() == 1);
+        REQUIRE(receiver.events[0].type == J1939_STREAM_BEGIN);
+        REQUIRE(j1939_tp_find_tx_session(&sender.storage[0].tp, receiver_address) == nullptr);
+    }
+    SECTION("Without a sink, messages are refused")
+    {
+        j1939_set_stream_sink(&receiver.node, nullptr, nullptr);
+
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            source_data.size(), source, nullptr) == true);
+        j1939_update_at(&sender.node, now_us);
+        TestSide::deliver_frames(&sender, &receiver);
+
+        REQUIRE(j1939_tp_find_tx_session(&sender.storage[0].tp, receiver_address) == nullptr);
+    }
+    SECTION("The sink is told when the sender goes away")
+    {
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            source_data.size(), source, nullptr) == true);
+
+        // The sender's frames no longer reach the receiver after the first
+        //  few packets
+        TestSide::bus_filter = [&](const J1939CanFrame& frame) {
+            return (frame.id & 0xFF) != sender_address || receiver.data.size() < 7 * 7;
+        };
+        TestSide::run(&sender, &receiver, &now_us);
+
+        REQUIRE(receiver.data.size() == 7 * 7);
+        REQUIRE(receiver.events.back().type == J1939_STREAM_ABORT);
+        REQUIRE(receiver.events.back().abort_reason == J1939_TP_ABORT_REASON_TIMEOUT);
+        REQUIRE(j1939_tp_find_tx_session(&sender.storage[0].tp, receiver_address) == nullptr);
+
+        // The receiver's abort reaches the sender
+        REQUIRE(tx_result.status == J1939_TX_ABORTED);
+        REQUIRE(tx_result.abort_reason == J1939_TP_ABORT_REASON_TIMEOUT);
+    }
+    SECTION("A PGN's own sink is used instead of the node's")
+    {
+        j1939_set_stream_sink(&receiver.node, nullptr, nullptr);
+        REQUIRE(j1939_set_pgn_stream_sink(&receiver.node, msg_pgn, sink, &receiver) == true);
+
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            source_data.size(), source, nullptr) == true);
+        TestSide::run(&sender, &receiver, &now_us);
+
+        REQUIRE(receiver.data == source_data);
+        REQUIRE(receiver.events.back().type == J1939_STREAM_COMPLETE);
+    }
+    SECTION("Invalid messages aren't sent")
+    {
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            J1939_TP_MAX_PAYLOAD, source, nullptr) == false);
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, J1939_ADDR_GLOBAL, 6,
+            source_data.size(), source, nullptr) == false);
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            J1939_ETP_MAX_SIZE + 1, source, nullptr) == false);
+
+        // One connection per destination
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            source_data.size(), source, nullptr) == true);
+        REQUIRE(j1939_tx_stream(&sender.node, msg_pgn, receiver_address, 6,
+            source_data.size(), source, nullptr) == false);
+        j1939_tp_close_all(&sender.storage[0].tp);
+    }
+
+    TestSide::bus_filter = nullptr;
+}
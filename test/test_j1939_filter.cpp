@@ -0,0 +1,194 @@
+#include "test_j1939.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("Frames are accepted or rejected by their raw CAN ID", "[j1939_filter_accept]")
+{
+    J1939Filter filter;
+    j1939_filter_init(&filter);
+
+    SECTION("A new filter accepts every frame")
+    {
+        REQUIRE(j1939_filter_accept(&filter, 0x8CF00412) == true);
+        REQUIRE(j1939_filter_accept(&filter, 0x98EF5512) == true);
+    }
+    SECTION("Only added PGNs are accepted once the first one is added")
+    {
+        REQUIRE(j1939_filter_add_pgn(&filter, 0xF004) == true);
+
+        REQUIRE(j1939_filter_accept(&filter, 0x8CF00412) == true);
+        // Same PF, different group extension
+        REQUIRE(j1939_filter_accept(&filter, 0x8CF00512) == false);
+        // Different PF
+        REQUIRE(j1939_filter_accept(&filter, 0x8CFEF112) == false);
+        // Same PF and PS, but data page 1
+        REQUIRE(j1939_filter_accept(&filter, 0x8DF00412) == false);
+    }
+    SECTION("PDU1 PGNs are accepted for any destination")
+    {
+        REQUIRE(j1939_filter_add_pgn(&filter, 0xEF00) == true);
+
+        REQUIRE(j1939_filter_accept(&filter, 0x98EF5512) == true);
+        REQUIRE(j1939_filter_accept(&filter, 0x98EFFF12) == true);
+    }
+    SECTION("Transport protocol and address claim PGNs are always accepted")
+    {
+        REQUIRE(j1939_filter_add_pgn(&filter, 0xF004) == true);
+
+        REQUIRE(j1939_filter_accept(&filter, 0x9CEC5512) == true);
+        REQUIRE(j1939_filter_accept(&filter, 0x9CEB5512) == true);
+        REQUIRE(j1939_filter_accept(&filter, 0x98EEFF12) == true);
+        REQUIRE(j1939_filter_accept(&filter, 0x98EAFF12) == true);
+    }
+    SECTION("Restricting sources rejects other senders, except for protocol PGNs")
+    {
+        REQUIRE(j1939_filter_add_pgn(&filter, 0xF004) == true);
+        j1939_filter_add_source(&filter, 0x12);
+
+        REQUIRE(j1939_filter_accept(&filter, 0x8CF00412) == true);
+        REQUIRE(j1939_filter_accept(&filter, 0x8CF00413) == false);
+        REQUIRE(j1939_filter_accept(&filter, 0x98EEFF13) == true);
+    }
+    SECTION("Restricting sources alone keeps every PGN from those senders")
+    {
+        j1939_filter_add_source(&filter, 0x30);
+
+        REQUIRE(j1939_filter_accept(&filter, 0x8CF00430) == true);
+        REQUIRE(j1939_filter_accept(&filter, 0x98EF5530) == true);
+        REQUIRE(j1939_filter_accept(&filter, 0x8CF00431) == false);
+        REQUIRE(j1939_filter_accept(&filter, 0x98EF5531) == false);
+        REQUIRE(j1939_filter_accept(&filter, 0x9CEC5531) == true);
+        REQUIRE(j1939_filter_accept(&filter, 0x98EEFF31) == true);
+    }
+    SECTION("Invalid PGNs are rejected")
+    {
+        REQUIRE(j1939_filter_add_pgn(&filter, 0x20000) == false);
+        REQUIRE(filter.pgns_restricted == false);
+    }
+}
+
+TEST_CASE("Filters are exported as (id, mask) pairs", "[j1939_filter_export]")
+{
+    J1939Filter filter;
+    j1939_filter_init(&filter);
+
+    J1939CanIdFilter filters[16];
+
+    auto matches = [&](int count, uint32_t id) {
+        for (int i = 0; i < count; ++i)
+        {
+            if ((id & filters[i].mask) == (filters[i].id & filters[i].mask))
+                return true;
+        }
+        return false;
+    };
+
+    SECTION("A new filter exports a single entry matching all extended frames")
+    {
+        REQUIRE(j1939_filter_export(&filter, filters, 16) == 1);
+        REQUIRE(matches(1, 0x8CF00412) == true);
+        REQUIRE(matches(1, 0x00000123) == false);
+    }
+    SECTION("Each PGN becomes one entry, plus the protocol PGNs")
+    {
+        j1939_filter_add_pgn(&filter, 0xF004);
+        j1939_filter_add_pgn(&filter, 0xEF00);
+
+        int count = j1939_filter_export(&filter, filters, 16);
+        REQUIRE(count == 8);
+
+        REQUIRE(matches(count, 0x8CF00412) == true);
+        REQUIRE(matches(count, 0x98EF5512) == true);
+        REQUIRE(matches(count, 0x9CEC5512) == true);
+        REQUIRE(matches(count, 0x9CC85512) == true);
+        REQUIRE(matches(count, 0x8CF00512) == false);
+        REQUIRE(matches(count, 0x8CFEF112) == false);
+        // Remote frames are excluded
+        REQUIRE(matches(count, 0xCCF00412) == false);
+    }
+    SECTION("Restricted sources multiply the entries of application PGNs")
+    {
+        j1939_filter_add_pgn(&filter, 0xF004);
+        j1939_filter_add_source(&filter, 0x12);
+        j1939_filter_add_source(&filter, 0x34);
+
+        int count = j1939_filter_export(&filter, filters, 16);
+        REQUIRE(count == 8);
+
+        REQUIRE(matches(count, 0x8CF00412) == true);
+        REQUIRE(matches(count, 0x8CF00434) == true);
+        REQUIRE(matches(count, 0x8CF00456) == false);
+        REQUIRE(matches(count, 0x98EEFF56) == true);
+    }
+    SECTION("Restricted sources alone become one entry each, plus the protocol PGNs")
+    {
+        j1939_filter_add_source(&filter, 0x30);
+
+        int count = j1939_filter_export(&filter, filters, 16);
+        REQUIRE(count == 7);
+
+        REQUIRE(matches(count, 0x8CF00430) == true);
+        REQUIRE(matches(count, 0x98EF5530) == true);
+        REQUIRE(matches(count, 0x8CF00431) == false);
+        REQUIRE(matches(count, 0x9CEC5531) == true);
+        REQUIRE(matches(count, 0x98EEFF31) == true);
+        REQUIRE(matches(count, 0xCCF00430) == false);
+    }
+    SECTION("The required number of entries is returned even if the array is too small")
+    {
+        j1939_filter_add_pgn(&filter, 0xF004);
+
+        REQUIRE(j1939_filter_export(&filter, filters, 2) == 7);
+    }
+}
+
+TEST_CASE("Rejected frames are never unpacked", "[j1939_accept_pgn]")
+{
+    J1939* node = &TestJ1939::node;
+    J1939Private* jp = &g_j1939[node->node_idx];
+    J1939Filter original_filter = jp->filter;
+
+    jp->can_id_converter.pgn = 0;
+    TestJ1939::msg.pgn = 0;
+
+    SECTION("Frames with a rejected PGN")
+    {
+        REQUIRE(j1939_accept_pgn(node, 0xFEF1) == true);
+
+        J1939CanFrame frame { .id = 0x8CF00412, .data = { 0xAA }, .len = 1 };
+        j1939_process_frames(node, &frame, 1);
+
+        REQUIRE(jp->can_id_converter.pgn == 0);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+
+        frame.id = 0x8CFEF112;
+        j1939_process_frames(node, &frame, 1);
+        REQUIRE(TestJ1939::msg.pgn == 0xFEF1);
+    }
+    SECTION("Frames from a rejected source")
+    {
+        j1939_accept_source(node, 0x30);
+
+        J1939CanFrame frame { .id = 0x8CF00431, .data = { 0xAA }, .len = 1 };
+        j1939_process_frames(node, &frame, 1);
+
+        REQUIRE(jp->can_id_converter.pgn == 0);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+
+        frame.id = 0x8CF00430;
+        j1939_process_frames(node, &frame, 1);
+        REQUIRE(TestJ1939::msg.pgn == 0xF004);
+        REQUIRE(TestJ1939::msg.src == 0x30);
+    }
+    SECTION("Peer-to-peer frames addressed to another node")
+    {
+        uint8_t other = (uint8_t)(node->source_address + 1);
+        J1939CanFrame frame { .id = 0x98EF0012 | ((uint32_t)other << 8), .data = { 0xAA }, .len = 1 };
+        j1939_process_frames(node, &frame, 1);
+
+        REQUIRE(jp->can_id_converter.pgn == 0);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+    }
+
+    jp->filter = original_filter;
+}
@@ -0,0 +1,153 @@
+#include "test_j1939.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <thread>
+
+static J1939CanFrame make_frame(uint32_t seq)
+{
+    J1939CanFrame frame {};
+    frame.id = 0x98FEF112;
+    frame.len = 4;
+    std::memcpy(frame.data, &seq, sizeof(seq));
+    return frame;
+}
+
+static uint32_t frame_seq(const J1939CanFrame* frame)
+{
+    uint32_t seq;
+    std::memcpy(&seq, frame->data, sizeof(seq));
+    return seq;
+}
+
+TEST_CASE("Frame ring push, peek and consume", "[j1939_frame_ring]")
+{
+    static J1939FrameRing ring;
+    j1939_frame_ring_init(&ring);
+
+    J1939CanFrame* frames = nullptr;
+
+    SECTION("An empty ring has nothing to peek")
+    {
+        REQUIRE(j1939_frame_ring_peek(&ring, &frames) == 0);
+    }
+    SECTION("Frames come out in the order they were pushed")
+    {
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            J1939CanFrame frame = make_frame(i);
+            REQUIRE(j1939_frame_ring_push(&ring, &frame) == true);
+        }
+
+        REQUIRE(j1939_frame_ring_peek(&ring, &frames) == 3);
+        for (uint32_t i = 0; i < 3; ++i)
+            REQUIRE(frame_seq(&frames[i]) == i);
+
+        j1939_frame_ring_consume(&ring, 3);
+        REQUIRE(j1939_frame_ring_peek(&ring, &frames) == 0);
+    }
+    SECTION("A full ring drops frames until some are consumed")
+    {
+        for (uint32_t i = 0; i < J1939_FRAME_RING_SIZE; ++i)
+        {
+            J1939CanFrame frame = make_frame(i);
+            REQUIRE(j1939_frame_ring_push(&ring, &frame) == true);
+        }
+
+        J1939CanFrame frame = make_frame(J1939_FRAME_RING_SIZE);
+        REQUIRE(j1939_frame_ring_push(&ring, &frame) == false);
+        REQUIRE(j1939_frame_ring_dropped(&ring) == 1);
+
+        j1939_frame_ring_consume(&ring, 1);
+        REQUIRE(j1939_frame_ring_push(&ring, &frame) == true);
+    }
+    SECTION("Peek stops at the end of the array when the ring wraps")
+    {
+        const uint32_t offset = J1939_FRAME_RING_SIZE - 2;
+
+        for (uint32_t i = 0; i < offset; ++i)
+        {
+            J1939CanFrame frame = make_frame(i);
+            j1939_frame_ring_push(&ring, &frame);
+        }
+        j1939_frame_ring_consume(&ring, j1939_frame_ring_peek(&ring, &frames));
+
+        for (uint32_t i = 0; i < 5; ++i)
+        {
+            J1939CanFrame frame = make_frame(100 + i);
+            REQUIRE(j1939_frame_ring_push(&ring, &frame) == true);
+        }
+
+        REQUIRE(j1939_frame_ring_peek(&ring, &frames) == 2);
+        REQUIRE(frame_seq(&frames[0]) == 100);
+        j1939_frame_ring_consume(&ring, 2);
+
+        REQUIRE(j1939_frame_ring_peek(&ring, &frames) == 3);
+        REQUIRE(frame_seq(&frames[0]) == 102);
+        REQUIRE(frames == &ring.frames[0]);
+    }
+}
+
+static uint32_t ring_rx_count;
+static uint32_t ring_rx_expected_seq;
+static bool ring_rx_in_order;
+
+static bool ring_can_tx(void* user_data, J1939Msg* msg)
+{
+    (void)user_data, (void)msg;
+    return true;
+}
+
+static void ring_j1939_rx(void* user_data, J1939Msg* msg)
+{
+    (void)user_data;
+
+    uint32_t seq;
+    std::memcpy(&seq, msg->data, sizeof(seq));
+
+    if (seq != ring_rx_expected_seq)
+        ring_rx_in_order = false;
+
+    ring_rx_expected_seq = seq + 1;
+    ring_rx_count++;
+}
+
+static void ring_startup_delay(void* param)
+{
+    (void)param;
+}
+
+TEST_CASE("Frames pushed from another thread are all received in order", "[j1939_push_frame]")
+{
+    static J1939Private storage[1];
+    J1939Context ctx;
+    J1939 node;
+
+    REQUIRE(j1939_context_init(&ctx, storage, 1, nullptr) == true);
+    REQUIRE(j1939_context_node_init(&ctx, &node, &TestJ1939::name, 0x30, 10,
+        nullptr, ring_can_tx, ring_j1939_rx, ring_startup_delay, nullptr) == true);
+
+    const uint32_t num_frames = 200000;
+
+    ring_rx_count = 0;
+    ring_rx_expected_seq = 0;
+    ring_rx_in_order = true;
+
+    std::thread producer([&node, num_frames]() {
+        for (uint32_t i = 0; i < num_frames; ++i)
+        {
+            J1939CanFrame frame = make_frame(i);
+
+            // Spin rather than drop when the consumer falls behind
+            while (!j1939_push_frame(&node, &frame))
+                std::this_thread::yield();
+        }
+    });
+
+    while (ring_rx_count < num_frames)
+        j1939_update(&node);
+
+    producer.join();
+
+    REQUIRE(ring_rx_count == num_frames);
+    REQUIRE(ring_rx_in_order == true);
+}
@@ -0,0 +1,213 @@
+#include "test_j1939.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <map>
+#include <random>
+
+extern "C" {
+    #include "j1939_name_table.h"
+}
+
+TEST_CASE("NAMEs and addresses are looked up both ways", "[j1939_name_table_claim]")
+{
+    J1939NameTable table;
+    j1939_name_table_init(&table);
+
+    const uint64_t name_a = 0xA000000000001234;
+    const uint64_t name_b = 0xA000000000001235;
+    uint64_t name;
+
+    SECTION("An empty table knows no one")
+    {
+        REQUIRE(j1939_name_table_address(&table, name_a) == J1939_ADDR_NULL);
+        REQUIRE(j1939_name_table_name(&table, 0x10, &name) == false);
+    }
+    SECTION("A claimed address is found by NAME and by address")
+    {
+        REQUIRE(j1939_name_table_claim(&table, 0x10, name_a) == J1939_ADDR_NULL);
+        REQUIRE(j1939_name_table_claim(&table, 0x11, name_b) == J1939_ADDR_NULL);
+
+        REQUIRE(j1939_name_table_address(&table, name_a) == 0x10);
+        REQUIRE(j1939_name_table_address(&table, name_b) == 0x11);
+        REQUIRE(j1939_name_table_name(&table, 0x11, &name) == true);
+        REQUIRE(name == name_b);
+    }
+    SECTION("A node that claims a new address leaves its old one")
+    {
+        j1939_name_table_claim(&table, 0x10, name_a);
+
+        REQUIRE(j1939_name_table_claim(&table, 0x80, name_a) == 0x10);
+        REQUIRE(j1939_name_table_address(&table, name_a) == 0x80);
+        REQUIRE(j1939_name_table_name(&table, 0x10, &name) == false);
+
+        // Claiming the same address again changes nothing
+        REQUIRE(j1939_name_table_claim(&table, 0x80, name_a) == J1939_ADDR_NULL);
+        REQUIRE(j1939_name_table_address(&table, name_a) == 0x80);
+    }
+    SECTION("A node that takes an address replaces the one there")
+    {
+        j1939_name_table_claim(&table, 0x10, name_a);
+        j1939_name_table_claim(&table, 0x10, name_b);
+
+        REQUIRE(j1939_name_table_address(&table, name_a) == J1939_ADDR_NULL);
+        REQUIRE(j1939_name_table_address(&table, name_b) == 0x10);
+    }
+    SECTION("Removed NAMEs are forgotten")
+    {
+        j1939_name_table_claim(&table, 0x10, name_a);
+
+        REQUIRE(j1939_name_table_remove(&table, name_a) == 0x10);
+        REQUIRE(j1939_name_table_remove(&table, name_a) == J1939_ADDR_NULL);
+        REQUIRE(j1939_name_table_address(&table, name_a) == J1939_ADDR_NULL);
+        REQUIRE(j1939_name_table_name(&table, 0x10, &name) == false);
+    }
+    SECTION("Only valid addresses are recorded")
+    {
+        REQUIRE(j1939_name_table_claim(&table, J1939_ADDR_NULL, name_a) == J1939_ADDR_NULL);
+        REQUIRE(j1939_name_table_claim(&table, J1939_ADDR_GLOBAL, name_a) == J1939_ADDR_NULL);
+        REQUIRE(j1939_name_table_address(&table, name_a) == J1939_ADDR_NULL);
+        REQUIRE(j1939_name_table_name(&table, J1939_ADDR_GLOBAL, &name) == false);
+    }
+    SECTION("Every address can be in use at once, and nodes move about")
+    {
+        std::mt19937_64 rng(1939);
+        std::map<uint64_t, uint8_t> expected;
+        std::map<uint8_t, uint64_t> at;
+
+        for (int address = 0; address < J1939_ADDR_NULL; ++address)
+        {
+            uint64_t n = 0x8000000000000000 | (address * 7);
+            REQUIRE(j1939_name_table_claim(&table, address, n) == J1939_ADDR_NULL);
+            expected[n] = address;
+            at[address] = n;
+        }
+        for (auto& [n, address] : expected)
+            REQUIRE(j1939_name_table_address(&table, n) == address);
+
+        for (int step = 0; step < 20000; ++step)
+        {
+            // Few distinct NAMEs, differing in their low bits, so they collide
+            uint64_t n = 0x8000000000000000 | (rng() % 400);
+            uint8_t address = rng() % J1939_ADDR_NULL;
+
+            if (rng() % 8 == 0)
+            {
+                auto it = expected.find(n);
+                uint8_t removed = j1939_name_table_remove(&table, n);
+                REQUIRE(removed == ((it != expected.end()) ? it->second : J1939_ADDR_NULL));
+                if (it != expected.end())
+                {
+                    at.erase(it->second);
+                    expected.erase(it);
+                }
+                continue;
+            }
+
+            auto it = expected.find(n);
+            uint8_t previous = ((it != expected.end()) && (it->second != address)) ?
+                it->second : J1939_ADDR_NULL;
+            REQUIRE(j1939_name_table_claim(&table, address, n) == previous);
+
+            if (it != expected.end())
+                at.erase(it->second);
+            auto there = at.find(address);
+            if (there != at.end())
+                expected.erase(there->second);
+            expected[n] = address;
+            at[address] = n;
+        }
+
+        for (auto& [n, address] : expected)
+        {
+            REQUIRE(j1939_name_table_address(&table, n) == address);
+            REQUIRE(j1939_name_table_name(&table, address, &name) == true);
+            REQUIRE(name == n);
+        }
+        for (int address = 0; address < J1939_ADDR_NULL; ++address)
+            REQUIRE(j1939_name_table_name(&table, address, &name) == (at.count(address) == 1));
+    }
+}
+
+TEST_CASE("Nodes are found by NAME on the bus", "[j1939_name_to_address][j1939_tx_to_name]")
+{
+    J1939AC* ac = &g_j1939[TestJ1939::node.node_idx].ac;
+    j1939_name_table_init(&ac->names);
+    std::memset(ac->address_table, 0, sizeof(ac->address_table));
+    ac->addresses_available = J1939_AC_MAX_ADDRESSES;
+    j1939_ac_mark_address(ac, TestJ1939::node.source_address, true);
+
+    J1939Name peer {};
+    peer.identity = 0x1234;
+    peer.manufacturer = 0x55;
+
+    J1939_ADDRESS_CLAIMED claim = peer;
+    J1939Msg claim_msg {
+        .pgn = J1939_ADDRESS_CLAIMED_PGN,
+        .data = (uint8_t*)&claim,
+        .len = J1939_ADDRESS_CLAIMED_LEN,
+        .src = 0x60,
+        .dst = J1939_ADDR_GLOBAL,
+        .pri = J1939_ADDRESS_CLAIMED_PRI
+    };
+
+    j1939_ac_rx_address_claim(ac, &claim_msg);
+    REQUIRE(j1939_name_to_address(&TestJ1939::node, &peer) == 0x60);
+
+    J1939Name name;
+    REQUIRE(j1939_address_to_name(&TestJ1939::node, 0x60, &name) == true);
+    REQUIRE(std::memcmp(&name, &peer, sizeof(name)) == 0);
+    REQUIRE(j1939_address_to_name(&TestJ1939::node, 0x61, &name) == false);
+
+    uint8_t data[4] = { 1, 2, 3, 4 };
+    J1939Msg msg {
+        .pgn = 0xEF00,
+        .data = data,
+        .len = sizeof(data),
+        .pri = J1939_DEFAULT_PRIORITY
+    };
+
+    SECTION("Messages follow a node that moves")
+    {
+        REQUIRE(j1939_tx_to_name(&TestJ1939::node, &msg, &peer) == true);
+        REQUIRE(TestJ1939::msg.dst == 0x60);
+
+        claim_msg.src = 0x90;
+        j1939_ac_rx_address_claim(ac, &claim_msg);
+
+        REQUIRE(j1939_tx_to_name(&TestJ1939::node, &msg, &peer) == true);
+        REQUIRE(TestJ1939::msg.dst == 0x90);
+
+        // Its old address is free again
+        REQUIRE(j1939_ac_is_address_taken(ac, 0x60) == false);
+        REQUIRE(j1939_ac_is_address_taken(ac, 0x90) == true);
+        REQUIRE(ac->addresses_available == J1939_AC_MAX_ADDRESSES - 2);
+    }
+    SECTION("A node that can't claim an address is forgotten")
+    {
+        claim_msg.src = J1939_ADDR_NULL;
+        j1939_ac_rx_address_claim(ac, &claim_msg);
+
+        REQUIRE(j1939_name_to_address(&TestJ1939::node, &peer) == J1939_ADDR_NULL);
+        REQUIRE(j1939_tx_to_name(&TestJ1939::node, &msg, &peer) == false);
+        REQUIRE(j1939_ac_is_address_taken(ac, 0x60) == false);
+    }
+    SECTION("A request for address claim starts both tables over")
+    {
+        j1939_ac_rx_address_claim_request(ac);
+
+        REQUIRE(j1939_name_to_address(&TestJ1939::node, &peer) == J1939_ADDR_NULL);
+        REQUIRE(j1939_ac_is_address_taken(ac, 0x60) == false);
+
+        // Nodes that answer are known again
+        j1939_ac_rx_address_claim(ac, &claim_msg);
+        REQUIRE(j1939_name_to_address(&TestJ1939::node, &peer) == 0x60);
+        REQUIRE(j1939_ac_is_address_taken(ac, 0x60) == true);
+    }
+    SECTION("Unknown NAMEs can't be sent to")
+    {
+        peer.identity = 0x4321;
+        REQUIRE(j1939_tx_to_name(&TestJ1939::node, &msg, &peer) == false);
+    }
+
+    j1939_name_table_init(&ac->names);
+}
@@ -0,0 +1,135 @@
+#include "test_j1939.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+extern "C" {
+    #include "j1939_pgn_db.h"
+}
+
+TEST_CASE("The PGN database is sorted and consistent", "[j1939_pgn_db_lookup]")
+{
+    REQUIRE(j1939_pgn_db_len > 0);
+
+    for (int i = 0; i < j1939_pgn_db_len; ++i)
+    {
+        const J1939PgnInfo* info = &j1939_pgn_db[i];
+
+        if (i > 0)
+            REQUIRE(j1939_pgn_db[i - 1].pgn < info->pgn);
+
+        REQUIRE(j1939_pgn_db_lookup(info->pgn) == info);
+        REQUIRE(info->pri <= 7);
+        REQUIRE(info->name != nullptr);
+
+        if (info->len == 0)
+            REQUIRE(info->transport == J1939_PGN_EITHER);
+        else if (info->len > 8)
+            REQUIRE(info->transport == J1939_PGN_MULTI_PACKET);
+        else
+            REQUIRE(info->transport == J1939_PGN_SINGLE_FRAME);
+    }
+}
+
+TEST_CASE("PGNs are looked up in the PGN database", "[j1939_pgn_info]")
+{
+    SECTION("Known PGNs")
+    {
+        const J1939PgnInfo* eec1 = j1939_pgn_info(0xF004);
+        REQUIRE(eec1 != nullptr);
+        REQUIRE(eec1->pgn == 0xF004);
+        REQUIRE(eec1->pri == 3);
+        REQUIRE(eec1->len == 8);
+        REQUIRE(eec1->rate_ms == 20);
+        REQUIRE(eec1->transport == J1939_PGN_SINGLE_FRAME);
+
+        const J1939PgnInfo* commanded_address = j1939_pgn_info(0xFED8);
+        REQUIRE(commanded_address != nullptr);
+        REQUIRE(commanded_address->len == 9);
+        REQUIRE(commanded_address->transport == J1939_PGN_MULTI_PACKET);
+
+        const J1939PgnInfo* dm1 = j1939_pgn_info(0xFECA);
+        REQUIRE(dm1 != nullptr);
+        REQUIRE(dm1->len == 0);
+        REQUIRE(dm1->transport == J1939_PGN_EITHER);
+
+        // The first and last entries
+        REQUIRE(j1939_pgn_info(j1939_pgn_db[0].pgn) == &j1939_pgn_db[0]);
+        REQUIRE(j1939_pgn_info(j1939_pgn_db[j1939_pgn_db_len - 1].pgn) ==
+            &j1939_pgn_db[j1939_pgn_db_len - 1]);
+    }
+    SECTION("Unknown PGNs")
+    {
+        REQUIRE(j1939_pgn_info(0xABCD) == nullptr);
+        REQUIRE(j1939_pgn_info(0xF005) == nullptr);
+        REQUIRE(j1939_pgn_info(0x3FFFF) == nullptr);
+        REQUIRE(j1939_pgn_info(j1939_pgn_db[0].pgn + 1) == nullptr);
+    }
+    SECTION("Priorities default for unknown PGNs")
+    {
+        REQUIRE(j1939_pgn_db_priority(0xF004) == 3);
+        REQUIRE(j1939_pgn_db_priority(0xABCD) == J1939_DEFAULT_PRIORITY);
+    }
+}
+
+TEST_CASE("Messages are sent with their PGN's priority", "[j1939_tx_pgn]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    uint8_t data[20] = { 0 };
+
+    j1939_tp_close_all(tp);
+
+    SECTION("A single-frame PGN")
+    {
+        REQUIRE(j1939_tx_pgn(&TestJ1939::node, 0xF004, data, 8, J1939_ADDR_GLOBAL) == true);
+        REQUIRE(TestJ1939::msg.pgn == 0xF004);
+        REQUIRE(TestJ1939::msg.pri == 3);
+        REQUIRE(TestJ1939::msg.len == 8);
+    }
+    SECTION("A fixed-length PGN must have its length")
+    {
+        REQUIRE(j1939_tx_pgn(&TestJ1939::node, 0xF004, data, 7, J1939_ADDR_GLOBAL) == false);
+        REQUIRE(j1939_tx_pgn(&TestJ1939::node, 0xFED8, data, 8, J1939_ADDR_GLOBAL) == false);
+    }
+    SECTION("A long variable-length PGN is sent with the transport protocol")
+    {
+        REQUIRE(j1939_tx_pgn(&TestJ1939::node, 0xFECA, data, sizeof(data), J1939_ADDR_GLOBAL) == true);
+
+        J1939TPSession* session = j1939_tp_find_tx_session(tp, J1939_ADDR_GLOBAL);
+        REQUIRE(session != nullptr);
+        REQUIRE(session->msg_info.pgn == 0xFECA);
+        REQUIRE(session->msg_info.pri == 6);
+    }
+    SECTION("Unknown PGNs get the default priority")
+    {
+        REQUIRE(j1939_tx_pgn(&TestJ1939::node, 0xFF12, data, 5, J1939_ADDR_GLOBAL) == true);
+        REQUIRE(TestJ1939::msg.pri == J1939_DEFAULT_PRIORITY);
+    }
+
+    j1939_tp_close_all(tp);
+}
+
+TEST_CASE("Reassembled messages carry their PGN's priority", "[j1939_tp_rx_rts][j1939_tp_rx_bam]")
+{
+    J1939TPSession session;
+
+    J1939_TP_CM_BAM bam {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_BAM,
+        .len = 9,
+        .num_packages = 2,
+        .res = 0xFF,
+        .pgn = 0xF003
+    };
+    j1939_tp_rx_bam(&session, &bam, 0x10);
+    REQUIRE(session.msg_info.pri == 3);
+
+    J1939_TP_CM_RTS rts {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_RTS,
+        .len = 9,
+        .num_packages = 2,
+        .max_packages = 0xFF,
+        .pgn = 0xABCD
+    };
+    session.tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    j1939_tp_rx_rts(&session, &rts, 0x10);
+    REQUIRE(session.msg_info.pri == J1939_DEFAULT_PRIORITY);
+}
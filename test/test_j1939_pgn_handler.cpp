@@ -0,0 +1,160 @@
+#include "test_j1939.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+static int handler_calls;
+static void* handler_user_data;
+static uint32_t handler_pgn;
+
+static void pgn_handler(void* user_data, J1939Msg* msg)
+{
+    handler_calls++;
+    handler_user_data = user_data;
+    handler_pgn = msg->pgn;
+}
+
+static void other_pgn_handler(void* user_data, J1939Msg* msg)
+{
+    (void)user_data, (void)msg;
+}
+
+TEST_CASE("PGN handler table registration and lookup", "[j1939_pgn_handlers]")
+{
+    J1939PgnHandlers handlers;
+    j1939_pgn_handlers_init(&handlers);
+
+    int user_data = 0;
+
+    SECTION("Unregistered PGNs are not found")
+    {
+        REQUIRE(j1939_pgn_handlers_lookup(&handlers, 0xF004) == nullptr);
+    }
+    SECTION("Registered PGNs are found along with their user data")
+    {
+        REQUIRE(j1939_pgn_handlers_register(&handlers, 0xF004, pgn_handler, &user_data) == true);
+
+        const J1939PgnHandlerEntry* entry = j1939_pgn_handlers_lookup(&handlers, 0xF004);
+        REQUIRE(entry != nullptr);
+        REQUIRE(entry->handler == pgn_handler);
+        REQUIRE(entry->user_data == &user_data);
+        REQUIRE(handlers.count == 1);
+    }
+    SECTION("Registering a PGN again replaces its handler")
+    {
+        REQUIRE(j1939_pgn_handlers_register(&handlers, 0xF004, pgn_handler, nullptr) == true);
+        REQUIRE(j1939_pgn_handlers_register(&handlers, 0xF004, other_pgn_handler, &user_data) == true);
+
+        const J1939PgnHandlerEntry* entry = j1939_pgn_handlers_lookup(&handlers, 0xF004);
+        REQUIRE(entry->handler == other_pgn_handler);
+        REQUIRE(entry->user_data == &user_data);
+        REQUIRE(handlers.count == 1);
+    }
+    SECTION("Invalid registrations are rejected")
+    {
+        REQUIRE(j1939_pgn_handlers_register(&handlers, 0xF004, nullptr, nullptr) == false);
+        REQUIRE(j1939_pgn_handlers_register(&handlers, 0x40000, pgn_handler, nullptr) == false);
+    }
+    SECTION("The table accepts at most J1939_PGN_HANDLERS_MAX PGNs")
+    {
+        for (uint32_t i = 0; i < J1939_PGN_HANDLERS_MAX; ++i)
+            REQUIRE(j1939_pgn_handlers_register(&handlers, 0xFE00 + i, pgn_handler, nullptr) == true);
+
+        REQUIRE(j1939_pgn_handlers_register(&handlers, 0xF004, pgn_handler, nullptr) == false);
+
+        for (uint32_t i = 0; i < J1939_PGN_HANDLERS_MAX; ++i)
+            REQUIRE(j1939_pgn_handlers_lookup(&handlers, 0xFE00 + i) != nullptr);
+    }
+    SECTION("Unregistering keeps every other PGN reachable")
+    {
+        for (uint32_t i = 0; i < J1939_PGN_HANDLERS_MAX; ++i)
+            j1939_pgn_handlers_register(&handlers, 0xFE00 + i, pgn_handler, nullptr);
+
+        // Remove every other entry, which breaks up the probe sequences
+        for (uint32_t i = 0; i < J1939_PGN_HANDLERS_MAX; i += 2)
+            REQUIRE(j1939_pgn_handlers_unregister(&handlers, 0xFE00 + i) == true);
+
+        for (uint32_t i = 0; i < J1939_PGN_HANDLERS_MAX; ++i)
+        {
+            bool registered = (i % 2) != 0;
+            REQUIRE((j1939_pgn_handlers_lookup(&handlers, 0xFE00 + i) != nullptr) == registered);
+        }
+
+        REQUIRE(handlers.count == J1939_PGN_HANDLERS_MAX / 2);
+        REQUIRE(j1939_pgn_handlers_unregister(&handlers, 0xFE00) == false);
+    }
+}
+
+TEST_CASE("Messages are routed to registered PGN handlers", "[j1939_register_pgn_handler]")
+{
+    J1939* node = &TestJ1939::node;
+    J1939_MSG_RX original_rx = node->j1939_rx;
+    int user_data = 0;
+
+    handler_calls = 0;
+    handler_user_data = nullptr;
+    handler_pgn = 0;
+    TestJ1939::msg.pgn = 0;
+
+    // PGN 0xF004 broadcast from address 0x12
+    J1939CanFrame frame { .id = 0x8CF00412, .data = { 0xAA }, .len = 1 };
+
+    SECTION("A registered PGN goes to its handler instead of j1939_rx")
+    {
+        REQUIRE(j1939_register_pgn_handler(node, 0xF004, pgn_handler, &user_data) == true);
+        j1939_process_frames(node, &frame, 1);
+
+        REQUIRE(handler_calls == 1);
+        REQUIRE(handler_user_data == &user_data);
+        REQUIRE(handler_pgn == 0xF004);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+    }
+    SECTION("Unregistered PGNs fall back to j1939_rx")
+    {
+        j1939_process_frames(node, &frame, 1);
+
+        REQUIRE(handler_calls == 0);
+        REQUIRE(TestJ1939::msg.pgn == 0xF004);
+    }
+    SECTION("Without j1939_rx, unregistered PGNs are dropped")
+    {
+        node->j1939_rx = nullptr;
+        j1939_process_frames(node, &frame, 1);
+
+        REQUIRE(handler_calls == 0);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+    }
+    SECTION("Without j1939_rx, broadcasts of unregistered PGNs are not reassembled")
+    {
+        J1939TP* tp = &g_j1939[node->node_idx].tp;
+        j1939_tp_close_all(tp);
+        node->j1939_rx = nullptr;
+
+        J1939_TP_CM_BAM bam {
+            .control_byte = J1939_TP_CM_CONTROL_BYTE_BAM,
+            .len = 9,
+            .num_packages = 2,
+            .res = 0xFF,
+            .pgn = 0xFEE3
+        };
+        J1939Msg bam_msg {
+            .pgn = J1939_TP_CM_PGN,
+            .data = (uint8_t*)&bam,
+            .len = J1939_TP_CM_LEN,
+            .src = 0x12,
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_TP_CM_PRI
+        };
+        j1939_tp_dispatch(tp, &bam_msg);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x12, J1939_ADDR_GLOBAL) == nullptr);
+
+        REQUIRE(j1939_register_pgn_handler(node, 0xFEE3, pgn_handler, nullptr) == true);
+        j1939_tp_dispatch(tp, &bam_msg);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x12, J1939_ADDR_GLOBAL) != nullptr);
+
+        j1939_tp_close_all(tp);
+        j1939_unregister_pgn_handler(node, 0xFEE3);
+    }
+
+    j1939_unregister_pgn_handler(node, 0xF004);
+    node->j1939_rx = original_rx;
+}
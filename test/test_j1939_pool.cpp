@@ -0,0 +1,125 @@
+#include "test_j1939.hpp"
+
+extern "C" {
+    #include "j1939_pool.h"
+}
+
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+
+static J1939PoolStats class_stats(int class_idx)
+{
+    J1939PoolStats stats[J1939_POOL_CLASSES];
+    REQUIRE(j1939_pool_stats(stats, J1939_POOL_CLASSES) == J1939_POOL_CLASSES);
+    return stats[class_idx];
+}
+
+TEST_CASE("Transport protocol buffer pool", "[j1939_pool]")
+{
+    j1939_pool_reset_stats();
+    const uint16_t small_in_use = class_stats(0).in_use;
+
+    SECTION("Requests are served from the smallest class that fits")
+    {
+        uint8_t* small = j1939_pool_alloc(9);
+        uint8_t* medium = j1939_pool_alloc(J1939_POOL_SMALL_SIZE + 1);
+        uint8_t* large = j1939_pool_alloc(J1939_TP_MAX_PAYLOAD);
+
+        REQUIRE(small != nullptr);
+        REQUIRE(medium != nullptr);
+        REQUIRE(large != nullptr);
+        REQUIRE(class_stats(0).in_use == small_in_use + 1);
+        REQUIRE(class_stats(1).block_size == J1939_POOL_MEDIUM_SIZE);
+        REQUIRE(class_stats(2).block_size == J1939_TP_MAX_PAYLOAD);
+
+        j1939_pool_free(small);
+        j1939_pool_free(medium);
+        j1939_pool_free(large);
+        REQUIRE(class_stats(0).in_use == small_in_use);
+    }
+    SECTION("Payloads longer than the largest class are refused")
+    {
+        REQUIRE(j1939_pool_alloc(J1939_TP_MAX_PAYLOAD + 1) == nullptr);
+    }
+    SECTION("An exhausted class falls back to a larger one")
+    {
+        std::vector<uint8_t*> blocks;
+        for (int i = small_in_use; i < J1939_POOL_SMALL_BLOCKS; ++i)
+            blocks.push_back(j1939_pool_alloc(9));
+
+        REQUIRE(class_stats(0).in_use == J1939_POOL_SMALL_BLOCKS);
+        REQUIRE(class_stats(0).exhausted == 0);
+
+        uint16_t medium_in_use = class_stats(1).in_use;
+        uint8_t* fallback = j1939_pool_alloc(9);
+
+        REQUIRE(fallback != nullptr);
+        REQUIRE(class_stats(0).exhausted == 1);
+        REQUIRE(class_stats(1).in_use == medium_in_use + 1);
+
+        // Freed blocks are handed out again
+        j1939_pool_free(blocks.back());
+        blocks.pop_back();
+        uint8_t* reused = j1939_pool_alloc(9);
+        REQUIRE(class_stats(0).in_use == J1939_POOL_SMALL_BLOCKS);
+        blocks.push_back(reused);
+
+        for (uint8_t* block : blocks)
+            j1939_pool_free(block);
+        j1939_pool_free(fallback);
+
+        // The high-water mark remembers the peak
+        REQUIRE(class_stats(0).in_use == small_in_use);
+        REQUIRE(class_stats(0).high_water == J1939_POOL_SMALL_BLOCKS);
+
+        j1939_pool_reset_stats();
+        REQUIRE(class_stats(0).high_water == small_in_use);
+        REQUIRE(class_stats(0).exhausted == 0);
+    }
+}
+
+TEST_CASE("Transport protocol sessions borrow pool buffers", "[j1939_pool][j1939_tp_dispatch]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    const uint8_t our_address = TestJ1939::node.source_address;
+
+    j1939_tp_close_all(tp);
+    const uint16_t small_in_use = class_stats(0).in_use;
+
+    J1939_TP_CM_RTS rts {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_RTS,
+        .len = 20,
+        .num_packages = 3,
+        .max_packages = J1939_TP_CM_RTS_MAX_PACKAGES,
+        .pgn = 0xABCD
+    };
+    J1939Msg rts_msg {
+        .pgn = J1939_TP_CM_PGN,
+        .data = (uint8_t*)&rts,
+        .len = J1939_TP_CM_LEN,
+        .src = 0x41,
+        .dst = our_address,
+        .pri = J1939_TP_CM_PRI
+    };
+
+    SECTION("A buffer is held only while the connection is open")
+    {
+        j1939_tp_dispatch(tp, &rts_msg);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x41, our_address) != nullptr);
+        REQUIRE(class_stats(0).in_use == small_in_use + 1);
+
+        j1939_tp_close_all(tp);
+        REQUIRE(class_stats(0).in_use == small_in_use);
+    }
+    SECTION("An RTS announcing more than J1939_TP_MAX_PAYLOAD bytes is refused")
+    {
+        rts.len = J1939_TP_MAX_PAYLOAD + 1;
+        j1939_tp_dispatch(tp, &rts_msg);
+
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x41, our_address) == nullptr);
+
+        J1939_TP_CM_ABORT* abort = (J1939_TP_CM_ABORT*)TestJ1939::msg.data;
+        REQUIRE(abort->control_byte == J1939_TP_CM_CONTROL_BYTE_ABORT);
+        REQUIRE(abort->abort_reason == J1939_TP_ABORT_REASON_RESOURCES);
+    }
+}
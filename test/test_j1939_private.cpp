@@ -117,6 +117,14 @@ TEST_CASE("CAN frames are successfully converted to J1939 messages", "[j1939_can
         REQUIRE(msg.len == 8);
         REQUIRE(std::memcmp(msg.data, frame_data, 8) == 0);
     }
+    SECTION("The payload is borrowed from the frame rather than copied")
+    {
+        frame.id = 0x8CF004FE;
+        bool result = j1939_can_frame_unpack(node, &frame, &msg);
+
+        REQUIRE(result == true);
+        REQUIRE(msg.data == frame.data);
+    }
     SECTION("J1939Msg struct is filled out correctly (PDU2 format)")
     {
         frame.id = 0x8CF004FE;
@@ -129,3 +137,246 @@ TEST_CASE("CAN frames are successfully converted to J1939 messages", "[j1939_can
         REQUIRE(msg.pri == 3);
     }
 }
+
+static int batch_frames_pending;
+static int batch_calls;
+
+static int can_rx_batch(void* user_data, J1939CanFrame* frames, int max_frames)
+{
+    (void)user_data;
+    int n = (batch_frames_pending < max_frames) ? batch_frames_pending : max_frames;
+
+    for (int i = 0; i < n; ++i)
+    {
+        // PGN 0xF004 broadcast, source address is the frame's index
+        frames[i].id = 0x8CF00400 | (uint8_t)(batch_frames_pending - i);
+        frames[i].len = 1;
+        frames[i].data[0] = (uint8_t)(batch_frames_pending - i);
+    }
+
+    batch_frames_pending -= n;
+    batch_calls++;
+    return n;
+}
+
+TEST_CASE("Frames are received in batches when a batch callback is registered", "[j1939_update]")
+{
+    J1939* node = &TestJ1939::node;
+
+    batch_frames_pending = J1939_RX_BATCH_SIZE + 3;
+    batch_calls = 0;
+
+    j1939_set_can_rx_batch(node, can_rx_batch);
+    j1939_update(node);
+    j1939_set_can_rx_batch(node, nullptr);
+
+    // A full batch followed by a partial batch; the partial batch ends the tick
+    REQUIRE(batch_calls == 2);
+    REQUIRE(batch_frames_pending == 0);
+    REQUIRE(TestJ1939::msg.pgn == 0x00F004);
+    REQUIRE(TestJ1939::msg.src == 1);
+    REQUIRE(TestJ1939::msg.len == 1);
+    REQUIRE(TestJ1939::msg.data[0] == 1);
+}
+
+static const uint8_t* borrowed_data;
+
+static void j1939_rx_borrowed(void* user_data, J1939Msg* msg)
+{
+    (void)user_data;
+    borrowed_data = msg->data;
+}
+
+TEST_CASE("Caller-owned frames are dispatched without copying the payload", "[j1939_process_frames]")
+{
+    J1939* node = &TestJ1939::node;
+    J1939_MSG_RX original_rx = node->j1939_rx;
+
+    J1939CanFrame frames[2] = {
+        { .id = 0x8CF00412, .data = { 0xAA }, .len = 1 },
+        { .id = 0x8CF00434, .data = { 0xBB }, .len = 1 }
+    };
+
+    borrowed_data = nullptr;
+    node->j1939_rx = j1939_rx_borrowed;
+    j1939_process_frames(node, frames, 2);
+    node->j1939_rx = original_rx;
+
+    REQUIRE(borrowed_data == frames[1].data);
+}
+
+static J1939CanFrame bus_frames[2];
+static int bus_frames_pending;
+static int node2_can_rx_calls;
+static int node2_rx_calls;
+static uint32_t node2_rx_pgn;
+
+static bool bus_rx(void* user_data, J1939CanFrame* frame)
+{
+    (void)user_data;
+    if (bus_frames_pending == 0)
+        return false;
+
+    *frame = bus_frames[2 - bus_frames_pending];
+    bus_frames_pending--;
+    return true;
+}
+
+static bool node2_can_rx(void* user_data, J1939CanFrame* frame)
+{
+    (void)user_data, (void)frame;
+    node2_can_rx_calls++;
+    return false;
+}
+
+static void node2_j1939_rx(void* user_data, J1939Msg* msg)
+{
+    (void)user_data;
+    node2_rx_calls++;
+    node2_rx_pgn = msg->pgn;
+}
+
+static void node2_startup_delay(void* param)
+{
+    (void)param;
+}
+
+TEST_CASE("The bus is read once and frames are fanned out to every node", "[j1939_update_all]")
+{
+    static J1939 node2;
+    static bool node2_initialized = false;
+    static bool node2_available = false;
+
+    J1939* node1 = &TestJ1939::node;
+    J1939_CAN_RX original_can_rx = node1->can_rx;
+
+    // The second node is only available when built with J1939_NODES > 1
+    if (!node2_initialized)
+    {
+        node2_available = j1939_init(&node2, &TestJ1939::name, 0x28, 10,
+            node2_can_rx, TestJ1939::can_tx, node2_j1939_rx,
+            node2_startup_delay, nullptr);
+        node2_initialized = true;
+    }
+
+    node2_can_rx_calls = 0;
+    node2_rx_calls = 0;
+    node2_rx_pgn = 0;
+    TestJ1939::msg.pgn = 0;
+
+    // A broadcast, then a peer-to-peer message for node1 only
+    bus_frames[0] = { .id = 0x8CFEF112, .data = { 0x01 }, .len = 1 };
+    bus_frames[1] = { .id = 0x98EF0012 | ((uint32_t)node1->source_address << 8), .data = { 0x02 }, .len = 1 };
+    bus_frames_pending = 2;
+
+    node1->can_rx = bus_rx;
+    j1939_update_all();
+    node1->can_rx = original_can_rx;
+
+    REQUIRE(bus_frames_pending == 0);
+    REQUIRE(TestJ1939::msg.pgn == 0xEF00);
+
+    if (node2_available)
+    {
+        REQUIRE(node2_can_rx_calls == 0);
+        REQUIRE(node2_rx_calls == 1);
+        REQUIRE(node2_rx_pgn == 0xFEF1);
+    }
+}
+
+static void* ctx_tx_user_data;
+static void* ctx_rx_user_data;
+static int ctx_rx_calls;
+
+static bool ctx_can_rx(void* user_data, J1939CanFrame* frame)
+{
+    (void)user_data, (void)frame;
+    return false;
+}
+
+static bool ctx_can_tx(void* user_data, J1939Msg* msg)
+{
+    (void)msg;
+    ctx_tx_user_data = user_data;
+    return true;
+}
+
+static void ctx_j1939_rx(void* user_data, J1939Msg* msg)
+{
+    (void)msg;
+    ctx_rx_user_data = user_data;
+    ctx_rx_calls++;
+}
+
+static void ctx_startup_delay(void* param)
+{
+    (void)param;
+}
+
+TEST_CASE("Contexts hold independent node state", "[j1939_context_init]")
+{
+    static J1939Private storage_a[1];
+    static J1939Private storage_b[1];
+    J1939Context ctx_a;
+    J1939Context ctx_b;
+    J1939 node_a;
+    J1939 node_b;
+    int user_data_a = 0;
+    int user_data_b = 0;
+
+    REQUIRE(j1939_context_init(&ctx_a, storage_a, 1, &user_data_a) == true);
+    REQUIRE(j1939_context_init(&ctx_b, storage_b, 1, &user_data_b) == true);
+
+    SECTION("Invalid storage is rejected")
+    {
+        REQUIRE(j1939_context_init(&ctx_a, nullptr, 1, nullptr) == false);
+        REQUIRE(j1939_context_init(&ctx_a, storage_a, 0, nullptr) == false);
+    }
+    SECTION("Nodes are limited by the context's storage")
+    {
+        REQUIRE(j1939_context_node_init(&ctx_a, &node_a, &TestJ1939::name, 0x30, 10,
+            ctx_can_rx, ctx_can_tx, ctx_j1939_rx, ctx_startup_delay, nullptr) == true);
+        REQUIRE(j1939_context_node_init(&ctx_a, &node_b, &TestJ1939::name, 0x31, 10,
+            ctx_can_rx, ctx_can_tx, ctx_j1939_rx, ctx_startup_delay, nullptr) == false);
+    }
+    SECTION("Callbacks receive their context's user data")
+    {
+        ctx_tx_user_data = nullptr;
+        REQUIRE(j1939_context_node_init(&ctx_a, &node_a, &TestJ1939::name, 0x30, 10,
+            ctx_can_rx, ctx_can_tx, ctx_j1939_rx, ctx_startup_delay, nullptr) == true);
+        // The address claim is sent during init
+        REQUIRE(ctx_tx_user_data == &user_data_a);
+
+        REQUIRE(j1939_context_node_init(&ctx_b, &node_b, &TestJ1939::name, 0x30, 10,
+            ctx_can_rx, ctx_can_tx, ctx_j1939_rx, ctx_startup_delay, nullptr) == true);
+        REQUIRE(ctx_tx_user_data == &user_data_b);
+
+        REQUIRE(node_a.ctx == &ctx_a);
+        REQUIRE(node_b.ctx == &ctx_b);
+        REQUIRE(storage_a[0].j1939_public == &node_a);
+        REQUIRE(storage_b[0].j1939_public == &node_b);
+
+        ctx_rx_calls = 0;
+        J1939CanFrame frame { .id = 0x8CFEF112, .data = { 0x01 }, .len = 1 };
+        j1939_process_frames(&node_b, &frame, 1);
+
+        REQUIRE(ctx_rx_calls == 1);
+        REQUIRE(ctx_rx_user_data == &user_data_b);
+    }
+    SECTION("Address claims in one context don't affect another")
+    {
+        REQUIRE(j1939_context_node_init(&ctx_a, &node_a, &TestJ1939::name, 0x30, 10,
+            ctx_can_rx, ctx_can_tx, ctx_j1939_rx, ctx_startup_delay, nullptr) == true);
+        REQUIRE(j1939_context_node_init(&ctx_b, &node_b, &TestJ1939::name, 0x30, 10,
+            ctx_can_rx, ctx_can_tx, ctx_j1939_rx, ctx_startup_delay, nullptr) == true);
+
+        // A higher priority NAME claims 0x30 on bus A only
+        J1939Name winner {};
+        J1939CanFrame frame { .id = 0x98EEFF30, .len = 8 };
+        std::memcpy(frame.data, &winner, sizeof(winner));
+        j1939_process_frames(&node_a, &frame, 1);
+
+        REQUIRE(node_a.source_address != 0x30);
+        REQUIRE(node_b.source_address == 0x30);
+    }
+}
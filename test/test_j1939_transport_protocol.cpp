@@ -2,105 +2,149 @@
 
 #include <catch2/catch_test_macros.hpp>
 #include <cmath>
+#include <vector>
+
+// Set up a received broadcast of len bytes, with every packet missing
+static void
+init_rx_session(J1939TPSession* session, uint16_t len)
+{
+    J1939_TP_CM_BAM bam {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_BAM,
+        .len = len,
+        .num_packages = static_cast<uint8_t>((len + 6) / 7),
+        .res = 0xFF,
+        .pgn = 0xABCD
+    };
+    j1939_tp_rx_bam(session, &bam, 0x10);
+}
 
 TEST_CASE("Data from TP.DT packets are received and added to the buffer", "[j1939_tp_rx_dt]")
 {
-    J1939TP tp;
+    J1939TPSession session;
+    uint8_t buf[J1939_TP_MAX_PAYLOAD];
+    session.buf = buf;
     J1939_TP_DT dt;
 
-    SECTION("Sequence numbers must be received in the expected order")
+    SECTION("Sequence numbers outside of the window are rejected")
     {
-        tp.next_seq = 1;
-        tp.bytes_rem = 7;
-        dt.seq = 2;
+        init_rx_session(&session, 14);
+        dt.seq = 3;
 
-        bool result = j1939_tp_rx_dt(&tp, &dt);
+        bool result = j1939_tp_rx_dt(&session, &dt);
 
-        // The function should return early and thus skip incrementing next_seq
         REQUIRE(result == false);
-        REQUIRE(tp.next_seq == 1);
+        REQUIRE(session.bytes_rem == 14);
+
+        dt.seq = 0;
+        REQUIRE(j1939_tp_rx_dt(&session, &dt) == false);
+    }
+    SECTION("Packets may arrive out of order, but only once")
+    {
+        init_rx_session(&session, 14);
+
+        dt.seq = 2;
+        REQUIRE(j1939_tp_rx_dt(&session, &dt) == true);
+        REQUIRE(session.bytes_rem == 7);
+        REQUIRE(j1939_tp_rx_dt(&session, &dt) == false);
+        REQUIRE(session.bytes_rem == 7);
+
+        dt.seq = 1;
+        REQUIRE(j1939_tp_rx_dt(&session, &dt) == true);
+        REQUIRE(session.bytes_rem == 0);
     }
-    SECTION("The correct number of bytes are copied, depending on the number of bytes remaining")
+    SECTION("The correct number of bytes are copied, depending on the length of the message")
     {
-        tp.next_seq = 1;
-        tp.bytes_rem = 8;
-        std::memset(tp.buf, 0, 9);
+        init_rx_session(&session, 8);
+        std::memset(session.buf, 0, 9);
 
         dt.seq = 1;
         uint8_t data1[7] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
         uint8_t data2[7] = { 0x77, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 
         std::memcpy(&dt.data0, data1, sizeof(data1));
-        (void)j1939_tp_rx_dt(&tp, &dt);
+        (void)j1939_tp_rx_dt(&session, &dt);
 
-        REQUIRE(tp.bytes_rem == 1);
-        REQUIRE(tp.next_seq == 2);
-        REQUIRE(std::memcmp(&tp.buf[0], data1, 7) == 0);
+        REQUIRE(session.bytes_rem == 1);
+        REQUIRE(std::memcmp(&session.buf[0], data1, 7) == 0);
 
         dt.seq = 2;
         std::memcpy(&dt.data0, data2, sizeof(data2));
-        j1939_tp_rx_dt(&tp, &dt);
+        j1939_tp_rx_dt(&session, &dt);
 
-        REQUIRE(tp.bytes_rem == 0);
-        REQUIRE(tp.next_seq == 3);
-        REQUIRE(tp.buf[7] == 0x77);
-        REQUIRE(tp.buf[8] == 0x00);
+        REQUIRE(session.bytes_rem == 0);
+        REQUIRE(session.buf[7] == 0x77);
+        REQUIRE(session.buf[8] == 0x00);
     }
     SECTION("Data is copied into the correct buffer location, depending on the packet's sequence number")
     {
-        tp.next_seq = 255;
-        tp.bytes_rem = 7;
-        std::memset(tp.buf, 0, sizeof(tp.buf));
+        init_rx_session(&session, J1939_TP_MAX_PAYLOAD);
+        std::memset(session.buf, 0, sizeof(buf));
 
         dt.seq = 255;
         uint8_t data[7] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xBA, 0xBE, 0xEE };
         std::memcpy(&dt.data0, data, sizeof(data));
 
-        (void)j1939_tp_rx_dt(&tp, &dt);
+        (void)j1939_tp_rx_dt(&session, &dt);
 
-        REQUIRE(tp.bytes_rem == 0);
-        REQUIRE(std::memcmp(&tp.buf[1778], data, sizeof(data)) == 0);
+        REQUIRE(session.bytes_rem == J1939_TP_MAX_PAYLOAD - 7);
+        REQUIRE(std::memcmp(&session.buf[1778], data, sizeof(data)) == 0);
     }
 }
 
 TEST_CASE("Data in the buffer is packed properly into TP.DT packets", "[j1939_tp_dt_pack]")
 {
-    J1939TP tp;
+    J1939TPSession session;
+    uint8_t buf[J1939_TP_MAX_PAYLOAD];
+    session.buf = buf;
     J1939_TP_DT dt;
 
     SECTION("Data is copied from the correct location in the buffer, depending on the sequence number")
     {
-        std::memset(tp.buf, 0, sizeof(tp.buf));
+        std::memset(session.buf, 0, sizeof(buf));
         std::memset(&dt, 0, sizeof(dt));
 
         // Pick a random sequence number and ensure data is copied from the expected locations in the buffer
-        tp.next_seq = 18;
-        tp.bytes_rem = 7;
+        session.next_seq = 18;
+        session.msg_info.len = 18 * 7;
+        session.bytes_rem = 7;
 
-        int buf_idx = (tp.next_seq - 1) * 7;
+        int buf_idx = (session.next_seq - 1) * 7;
         uint8_t data[7] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xBA, 0xBE, 0xEE };
-        std::memcpy(&tp.buf[buf_idx], data, sizeof(data));
+        std::memcpy(&session.buf[buf_idx], data, sizeof(data));
 
-        j1939_tp_dt_pack(&tp, &dt);
+        j1939_tp_dt_pack(&session, &dt);
         
         REQUIRE(dt.seq == 18);
-        REQUIRE(tp.next_seq == 19);
+        REQUIRE(session.next_seq == 19);
+        REQUIRE(session.bytes_rem == 0);
         REQUIRE(std::memcmp(&dt.data0, data, sizeof(data)) == 0);
     }
     SECTION("All unused bytes in the last packet are set of 0xFF")
     {
-        tp.next_seq = 1;
-        tp.bytes_rem = 4;
+        session.next_seq = 1;
+        session.msg_info.len = 4;
+        session.bytes_rem = 4;
 
         uint8_t data[4] = { 0xDE, 0xAD, 0xBE, 0xEF };
         uint8_t expected[7] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFF, 0xFF, 0xFF };
 
-        std::memcpy(tp.buf, data, sizeof(data));
+        std::memcpy(session.buf, data, sizeof(data));
 
-        j1939_tp_dt_pack(&tp, &dt);
+        j1939_tp_dt_pack(&session, &dt);
 
         REQUIRE(std::memcmp(&dt.data0, expected, sizeof(expected)) == 0);
     }
+    SECTION("Packets sent again don't count towards the bytes remaining")
+    {
+        session.next_seq = 1;
+        session.msg_info.len = 14;
+        session.bytes_rem = 0;
+
+        j1939_tp_dt_pack(&session, &dt);
+
+        REQUIRE(dt.seq == 1);
+        REQUIRE(session.bytes_rem == 0);
+    }
 }
 
 TEST_CASE("Broadcast sender", "[j1939_tp_queue][j1939_tp_broadcast_update_sender]")
@@ -120,13 +164,15 @@ TEST_CASE("Broadcast sender", "[j1939_tp_queue][j1939_tp_broadcast_update_sender
     msg.pri = J1939_DEFAULT_PRIORITY;
 
     // Send BAM
-    j1939_tp_close_connection(&jp->tp);
+    j1939_tp_close_all(&jp->tp);
     bool result = j1939_tp_queue(&jp->tp, &msg);
+    J1939TPSession* session = j1939_tp_find_tx_session(&jp->tp, J1939_ADDR_GLOBAL);
 
     REQUIRE(result == true);
-    REQUIRE(std::memcmp(jp->tp.buf, data, sizeof(data)) == 0);
-    REQUIRE(jp->tp.connection == J1939_TP_CONNECTION_BROADCAST);
-    REQUIRE(jp->tp.bytes_rem == 15);
+    REQUIRE(session != nullptr);
+    REQUIRE(std::memcmp(session->buf, data, sizeof(data)) == 0);
+    REQUIRE(session->connection == J1939_TP_CONNECTION_BROADCAST);
+    REQUIRE(session->bytes_rem == 15);
     REQUIRE(TestJ1939::msg.pgn == J1939_TP_CM_PGN);
     REQUIRE(TestJ1939::msg.len == J1939_TP_CM_LEN);
     REQUIRE(TestJ1939::msg.pri == J1939_TP_CM_PRI);
@@ -140,8 +186,8 @@ TEST_CASE("Broadcast sender", "[j1939_tp_queue][j1939_tp_broadcast_update_sender
     REQUIRE(bam->pgn == 0xABCD);
 
     // Send first TP.DT packet
-    jp->tp.timer_ms = J1939_TP_TX_PERIOD;
-    j1939_tp_broadcast_update_sender(&jp->tp);
+    session->timer_ms = J1939_TP_TX_PERIOD;
+    j1939_tp_broadcast_update_sender(session);
     J1939_TP_DT* dt = (J1939_TP_DT*)TestJ1939::msg.data;
 
     REQUIRE(TestJ1939::msg.pgn == J1939_TP_DT_PGN);
@@ -151,27 +197,27 @@ TEST_CASE("Broadcast sender", "[j1939_tp_queue][j1939_tp_broadcast_update_sender
     REQUIRE(TestJ1939::msg.src == jp->j1939_public->source_address);
     REQUIRE(dt->seq == 1);
     REQUIRE(std::memcmp(&dt->data0, &data[0], 7) == 0);
-    REQUIRE(jp->tp.bytes_rem == 8);
+    REQUIRE(session->bytes_rem == 8);
 
     // Send second TP.DT packet
-    jp->tp.timer_ms = J1939_TP_TX_PERIOD;
-    j1939_tp_broadcast_update_sender(&jp->tp);
+    session->timer_ms = J1939_TP_TX_PERIOD;
+    j1939_tp_broadcast_update_sender(session);
 
     REQUIRE(dt->seq == 2);
     REQUIRE(std::memcmp(&dt->data0, &data[7], 7) == 0);
-    REQUIRE(jp->tp.bytes_rem == 1);
+    REQUIRE(session->bytes_rem == 1);
 
     // Send third TP.DT packet
-    jp->tp.timer_ms = J1939_TP_TX_PERIOD;
-    j1939_tp_broadcast_update_sender(&jp->tp);
+    session->timer_ms = J1939_TP_TX_PERIOD;
+    j1939_tp_broadcast_update_sender(session);
 
     REQUIRE(dt->seq == 3);
     REQUIRE(dt->data0 == data[14]);
-    REQUIRE(jp->tp.bytes_rem == 0);
+    REQUIRE(session->bytes_rem == 0);
 
     // Connection should now close
-    j1939_tp_broadcast_update_sender(&jp->tp);
-    REQUIRE(jp->tp.connection == J1939_TP_CONNECTION_NONE);
+    j1939_tp_broadcast_update_sender(session);
+    REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
 }
 
 TEST_CASE("Broadcast reciever", "[j1939_tp_broadcast_update_receiver]")
@@ -182,7 +228,7 @@ TEST_CASE("Broadcast reciever", "[j1939_tp_broadcast_update_receiver]")
     constexpr uint32_t msg_pgn = 0xABCD;
 
     J1939Private* jp = &g_j1939[TestJ1939::node.node_idx];
-    j1939_tp_close_connection(&jp->tp);
+    j1939_tp_close_all(&jp->tp);
 
     uint8_t msg_data[15] = {
         0x5a, 0x62, 0x38, 0xd8, 0x03, 0xd1, 0x40,
@@ -216,21 +262,23 @@ TEST_CASE("Broadcast reciever", "[j1939_tp_broadcast_update_receiver]")
 
     // Emulate receiving the BAM message
     j1939_tp_dispatch(&jp->tp, &bam_msg);
+    J1939TPSession* session = j1939_tp_find_rx_session(&jp->tp, sender_node_address, J1939_ADDR_GLOBAL);
+    REQUIRE(session != nullptr);
 
     SECTION("Timeout")
     {
-        jp->tp.timer_ms = J1939_TP_TIMEOUT_T1;
-        j1939_tp_broadcast_update_receiver(&jp->tp);
+        session->timer_ms = J1939_TP_TIMEOUT_T1;
+        j1939_tp_broadcast_update_receiver(session);
 
-        REQUIRE(jp->tp.connection == J1939_TP_CONNECTION_NONE);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
     }
     SECTION("Normal data transfer")
     {
-        REQUIRE(jp->tp.connection == J1939_TP_CONNECTION_BROADCAST);
-        REQUIRE(jp->tp.sender == false);
-        REQUIRE(jp->tp.next_seq == 1);
-        REQUIRE(jp->tp.bytes_rem == sizeof(msg_data));
-        REQUIRE(jp->tp.num_packages == 3);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_BROADCAST);
+        REQUIRE(session->sender == false);
+        REQUIRE(session->next_seq == 1);
+        REQUIRE(session->bytes_rem == sizeof(msg_data));
+        REQUIRE(session->num_packages == 3);
 
         J1939Msg dt_msg {
             .pgn = J1939_TP_DT_PGN,
@@ -241,8 +289,6 @@ TEST_CASE("Broadcast reciever", "[j1939_tp_broadcast_update_receiver]")
             .pri = J1939_TP_DT_PRI
         };
 
-        jp->tp.timer_ms = 0;
-
         // Emulate receiving the first TP.DT packet
         J1939_TP_DT dt { .seq = 1 };
         std::memcpy(&dt.data0, msg_data, 7);
@@ -259,16 +305,16 @@ TEST_CASE("Broadcast reciever", "[j1939_tp_broadcast_update_receiver]")
         dt.data0 = msg_data[14];
         j1939_tp_dispatch(&jp->tp, &dt_msg);
 
-        j1939_tp_broadcast_update_receiver(&jp->tp);
+        j1939_tp_broadcast_update_receiver(session);
 
-        REQUIRE(jp->tp.bytes_rem == 0);
-        REQUIRE(jp->tp.connection == J1939_TP_CONNECTION_NONE);
-        REQUIRE(jp->tp.msg_info.pgn == msg_pgn);
-        REQUIRE(jp->tp.msg_info.dst == J1939_ADDR_GLOBAL);
-        REQUIRE(jp->tp.msg_info.len == sizeof(msg_data));
-        REQUIRE(jp->tp.msg_info.src == sender_node_address);
-        REQUIRE(jp->tp.msg_info.pri == J1939_DEFAULT_PRIORITY);
-        REQUIRE(std::memcmp(jp->tp.buf, TestJ1939::msg.data, sizeof(msg_data)) == 0);
+        REQUIRE(session->bytes_rem == 0);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
+        REQUIRE(session->msg_info.pgn == msg_pgn);
+        REQUIRE(session->msg_info.dst == J1939_ADDR_GLOBAL);
+        REQUIRE(session->msg_info.len == sizeof(msg_data));
+        REQUIRE(session->msg_info.src == sender_node_address);
+        REQUIRE(session->msg_info.pri == J1939_DEFAULT_PRIORITY);
+        REQUIRE(std::memcmp(msg_data, TestJ1939::msg.data, sizeof(msg_data)) == 0);
     }
 }
 
@@ -280,8 +326,7 @@ TEST_CASE("Peer-to-peer sender", "[j1939_tp_p2p_update_sender]")
     constexpr uint32_t msg_pgn = 0xABCD;
     const uint8_t sender_node_address = jp->j1939_public->source_address;
 
-    j1939_tp_close_connection(&jp->tp);
-    jp->tp.timer_ms = 0;
+    j1939_tp_close_all(&jp->tp);
 
     uint8_t msg_data[15] = {
         0x5a, 0x62, 0x38, 0xd8, 0x03, 0xd1, 0x40,
@@ -302,12 +347,14 @@ TEST_CASE("Peer-to-peer sender", "[j1939_tp_p2p_update_sender]")
 
     // Send RTS
     bool queue_result = j1939_tp_queue(&jp->tp, &msg);
+    J1939TPSession* session = j1939_tp_find_tx_session(&jp->tp, receiver_node_address);
+    REQUIRE(session != nullptr);
 
     SECTION("Normal data transfer")
     {
         REQUIRE(queue_result == true);
-        REQUIRE(jp->tp.connection == J1939_TP_CONNECTION_P2P);
-        REQUIRE(jp->tp.clear_to_send == false);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_P2P);
+        REQUIRE(session->clear_to_send == false);
         REQUIRE(TestJ1939::msg.pgn == J1939_TP_CM_PGN);
         REQUIRE(TestJ1939::msg.len == J1939_TP_CM_LEN);
         REQUIRE(TestJ1939::msg.pri == J1939_TP_CM_PRI);
@@ -339,17 +386,17 @@ TEST_CASE("Peer-to-peer sender", "[j1939_tp_p2p_update_sender]")
         };
 
         j1939_tp_dispatch(&jp->tp, &response_msg);
-        REQUIRE(jp->tp.clear_to_send == true);
+        REQUIRE(session->clear_to_send == true);
 
         // Send all TP.DT packets
         uint8_t bytes_rem_expected = msg_len;
         for (int package = 0; package < msg_num_packages; package++)
         {
-            jp->tp.timer_ms = J1939_TP_TX_PERIOD;
-            j1939_tp_p2p_update_sender(&jp->tp);
+            session->timer_ms = J1939_TP_TX_PERIOD;
+            j1939_tp_p2p_update_sender(session);
 
             bytes_rem_expected -= (bytes_rem_expected < 7) ? bytes_rem_expected : 7;
-            REQUIRE(jp->tp.bytes_rem == bytes_rem_expected);
+            REQUIRE(session->bytes_rem == bytes_rem_expected);
         }
 
         SECTION("Connection closes after receiving end of msg ACK")
@@ -369,12 +416,12 @@ TEST_CASE("Peer-to-peer sender", "[j1939_tp_p2p_update_sender]")
             response_msg.pri = J1939_TP_CM_PRI;
 
             j1939_tp_dispatch(&jp->tp, &response_msg);
-            REQUIRE(jp->tp.connection == J1939_TP_CONNECTION_NONE);
+            REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
         }
         SECTION("Timeout occurs if we don't receive an ACK")
         {
-            jp->tp.timer_ms = J1939_TP_TIMEOUT_T3;
-            j1939_tp_p2p_update_sender(&jp->tp);
+            session->timer_ms = J1939_TP_TIMEOUT_T3;
+            j1939_tp_p2p_update_sender(session);
 
             REQUIRE(TestJ1939::msg.pgn == J1939_TP_CM_PGN);
             REQUIRE(TestJ1939::msg.len == J1939_TP_CM_LEN);
@@ -386,14 +433,14 @@ TEST_CASE("Peer-to-peer sender", "[j1939_tp_p2p_update_sender]")
             REQUIRE(abort->control_byte == J1939_TP_CM_CONTROL_BYTE_ABORT);
             REQUIRE(abort->abort_reason == J1939_TP_ABORT_REASON_TIMEOUT);
             REQUIRE(abort->pgn == msg_pgn);
-            REQUIRE(jp->tp.connection == J1939_TP_CONNECTION_NONE);
+            REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
         }
 
     }
     SECTION("Timeout occurs if sender doesn't receive a CTS in response")
     {
-        jp->tp.timer_ms = J1939_TP_TIMEOUT_TR;
-        j1939_tp_p2p_update_sender(&jp->tp);
+        session->timer_ms = J1939_TP_TIMEOUT_TR;
+        j1939_tp_p2p_update_sender(session);
 
         REQUIRE(TestJ1939::msg.pgn == J1939_TP_CM_PGN);
         REQUIRE(TestJ1939::msg.len == J1939_TP_CM_LEN);
@@ -405,7 +452,7 @@ TEST_CASE("Peer-to-peer sender", "[j1939_tp_p2p_update_sender]")
         REQUIRE(abort->control_byte == J1939_TP_CM_CONTROL_BYTE_ABORT);
         REQUIRE(abort->abort_reason == J1939_TP_ABORT_REASON_TIMEOUT);
         REQUIRE(abort->pgn == msg_pgn);
-        REQUIRE(jp->tp.connection == J1939_TP_CONNECTION_NONE);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
     }
 }
 
@@ -417,8 +464,7 @@ TEST_CASE("Peer-to-peer receiver", "[j1939_tp_p2p_update_receiver]")
     constexpr uint32_t msg_pgn = 0xABCD;
     const uint8_t receiver_node_address = g_j1939[TestJ1939::node.node_idx].j1939_public->source_address;
 
-    j1939_tp_close_connection(tp);
-    tp->timer_ms = 0;
+    j1939_tp_close_all(tp);
 
     uint8_t msg_data[15] = {
         0x5a, 0x62, 0x38, 0xd8, 0x03, 0xd1, 0x40,
@@ -455,13 +501,15 @@ TEST_CASE("Peer-to-peer receiver", "[j1939_tp_p2p_update_receiver]")
     };
 
     j1939_tp_dispatch(tp, &received_msg);
-    REQUIRE(tp->clear_to_send == false);
+    J1939TPSession* session = j1939_tp_find_rx_session(tp, sender_node_address, receiver_node_address);
+    REQUIRE(session != nullptr);
+    REQUIRE(session->clear_to_send == false);
 
     // At the specified TX period, we should respond with a CTS
-    tp->timer_ms = J1939_TP_TX_PERIOD;
-    j1939_tp_p2p_update_receiver(tp);
+    session->timer_ms = J1939_TP_TX_PERIOD;
+    j1939_tp_p2p_update_receiver(session);
 
-    REQUIRE(tp->clear_to_send == true);
+    REQUIRE(session->clear_to_send == true);
     REQUIRE(TestJ1939::msg.pgn == J1939_TP_CM_PGN);
     REQUIRE(TestJ1939::msg.len == J1939_TP_CM_LEN);
     REQUIRE(TestJ1939::msg.src == receiver_node_address);
@@ -477,10 +525,10 @@ TEST_CASE("Peer-to-peer receiver", "[j1939_tp_p2p_update_receiver]")
 
     SECTION("Timeout if we don't receive data packets at given frequency")
     {
-        tp->timer_ms = J1939_TP_TIMEOUT_T1;
-        j1939_tp_p2p_update_receiver(tp);
+        session->timer_ms = J1939_TP_TIMEOUT_T1;
+        j1939_tp_p2p_update_receiver(session);
 
-        REQUIRE(tp->connection == J1939_TP_CONNECTION_NONE);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
     }
     SECTION("Send ACK and forward multi-packet msg if received successfully")
     {
@@ -495,15 +543,16 @@ TEST_CASE("Peer-to-peer receiver", "[j1939_tp_p2p_update_receiver]")
 
         for (int i = 0; i < msg_num_packages; ++i)
         {
+            int offset = (dt.seq - 1) * 7;
             std::memcpy(
                 &dt.data0,
-                &msg_data[(tp->next_seq - 1) * 7],
-                (tp->bytes_rem < 7) ? tp->bytes_rem : 7);
+                &msg_data[offset],
+                (msg_len - offset < 7) ? msg_len - offset : 7);
             j1939_tp_dispatch(tp, &received_msg);
 
             dt.seq++;
         }
-        j1939_tp_p2p_update_receiver(tp);
+        j1939_tp_p2p_update_receiver(session);
 
         REQUIRE(TestJ1939::msg.pgn == msg_pgn);
         REQUIRE(TestJ1939::msg.len == msg_len);
@@ -511,6 +560,1632 @@ TEST_CASE("Peer-to-peer receiver", "[j1939_tp_p2p_update_receiver]")
         REQUIRE(TestJ1939::msg.dst == receiver_node_address);
         REQUIRE(TestJ1939::msg.pri == J1939_DEFAULT_PRIORITY);
         REQUIRE(std::memcmp(TestJ1939::msg.data, msg_data, sizeof(msg_data)) == 0);
-        REQUIRE(tp->connection == J1939_TP_CONNECTION_NONE);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
+    }
+}
+
+TEST_CASE("Inconsistent RTS and BAM messages are refused", "[j1939_tp_dispatch]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+
+    constexpr uint8_t sender_node_address = 0x99;
+    constexpr uint32_t msg_pgn = 0xABCD;
+    const uint8_t receiver_node_address = TestJ1939::node.source_address;
+
+    j1939_tp_close_all(tp);
+
+    J1939_TP_CM_RTS rts {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_RTS,
+        .len = 15,
+        .num_packages = 3,
+        .max_packages = J1939_TP_CM_RTS_MAX_PACKAGES,
+        .pgn = msg_pgn
+    };
+    J1939Msg received_msg {
+        .pgn = J1939_TP_CM_PGN,
+        .data = (uint8_t*)&rts,
+        .len = J1939_TP_CM_LEN,
+        .src = sender_node_address,
+        .dst = receiver_node_address,
+        .pri = J1939_TP_CM_PRI
+    };
+
+    auto require_refused = [&]() {
+        TestJ1939::msg.pgn = 0;
+        j1939_tp_dispatch(tp, &received_msg);
+
+        REQUIRE(j1939_tp_find_rx_session(tp, sender_node_address, receiver_node_address) == nullptr);
+        REQUIRE(TestJ1939::msg.pgn == J1939_TP_CM_PGN);
+        REQUIRE(TestJ1939::msg.dst == sender_node_address);
+
+        J1939_TP_CM_ABORT* abort = (J1939_TP_CM_ABORT*)TestJ1939::msg.data;
+        REQUIRE(abort->control_byte == J1939_TP_CM_CONTROL_BYTE_ABORT);
+        REQUIRE(abort->abort_reason == J1939_TP_ABORT_REASON_OTHER);
+        REQUIRE(abort->pgn == msg_pgn);
+    };
+
+    SECTION("Too few packets for the length")
+    {
+        rts.num_packages = 2;
+        require_refused();
+    }
+    SECTION("Too many packets for the length")
+    {
+        rts.num_packages = 4;
+        require_refused();
+    }
+    SECTION("No packets at all")
+    {
+        rts.num_packages = 0;
+        require_refused();
+    }
+    SECTION("A length that fits in a single frame")
+    {
+        rts.len = 8;
+        rts.num_packages = 2;
+        require_refused();
+    }
+    SECTION("A consistent RTS still opens a session")
+    {
+        j1939_tp_dispatch(tp, &received_msg);
+        REQUIRE(j1939_tp_find_rx_session(tp, sender_node_address, receiver_node_address) != nullptr);
+    }
+    SECTION("An inconsistent BAM is ignored")
+    {
+        J1939_TP_CM_BAM bam {
+            .control_byte = J1939_TP_CM_CONTROL_BYTE_BAM,
+            .len = 15,
+            .num_packages = 2,
+            .res = 0xFF,
+            .pgn = msg_pgn
+        };
+        received_msg.data = (uint8_t*)&bam;
+        received_msg.dst = J1939_ADDR_GLOBAL;
+
+        TestJ1939::msg.pgn = 0;
+        j1939_tp_dispatch(tp, &received_msg);
+
+        REQUIRE(j1939_tp_find_rx_session(tp, sender_node_address, J1939_ADDR_GLOBAL) == nullptr);
+        REQUIRE(TestJ1939::msg.pgn == 0);
+    }
+
+    j1939_tp_close_all(tp);
+}
+
+TEST_CASE("Timestamp-driven updates and deadlines", "[j1939_tp_update_at][j1939_next_deadline]")
+{
+    J1939Private* jp = &g_j1939[TestJ1939::node.node_idx];
+    J1939* node = &TestJ1939::node;
+
+    j1939_tp_close_all(&jp->tp);
+
+    SECTION("Nothing is scheduled without an open connection")
+    {
+        REQUIRE(j1939_next_deadline(node) == J1939_NO_DEADLINE);
+    }
+    SECTION("Broadcast packets are sent when their deadline is reached")
+    {
+        uint8_t data[15] = { 0 };
+        J1939Msg msg {
+            .pgn = 0xABCD,
+            .data = data,
+            .len = sizeof(data),
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_DEFAULT_PRIORITY
+        };
+        REQUIRE(j1939_tp_queue(&jp->tp, &msg) == true);
+        J1939TPSession* session = j1939_tp_find_tx_session(&jp->tp, J1939_ADDR_GLOBAL);
+
+        // The timer starts at the next update, which is due right away
+        REQUIRE(j1939_next_deadline(node) == 0);
+
+        const uint64_t start_us = 5000000;
+        j1939_update_at(node, start_us);
+        REQUIRE(j1939_next_deadline(node) == start_us + (J1939_TP_TX_PERIOD * 1000));
+
+        // Just before the deadline nothing is sent
+        j1939_update_at(node, start_us + (J1939_TP_TX_PERIOD * 1000) - 1);
+        REQUIRE(session->bytes_rem == sizeof(data));
+
+        j1939_update_at(node, start_us + (J1939_TP_TX_PERIOD * 1000));
+        REQUIRE(TestJ1939::msg.pgn == J1939_TP_DT_PGN);
+        REQUIRE(session->bytes_rem == 8);
+        REQUIRE(j1939_next_deadline(node) == start_us + (2 * J1939_TP_TX_PERIOD * 1000));
+
+        // The period restarts when a packet is actually sent, so a late update
+        //  pushes back the next deadline
+        const uint64_t late_us = start_us + (2 * J1939_TP_TX_PERIOD * 1000) + 700;
+        j1939_update_at(node, late_us);
+        REQUIRE(session->bytes_rem == 1);
+        REQUIRE(j1939_next_deadline(node) == late_us + (J1939_TP_TX_PERIOD * 1000));
+    }
+    SECTION("Receivers are woken up for the timeout")
+    {
+        J1939_TP_CM_BAM bam {
+            .control_byte = J1939_TP_CM_CONTROL_BYTE_BAM,
+            .len = 15,
+            .num_packages = 3,
+            .res = 0xFF,
+            .pgn = 0xABCD
+        };
+        J1939Msg bam_msg {
+            .pgn = J1939_TP_CM_PGN,
+            .data = (uint8_t*)&bam,
+            .len = J1939_TP_CM_LEN,
+            .src = 0x99,
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_TP_CM_PRI
+        };
+        j1939_tp_dispatch(&jp->tp, &bam_msg);
+        J1939TPSession* session = j1939_tp_find_rx_session(&jp->tp, 0x99, J1939_ADDR_GLOBAL);
+
+        const uint64_t start_us = 1000;
+        j1939_update_at(node, start_us);
+        REQUIRE(j1939_next_deadline(node) == start_us + (J1939_TP_TIMEOUT_T1 * 1000));
+
+        // Updates between deadlines don't drift the timer, even when they
+        //  fall between millisecond boundaries
+        j1939_update_at(node, start_us + 300);
+        j1939_update_at(node, start_us + 1600);
+        j1939_update_at(node, start_us + 2900);
+        REQUIRE(j1939_next_deadline(node) == start_us + (J1939_TP_TIMEOUT_T1 * 1000));
+
+        j1939_update_at(node, j1939_next_deadline(node));
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
+        REQUIRE(j1939_next_deadline(node) == J1939_NO_DEADLINE);
+    }
+}
+
+static J1939Msg make_bam_msg(J1939_TP_CM_BAM* bam, uint8_t src, uint32_t pgn, uint16_t len)
+{
+    *bam = J1939_TP_CM_BAM {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_BAM,
+        .len = len,
+        .num_packages = static_cast<uint8_t>((len + 6) / 7),
+        .res = 0xFF,
+        .pgn = pgn
+    };
+    return J1939Msg {
+        .pgn = J1939_TP_CM_PGN,
+        .data = (uint8_t*)bam,
+        .len = J1939_TP_CM_LEN,
+        .src = src,
+        .dst = J1939_ADDR_GLOBAL,
+        .pri = J1939_TP_CM_PRI
+    };
+}
+
+static J1939Msg make_rts_msg(J1939_TP_CM_RTS* rts, uint8_t src, uint8_t dst, uint32_t pgn, uint16_t len)
+{
+    *rts = J1939_TP_CM_RTS {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_RTS,
+        .len = len,
+        .num_packages = static_cast<uint8_t>((len + 6) / 7),
+        .max_packages = J1939_TP_CM_RTS_MAX_PACKAGES,
+        .pgn = pgn
+    };
+    return J1939Msg {
+        .pgn = J1939_TP_CM_PGN,
+        .data = (uint8_t*)rts,
+        .len = J1939_TP_CM_LEN,
+        .src = src,
+        .dst = dst,
+        .pri = J1939_TP_CM_PRI
+    };
+}
+
+TEST_CASE("Concurrent transport protocol sessions", "[j1939_tp_dispatch][j1939_tp_find_rx_session]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    const uint8_t our_address = TestJ1939::node.source_address;
+
+    j1939_tp_close_all(tp);
+
+    SECTION("Broadcasts from different sources are reassembled side by side")
+    {
+        J1939_TP_CM_BAM bam1, bam2;
+        J1939Msg bam_msg1 = make_bam_msg(&bam1, 0x10, 0xFECA, 9);
+        J1939Msg bam_msg2 = make_bam_msg(&bam2, 0x20, 0xFECA, 9);
+
+        j1939_tp_dispatch(tp, &bam_msg1);
+        j1939_tp_dispatch(tp, &bam_msg2);
+
+        J1939TPSession* session1 = j1939_tp_find_rx_session(tp, 0x10, J1939_ADDR_GLOBAL);
+        J1939TPSession* session2 = j1939_tp_find_rx_session(tp, 0x20, J1939_ADDR_GLOBAL);
+        REQUIRE(session1 != nullptr);
+        REQUIRE(session2 != nullptr);
+        REQUIRE(session1 != session2);
+
+        // Interleave the TP.DT packets of both senders
+        J1939_TP_DT dt {};
+        J1939Msg dt_msg {
+            .pgn = J1939_TP_DT_PGN,
+            .data = (uint8_t*)&dt,
+            .len = J1939_TP_DT_LEN,
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_TP_DT_PRI
+        };
+        for (uint8_t seq = 1; seq <= 2; ++seq)
+        {
+            dt.seq = seq;
+
+            dt.data0 = 0xA0 + seq;
+            dt_msg.src = 0x10;
+            j1939_tp_dispatch(tp, &dt_msg);
+
+            dt.data0 = 0xB0 + seq;
+            dt_msg.src = 0x20;
+            j1939_tp_dispatch(tp, &dt_msg);
+        }
+
+        REQUIRE(session1->bytes_rem == 0);
+        REQUIRE(session2->bytes_rem == 0);
+        REQUIRE(session1->buf[0] == 0xA1);
+        REQUIRE(session1->buf[7] == 0xA2);
+        REQUIRE(session2->buf[0] == 0xB1);
+        REQUIRE(session2->buf[7] == 0xB2);
+
+        j1939_tp_update(tp);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x10, J1939_ADDR_GLOBAL) == nullptr);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x20, J1939_ADDR_GLOBAL) == nullptr);
+    }
+    SECTION("A new BAM from the same source replaces the old one")
+    {
+        J1939_TP_CM_BAM bam;
+        J1939Msg bam_msg = make_bam_msg(&bam, 0x10, 0xFECA, 9);
+        j1939_tp_dispatch(tp, &bam_msg);
+
+        bam_msg = make_bam_msg(&bam, 0x10, 0xFECB, 20);
+        j1939_tp_dispatch(tp, &bam_msg);
+
+        J1939TPSession* session = j1939_tp_find_rx_session(tp, 0x10, J1939_ADDR_GLOBAL);
+        REQUIRE(session != nullptr);
+        REQUIRE(session->msg_info.pgn == 0xFECB);
+        REQUIRE(session->bytes_rem == 20);
+    }
+    SECTION("When every RX session is busy, RTS is refused and BAM ignored")
+    {
+        J1939_TP_CM_BAM bam;
+        for (int i = 0; i < J1939_TP_RX_SESSIONS; ++i)
+        {
+            J1939Msg bam_msg = make_bam_msg(&bam, 0x10 + i, 0xFECA, 9);
+            j1939_tp_dispatch(tp, &bam_msg);
+            REQUIRE(j1939_tp_find_rx_session(tp, 0x10 + i, J1939_ADDR_GLOBAL) != nullptr);
+        }
+
+        J1939Msg bam_msg = make_bam_msg(&bam, 0x40, 0xFECA, 9);
+        j1939_tp_dispatch(tp, &bam_msg);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x40, J1939_ADDR_GLOBAL) == nullptr);
+
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, 0x41, our_address, 0xABCD, 20);
+        j1939_tp_dispatch(tp, &rts_msg);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x41, our_address) == nullptr);
+
+        J1939_TP_CM_ABORT* abort = (J1939_TP_CM_ABORT*)TestJ1939::msg.data;
+        REQUIRE(TestJ1939::msg.pgn == J1939_TP_CM_PGN);
+        REQUIRE(TestJ1939::msg.dst == 0x41);
+        REQUIRE(abort->control_byte == J1939_TP_CM_CONTROL_BYTE_ABORT);
+        REQUIRE(abort->abort_reason == J1939_TP_ABORT_REASON_BUSY);
+        REQUIRE(abort->pgn == 0xABCD);
+    }
+    SECTION("A second RTS from a sender with an open connection is refused")
+    {
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, 0x41, our_address, 0xABCD, 20);
+        j1939_tp_dispatch(tp, &rts_msg);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x41, our_address) != nullptr);
+
+        rts_msg = make_rts_msg(&rts, 0x41, our_address, 0xABCE, 20);
+        j1939_tp_dispatch(tp, &rts_msg);
+
+        J1939_TP_CM_ABORT* abort = (J1939_TP_CM_ABORT*)TestJ1939::msg.data;
+        REQUIRE(abort->control_byte == J1939_TP_CM_CONTROL_BYTE_ABORT);
+        REQUIRE(abort->abort_reason == J1939_TP_ABORT_REASON_BUSY);
+        REQUIRE(abort->pgn == 0xABCE);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x41, our_address)->msg_info.pgn == 0xABCD);
+    }
+    SECTION("A broadcast and peer-to-peer messages can be sent at the same time")
+    {
+        uint8_t data[20] = { 0 };
+        J1939Msg msg {
+            .pgn = 0xABCD,
+            .data = data,
+            .len = sizeof(data),
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_DEFAULT_PRIORITY
+        };
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        // Only one broadcast at a time, the second one waits
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        REQUIRE(tp->tx_queue_len == 1);
+
+        msg.dst = 0x50;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+
+        REQUIRE(j1939_tp_find_tx_session(tp, J1939_ADDR_GLOBAL) != nullptr);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x50) != nullptr);
+
+        // Both TX sessions are in use
+        msg.dst = 0x51;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        REQUIRE((j1939_tp_find_tx_session(tp, 0x51) != nullptr) == (J1939_TP_TX_SESSIONS > 2));
+    }
+    SECTION("Connections are received while a long message is being sent")
+    {
+        static uint8_t data[J1939_TP_MAX_PAYLOAD] = { 0 };
+        J1939Msg msg {
+            .pgn = 0xFECA,
+            .data = data,
+            .len = sizeof(data),
+            .dst = J1939_ADDR_GLOBAL,
+            .pri = J1939_DEFAULT_PRIORITY
+        };
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        msg.dst = 0x41;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+
+        // Both peers of our transfers send us something of their own
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, 0x41, our_address, 0xABCD, 20);
+        j1939_tp_dispatch(tp, &rts_msg);
+
+        J1939_TP_CM_BAM bam;
+        J1939Msg bam_msg = make_bam_msg(&bam, 0x42, 0xFECB, 9);
+        j1939_tp_dispatch(tp, &bam_msg);
+
+        J1939TPSession* rx_p2p = j1939_tp_find_rx_session(tp, 0x41, our_address);
+        REQUIRE(rx_p2p != nullptr);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x42, J1939_ADDR_GLOBAL) != nullptr);
+
+        rx_p2p->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_p2p_update_receiver(rx_p2p);
+        J1939_TP_CM_CTS* cts = (J1939_TP_CM_CTS*)TestJ1939::msg.data;
+        REQUIRE(TestJ1939::msg.dst == 0x41);
+        REQUIRE(cts->control_byte == J1939_TP_CM_CONTROL_BYTE_CTS);
+        REQUIRE(cts->pgn == 0xABCD);
+
+        REQUIRE(j1939_tp_find_tx_session(tp, J1939_ADDR_GLOBAL) != nullptr);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x41) != nullptr);
+    }
+    SECTION("An abort only ends the connection in the direction it was sent for")
+    {
+        uint8_t data[20] = { 0 };
+        J1939Msg msg {
+            .pgn = 0xABCD,
+            .data = data,
+            .len = sizeof(data),
+            .dst = 0x41,
+            .pri = J1939_DEFAULT_PRIORITY
+        };
+
+        J1939_TP_CM_ABORT abort;
+        J1939Msg abort_msg {
+            .pgn = J1939_TP_CM_PGN,
+            .data = (uint8_t*)&abort,
+            .len = J1939_TP_CM_LEN,
+            .src = 0x41,
+            .dst = our_address,
+            .pri = J1939_TP_CM_PRI
+        };
+
+        // The same PGN, in both directions
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, 0x41, our_address, 0xABCD, 20);
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        j1939_tp_dispatch(tp, &rts_msg);
+
+        j1939_tp_abort_pack(&abort, J1939_TP_ABORT_REASON_OTHER, J1939_TP_ABORT_ROLE_RECEIVER, 0xABCD);
+        j1939_tp_dispatch(tp, &abort_msg);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x41) == nullptr);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x41, our_address) != nullptr);
+
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        j1939_tp_abort_pack(&abort, J1939_TP_ABORT_REASON_OTHER, J1939_TP_ABORT_ROLE_SENDER, 0xABCD);
+        j1939_tp_dispatch(tp, &abort_msg);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x41) != nullptr);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x41, our_address) == nullptr);
+
+        // Without a role, both are aborted
+        j1939_tp_dispatch(tp, &rts_msg);
+        j1939_tp_abort_pack(&abort, J1939_TP_ABORT_REASON_OTHER, J1939_TP_ABORT_ROLE_UNSPECIFIED, 0xABCD);
+        j1939_tp_dispatch(tp, &abort_msg);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x41) == nullptr);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x41, our_address) == nullptr);
+    }
+    SECTION("Aborts say which side sent them")
+    {
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, 0x41, our_address, 0xABCD, 20);
+        j1939_tp_dispatch(tp, &rts_msg);
+        j1939_tp_dispatch(tp, &rts_msg);
+
+        // Reserved bits are set
+        uint8_t expected[8] = { 255, J1939_TP_ABORT_REASON_BUSY, 0xFD, 0xFF, 0xFF, 0xCD, 0xAB, 0x00 };
+        REQUIRE(TestJ1939::msg.len == J1939_TP_CM_LEN);
+        REQUIRE(std::memcmp(TestJ1939::msg.data, expected, sizeof(expected)) == 0);
+    }
+    SECTION("Sessions time out independently")
+    {
+        J1939_TP_CM_BAM bam;
+        J1939Msg bam_msg = make_bam_msg(&bam, 0x10, 0xFECA, 9);
+        j1939_tp_dispatch(tp, &bam_msg);
+        J1939TPSession* stale = j1939_tp_find_rx_session(tp, 0x10, J1939_ADDR_GLOBAL);
+
+        bam_msg = make_bam_msg(&bam, 0x20, 0xFECA, 9);
+        j1939_tp_dispatch(tp, &bam_msg);
+
+        stale->timer_ms = J1939_TP_TIMEOUT_T1;
+        j1939_tp_update(tp);
+
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x10, J1939_ADDR_GLOBAL) == nullptr);
+        REQUIRE(j1939_tp_find_rx_session(tp, 0x20, J1939_ADDR_GLOBAL) != nullptr);
+    }
+
+    j1939_tp_close_all(tp);
+}
+
+TEST_CASE("Transmit queue", "[j1939_tp_queue][j1939_tx_queue_stats]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+
+    j1939_tp_close_all(tp);
+    memset(&tp->tx_queue_stats, 0, sizeof(tp->tx_queue_stats));
+
+    uint8_t data[20] = { 0 };
+    J1939Msg msg {
+        .pgn = 0xABCD,
+        .data = data,
+        .len = sizeof(data),
+        .pri = J1939_DEFAULT_PRIORITY
+    };
+
+    // Occupy every TX session
+    for (int i = 0; i < J1939_TP_TX_SESSIONS; ++i)
+    {
+        msg.dst = 0x50 + i;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+    }
+    REQUIRE(tp->tx_queue_len == 0);
+
+    J1939_TP_CM_ABORT abort;
+    j1939_tp_abort_pack(&abort, J1939_TP_ABORT_REASON_TIMEOUT, J1939_TP_ABORT_ROLE_RECEIVER, 0xABCD);
+    J1939Msg abort_msg {
+        .pgn = J1939_TP_CM_PGN,
+        .data = (uint8_t*)&abort,
+        .len = J1939_TP_CM_LEN,
+        .src = 0x50,
+        .dst = TestJ1939::node.source_address,
+        .pri = J1939_TP_CM_PRI
+    };
+
+    SECTION("A higher priority message overtakes queued ones")
+    {
+        msg.dst = 0x60;
+        msg.pri = 7;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        msg.dst = 0x61;
+        msg.pri = 3;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        msg.dst = 0x62;
+        msg.pri = 3;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+
+        REQUIRE(tp->tx_queue_len == 3);
+        REQUIRE(tp->tx_queue[0].msg.dst == 0x61);
+        REQUIRE(tp->tx_queue[1].msg.dst == 0x62);
+        REQUIRE(tp->tx_queue[2].msg.dst == 0x60);
+
+        // The message is copied, the caller's buffer may be reused
+        REQUIRE(tp->tx_queue[0].msg.data != data);
+
+        // The abort frees a session that is taken over immediately
+        j1939_tp_dispatch(tp, &abort_msg);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x50) == nullptr);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x61) != nullptr);
+        REQUIRE(TestJ1939::msg.pgn == J1939_TP_CM_PGN);
+        REQUIRE(TestJ1939::msg.dst == 0x61);
+        REQUIRE(tp->tx_queue_len == 2);
+    }
+    SECTION("Messages to a busy destination keep their order")
+    {
+        msg.dst = 0x50;
+        msg.pgn = 0x1111;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        msg.dst = 0x60;
+        msg.pri = 7;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+
+        // Session freed by closing, started by the next update
+        j1939_tp_close_session(j1939_tp_find_tx_session(tp, 0x51));
+        j1939_tp_update(tp);
+
+        // The message to 0x50 cannot start before the first one is done
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x60) != nullptr);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x50)->msg_info.pgn == 0xABCD);
+
+        j1939_tp_dispatch(tp, &abort_msg);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x50)->msg_info.pgn == 0x1111);
+        REQUIRE(tp->tx_queue_len == 0);
+    }
+    SECTION("A full queue rejects messages")
+    {
+        for (int i = 0; i < J1939_TP_TX_QUEUE_SIZE; ++i)
+        {
+            msg.dst = 0x60 + i;
+            REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        }
+        msg.dst = 0x70;
+        REQUIRE(j1939_tp_queue(tp, &msg) == false);
+
+        J1939TxQueueStats stats;
+        j1939_tx_queue_stats(&TestJ1939::node, &stats);
+        REQUIRE(stats.depth == J1939_TP_TX_QUEUE_SIZE);
+        REQUIRE(stats.max_depth == J1939_TP_TX_QUEUE_SIZE);
+        REQUIRE(stats.rejected == 1);
+
+        // Dropped on address change
+        j1939_tp_close_all(tp);
+        j1939_tx_queue_stats(&TestJ1939::node, &stats);
+        REQUIRE(stats.depth == 0);
+        REQUIRE(stats.max_depth == J1939_TP_TX_QUEUE_SIZE);
+    }
+    SECTION("The time spent waiting is measured")
+    {
+        j1939_tp_update_at(tp, 1000000);
+
+        msg.dst = 0x60;
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+
+        j1939_tp_close_session(j1939_tp_find_tx_session(tp, 0x50));
+        j1939_tp_update_at(tp, 1250000);
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x60) != nullptr);
+
+        // Started by the update, so its timer runs from that update
+        REQUIRE(j1939_tp_find_tx_session(tp, 0x60)->timer_stamp_us == 1250000);
+
+        J1939TxQueueStats stats;
+        j1939_tx_queue_stats(&TestJ1939::node, &stats);
+        REQUIRE(stats.queued == J1939_TP_TX_SESSIONS + 1);
+        REQUIRE(stats.started == J1939_TP_TX_SESSIONS + 1);
+        REQUIRE(stats.depth == 0);
+        REQUIRE(stats.max_depth == 1);
+        REQUIRE(stats.total_wait_us == 250000);
+        REQUIRE(stats.max_wait_us == 250000);
+    }
+
+    j1939_tp_close_all(tp);
+}
+
+TEST_CASE("Peer-to-peer windows and retransmission", "[j1939_tp_rx_cts][j1939_tp_cts_pack][j1939_set_tp_window]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    const uint8_t our_address = TestJ1939::node.source_address;
+    constexpr uint8_t peer_address = 0x99;
+    constexpr uint32_t msg_pgn = 0xABCD;
+
+    j1939_tp_close_all(tp);
+
+    uint8_t msg_data[33];
+    for (int i = 0; i < (int)sizeof(msg_data); ++i)
+        msg_data[i] = i;
+    const uint16_t msg_len = sizeof(msg_data);
+
+    J1939_TP_CM_CTS cts {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_CTS,
+        .res = 0xFFFF,
+        .pgn = msg_pgn
+    };
+
+    SECTION("The receiver asks for a window at a time and only for missing packets")
+    {
+        j1939_set_tp_window(&TestJ1939::node, 2);
+
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, peer_address, our_address, msg_pgn, msg_len);
+        j1939_tp_dispatch(tp, &rts_msg);
+        J1939TPSession* session = j1939_tp_find_rx_session(tp, peer_address, our_address);
+        REQUIRE(session != nullptr);
+
+        J1939_TP_DT dt;
+        J1939Msg dt_msg {
+            .pgn = J1939_TP_DT_PGN,
+            .data = (uint8_t*)&dt,
+            .len = J1939_TP_DT_LEN,
+            .src = peer_address,
+            .dst = our_address,
+            .pri = J1939_TP_DT_PRI
+        };
+        auto receive = [&](uint8_t seq) {
+            int offset = (seq - 1) * 7;
+            dt.seq = seq;
+            std::memset(&dt.data0, 0xFF, 7);
+            std::memcpy(&dt.data0, &msg_data[offset], (msg_len - offset < 7) ? msg_len - offset : 7);
+            j1939_tp_dispatch(tp, &dt_msg);
+        };
+        auto expect_cts = [&](uint8_t next_seq, uint8_t num_packages) {
+            session->timer_ms = J1939_TP_TX_PERIOD;
+            j1939_tp_p2p_update_receiver(session);
+
+            J1939_TP_CM_CTS* sent = (J1939_TP_CM_CTS*)TestJ1939::msg.data;
+            REQUIRE(sent->control_byte == J1939_TP_CM_CONTROL_BYTE_CTS);
+            REQUIRE(sent->next_seq == next_seq);
+            REQUIRE(sent->num_packages == num_packages);
+            REQUIRE(session->clear_to_send == true);
+        };
+
+        expect_cts(1, 2);
+
+        // Packet 1 is lost, so only it is asked for again
+        receive(2);
+        REQUIRE(session->clear_to_send == false);
+        expect_cts(1, 1);
+
+        // Packets from outside the window are dropped
+        receive(3);
+        REQUIRE(session->bytes_rem == msg_len - 7);
+
+        receive(1);
+        expect_cts(3, 2);
+
+        // Packet 4, the last of the window, is lost; the receiver asks for
+        //  it again once the sender has gone quiet for long enough
+        receive(3);
+        session->timer_ms = J1939_TP_TIMEOUT_TR;
+        j1939_tp_p2p_update_receiver(session);
+        REQUIRE(session->retries == 1);
+        expect_cts(4, 2);
+
+        receive(4);
+        REQUIRE(session->retries == 0);
+        receive(5);
+        REQUIRE(session->bytes_rem == 0);
+
+        // ACKed and delivered
+        j1939_tp_p2p_update_receiver(session);
+        REQUIRE(TestJ1939::msg.pgn == msg_pgn);
+        REQUIRE(TestJ1939::msg.len == msg_len);
+        REQUIRE(std::memcmp(TestJ1939::msg.data, msg_data, msg_len) == 0);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
+    }
+    SECTION("The receiver gives up after too many retries")
+    {
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, peer_address, our_address, msg_pgn, msg_len);
+        j1939_tp_dispatch(tp, &rts_msg);
+        J1939TPSession* session = j1939_tp_find_rx_session(tp, peer_address, our_address);
+
+        session->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_p2p_update_receiver(session);
+
+        for (int i = 0; i < J1939_TP_MAX_RETRIES; ++i)
+        {
+            session->timer_ms = J1939_TP_TIMEOUT_TR;
+            j1939_tp_p2p_update_receiver(session);
+            j1939_tp_p2p_update_receiver(session);
+            REQUIRE(session->clear_to_send == true);
+        }
+
+        session->timer_ms = J1939_TP_TIMEOUT_TR;
+        j1939_tp_p2p_update_receiver(session);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_P2P);
+
+        session->timer_ms = J1939_TP_TIMEOUT_T1;
+        j1939_tp_p2p_update_receiver(session);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
+    }
+    SECTION("The sender's RTS limits the window")
+    {
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, peer_address, our_address, msg_pgn, msg_len);
+        rts.max_packages = 3;
+        j1939_tp_dispatch(tp, &rts_msg);
+        J1939TPSession* session = j1939_tp_find_rx_session(tp, peer_address, our_address);
+
+        session->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_p2p_update_receiver(session);
+
+        J1939_TP_CM_CTS* sent = (J1939_TP_CM_CTS*)TestJ1939::msg.data;
+        REQUIRE(sent->next_seq == 1);
+        REQUIRE(sent->num_packages == 3);
     }
+    SECTION("The sender sends what the CTS asks for")
+    {
+        J1939Msg msg {
+            .pgn = msg_pgn,
+            .data = msg_data,
+            .len = msg_len,
+            .src = our_address,
+            .dst = peer_address,
+            .pri = J1939_DEFAULT_PRIORITY
+        };
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        J1939TPSession* session = j1939_tp_find_tx_session(tp, peer_address);
+
+        J1939Msg cts_msg {
+            .pgn = J1939_TP_CM_PGN,
+            .data = (uint8_t*)&cts,
+            .len = J1939_TP_CM_LEN,
+            .src = peer_address,
+            .dst = our_address,
+            .pri = J1939_TP_CM_PRI
+        };
+        auto send = [&]() {
+            session->timer_ms = J1939_TP_TX_PERIOD;
+            j1939_tp_p2p_update_sender(session);
+            return ((J1939_TP_DT*)TestJ1939::msg.data)->seq;
+        };
+
+        // Packets the sender doesn't have are never asked for
+        cts.next_seq = 6;
+        cts.num_packages = 1;
+        j1939_tp_dispatch(tp, &cts_msg);
+        REQUIRE(session->clear_to_send == false);
+
+        cts.next_seq = 1;
+        cts.num_packages = 2;
+        j1939_tp_dispatch(tp, &cts_msg);
+        REQUIRE(send() == 1);
+        REQUIRE(send() == 2);
+        REQUIRE(session->clear_to_send == false);
+        REQUIRE(session->bytes_rem == msg_len - 14);
+
+        // Resending packet 2 doesn't change the bytes remaining
+        cts.next_seq = 2;
+        cts.num_packages = 1;
+        j1939_tp_dispatch(tp, &cts_msg);
+        REQUIRE(send() == 2);
+        REQUIRE(session->bytes_rem == msg_len - 14);
+
+        // The window is clipped to the end of the message
+        cts.next_seq = 3;
+        cts.num_packages = 10;
+        j1939_tp_dispatch(tp, &cts_msg);
+        REQUIRE(send() == 3);
+        REQUIRE(send() == 4);
+        REQUIRE(send() == 5);
+        REQUIRE(session->clear_to_send == false);
+        REQUIRE(session->bytes_rem == 0);
+
+        // Waiting for the ACK, or another CTS
+        session->timer_ms = J1939_TP_TIMEOUT_T3;
+        j1939_tp_p2p_update_sender(session);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
+    }
+
+    j1939_set_tp_window(&TestJ1939::node, J1939_TP_CTS_WINDOW);
+    j1939_tp_close_all(tp);
+}
+
+TEST_CASE("Transport protocol timing", "[j1939_set_tp_timing][j1939_tx_timed]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    const uint8_t our_address = TestJ1939::node.source_address;
+    constexpr uint8_t peer_address = 0x99;
+    constexpr uint32_t msg_pgn = 0xABCD;
+
+    j1939_tp_close_all(tp);
+
+    const J1939TPTiming default_timing = tp->timing;
+    REQUIRE(default_timing.bam_gap_ms == J1939_TP_TX_PERIOD);
+    REQUIRE(default_timing.p2p_gap_ms == J1939_TP_TX_PERIOD);
+    REQUIRE(default_timing.cts_delay_ms == J1939_TP_TX_PERIOD);
+
+    uint8_t msg_data[33] = { 0 };
+    J1939Msg msg {
+        .pgn = msg_pgn,
+        .data = msg_data,
+        .len = sizeof(msg_data),
+        .dst = peer_address,
+        .pri = J1939_DEFAULT_PRIORITY
+    };
+
+    SECTION("Broadcast gaps are kept within the standard")
+    {
+        J1939TPTiming timing = default_timing;
+
+        timing.bam_gap_ms = 10;
+        j1939_set_tp_timing(&TestJ1939::node, &timing);
+        REQUIRE(tp->timing.bam_gap_ms == J1939_TP_BAM_GAP_MIN);
+
+        timing.bam_gap_ms = 500;
+        j1939_set_tp_timing(&TestJ1939::node, &timing);
+        REQUIRE(tp->timing.bam_gap_ms == J1939_TP_BAM_GAP_MAX);
+    }
+    SECTION("P2P gaps and CTS delays are kept within the peer's timeouts")
+    {
+        J1939TPTiming timing = default_timing;
+        timing.p2p_gap_ms = J1939_TP_TIMEOUT_T1;
+        timing.cts_delay_ms = J1939_TP_TIMEOUT_TR;
+
+        j1939_set_tp_timing(&TestJ1939::node, &timing);
+        REQUIRE(tp->timing.p2p_gap_ms == J1939_TP_P2P_GAP_MAX);
+        REQUIRE(tp->timing.cts_delay_ms == J1939_TP_CTS_DELAY_MAX);
+
+        // Also for a single message
+        timing.bam_gap_ms = 10;
+        REQUIRE(j1939_tx_timed(&TestJ1939::node, &msg, &timing) == true);
+        J1939TPSession* session = j1939_tp_find_tx_session(tp, peer_address);
+        REQUIRE(session->timing.bam_gap_ms == J1939_TP_BAM_GAP_MIN);
+        REQUIRE(session->timing.p2p_gap_ms == J1939_TP_P2P_GAP_MAX);
+        REQUIRE(session->timing.cts_delay_ms == J1939_TP_CTS_DELAY_MAX);
+
+        // Values in range are kept as they are
+        timing = default_timing;
+        timing.p2p_gap_ms = J1939_TP_P2P_GAP_MAX;
+        timing.cts_delay_ms = 0;
+        j1939_set_tp_timing(&TestJ1939::node, &timing);
+        REQUIRE(tp->timing.p2p_gap_ms == J1939_TP_P2P_GAP_MAX);
+        REQUIRE(tp->timing.cts_delay_ms == 0);
+    }
+    SECTION("A message can be sent with its own timing")
+    {
+        J1939TPTiming timing = default_timing;
+        timing.bam_gap_ms = 120;
+
+        msg.dst = J1939_ADDR_GLOBAL;
+        REQUIRE(j1939_tx_timed(&TestJ1939::node, &msg, &timing) == true);
+        J1939TPSession* session = j1939_tp_find_tx_session(tp, J1939_ADDR_GLOBAL);
+        REQUIRE(session->timing.bam_gap_ms == 120);
+
+        session->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_broadcast_update_sender(session);
+        REQUIRE(session->next_seq == 1);
+
+        session->timer_ms = 120;
+        j1939_tp_broadcast_update_sender(session);
+        REQUIRE(session->next_seq == 2);
+
+        // The node's timing is unchanged
+        REQUIRE(tp->timing.bam_gap_ms == J1939_TP_TX_PERIOD);
+    }
+    SECTION("A P2P sender without a gap sends the whole window in one update")
+    {
+        J1939TPTiming timing = default_timing;
+        timing.p2p_gap_ms = 0;
+        j1939_set_tp_timing(&TestJ1939::node, &timing);
+
+        REQUIRE(j1939_tp_queue(tp, &msg) == true);
+        J1939TPSession* session = j1939_tp_find_tx_session(tp, peer_address);
+
+        J1939_TP_CM_CTS cts {
+            .control_byte = J1939_TP_CM_CONTROL_BYTE_CTS,
+            .num_packages = 4,
+            .next_seq = 1,
+            .res = 0xFFFF,
+            .pgn = msg_pgn
+        };
+        J1939Msg cts_msg {
+            .pgn = J1939_TP_CM_PGN,
+            .data = (uint8_t*)&cts,
+            .len = J1939_TP_CM_LEN,
+            .src = peer_address,
+            .dst = our_address,
+            .pri = J1939_TP_CM_PRI
+        };
+        j1939_tp_dispatch(tp, &cts_msg);
+
+        // Due right away
+        REQUIRE(j1939_tp_next_event_ms(session) == 0);
+
+        session->timer_ms = 0;
+        j1939_tp_p2p_update_sender(session);
+
+        REQUIRE(TestJ1939::msg.pgn == J1939_TP_DT_PGN);
+        REQUIRE(((J1939_TP_DT*)TestJ1939::msg.data)->seq == 4);
+        REQUIRE(session->clear_to_send == false);
+        REQUIRE(session->bytes_rem == sizeof(msg_data) - 28);
+    }
+    SECTION("The receiver's CTS delay is configurable")
+    {
+        J1939TPTiming timing = default_timing;
+        timing.cts_delay_ms = 0;
+        j1939_set_tp_timing(&TestJ1939::node, &timing);
+
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, peer_address, our_address, msg_pgn, sizeof(msg_data));
+        j1939_tp_dispatch(tp, &rts_msg);
+        J1939TPSession* session = j1939_tp_find_rx_session(tp, peer_address, our_address);
+
+        j1939_tp_p2p_update_receiver(session);
+        REQUIRE(session->clear_to_send == true);
+        REQUIRE(((J1939_TP_CM_CTS*)TestJ1939::msg.data)->control_byte == J1939_TP_CM_CONTROL_BYTE_CTS);
+    }
+
+    j1939_set_tp_timing(&TestJ1939::node, &default_timing);
+    j1939_tp_close_all(tp);
+}
+
+namespace {
+
+std::vector<J1939CanFrame> batch_frames;
+int batch_calls;
+// Number of frames accepted before the bus is full, -1 for no limit
+int batch_room = -1;
+
+int
+record_tx_batch(void*, const J1939CanFrame* frames, int num_frames)
+{
+    batch_calls++;
+
+    if ((batch_room >= 0) && (num_frames > batch_room))
+        num_frames = batch_room;
+    if (batch_room >= 0)
+        batch_room -= num_frames;
+
+    batch_frames.insert(batch_frames.end(), frames, frames + num_frames);
+    return num_frames;
+}
+
+}
+
+TEST_CASE("Batched TP.DT transmit", "[j1939_set_can_tx_batch][j1939_tp_dt_pack_frames]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    const uint8_t our_address = TestJ1939::node.source_address;
+    constexpr uint8_t peer_address = 0x99;
+    constexpr uint32_t msg_pgn = 0xABCD;
+
+    j1939_tp_close_all(tp);
+    batch_frames.clear();
+    batch_calls = 0;
+    batch_room = -1;
+
+    const J1939TPTiming default_timing = tp->timing;
+    J1939TPTiming timing = default_timing;
+    timing.p2p_gap_ms = 0;
+    j1939_set_tp_timing(&TestJ1939::node, &timing);
+    j1939_set_can_tx_batch(&TestJ1939::node, record_tx_batch);
+
+    static uint8_t msg_data[J1939_TP_MAX_PAYLOAD - 3];
+    for (int i = 0; i < (int)sizeof(msg_data); ++i)
+        msg_data[i] = static_cast<uint8_t>(i * 3);
+    J1939Msg msg {
+        .pgn = msg_pgn,
+        .data = msg_data,
+        .len = sizeof(msg_data),
+        .dst = peer_address,
+        .pri = J1939_DEFAULT_PRIORITY
+    };
+
+    J1939_TP_CM_CTS cts {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_CTS,
+        .num_packages = 255,
+        .next_seq = 1,
+        .res = 0xFFFF,
+        .pgn = msg_pgn
+    };
+    J1939Msg cts_msg {
+        .pgn = J1939_TP_CM_PGN,
+        .data = (uint8_t*)&cts,
+        .len = J1939_TP_CM_LEN,
+        .src = peer_address,
+        .dst = our_address,
+        .pri = J1939_TP_CM_PRI
+    };
+
+    REQUIRE(j1939_tx(&TestJ1939::node, &msg) == true);
+    J1939TPSession* session = j1939_tp_find_tx_session(tp, peer_address);
+
+    SECTION("A whole window is sent through the batch callback")
+    {
+        j1939_tp_dispatch(tp, &cts_msg);
+        TestJ1939::msg.pgn = 0;
+        j1939_tp_p2p_update_sender(session);
+
+        REQUIRE(batch_calls == (255 + J1939_TX_BATCH_SIZE - 1) / J1939_TX_BATCH_SIZE);
+        REQUIRE(batch_frames.size() == 255);
+        // Nothing went through can_tx
+        REQUIRE(TestJ1939::msg.pgn == 0);
+
+        J1939Msg dt_msg {
+            .pgn = J1939_TP_DT_PGN,
+            .src = our_address,
+            .dst = peer_address,
+            .pri = J1939_TP_DT_PRI
+        };
+        const uint32_t dt_id = j1939_msg_to_can_id(&dt_msg);
+
+        for (int i = 0; i < 255; ++i)
+        {
+            REQUIRE(batch_frames[i].id == dt_id);
+            REQUIRE(batch_frames[i].len == J1939_TP_DT_LEN);
+            REQUIRE(batch_frames[i].data[0] == i + 1);
+        }
+        REQUIRE(std::memcmp(&batch_frames[10].data[1], &msg_data[70], 7) == 0);
+
+        // The last packet holds 4 bytes and padding
+        const uint8_t last[8] = { 255, msg_data[1778], msg_data[1779], msg_data[1780], msg_data[1781], 0xFF, 0xFF, 0xFF };
+        REQUIRE(std::memcmp(batch_frames[254].data, last, sizeof(last)) == 0);
+
+        REQUIRE(session->clear_to_send == false);
+        REQUIRE(session->bytes_rem == 0);
+    }
+    SECTION("Packets asked for again are sent again")
+    {
+        cts.num_packages = 3;
+        j1939_tp_dispatch(tp, &cts_msg);
+        j1939_tp_p2p_update_sender(session);
+        REQUIRE(batch_frames.size() == 3);
+
+        cts.next_seq = 2;
+        j1939_tp_dispatch(tp, &cts_msg);
+        j1939_tp_p2p_update_sender(session);
+
+        REQUIRE(batch_frames.size() == 6);
+        REQUIRE(batch_frames[3].data[0] == 2);
+        REQUIRE(batch_frames[5].data[0] == 4);
+        REQUIRE(session->bytes_rem == sizeof(msg_data) - 28);
+    }
+    SECTION("Only the frames accepted by the batch callback are counted as sent")
+    {
+        J1939TxResult result {};
+        j1939_set_tx_done(&TestJ1939::node, [](void* user_data, J1939Msg*, const J1939TxResult* r) {
+            *static_cast<J1939TxResult*>(user_data) = *r;
+        }, &result);
+
+        batch_room = 40;
+        j1939_tp_dispatch(tp, &cts_msg);
+        j1939_tp_p2p_update_sender(session);
+
+        REQUIRE(j1939_tp_find_tx_session(tp, peer_address) == nullptr);
+        REQUIRE(result.status == J1939_TX_FAILED);
+        REQUIRE(result.bytes_sent == 40 * 7);
+
+        j1939_set_tx_done(&TestJ1939::node, nullptr, nullptr);
+    }
+    SECTION("With a gap between packets, can_tx is used")
+    {
+        session->timing.p2p_gap_ms = J1939_TP_TX_PERIOD;
+
+        j1939_tp_dispatch(tp, &cts_msg);
+        session->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_p2p_update_sender(session);
+
+        REQUIRE(batch_calls == 0);
+        REQUIRE(TestJ1939::msg.pgn == J1939_TP_DT_PGN);
+    }
+
+    j1939_set_can_tx_batch(&TestJ1939::node, nullptr);
+    j1939_set_tp_timing(&TestJ1939::node, &default_timing);
+    j1939_tp_close_all(tp);
+}
+
+namespace {
+
+std::vector<J1939StreamEvent> stream_events;
+uint8_t streamed_data[J1939_TP_MAX_PAYLOAD];
+bool stream_accept = true;
+
+bool
+record_stream_event(void*, const J1939StreamEvent* event)
+{
+    stream_events.push_back(*event);
+
+    if (event->type == J1939_STREAM_DATA)
+        std::memcpy(&streamed_data[event->offset], event->data, event->len);
+
+    return stream_accept;
+}
+
+}
+
+TEST_CASE("Streamed reception", "[j1939_set_pgn_stream_sink][j1939_tp_rx_dt]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    const uint8_t our_address = TestJ1939::node.source_address;
+    constexpr uint8_t peer_address = 0x99;
+    constexpr uint32_t msg_pgn = 0xFECA;
+
+    j1939_tp_close_all(tp);
+    stream_events.clear();
+    stream_accept = true;
+    std::memset(streamed_data, 0, sizeof(streamed_data));
+
+    uint8_t msg_data[20];
+    for (int i = 0; i < (int)sizeof(msg_data); ++i)
+        msg_data[i] = 0x80 + i;
+    const uint16_t msg_len = sizeof(msg_data);
+
+    REQUIRE(j1939_set_pgn_stream_sink(&TestJ1939::node, msg_pgn, record_stream_event, nullptr) == true);
+
+    J1939_TP_DT dt;
+    auto receive = [&](uint8_t src, uint8_t dst, uint8_t seq) {
+        J1939Msg dt_msg {
+            .pgn = J1939_TP_DT_PGN,
+            .data = (uint8_t*)&dt,
+            .len = J1939_TP_DT_LEN,
+            .src = src,
+            .dst = dst,
+            .pri = J1939_TP_DT_PRI
+        };
+        int offset = (seq - 1) * 7;
+        dt.seq = seq;
+        std::memset(&dt.data0, 0xFF, 7);
+        std::memcpy(&dt.data0, &msg_data[offset], (msg_len - offset < 7) ? msg_len - offset : 7);
+        j1939_tp_dispatch(tp, &dt_msg);
+    };
+
+    SECTION("A broadcast is passed to the sink as it arrives, without a buffer")
+    {
+        J1939_TP_CM_BAM bam;
+        J1939Msg bam_msg = make_bam_msg(&bam, peer_address, msg_pgn, msg_len);
+        j1939_tp_dispatch(tp, &bam_msg);
+
+        J1939TPSession* session = j1939_tp_find_rx_session(tp, peer_address, J1939_ADDR_GLOBAL);
+        REQUIRE(session != nullptr);
+        REQUIRE(session->buf == nullptr);
+        REQUIRE(stream_events.size() == 1);
+        REQUIRE(stream_events[0].type == J1939_STREAM_BEGIN);
+        REQUIRE(stream_events[0].size == msg_len);
+        REQUIRE(stream_events[0].src == peer_address);
+
+        for (uint8_t seq = 1; seq <= 3; ++seq)
+        {
+            receive(peer_address, J1939_ADDR_GLOBAL, seq);
+            REQUIRE(stream_events.back().type == J1939_STREAM_DATA);
+            REQUIRE(stream_events.back().offset == (seq - 1) * 7u);
+        }
+        REQUIRE(stream_events.back().len == 6);
+
+        TestJ1939::msg.pgn = 0;
+        j1939_tp_broadcast_update_receiver(session);
+
+        REQUIRE(stream_events.back().type == J1939_STREAM_COMPLETE);
+        REQUIRE(stream_events.size() == 5);
+        REQUIRE(std::memcmp(streamed_data, msg_data, msg_len) == 0);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
+
+        // The message isn't delivered as a whole as well
+        REQUIRE(TestJ1939::msg.pgn == 0);
+    }
+    SECTION("Packets asked for again arrive after those that followed them")
+    {
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, peer_address, our_address, msg_pgn, msg_len);
+        j1939_tp_dispatch(tp, &rts_msg);
+
+        J1939TPSession* session = j1939_tp_find_rx_session(tp, peer_address, our_address);
+        REQUIRE(session != nullptr);
+        session->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_p2p_update_receiver(session);
+
+        // Packet 1 is lost
+        receive(peer_address, our_address, 2);
+        receive(peer_address, our_address, 3);
+        session->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_p2p_update_receiver(session);
+        receive(peer_address, our_address, 1);
+
+        REQUIRE(stream_events.size() == 4);
+        REQUIRE(stream_events[1].offset == 7);
+        REQUIRE(stream_events[2].offset == 14);
+        REQUIRE(stream_events[3].offset == 0);
+
+        j1939_tp_p2p_update_receiver(session);
+
+        REQUIRE(((J1939_TP_CM_ACK*)TestJ1939::msg.data)->control_byte == J1939_TP_CM_CONTROL_BYTE_ACK);
+        REQUIRE(stream_events.back().type == J1939_STREAM_COMPLETE);
+        REQUIRE(std::memcmp(streamed_data, msg_data, msg_len) == 0);
+    }
+    SECTION("The sink can refuse a message")
+    {
+        stream_accept = false;
+
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, peer_address, our_address, msg_pgn, msg_len);
+        j1939_tp_dispatch(tp, &rts_msg);
+
+        REQUIRE(j1939_tp_find_rx_session(tp, peer_address, our_address) == nullptr);
+        J1939_TP_CM_ABORT* abort = (J1939_TP_CM_ABORT*)TestJ1939::msg.data;
+        REQUIRE(abort->control_byte == J1939_TP_CM_CONTROL_BYTE_ABORT);
+        REQUIRE(abort->abort_reason == J1939_TP_ABORT_REASON_RESOURCES);
+        REQUIRE(stream_events.size() == 1);
+    }
+    SECTION("The sink can abort a message it has started to receive")
+    {
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, peer_address, our_address, msg_pgn, msg_len);
+        j1939_tp_dispatch(tp, &rts_msg);
+
+        J1939TPSession* session = j1939_tp_find_rx_session(tp, peer_address, our_address);
+        session->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_p2p_update_receiver(session);
+
+        stream_accept = false;
+        receive(peer_address, our_address, 1);
+
+        REQUIRE(j1939_tp_find_rx_session(tp, peer_address, our_address) == nullptr);
+        REQUIRE(((J1939_TP_CM_ABORT*)TestJ1939::msg.data)->abort_reason == J1939_TP_ABORT_REASON_RESOURCES);
+        REQUIRE(stream_events.back().type == J1939_STREAM_ABORT);
+        REQUIRE(stream_events.back().abort_reason == J1939_TP_ABORT_REASON_RESOURCES);
+    }
+    SECTION("The sink is told why a connection was aborted")
+    {
+        J1939_TP_CM_RTS rts;
+        J1939Msg rts_msg = make_rts_msg(&rts, peer_address, our_address, msg_pgn, msg_len);
+        j1939_tp_dispatch(tp, &rts_msg);
+
+        J1939_TP_CM_ABORT abort;
+        j1939_tp_abort_pack(&abort, J1939_TP_ABORT_REASON_BUSY, J1939_TP_ABORT_ROLE_SENDER, msg_pgn);
+        J1939Msg abort_msg {
+            .pgn = J1939_TP_CM_PGN,
+            .data = (uint8_t*)&abort,
+            .len = J1939_TP_CM_LEN,
+            .src = peer_address,
+            .dst = our_address,
+            .pri = J1939_TP_CM_PRI
+        };
+        j1939_tp_dispatch(tp, &abort_msg);
+
+        REQUIRE(stream_events.back().type == J1939_STREAM_ABORT);
+        REQUIRE(stream_events.back().abort_reason == J1939_TP_ABORT_REASON_BUSY);
+
+        // And when it times out
+        J1939_TP_CM_BAM bam;
+        J1939Msg bam_msg = make_bam_msg(&bam, peer_address, msg_pgn, msg_len);
+        j1939_tp_dispatch(tp, &bam_msg);
+        J1939TPSession* session = j1939_tp_find_rx_session(tp, peer_address, J1939_ADDR_GLOBAL);
+        session->timer_ms = J1939_TP_TIMEOUT_T1;
+        j1939_tp_broadcast_update_receiver(session);
+
+        REQUIRE(stream_events.back().type == J1939_STREAM_ABORT);
+        REQUIRE(stream_events.back().abort_reason == J1939_TP_ABORT_REASON_TIMEOUT);
+    }
+    SECTION("Other PGNs, and PGNs no longer streamed, are reassembled")
+    {
+        J1939_TP_CM_BAM bam;
+        J1939Msg bam_msg = make_bam_msg(&bam, peer_address, msg_pgn + 1, msg_len);
+        j1939_tp_dispatch(tp, &bam_msg);
+        REQUIRE(j1939_tp_find_rx_session(tp, peer_address, J1939_ADDR_GLOBAL)->buf != nullptr);
+        j1939_tp_close_all(tp);
+
+        REQUIRE(j1939_set_pgn_stream_sink(&TestJ1939::node, msg_pgn, nullptr, nullptr) == true);
+        bam_msg = make_bam_msg(&bam, peer_address, msg_pgn, msg_len);
+        j1939_tp_dispatch(tp, &bam_msg);
+        REQUIRE(j1939_tp_find_rx_session(tp, peer_address, J1939_ADDR_GLOBAL)->buf != nullptr);
+        REQUIRE(stream_events.empty());
+    }
+    SECTION("A limited number of PGNs can be streamed")
+    {
+        for (int i = 1; i < J1939_TP_STREAM_SINKS; ++i)
+            REQUIRE(j1939_set_pgn_stream_sink(&TestJ1939::node, msg_pgn + i, record_stream_event, nullptr) == true);
+
+        REQUIRE(j1939_set_pgn_stream_sink(&TestJ1939::node, 0xFE00, record_stream_event, nullptr) == false);
+
+        // Replacing a sink takes no more room
+        REQUIRE(j1939_set_pgn_stream_sink(&TestJ1939::node, msg_pgn, record_stream_event, nullptr) == true);
+
+        for (int i = 1; i < J1939_TP_STREAM_SINKS; ++i)
+            REQUIRE(j1939_set_pgn_stream_sink(&TestJ1939::node, msg_pgn + i, nullptr, nullptr) == true);
+    }
+
+    j1939_tp_close_all(tp);
+    REQUIRE(j1939_set_pgn_stream_sink(&TestJ1939::node, msg_pgn, nullptr, nullptr) == true);
+}
+
+namespace {
+
+struct TxDone {
+    int calls = 0;
+    bool sent = false;
+    uint32_t pgn = 0;
+    J1939TxResult result {};
+};
+
+void
+record_tx_done(void* user_data, J1939Msg* msg, const J1939TxResult* result)
+{
+    TxDone* done = static_cast<TxDone*>(user_data);
+
+    done->calls++;
+    done->sent = (result->status == J1939_TX_SENT);
+    done->pgn = msg->pgn;
+    done->result = *result;
+}
+
+}
+
+TEST_CASE("Zero-copy transmit", "[j1939_tx_zero_copy]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    const uint8_t our_address = TestJ1939::node.source_address;
+    constexpr uint8_t peer_address = 0x99;
+    constexpr uint32_t msg_pgn = 0xABCD;
+
+    j1939_tp_close_all(tp);
+
+    uint8_t data[20];
+    for (int i = 0; i < (int)sizeof(data); ++i)
+        data[i] = i;
+
+    J1939Msg msg {
+        .pgn = msg_pgn,
+        .data = data,
+        .len = sizeof(data),
+        .dst = J1939_ADDR_GLOBAL,
+        .pri = J1939_DEFAULT_PRIORITY
+    };
+    TxDone done;
+
+    J1939PoolStats pool_before[4];
+    int num_classes = j1939_pool_stats(pool_before, 4);
+
+    SECTION("A broadcast is sent from the caller's buffer")
+    {
+        REQUIRE(j1939_tx_zero_copy(&TestJ1939::node, &msg, record_tx_done, &done) == true);
+
+        J1939TPSession* session = j1939_tp_find_tx_session(tp, J1939_ADDR_GLOBAL);
+        REQUIRE(session->buf == data);
+
+        // No pool buffer was borrowed
+        J1939PoolStats pool_after[4];
+        REQUIRE(j1939_pool_stats(pool_after, 4) == num_classes);
+        for (int i = 0; i < num_classes; ++i)
+            REQUIRE(pool_after[i].in_use == pool_before[i].in_use);
+
+        // Read when the packet goes out, not when the message was queued
+        data[7] = 0x77;
+
+        for (int seq = 1; seq <= 3; ++seq)
+        {
+            session->timer_ms = J1939_TP_TX_PERIOD;
+            j1939_tp_broadcast_update_sender(session);
+
+            if (seq == 2)
+                REQUIRE(TestJ1939::msg.data[1] == 0x77);
+        }
+        REQUIRE(done.calls == 0);
+
+        j1939_tp_broadcast_update_sender(session);
+        REQUIRE(session->connection == J1939_TP_CONNECTION_NONE);
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.sent == true);
+        REQUIRE(done.pgn == msg_pgn);
+    }
+    SECTION("A P2P message is done once acknowledged")
+    {
+        msg.dst = peer_address;
+        REQUIRE(j1939_tx_zero_copy(&TestJ1939::node, &msg, record_tx_done, &done) == true);
+        J1939TPSession* session = j1939_tp_find_tx_session(tp, peer_address);
+        session->bytes_rem = 0;
+
+        J1939_TP_CM_ACK ack;
+        j1939_tp_ack_pack(session, &ack);
+        J1939Msg ack_msg {
+            .pgn = J1939_TP_CM_PGN,
+            .data = (uint8_t*)&ack,
+            .len = J1939_TP_CM_LEN,
+            .src = peer_address,
+            .dst = our_address,
+            .pri = J1939_TP_CM_PRI
+        };
+        j1939_tp_dispatch(tp, &ack_msg);
+
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.sent == true);
+    }
+    SECTION("An aborted message is done, but not sent")
+    {
+        msg.dst = peer_address;
+        REQUIRE(j1939_tx_zero_copy(&TestJ1939::node, &msg, record_tx_done, &done) == true);
+
+        J1939_TP_CM_ABORT abort;
+        j1939_tp_abort_pack(&abort, J1939_TP_ABORT_REASON_BUSY, J1939_TP_ABORT_ROLE_RECEIVER, msg_pgn);
+        J1939Msg abort_msg {
+            .pgn = J1939_TP_CM_PGN,
+            .data = (uint8_t*)&abort,
+            .len = J1939_TP_CM_LEN,
+            .src = peer_address,
+            .dst = our_address,
+            .pri = J1939_TP_CM_PRI
+        };
+        j1939_tp_dispatch(tp, &abort_msg);
+
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.sent == false);
+    }
+    SECTION("Queued messages that are dropped are done")
+    {
+        msg.dst = peer_address;
+        REQUIRE(j1939_tx_zero_copy(&TestJ1939::node, &msg, record_tx_done, &done) == true);
+
+        // Waits for the first connection to the same destination
+        TxDone queued_done;
+        REQUIRE(j1939_tx_zero_copy(&TestJ1939::node, &msg, record_tx_done, &queued_done) == true);
+        REQUIRE(tp->tx_queue_len == 1);
+        REQUIRE(tp->tx_queue[0].msg.data == data);
+
+        j1939_tp_close_all(tp);
+
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.sent == false);
+        REQUIRE(queued_done.calls == 1);
+        REQUIRE(queued_done.sent == false);
+    }
+    SECTION("A single-frame message is done before returning")
+    {
+        msg.len = 8;
+        REQUIRE(j1939_tx_zero_copy(&TestJ1939::node, &msg, record_tx_done, &done) == true);
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.sent == true);
+    }
+    SECTION("Rejected messages are never done")
+    {
+        msg.len = J1939_TP_MAX_PAYLOAD + 1;
+        REQUIRE(j1939_tx_zero_copy(&TestJ1939::node, &msg, record_tx_done, &done) == false);
+        REQUIRE(done.calls == 0);
+    }
+
+    j1939_tp_close_all(tp);
+}
+
+TEST_CASE("Transmit results", "[j1939_set_tx_done]")
+{
+    J1939TP* tp = &g_j1939[TestJ1939::node.node_idx].tp;
+    const uint8_t our_address = TestJ1939::node.source_address;
+    constexpr uint8_t peer_address = 0x99;
+    constexpr uint32_t msg_pgn = 0xABCD;
+
+    j1939_tp_close_all(tp);
+
+    TxDone done;
+    j1939_set_tx_done(&TestJ1939::node, record_tx_done, &done);
+
+    uint8_t data[20] = { 0 };
+    J1939Msg msg {
+        .pgn = msg_pgn,
+        .data = data,
+        .len = sizeof(data),
+        .dst = peer_address,
+        .pri = J1939_DEFAULT_PRIORITY
+    };
+
+    J1939_TP_CM_CTS cts {
+        .control_byte = J1939_TP_CM_CONTROL_BYTE_CTS,
+        .num_packages = 3,
+        .next_seq = 1,
+        .res = 0xFFFF,
+        .pgn = msg_pgn
+    };
+    J1939_TP_CM_ABORT abort;
+    J1939Msg cm_msg {
+        .pgn = J1939_TP_CM_PGN,
+        .data = (uint8_t*)&cts,
+        .len = J1939_TP_CM_LEN,
+        .src = peer_address,
+        .dst = our_address,
+        .pri = J1939_TP_CM_PRI
+    };
+
+    j1939_tp_update_at(tp, 1000000);
+
+    SECTION("A message that was sent reports how long it took")
+    {
+        msg.dst = J1939_ADDR_GLOBAL;
+        REQUIRE(j1939_tx(&TestJ1939::node, &msg) == true);
+
+        uint64_t now_us = 1000000;
+        while (j1939_tp_find_tx_session(tp, J1939_ADDR_GLOBAL) != nullptr)
+        {
+            now_us += J1939_TP_TX_PERIOD * 1000;
+            j1939_tp_update_at(tp, now_us);
+        }
+
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.result.status == J1939_TX_SENT);
+        REQUIRE(done.result.size == sizeof(data));
+        REQUIRE(done.result.bytes_sent == sizeof(data));
+        REQUIRE(done.result.elapsed_us == now_us - 1000000);
+    }
+    SECTION("A message the receiver aborts reports why, and how far it got")
+    {
+        REQUIRE(j1939_tx(&TestJ1939::node, &msg) == true);
+        J1939TPSession* session = j1939_tp_find_tx_session(tp, peer_address);
+
+        cts.num_packages = 2;
+        j1939_tp_dispatch(tp, &cm_msg);
+        session->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_p2p_update_sender(session);
+        session->timer_ms = J1939_TP_TX_PERIOD;
+        j1939_tp_p2p_update_sender(session);
+
+        j1939_tp_abort_pack(&abort, J1939_TP_ABORT_REASON_RESOURCES, J1939_TP_ABORT_ROLE_RECEIVER, msg_pgn);
+        cm_msg.data = (uint8_t*)&abort;
+        j1939_tp_dispatch(tp, &cm_msg);
+
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.result.status == J1939_TX_ABORTED);
+        REQUIRE(done.result.abort_reason == J1939_TP_ABORT_REASON_RESOURCES);
+        REQUIRE(done.result.bytes_sent == 14);
+    }
+    SECTION("A receiver that doesn't respond times out")
+    {
+        REQUIRE(j1939_tx(&TestJ1939::node, &msg) == true);
+
+        j1939_tp_update_at(tp, 1000000);
+        j1939_tp_update_at(tp, 1000000 + (J1939_TP_TIMEOUT_TR * 1000));
+
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.result.status == J1939_TX_TIMEOUT);
+        REQUIRE(done.result.bytes_sent == 0);
+        REQUIRE(done.result.elapsed_us == J1939_TP_TIMEOUT_TR * 1000);
+    }
+    SECTION("A frame that can't be sent fails the message")
+    {
+        REQUIRE(j1939_tx(&TestJ1939::node, &msg) == true);
+        j1939_tp_dispatch(tp, &cm_msg);
+        j1939_tp_update_at(tp, 1000000);
+
+        auto can_tx = TestJ1939::node.can_tx;
+        TestJ1939::node.can_tx = [](void*, J1939Msg*) { return false; };
+        j1939_tp_update_at(tp, 1000000 + (J1939_TP_TX_PERIOD * 1000));
+        TestJ1939::node.can_tx = can_tx;
+
+        REQUIRE(j1939_tp_find_tx_session(tp, peer_address) == nullptr);
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.result.status == J1939_TX_FAILED);
+        REQUIRE(done.result.bytes_sent == 0);
+
+        // Also when the BAM or RTS can't be sent
+        TestJ1939::node.can_tx = [](void*, J1939Msg*) { return false; };
+        REQUIRE(j1939_tx(&TestJ1939::node, &msg) == true);
+        TestJ1939::node.can_tx = can_tx;
+
+        REQUIRE(done.calls == 2);
+        REQUIRE(done.result.status == J1939_TX_FAILED);
+    }
+    SECTION("Messages dropped on an address change are cancelled")
+    {
+        REQUIRE(j1939_tx(&TestJ1939::node, &msg) == true);
+        REQUIRE(j1939_tx(&TestJ1939::node, &msg) == true);
+        REQUIRE(tp->tx_queue_len == 1);
+
+        j1939_tp_close_all(tp);
+
+        REQUIRE(done.calls == 2);
+        REQUIRE(done.result.status == J1939_TX_CANCELLED);
+    }
+    SECTION("Messages sent from a callback aren't cancelled with the others")
+    {
+        REQUIRE(j1939_tx(&TestJ1939::node, &msg) == true);
+        REQUIRE(j1939_tp_find_tx_session(tp, peer_address) != nullptr);
+
+        // The first reuses the session just closed, the second starts in the
+        //  next one, which the loop hasn't reached yet
+        static J1939Msg resend[2];
+        resend[0] = msg;
+        resend[0].dst = J1939_ADDR_GLOBAL;
+        resend[1] = msg;
+        resend[1].dst = peer_address + 1;
+        j1939_set_tx_done(&TestJ1939::node, [](void* user_data, J1939Msg* msg, const J1939TxResult* result) {
+            record_tx_done(user_data, msg, result);
+            if (static_cast<TxDone*>(user_data)->calls == 1)
+            {
+                REQUIRE(j1939_tx(&TestJ1939::node, &resend[0]) == true);
+                REQUIRE(j1939_tx(&TestJ1939::node, &resend[1]) == true);
+            }
+        }, &done);
+
+        j1939_tp_close_all(tp);
+
+        REQUIRE(done.calls == 1);
+        REQUIRE(done.result.status == J1939_TX_CANCELLED);
+        REQUIRE(j1939_tp_find_tx_session(tp, peer_address) == nullptr);
+        REQUIRE(j1939_tp_find_tx_session(tp, J1939_ADDR_GLOBAL) != nullptr);
+        REQUIRE(j1939_tp_find_tx_session(tp, peer_address + 1) != nullptr);
+    }
+    SECTION("A zero-copy message is reported to both callbacks")
+    {
+        TxDone own_done;
+        REQUIRE(j1939_tx_zero_copy(&TestJ1939::node, &msg, record_tx_done, &own_done) == true);
+
+        j1939_tp_close_all(tp);
+
+        REQUIRE(own_done.calls == 1);
+        REQUIRE(done.calls == 1);
+    }
+
+    j1939_set_tx_done(&TestJ1939::node, nullptr, nullptr);
+    j1939_tp_close_all(tp);
 }